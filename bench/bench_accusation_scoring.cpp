@@ -0,0 +1,97 @@
+/**
+ * @brief Throughput benchmark for Tardos accusation scoring
+ *
+ * Registers a population of viewers with an AccusationScorer and scores
+ * all of them against the evidence of a copy averaged by three colluders,
+ * with every kernel the CPU supports, on one thread and on a WorkerPool.
+ * Scoring runs once per investigated leak, over every viewer ever issued
+ * a codeword; registration once per population.
+ *
+ * Usage: bench_accusation_scoring [viewers] [length] [threads]
+ */
+
+#include "common/tardos_code.h"
+#include "common/worker_pool.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <vector>
+
+using namespace phantomframe;
+
+int main(int argc, char* argv[]) {
+    size_t viewers = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 1000000;
+    uint32_t length = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 1024;
+    uint32_t threads = argc > 3 ? std::strtoul(argv[3], nullptr, 10) : 0;
+    
+    TardosCode code(1, length, 3);
+    WorkerPool pool(threads);
+    
+    std::vector<uint64_t> ids(viewers);
+    for (size_t j = 0; j < viewers; ++j) {
+        ids[j] = 0x5e55000000000000ULL + j;
+    }
+    
+    std::cout << "Accusation scoring, " << viewers << " viewers, " << length << "-bit codewords, "
+              << pool.size() << " threads" << std::endl;
+    
+    auto start = std::chrono::steady_clock::now();
+    AccusationScorer scorer(code);
+    scorer.setViewers(ids.data(), ids.size(), &pool);
+    double ms = std::chrono::duration<double, std::milli>(
+        std::chrono::steady_clock::now() - start).count();
+    std::cout << "  register " << std::fixed << std::setprecision(1) << ms << " ms ("
+              << scorer.memoryBytes() / (1024 * 1024) << " MB)" << std::endl;
+    
+    // Evidence of a copy averaged from three colluders' copies
+    std::vector<float> soft(length, 0.0f);
+    std::vector<uint64_t> words(code.words());
+    for (size_t j : {viewers / 7, viewers / 3, viewers - 1}) {
+        code.codeword(ids[j], words.data());
+        for (uint32_t i = 0; i < length; ++i) {
+            soft[i] += (words[i / 64] >> (i % 64)) & 1 ? -1.0f : 1.0f;
+        }
+    }
+    std::mt19937 rng(2);
+    std::normal_distribution<float> noise(0.0f, 1.0f);
+    for (auto& value : soft) {
+        value += noise(rng);
+    }
+    
+    std::vector<float> scores(viewers);
+    for (SimdLevel level : {SimdLevel::Scalar, SimdLevel::AVX2}) {
+        if (level > detectSimdLevel()) {
+            continue;
+        }
+        
+        for (WorkerPool* p : {static_cast<WorkerPool*>(nullptr), &pool}) {
+            if (p && pool.size() == 1) {
+                continue;
+            }
+            
+            start = std::chrono::steady_clock::now();
+            scorer.score(soft.data(), scores.data(), p, level);
+            ms = std::chrono::duration<double, std::milli>(
+                std::chrono::steady_clock::now() - start).count();
+            
+            std::cout << "  " << std::left << std::setw(8) << simdLevelName(level)
+                      << std::setw(10) << (p ? "pool" : "1 thread")
+                      << std::right << std::setprecision(1) << ms << " ms, "
+                      << std::setprecision(0) << viewers / ms * 1000.0 << " viewers/s" << std::endl;
+        }
+    }
+    
+    float threshold = AccusationScorer::threshold(1e-3, viewers);
+    std::vector<Accusation> accused = scorer.accuse(soft.data(), threshold, 10, &pool);
+    std::cout << "Accused above " << std::setprecision(2) << threshold << ":";
+    for (const auto& accusation : accused) {
+        std::cout << " " << accusation.viewer_id - 0x5e55000000000000ULL
+                  << " (" << std::setprecision(1) << accusation.score << ")";
+    }
+    std::cout << std::endl;
+    
+    return 0;
+}
@@ -0,0 +1,203 @@
+/**
+ * @brief Compressed-domain marking against re-encoding with libx264
+ *
+ * Encodes synthetic frames once with CAVLC to get a source stream, then
+ * times two ways of watermarking it: a full x264 encode with the watermark
+ * map as pic.prop.quant_offsets (what re-encoding costs, decode excluded),
+ * and H264Rewriter on the encoded stream. Prints both throughputs, the
+ * speedup, and how many macroblocks the rewriter could mark.
+ *
+ * Usage: bench_bitstream_rewrite [width] [height] [frames] [preset] [density]
+ */
+
+#include "bitstream/h264_rewriter.h"
+#include "encoder/watermark_encoder.h"
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+extern "C" {
+#include <x264.h>
+}
+
+using namespace phantomframe;
+
+namespace {
+
+constexpr uint32_t kSourceFrames = 16;
+
+WatermarkConfig makeWatermark(float density) {
+    WatermarkConfig config;
+    config.payload = 0x0123456789ABCDEFull;
+    config.seed = 12345;
+    config.block_density = density;
+    config.temporal_period = 30;
+    config.adaptive_embedding = false;
+    config.quality_threshold = 0.0f;
+    config.frame_budget_us = 0;
+    config.scene_cut_threshold = 0.0f;
+    config.window_frames = 0;
+    config.window_repeats = 1;
+    config.pilot_density = 0.0f;
+    config.marked_period_interval = 1;
+    config.enable_encryption = false;
+    return config;
+}
+
+std::vector<std::vector<uint8_t>> makeLuma(uint32_t width, uint32_t height) {
+    std::vector<std::vector<uint8_t>> frames(kSourceFrames);
+    uint32_t seed = 12345;
+
+    // Moving gradient with noise, so motion search and AQ have work to do
+    for (uint32_t f = 0; f < kSourceFrames; ++f) {
+        frames[f].resize(static_cast<size_t>(width) * height);
+        for (uint32_t y = 0; y < height; ++y) {
+            for (uint32_t x = 0; x < width; ++x) {
+                seed = seed * 1664525u + 1013904223u;
+                frames[f][static_cast<size_t>(y) * width + x] =
+                    static_cast<uint8_t>(((x + y + f * 4) & 0xFF) / 2 + (seed >> 27));
+            }
+        }
+    }
+
+    return frames;
+}
+
+/**
+ * @brief Encode with CAVLC, optionally marking through quant_offsets
+ * @return Seconds spent encoding, negative on failure
+ */
+double encode(const std::vector<std::vector<uint8_t>>& luma, uint32_t width, uint32_t height,
+              uint32_t frames, const char* preset, float density, bool watermark,
+              std::vector<uint8_t>& stream) {
+    x264_param_t param;
+    if (x264_param_default_preset(&param, preset, nullptr) < 0) {
+        std::cerr << "Unknown x264 preset " << preset << std::endl;
+        return -1.0;
+    }
+    param.i_width = static_cast<int>(width);
+    param.i_height = static_cast<int>(height);
+    param.i_csp = X264_CSP_I420;
+    param.i_fps_num = 30;
+    param.i_fps_den = 1;
+    param.rc.i_rc_method = X264_RC_CRF;
+    param.rc.f_rf_constant = 23.0f;
+    param.i_log_level = X264_LOG_NONE;
+    param.b_cabac = 0;
+    param.b_annexb = 1;
+    if (param.rc.i_aq_mode == X264_AQ_NONE) {
+        param.rc.i_aq_mode = X264_AQ_VARIANCE;
+    }
+    x264_param_apply_profile(&param, "high");
+
+    x264_t* x264 = x264_encoder_open(&param);
+    if (!x264) {
+        std::cerr << "x264_encoder_open failed" << std::endl;
+        return -1.0;
+    }
+
+    WatermarkEncoder marker(makeWatermark(density));
+    marker.initialize(width, height, 30.0f);
+    uint32_t mb_width = (width + 15) / 16;
+    uint32_t mb_height = (height + 15) / 16;
+    std::vector<float> offsets(static_cast<size_t>(mb_width) * mb_height);
+    std::vector<uint8_t> chroma(static_cast<size_t>(width / 2) * (height / 2), 128);
+
+    x264_picture_t picture;
+    x264_picture_t picture_out;
+    x264_nal_t* nals = nullptr;
+    int nal_count = 0;
+    stream.clear();
+
+    // The payloads of one x264_encoder_encode() call are contiguous
+    auto start = std::chrono::steady_clock::now();
+    for (uint32_t f = 0; f < frames; ++f) {
+        x264_picture_init(&picture);
+        picture.img.i_csp = X264_CSP_I420;
+        picture.img.i_plane = 3;
+        picture.img.plane[0] = const_cast<uint8_t*>(luma[f % kSourceFrames].data());
+        picture.img.plane[1] = chroma.data();
+        picture.img.plane[2] = chroma.data();
+        picture.img.i_stride[0] = static_cast<int>(width);
+        picture.img.i_stride[1] = static_cast<int>(width / 2);
+        picture.img.i_stride[2] = static_cast<int>(width / 2);
+        picture.i_pts = f;
+        if (watermark) {
+            marker.renderQuantOffsets(f, QuantOffsetPlane{offsets.data(), mb_width, mb_height});
+            picture.prop.quant_offsets = offsets.data();
+        }
+
+        int size = x264_encoder_encode(x264, &nals, &nal_count, &picture, &picture_out);
+        if (size > 0) {
+            stream.insert(stream.end(), nals[0].p_payload, nals[0].p_payload + size);
+        }
+    }
+    while (x264_encoder_delayed_frames(x264) > 0) {
+        int size = x264_encoder_encode(x264, &nals, &nal_count, nullptr, &picture_out);
+        if (size > 0) {
+            stream.insert(stream.end(), nals[0].p_payload, nals[0].p_payload + size);
+        }
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    x264_encoder_close(x264);
+    return seconds;
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    uint32_t width = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 1920;
+    uint32_t height = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 1080;
+    uint32_t frames = argc > 3 ? std::strtoul(argv[3], nullptr, 10) : 300;
+    std::string preset = argc > 4 ? argv[4] : "veryfast";
+    float density = argc > 5 ? std::strtof(argv[5], nullptr) : 0.008f;
+
+    std::cout << "Watermarking by re-encode vs bitstream rewrite (" << width << "x" << height << ", "
+              << frames << " frames, preset " << preset << ", density " << density << ")" << std::endl;
+
+    auto luma = makeLuma(width, height);
+    std::vector<uint8_t> source;
+    std::vector<uint8_t> reencoded;
+    if (encode(luma, width, height, frames, preset.c_str(), density, false, source) < 0.0) {
+        return 1;
+    }
+    double reencode_seconds = encode(luma, width, height, frames, preset.c_str(), density, true,
+                                     reencoded);
+    if (reencode_seconds < 0.0) {
+        return 1;
+    }
+
+    RewriteConfig config;
+    config.watermark = makeWatermark(density);
+    config.fps = 30.0f;
+    config.reencode_unmarked = false;
+    H264Rewriter rewriter(config);
+    std::vector<uint8_t> rewritten;
+
+    auto start = std::chrono::steady_clock::now();
+    bool ok = rewriter.rewriteAnnexB(source.data(), source.size(), rewritten);
+    double rewrite_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    if (!ok) {
+        std::cerr << "Rewrite reported malformed NAL units" << std::endl;
+    }
+
+    RewriteStats stats = rewriter.getRewriteStats();
+    std::cout << std::left << std::setw(12) << "method" << std::setw(12) << "fps"
+              << std::setw(14) << "bytes" << std::endl;
+    std::cout << std::fixed << std::setprecision(2)
+              << std::setw(12) << "re-encode" << std::setw(12) << frames / reencode_seconds
+              << std::setw(14) << reencoded.size() << std::endl
+              << std::setw(12) << "rewrite" << std::setw(12) << frames / rewrite_seconds
+              << std::setw(14) << rewritten.size() << std::endl;
+    std::cout << "Speedup: " << reencode_seconds / rewrite_seconds << "x" << std::endl;
+    std::cout << "Macroblocks marked: " << stats.macroblocks_marked << ", unmarkable: "
+              << stats.macroblocks_unmarkable << ", slices rewritten: " << stats.slices_rewritten
+              << " of " << stats.slices_rewritten + stats.slices_copied << std::endl;
+
+    return 0;
+}
@@ -0,0 +1,98 @@
+/**
+ * @brief Scaling of independent watermark streams through the C ABI
+ *
+ * Runs 1..N streams at once, each on its own thread with its own handle,
+ * as concurrent transcodes in one host process would, and prints the
+ * aggregate map throughput and the per-stream efficiency relative to a
+ * single stream.
+ *
+ * Usage: bench_concurrent_streams [max_streams] [frames] [width] [height]
+ */
+
+#include "capi/phantomframe.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+namespace {
+
+void runStream(const phantomframe_config& config, const std::vector<uint8_t>& luma, uint32_t frames) {
+    phantomframe_handle* handle = phantomframe_create(&config);
+    if (!handle) {
+        return;
+    }
+
+    std::vector<float> offsets(phantomframe_offset_count(handle, nullptr, nullptr));
+    for (uint32_t f = 0; f < frames; ++f) {
+        phantomframe_apply_watermark(handle, f, luma.data(), config.width,
+                                     offsets.data(), offsets.size());
+    }
+    phantomframe_destroy(handle);
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    uint32_t max_streams = argc > 1 ? std::strtoul(argv[1], nullptr, 10) :
+                                      std::thread::hardware_concurrency();
+    uint32_t frames = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 600;
+    uint32_t width = argc > 3 ? std::strtoul(argv[3], nullptr, 10) : 1920;
+    uint32_t height = argc > 4 ? std::strtoul(argv[4], nullptr, 10) : 1080;
+    max_streams = std::max(1u, max_streams);
+    
+    phantomframe_config config;
+    phantomframe_config_init(&config);
+    config.payload_hex = "0123456789abcdef";
+    config.seed = 12345;
+    config.adaptive_embedding = 1;
+    config.quality_threshold = 0.5f;
+    config.width = width;
+    config.height = height;
+    config.fps = 30.0f;
+    
+    // Shared read-only source; each stream keeps its own maps
+    std::vector<uint8_t> luma(static_cast<size_t>(width) * height);
+    for (size_t i = 0; i < luma.size(); ++i) {
+        luma[i] = static_cast<uint8_t>(i * 2654435761u >> 24);
+    }
+    
+    std::cout << "Concurrent stream benchmark (" << width << "x" << height << ", "
+              << frames << " frames per stream, adaptive)" << std::endl;
+    std::cout << std::left << std::setw(9) << "streams" << std::setw(16) << "frames/s"
+              << std::setw(12) << "efficiency" << std::endl;
+    
+    // Powers of two up to max_streams, then max_streams itself
+    std::vector<uint32_t> stream_counts;
+    for (uint32_t streams = 1; streams < max_streams; streams *= 2) {
+        stream_counts.push_back(streams);
+    }
+    stream_counts.push_back(max_streams);
+    
+    double single = 0.0;
+    for (uint32_t streams : stream_counts) {
+        auto start = std::chrono::steady_clock::now();
+        std::vector<std::thread> threads;
+        for (uint32_t s = 0; s < streams; ++s) {
+            threads.emplace_back(runStream, std::cref(config), std::cref(luma), frames);
+        }
+        for (auto& thread : threads) {
+            thread.join();
+        }
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        double fps = seconds > 0.0 ? streams * frames / seconds : 0.0;
+        
+        if (streams == 1) {
+            single = fps;
+        }
+        
+        std::cout << std::left << std::setw(9) << streams << std::fixed << std::setprecision(1)
+                  << std::setw(16) << fps << std::setprecision(2)
+                  << std::setw(12) << (single > 0.0 ? fps / (single * streams) : 0.0) << std::endl;
+    }
+    
+    return 0;
+}
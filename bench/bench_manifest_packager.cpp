@@ -0,0 +1,79 @@
+/**
+ * @brief Throughput benchmark for per-session playlist packaging
+ *
+ * Parses the HLS playlists of two variants of a two-hour stream once, then
+ * packages playlists for many sessions, as an origin or edge does when a
+ * viewer starts playback. Session setup (hashing the ID and encoding its
+ * codeword) and rendering are timed separately.
+ *
+ * Usage: bench_manifest_packager [sessions] [segments]
+ */
+
+#include "packager/manifest_packager.h"
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using namespace phantomframe;
+
+namespace {
+
+std::string makePlaylist(uint32_t segments) {
+    std::ostringstream out;
+    out << "#EXTM3U\n#EXT-X-VERSION:7\n#EXT-X-TARGETDURATION:4\n"
+        << "#EXT-X-PLAYLIST-TYPE:VOD\n#EXT-X-MAP:URI=\"init.mp4\"\n";
+    for (uint32_t i = 0; i < segments; ++i) {
+        out << "#EXTINF:4.000000,\nstream" << i << ".m4s\n";
+    }
+    out << "#EXT-X-ENDLIST\n";
+    return out.str();
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    size_t sessions = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 100000;
+    uint32_t segments = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 1800;
+    
+    std::string playlist = makePlaylist(segments);
+    
+    auto start = std::chrono::steady_clock::now();
+    ManifestPackager packager;
+    if (!packager.parse(playlist, playlist, "https://cdn.example/a/", "https://cdn.example/b/")) {
+        return 1;
+    }
+    double parse_ms = std::chrono::duration<double, std::milli>(
+        std::chrono::steady_clock::now() - start).count();
+    
+    std::cout << "Manifest packaging, " << segments << " segments, " << sessions << " sessions" << std::endl;
+    std::cout << "  parse   " << std::fixed << std::setprecision(2) << parse_ms << " ms" << std::endl;
+    
+    double setup_ms = 0.0;
+    double render_ms = 0.0;
+    size_t bytes = 0;
+    std::string output;
+    for (size_t i = 0; i < sessions; ++i) {
+        start = std::chrono::steady_clock::now();
+        SessionSequence session("session-" + std::to_string(i), "secret");
+        auto rendered = std::chrono::steady_clock::now();
+        packager.render(session, output);
+        auto end = std::chrono::steady_clock::now();
+        
+        setup_ms += std::chrono::duration<double, std::milli>(rendered - start).count();
+        render_ms += std::chrono::duration<double, std::milli>(end - rendered).count();
+        bytes += output.size();
+    }
+    
+    double total_ms = setup_ms + render_ms;
+    std::cout << "  session " << std::setprecision(2) << setup_ms * 1000.0 / sessions << " us/session" << std::endl;
+    std::cout << "  render  " << render_ms * 1000.0 / sessions << " us/session ("
+              << bytes / sessions << " bytes)" << std::endl;
+    std::cout << "  total   " << std::setprecision(0) << sessions * 1000.0 / total_ms
+              << " sessions/s" << std::endl;
+    
+    return 0;
+}
@@ -0,0 +1,116 @@
+/**
+ * @brief Scaling benchmark for slice-parallel watermark map generation
+ *
+ * For 4K and 8K frames, measures schedule table construction and per-frame
+ * quant_offsets rendering with 1..N worker threads and prints the speedup
+ * over a single thread.
+ *
+ * Usage: bench_slice_parallel [max_threads] [frames] [density]
+ */
+
+#include "encoder/watermark_encoder.h"
+#include "common/worker_pool.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <thread>
+#include <vector>
+
+using namespace phantomframe;
+
+namespace {
+
+struct Resolution {
+    const char* name;
+    uint32_t width, height;
+};
+
+double elapsedMs(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    uint32_t max_threads = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 
+                                      std::thread::hardware_concurrency();
+    uint32_t frames = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 600;
+    float density = argc > 3 ? std::strtof(argv[3], nullptr) : 0.008f;
+    max_threads = std::max(1u, max_threads);
+    
+    const Resolution resolutions[] = {
+        {"4K", 3840, 2160},
+        {"8K", 7680, 4320},
+    };
+    
+    WatermarkConfig config;
+    config.payload = 0x0123456789ABCDEFULL;
+    config.seed = 12345;
+    config.block_density = density;
+    config.temporal_period = 30;
+    config.adaptive_embedding = false;
+    config.quality_threshold = 0.0f;
+    config.frame_budget_us = 0;
+    config.scene_cut_threshold = 0.0f;
+    config.window_frames = 0;
+    config.window_repeats = 1;
+    config.pilot_density = 0.0f;
+    config.marked_period_interval = 1;
+    config.enable_encryption = false;
+    
+    std::cout << "Slice-parallel watermark map benchmark (" << frames << " frames, density " 
+              << density << ")" << std::endl;
+    std::cout << std::left << std::setw(6) << "res" << std::setw(9) << "threads"
+              << std::setw(14) << "table ms" << std::setw(10) << "speedup"
+              << std::setw(14) << "frame us" << std::setw(10) << "speedup" << std::endl;
+    
+    // Powers of two up to max_threads, then max_threads itself
+    std::vector<uint32_t> thread_counts;
+    for (uint32_t threads = 1; threads < max_threads; threads *= 2) {
+        thread_counts.push_back(threads);
+    }
+    thread_counts.push_back(max_threads);
+    
+    for (const auto& res : resolutions) {
+        double table_base = 0.0;
+        double frame_base = 0.0;
+        
+        for (uint32_t threads : thread_counts) {
+            std::unique_ptr<WorkerPool> pool;
+            WatermarkEncoder encoder(config);
+            if (threads > 1) {
+                pool = std::make_unique<WorkerPool>(threads);
+                encoder.setWorkerPool(pool.get());
+            }
+            
+            auto start = std::chrono::steady_clock::now();
+            encoder.initialize(res.width, res.height, 30.0f);
+            double table_ms = elapsedMs(start);
+            
+            std::vector<float> offsets(((res.width + 15) / 16) * ((res.height + 15) / 16));
+            QuantOffsetPlane plane{offsets.data(), (res.width + 15) / 16, (res.height + 15) / 16};
+            
+            start = std::chrono::steady_clock::now();
+            for (uint32_t f = 0; f < frames; ++f) {
+                encoder.renderQuantOffsets(f, plane);
+            }
+            double frame_us = elapsedMs(start) * 1000.0 / frames;
+            
+            if (threads == 1) {
+                table_base = table_ms;
+                frame_base = frame_us;
+            }
+            
+            std::cout << std::left << std::setw(6) << res.name << std::setw(9) << threads
+                      << std::fixed << std::setprecision(2)
+                      << std::setw(14) << table_ms << std::setw(10) << table_base / table_ms
+                      << std::setw(14) << frame_us << std::setw(10) << frame_base / frame_us 
+                      << std::endl;
+        }
+    }
+    
+    return 0;
+}
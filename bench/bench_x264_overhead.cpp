@@ -0,0 +1,188 @@
+/**
+ * @brief Encode throughput of libx264 with the watermark off and on
+ *
+ * Encodes the same synthetic frames twice: once plain, and once with the
+ * watermark map computed by phantomframe_apply_watermark() before every
+ * x264_encoder_encode() call and passed as pic.prop.quant_offsets from a
+ * single reused buffer, as the VLC integration does. Prints encode fps,
+ * output size and the throughput cost of the watermark.
+ *
+ * Usage: bench_x264_overhead [width] [height] [frames] [preset] [density]
+ */
+
+#include "capi/phantomframe.h"
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+extern "C" {
+#include <x264.h>
+}
+
+namespace {
+
+// Distinct source pictures, cycled so frame generation is not timed
+constexpr uint32_t kSourceFrames = 16;
+
+struct Source {
+    std::vector<uint8_t> y, u, v;
+};
+
+struct Result {
+    double fps;
+    uint64_t bytes;
+    bool ok;
+};
+
+std::vector<Source> makeSources(uint32_t width, uint32_t height) {
+    std::vector<Source> sources(kSourceFrames);
+    uint32_t seed = 12345;
+
+    // Moving gradient with noise, so motion search and AQ have work to do
+    for (uint32_t f = 0; f < kSourceFrames; ++f) {
+        Source& source = sources[f];
+        source.y.resize(static_cast<size_t>(width) * height);
+        source.u.assign(static_cast<size_t>(width / 2) * (height / 2), 128);
+        source.v.assign(static_cast<size_t>(width / 2) * (height / 2), 128);
+
+        for (uint32_t y = 0; y < height; ++y) {
+            for (uint32_t x = 0; x < width; ++x) {
+                seed = seed * 1664525u + 1013904223u;
+                source.y[static_cast<size_t>(y) * width + x] =
+                    static_cast<uint8_t>(((x + y + f * 4) & 0xFF) / 2 + (seed >> 27));
+            }
+        }
+    }
+
+    return sources;
+}
+
+Result encode(const std::vector<Source>& sources, uint32_t width, uint32_t height,
+              uint32_t frames, const char* preset, float density, bool watermark) {
+    Result result{0.0, 0, false};
+
+    x264_param_t param;
+    if (x264_param_default_preset(&param, preset, nullptr) < 0) {
+        std::cerr << "Unknown x264 preset " << preset << std::endl;
+        return result;
+    }
+    param.i_width = static_cast<int>(width);
+    param.i_height = static_cast<int>(height);
+    param.i_csp = X264_CSP_I420;
+    param.i_fps_num = 30;
+    param.i_fps_den = 1;
+    param.rc.i_rc_method = X264_RC_CRF;
+    param.rc.f_rf_constant = 23.0f;
+    param.i_log_level = X264_LOG_NONE;
+
+    // quant_offsets are only applied with adaptive quantization on
+    if (param.rc.i_aq_mode == X264_AQ_NONE) {
+        param.rc.i_aq_mode = X264_AQ_VARIANCE;
+    }
+
+    x264_t* x264 = x264_encoder_open(&param);
+    if (!x264) {
+        std::cerr << "x264_encoder_open failed" << std::endl;
+        return result;
+    }
+
+    phantomframe_handle* pf = nullptr;
+    std::vector<float> offsets;
+    if (watermark) {
+        phantomframe_config config;
+        phantomframe_config_init(&config);
+        config.payload_hex = "0123456789abcdef";
+        config.seed = 12345;
+        config.block_density = density;
+        config.width = width;
+        config.height = height;
+        config.fps = 30.0f;
+
+        pf = phantomframe_create(&config);
+        if (!pf) {
+            x264_encoder_close(x264);
+            return result;
+        }
+        offsets.resize(phantomframe_offset_count(pf, nullptr, nullptr));
+    }
+
+    x264_picture_t picture;
+    x264_picture_t picture_out;
+    x264_nal_t* nals = nullptr;
+    int nal_count = 0;
+
+    auto start = std::chrono::steady_clock::now();
+    for (uint32_t f = 0; f < frames; ++f) {
+        const Source& source = sources[f % kSourceFrames];
+
+        x264_picture_init(&picture);
+        picture.img.i_csp = X264_CSP_I420;
+        picture.img.i_plane = 3;
+        picture.img.plane[0] = const_cast<uint8_t*>(source.y.data());
+        picture.img.plane[1] = const_cast<uint8_t*>(source.u.data());
+        picture.img.plane[2] = const_cast<uint8_t*>(source.v.data());
+        picture.img.i_stride[0] = static_cast<int>(width);
+        picture.img.i_stride[1] = static_cast<int>(width / 2);
+        picture.img.i_stride[2] = static_cast<int>(width / 2);
+        picture.i_pts = f;
+
+        // x264 reads the offsets during this call, so one buffer serves every frame
+        if (pf && phantomframe_apply_watermark(pf, f, source.y.data(), width,
+                                               offsets.data(), offsets.size()) >= 0) {
+            picture.prop.quant_offsets = offsets.data();
+        }
+
+        int size = x264_encoder_encode(x264, &nals, &nal_count, &picture, &picture_out);
+        if (size > 0) {
+            result.bytes += static_cast<uint64_t>(size);
+        }
+    }
+    while (x264_encoder_delayed_frames(x264) > 0) {
+        int size = x264_encoder_encode(x264, &nals, &nal_count, nullptr, &picture_out);
+        if (size > 0) {
+            result.bytes += static_cast<uint64_t>(size);
+        }
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    x264_encoder_close(x264);
+    phantomframe_destroy(pf);
+
+    result.fps = seconds > 0.0 ? frames / seconds : 0.0;
+    result.ok = true;
+    return result;
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    uint32_t width = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 1920;
+    uint32_t height = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 1080;
+    uint32_t frames = argc > 3 ? std::strtoul(argv[3], nullptr, 10) : 300;
+    std::string preset = argc > 4 ? argv[4] : "veryfast";
+    float density = argc > 5 ? std::strtof(argv[5], nullptr) : 0.008f;
+
+    std::cout << "libx264 encode with and without watermark (" << width << "x" << height << ", "
+              << frames << " frames, preset " << preset << ", density " << density << ")" << std::endl;
+
+    std::vector<Source> sources = makeSources(width, height);
+    Result off = encode(sources, width, height, frames, preset.c_str(), density, false);
+    Result on = encode(sources, width, height, frames, preset.c_str(), density, true);
+    if (!off.ok || !on.ok) {
+        return 1;
+    }
+
+    std::cout << std::left << std::setw(11) << "watermark" << std::setw(12) << "fps"
+              << std::setw(14) << "bytes" << std::endl;
+    std::cout << std::fixed << std::setprecision(2)
+              << std::setw(11) << "off" << std::setw(12) << off.fps << std::setw(14) << off.bytes << std::endl
+              << std::setw(11) << "on" << std::setw(12) << on.fps << std::setw(14) << on.bytes << std::endl;
+    std::cout << "Throughput cost: " << (off.fps > 0.0 ? (1.0 - on.fps / off.fps) * 100.0 : 0.0)
+              << "%" << std::endl;
+
+    return 0;
+}
@@ -7,6 +7,7 @@
 #include "encoder/watermark_encoder.h"
 #include "extractor/watermark_extractor.h"
 #include "common/utils.h"
+#include "pipeline/encode_pipeline.h"
 
 using namespace phantomframe;
 
@@ -37,6 +38,10 @@ void printEncodeHelp() {
     std::cout << "  --adaptive           Enable adaptive embedding based on video content" << std::endl;
     std::cout << "  --temporal <period>  Temporal period for watermark (default: 30)" << std::endl;
     std::cout << "  --quality <0-100>    Quality preservation level (default: 95)" << std::endl;
+    std::cout << "  --embed-threads <n>  Slice workers for the watermark map (default: 1)" << std::endl;
+    std::cout << "  --frame-budget <us>  Embedding deadline per frame, 0 for none (default: 0)" << std::endl;
+    std::cout << "  --scene-cut <0-255>  Restart the pattern at cuts of this mean luma change, 0 for none (default: 0)" << std::endl;
+    std::cout << "  --huge-pages         Back frame buffers with transparent huge pages" << std::endl;
     std::cout << "  --verbose            Enable verbose output" << std::endl;
 }
 
@@ -96,19 +101,35 @@ int encodeCommand(const std::map<std::string, std::string>& options) {
     bool adaptive = options.count("adaptive");
     int temporal = options.count("temporal") ? std::stoi(options.at("temporal")) : 30;
     int quality = options.count("quality") ? std::stoi(options.at("quality")) : 95;
+    uint32_t embedThreads = options.count("embed-threads") ? std::stoul(options.at("embed-threads")) : 1;
+    uint32_t frameBudget = options.count("frame-budget") ? std::stoul(options.at("frame-budget")) : 0;
+    float sceneCut = options.count("scene-cut") ? std::stof(options.at("scene-cut")) : 0.0f;
+    bool hugePages = options.count("huge-pages");
     bool verbose = options.count("verbose");
     
     try {
-        // Initialize encoder
-        EncodingConfig config;
-        config.payload = payload;
-        config.random_seed = seed;
-        config.block_density = density;
-        config.adaptive_embedding = adaptive;
-        config.temporal_period = temporal;
-        config.quality_preservation = quality;
-        
-        auto encoder = std::make_unique<WatermarkEncoder>(config);
+        // Decode, watermark and re-encode with libavcodec + libx264
+        PipelineConfig config;
+        config.input_path = inputFile;
+        config.output_path = outputFile;
+        config.watermark.payload = utils::generatePayloadFromString(payload);
+        config.watermark.seed = seed;
+        config.watermark.block_density = density;
+        config.watermark.temporal_period = temporal;
+        config.watermark.adaptive_embedding = adaptive;
+        // Higher quality levels allow wider moves toward textured blocks
+        config.watermark.quality_threshold = quality / 100.0f;
+        config.watermark.frame_budget_us = frameBudget;
+        config.watermark.scene_cut_threshold = sceneCut;
+        config.watermark.enable_encryption = false;
+        config.queue_depth = 8;
+        config.preset = "medium";
+        // Map the 0-100 quality level onto x264's CRF scale (95 -> CRF 18)
+        config.crf = 51.0f - quality * 0.35f;
+        config.encoder_threads = 0;
+        config.embed_threads = embedThreads;
+        config.huge_pages = hugePages;
+        config.verbose = verbose;
         
         if (verbose) {
             std::cout << "Encoding configuration:" << std::endl;
@@ -120,19 +141,22 @@ int encodeCommand(const std::map<std::string, std::string>& options) {
             std::cout << "  Adaptive: " << (adaptive ? "Yes" : "No") << std::endl;
             std::cout << "  Temporal: " << temporal << std::endl;
             std::cout << "  Quality: " << quality << std::endl;
+            std::cout << "  Frame budget: " << frameBudget << " us" << std::endl;
+            std::cout << "  Scene cut threshold: " << sceneCut << std::endl;
+            std::cout << "  Huge pages: " << (hugePages ? "Yes" : "No") << std::endl;
             std::cout << std::endl;
         }
         
         // Process video
         std::cout << "Processing video..." << std::endl;
-        auto result = encoder->processVideo(inputFile, outputFile);
+        EncodePipeline pipeline(config);
+        auto result = pipeline.run();
         
         if (result.success) {
             std::cout << "Successfully encoded watermark!" << std::endl;
             std::cout << "  Processing time: " << result.processing_time << "ms" << std::endl;
             std::cout << "  Frames processed: " << result.frames_processed << std::endl;
-            std::cout << "  Quality metrics: PSNR=" << result.quality_metrics.psnr 
-                      << ", SSIM=" << result.quality_metrics.ssim << std::endl;
+            std::cout << "  Throughput: " << result.fps << " fps" << std::endl;
         } else {
             std::cerr << "Error encoding watermark: " << result.error_message << std::endl;
             return 1;
@@ -0,0 +1,216 @@
+#include "h264_bitstream.h"
+#include <algorithm>
+
+namespace phantomframe {
+
+uint32_t BitReader::peekBits(uint32_t count) const {
+    if (count == 0) {
+        return 0;
+    }
+    
+    // Five bytes cover any 32-bit field at any bit offset
+    size_t byte = position_ >> 3;
+    size_t size_bytes = size_bits_ >> 3;
+    uint64_t window = 0;
+    for (size_t i = 0; i < 5; ++i) {
+        window <<= 8;
+        if (byte + i < size_bytes) {
+            window |= data_[byte + i];
+        }
+    }
+    
+    uint32_t shift = static_cast<uint32_t>(position_ & 7);
+    uint64_t mask = (1ull << count) - 1;
+    return static_cast<uint32_t>(((window << shift) >> (40 - count)) & mask);
+}
+
+uint32_t BitReader::readBits(uint32_t count) {
+    uint32_t value = peekBits(count);
+    position_ += count;
+    return value;
+}
+
+uint32_t BitReader::readUE() {
+    uint32_t bits = peekBits(32);
+    if (bits == 0) {
+        overrun_ = true;
+        return 0;
+    }
+    
+    uint32_t zeros = static_cast<uint32_t>(__builtin_clz(bits));
+    if (zeros < 16) {
+        return readBits(2 * zeros + 1) - 1;
+    }
+    
+    position_ += zeros + 1;
+    return ((1u << zeros) - 1) + readBits(zeros);
+}
+
+int32_t BitReader::readSE() {
+    uint32_t code = readUE();
+    int32_t magnitude = static_cast<int32_t>((code >> 1) + (code & 1));
+    return (code & 1) ? magnitude : -magnitude;
+}
+
+void BitReader::skipBits(size_t count) {
+    position_ += count;
+}
+
+bool BitReader::moreRbspData() const {
+    // The last set bit of the RBSP is the rbsp_stop_one_bit
+    size_t bytes = size_bits_ >> 3;
+    while (bytes > 0 && data_[bytes - 1] == 0) {
+        bytes--;
+    }
+    if (bytes == 0) {
+        return false;
+    }
+    
+    size_t stop_bit = bytes * 8 - 1 - static_cast<size_t>(__builtin_ctz(data_[bytes - 1]));
+    return position_ < stop_bit;
+}
+
+void BitWriter::putBits(uint32_t count, uint32_t value) {
+    if (count == 0) {
+        return;
+    }
+    
+    uint64_t mask = (1ull << count) - 1;
+    cache_ = (cache_ << count) | (value & mask);
+    cache_bits_ += count;
+    flush();
+}
+
+void BitWriter::putUE(uint32_t value) {
+    uint64_t code = static_cast<uint64_t>(value) + 1;
+    uint32_t length = 64 - static_cast<uint32_t>(__builtin_clzll(code));
+    
+    putBits(length - 1, 0);
+    if (length > 32) {
+        putBits(1, 1);
+        putBits(length - 1, static_cast<uint32_t>(code));
+    } else {
+        putBits(length, static_cast<uint32_t>(code));
+    }
+}
+
+void BitWriter::putSE(int32_t value) {
+    uint32_t code = value > 0 ? 2 * static_cast<uint32_t>(value) - 1
+                              : 2 * static_cast<uint32_t>(-static_cast<int64_t>(value));
+    putUE(code);
+}
+
+void BitWriter::copyBits(const BitReader& source, size_t begin, size_t end) {
+    BitReader reader = source;
+    reader.seek(begin);
+    
+    size_t remaining = end > begin ? end - begin : 0;
+    while (remaining > 0) {
+        uint32_t count = static_cast<uint32_t>(std::min<size_t>(32, remaining));
+        putBits(count, reader.readBits(count));
+        remaining -= count;
+    }
+}
+
+void BitWriter::alignZero() {
+    if (cache_bits_ & 7) {
+        putBits(8 - (cache_bits_ & 7), 0);
+    }
+}
+
+void BitWriter::putTrailingBits() {
+    putBits(1, 1);
+    alignZero();
+}
+
+void BitWriter::clear() {
+    bytes_.clear();
+    cache_ = 0;
+    cache_bits_ = 0;
+}
+
+const std::vector<uint8_t>& BitWriter::bytes() {
+    return bytes_;
+}
+
+void BitWriter::flush() {
+    while (cache_bits_ >= 8) {
+        cache_bits_ -= 8;
+        bytes_.push_back(static_cast<uint8_t>(cache_ >> cache_bits_));
+    }
+    cache_ &= (1ull << cache_bits_) - 1;
+}
+
+void findNalUnits(const uint8_t* data, size_t size, std::vector<NalRange>& nals) {
+    nals.clear();
+    
+    const size_t none = static_cast<size_t>(-1);
+    size_t begin = none;
+    auto close = [&](size_t end) {
+        // Zero bytes before a start code are trailing_zero_8bits or the
+        // zero_byte of a four-byte start code, not payload
+        while (end > begin && data[end - 1] == 0) {
+            end--;
+        }
+        if (end > begin) {
+            nals.push_back({begin, end});
+        }
+    };
+    
+    size_t i = 0;
+    while (i + 2 < size) {
+        if (data[i + 2] > 1) {
+            i += 3;
+        } else if (data[i] == 0 && data[i + 1] == 0 && data[i + 2] == 1) {
+            if (begin != none) {
+                close(i);
+            }
+            begin = i + 3;
+            i += 3;
+        } else {
+            i++;
+        }
+    }
+    
+    if (begin != none && begin < size) {
+        close(size);
+    }
+}
+
+void unescapeRbsp(const uint8_t* data, size_t size, std::vector<uint8_t>& rbsp) {
+    rbsp.resize(size);
+    
+    size_t written = 0;
+    uint32_t zeros = 0;
+    for (size_t i = 0; i < size; ++i) {
+        uint8_t byte = data[i];
+        if (zeros >= 2 && byte == 0x03) {
+            zeros = 0;
+            continue;
+        }
+        rbsp[written++] = byte;
+        zeros = byte == 0 ? zeros + 1 : 0;
+    }
+    
+    rbsp.resize(written);
+}
+
+void appendEscaped(const uint8_t* rbsp, size_t size, std::vector<uint8_t>& out) {
+    uint32_t zeros = 0;
+    for (size_t i = 0; i < size; ++i) {
+        uint8_t byte = rbsp[i];
+        if (zeros >= 2 && byte <= 0x03) {
+            out.push_back(0x03);
+            zeros = 0;
+        }
+        out.push_back(byte);
+        zeros = byte == 0 ? zeros + 1 : 0;
+    }
+    
+    // A payload may not end in a zero byte
+    if (zeros > 0) {
+        out.push_back(0x03);
+    }
+}
+
+} // namespace phantomframe
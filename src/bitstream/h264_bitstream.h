@@ -0,0 +1,183 @@
+#ifndef PHANTOMFRAME_H264_BITSTREAM_H
+#define PHANTOMFRAME_H264_BITSTREAM_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace phantomframe {
+
+/**
+ * @brief MSB-first reader over the RBSP of one NAL unit
+ *
+ * Reads past the end return zero bits and set overrun(), so parsers check
+ * once per syntax structure instead of on every read.
+ */
+class BitReader {
+public:
+    BitReader() : data_(nullptr), size_bits_(0), position_(0), overrun_(false) {}
+    BitReader(const uint8_t* data, size_t size)
+        : data_(data), size_bits_(size * 8), position_(0), overrun_(false) {}
+
+    /**
+     * @brief Read up to 32 bits
+     * @param count Number of bits, 0-32
+     * @return Bits read, first bit most significant
+     */
+    uint32_t readBits(uint32_t count);
+
+    /**
+     * @brief Look at up to 32 bits without consuming them
+     * @param count Number of bits, 0-32
+     * @return Next bits, zero-padded past the end
+     */
+    uint32_t peekBits(uint32_t count) const;
+
+    bool readFlag() { return readBits(1) != 0; }
+
+    /**
+     * @brief Read an unsigned Exp-Golomb code, ue(v)
+     * @return Decoded value; codes longer than 32 bits set overrun()
+     */
+    uint32_t readUE();
+
+    /**
+     * @brief Read a signed Exp-Golomb code, se(v)
+     * @return Decoded value
+     */
+    int32_t readSE();
+
+    /**
+     * @brief Skip bits
+     * @param count Number of bits
+     */
+    void skipBits(size_t count);
+
+    /**
+     * @brief Whether syntax remains before the RBSP trailing bits
+     * @return true if the position is before the final stop bit
+     */
+    bool moreRbspData() const;
+
+    void seek(size_t position) { position_ = position; }
+    size_t position() const { return position_; }
+    size_t sizeBits() const { return size_bits_; }
+    const uint8_t* data() const { return data_; }
+    bool byteAligned() const { return (position_ & 7) == 0; }
+    bool overrun() const { return overrun_ || position_ > size_bits_; }
+
+private:
+    const uint8_t* data_;
+    size_t size_bits_;
+    size_t position_;
+    bool overrun_;
+};
+
+/**
+ * @brief MSB-first writer producing RBSP bytes
+ */
+class BitWriter {
+public:
+    BitWriter() : cache_(0), cache_bits_(0) {}
+
+    /**
+     * @brief Append up to 32 bits
+     * @param count Number of bits, 0-32
+     * @param value Bits to append, in the low count bits
+     */
+    void putBits(uint32_t count, uint32_t value);
+
+    void putFlag(bool flag) { putBits(1, flag ? 1 : 0); }
+
+    /**
+     * @brief Append an unsigned Exp-Golomb code, ue(v)
+     * @param value Value to code
+     */
+    void putUE(uint32_t value);
+
+    /**
+     * @brief Append a signed Exp-Golomb code, se(v)
+     * @param value Value to code
+     */
+    void putSE(int32_t value);
+
+    /**
+     * @brief Append a bit range of another stream
+     * @param source Reader whose data is copied; its position is kept
+     * @param begin First bit to copy
+     * @param end One past the last bit to copy
+     */
+    void copyBits(const BitReader& source, size_t begin, size_t end);
+
+    /**
+     * @brief Append zero bits up to the next byte boundary
+     */
+    void alignZero();
+
+    /**
+     * @brief Append rbsp_trailing_bits(): a stop bit and zero alignment
+     */
+    void putTrailingBits();
+
+    /**
+     * @brief Forget all written bits, keeping the storage
+     */
+    void clear();
+
+    /**
+     * @brief Get the written bytes
+     *
+     * Only whole bytes are included; align first to flush the rest.
+     * @return Written bytes
+     */
+    const std::vector<uint8_t>& bytes();
+
+    size_t position() const { return bytes_.size() * 8 + cache_bits_; }
+    bool byteAligned() const { return (cache_bits_ & 7) == 0; }
+
+private:
+    std::vector<uint8_t> bytes_;
+    uint64_t cache_;            // Pending bits, right-aligned
+    uint32_t cache_bits_;       // Number of pending bits, below 8 between calls
+
+    void flush();
+};
+
+/**
+ * @brief Location of one NAL unit in an Annex B byte stream
+ */
+struct NalRange {
+    size_t begin;               // First byte of the NAL unit header
+    size_t end;                 // One past the last payload byte, trailing zeros excluded
+};
+
+/**
+ * @brief Find the NAL units of an Annex B byte stream
+ *
+ * Bytes between two ranges are start codes and zero padding, which callers
+ * copy through unchanged.
+ * @param data Byte stream
+ * @param size Size of data in bytes
+ * @param nals Output ranges in stream order, replaced
+ */
+void findNalUnits(const uint8_t* data, size_t size, std::vector<NalRange>& nals);
+
+/**
+ * @brief Remove emulation prevention bytes from a NAL unit payload
+ * @param data NAL unit bytes after the header
+ * @param size Size of data in bytes
+ * @param rbsp Output RBSP, replaced
+ */
+void unescapeRbsp(const uint8_t* data, size_t size, std::vector<uint8_t>& rbsp);
+
+/**
+ * @brief Append an RBSP with emulation prevention bytes inserted
+ * @param rbsp RBSP bytes
+ * @param size Size of rbsp in bytes
+ * @param out Output NAL unit payload, appended to
+ */
+void appendEscaped(const uint8_t* rbsp, size_t size, std::vector<uint8_t>& out);
+
+} // namespace phantomframe
+
+#endif // PHANTOMFRAME_H264_BITSTREAM_H
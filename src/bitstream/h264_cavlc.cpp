@@ -0,0 +1,456 @@
+#include "h264_cavlc.h"
+#include <algorithm>
+#include <cstdlib>
+
+namespace phantomframe {
+
+namespace {
+
+// coeff_token (9.2.1, table 9-5) for 0 <= nC < 2, 2 <= nC < 4 and 4 <= nC < 8,
+// indexed by TotalCoeff * 4 + TrailingOnes; nC >= 8 uses a 6-bit FLC
+constexpr uint8_t kCoeffTokenLength[3][68] = {
+    {
+         1, 0, 0, 0,
+         6, 2, 0, 0,     8, 6, 3, 0,     9, 8, 7, 5,    10, 9, 8, 6,
+        11,10, 9, 7,    13,11,10, 8,    13,13,11, 9,    13,13,13,10,
+        14,14,13,11,    14,14,14,13,    15,15,14,14,    15,15,15,14,
+        16,15,15,15,    16,16,16,15,    16,16,16,16,    16,16,16,16,
+    },
+    {
+         2, 0, 0, 0,
+         6, 2, 0, 0,     6, 5, 3, 0,     7, 6, 6, 4,     8, 6, 6, 4,
+         8, 7, 7, 5,     9, 8, 8, 6,    11, 9, 9, 6,    11,11,11, 7,
+        12,11,11, 9,    12,12,12,11,    12,12,12,11,    13,13,13,12,
+        13,13,13,13,    13,14,13,13,    14,14,14,13,    14,14,14,14,
+    },
+    {
+         4, 0, 0, 0,
+         6, 4, 0, 0,     6, 5, 4, 0,     6, 5, 5, 4,     7, 5, 5, 4,
+         7, 5, 5, 4,     7, 6, 6, 4,     7, 6, 6, 4,     8, 7, 7, 5,
+         8, 8, 7, 6,     9, 8, 8, 7,     9, 9, 8, 8,     9, 9, 9, 8,
+        10, 9, 9, 9,    10,10,10,10,    10,10,10,10,    10,10,10,10,
+    },
+};
+
+constexpr uint16_t kCoeffTokenCode[3][68] = {
+    {
+         1, 0, 0, 0,
+         5, 1, 0, 0,     7, 4, 1, 0,     7, 6, 5, 3,     7, 6, 5, 3,
+         7, 6, 5, 4,    15, 6, 5, 4,    11,14, 5, 4,     8,10,13, 4,
+        15,14, 9, 4,    11,10,13,12,    15,14, 9,12,    11,10,13, 8,
+        15, 1, 9,12,    11,14,13, 8,     7,10, 9,12,     4, 6, 5, 8,
+    },
+    {
+         3, 0, 0, 0,
+        11, 2, 0, 0,     7, 7, 3, 0,     7,10, 9, 5,     7, 6, 5, 4,
+         4, 6, 5, 6,     7, 6, 5, 8,    15, 6, 5, 4,    11,14,13, 4,
+        15,10, 9, 4,    11,14,13,12,     8,10, 9, 8,    15,14,13,12,
+        11,10, 9,12,     7,11, 6, 8,     9, 8,10, 1,     7, 6, 5, 4,
+    },
+    {
+        15, 0, 0, 0,
+        15,14, 0, 0,    11,15,13, 0,     8,12,14,12,    15,10,11,11,
+        11, 8, 9,10,     9,14,13, 9,     8,10, 9, 8,    15,14,13,13,
+        11,14,10,12,    15,10,13,12,    11,14, 9,12,     8,10,13, 8,
+        13, 7, 9,12,     9,12,11,10,     5, 8, 7, 6,     1, 4, 3, 2,
+    },
+};
+
+// coeff_token for 4:2:0 chroma DC (nC == -1)
+constexpr uint8_t kChromaDcTokenLength[20] = {
+    2, 0, 0, 0,    6, 1, 0, 0,    6, 6, 3, 0,    6, 7, 7, 6,    6, 8, 8, 7,
+};
+
+constexpr uint16_t kChromaDcTokenCode[20] = {
+    1, 0, 0, 0,    7, 1, 0, 0,    4, 6, 1, 0,    3, 3, 2, 5,    2, 3, 2, 0,
+};
+
+// total_zeros for 4x4 blocks (tables 9-7, 9-8), indexed by TotalCoeff - 1
+constexpr uint8_t kTotalZerosLength[15][16] = {
+    {1,3,3,4,4,5,5,6,6,7,7,8,8,9,9,9},
+    {3,3,3,3,3,4,4,4,4,5,5,6,6,6,6},
+    {4,3,3,3,4,4,3,3,4,5,5,6,5,6},
+    {5,3,4,4,3,3,3,4,3,4,5,5,5},
+    {4,4,4,3,3,3,3,3,4,5,4,5},
+    {6,5,3,3,3,3,3,3,4,3,6},
+    {6,5,3,3,3,2,3,4,3,6},
+    {6,4,5,3,2,2,3,3,6},
+    {6,6,4,2,2,3,2,5},
+    {5,5,3,2,2,2,4},
+    {4,4,3,3,1,3},
+    {4,4,2,1,3},
+    {3,3,1,2},
+    {2,2,1},
+    {1,1},
+};
+
+constexpr uint16_t kTotalZerosCode[15][16] = {
+    {1,3,2,3,2,3,2,3,2,3,2,3,2,3,2,1},
+    {7,6,5,4,3,5,4,3,2,3,2,3,2,1,0},
+    {5,7,6,5,4,3,4,3,2,3,2,1,1,0},
+    {3,7,5,4,6,5,4,3,3,2,2,1,0},
+    {5,4,3,7,6,5,4,3,2,1,1,0},
+    {1,1,7,6,5,4,3,2,1,1,0},
+    {1,1,5,4,3,3,2,1,1,0},
+    {1,1,1,3,3,2,2,1,0},
+    {1,0,1,3,2,1,1,1},
+    {1,0,1,3,2,1,1},
+    {0,1,1,2,1,3},
+    {0,1,1,1,1},
+    {0,1,1,1},
+    {0,1,1},
+    {0,1},
+};
+
+// total_zeros for 4:2:0 chroma DC (table 9-9a)
+constexpr uint8_t kChromaDcTotalZerosLength[3][4] = {
+    {1,2,3,3},
+    {1,2,2},
+    {1,1},
+};
+
+constexpr uint16_t kChromaDcTotalZerosCode[3][4] = {
+    {1,1,1,0},
+    {1,1,0},
+    {1,0},
+};
+
+// run_before (table 9-10), indexed by Min(zerosLeft, 7) - 1
+constexpr uint8_t kRunBeforeLength[7][15] = {
+    {1,1},
+    {1,2,2},
+    {2,2,2,2},
+    {2,2,2,3,3},
+    {2,2,3,3,3,3},
+    {2,3,3,3,3,3,3},
+    {3,3,3,3,3,3,3,4,5,6,7,8,9,10,11},
+};
+
+constexpr uint16_t kRunBeforeCode[7][15] = {
+    {1,0},
+    {1,1,0},
+    {3,2,1,0},
+    {3,2,1,1,0},
+    {3,2,3,2,1,0},
+    {3,0,1,3,2,5,4},
+    {7,6,5,4,3,2,1,1,1,1,1,1,1,1,1},
+};
+
+/**
+ * @brief coeff_token codes of one table ordered by length for decoding
+ */
+struct TokenTable {
+    uint8_t length[62];
+    uint16_t code[62];
+    uint8_t symbol[62];         // TotalCoeff * 4 + TrailingOnes
+    uint32_t count;
+};
+
+constexpr TokenTable sortTokenTable(const uint8_t* lengths, const uint16_t* codes, uint32_t symbols) {
+    TokenTable table{};
+    table.count = 0;
+    for (uint32_t length = 1; length <= 16; ++length) {
+        for (uint32_t symbol = 0; symbol < symbols; ++symbol) {
+            if (lengths[symbol] == length) {
+                table.length[table.count] = static_cast<uint8_t>(length);
+                table.code[table.count] = codes[symbol];
+                table.symbol[table.count] = static_cast<uint8_t>(symbol);
+                table.count++;
+            }
+        }
+    }
+    return table;
+}
+
+// Shorter codes are the common ones, so they are tried first
+constexpr TokenTable kTokenTables[4] = {
+    sortTokenTable(kCoeffTokenLength[0], kCoeffTokenCode[0], 68),
+    sortTokenTable(kCoeffTokenLength[1], kCoeffTokenCode[1], 68),
+    sortTokenTable(kCoeffTokenLength[2], kCoeffTokenCode[2], 68),
+    sortTokenTable(kChromaDcTokenLength, kChromaDcTokenCode, 20),
+};
+
+uint32_t tokenTableIndex(int nc) {
+    if (nc < 0) return 3;
+    if (nc < 2) return 0;
+    if (nc < 4) return 1;
+    return 2;
+}
+
+/**
+ * @brief Decode a code from a small table by trying every entry
+ * @return Index of the matching entry, or -1
+ */
+int readVlc(BitReader& reader, const uint8_t* lengths, const uint16_t* codes, uint32_t count) {
+    uint32_t bits = reader.peekBits(16);
+    for (uint32_t i = 0; i < count; ++i) {
+        uint32_t length = lengths[i];
+        if (length != 0 && (bits >> (16 - length)) == codes[i]) {
+            reader.skipBits(length);
+            return static_cast<int>(i);
+        }
+    }
+    return -1;
+}
+
+bool readCoeffToken(BitReader& reader, int nc, uint32_t& total_coeff, uint32_t& trailing_ones) {
+    if (nc >= 8) {
+        uint32_t code = reader.readBits(6);
+        if (code == 3) {
+            total_coeff = 0;
+            trailing_ones = 0;
+            return true;
+        }
+        total_coeff = (code >> 2) + 1;
+        trailing_ones = code & 3;
+        return trailing_ones <= total_coeff;
+    }
+    
+    const TokenTable& table = kTokenTables[tokenTableIndex(nc)];
+    uint32_t bits = reader.peekBits(16);
+    for (uint32_t i = 0; i < table.count; ++i) {
+        if ((bits >> (16 - table.length[i])) == table.code[i]) {
+            reader.skipBits(table.length[i]);
+            total_coeff = table.symbol[i] >> 2;
+            trailing_ones = table.symbol[i] & 3;
+            return true;
+        }
+    }
+    return false;
+}
+
+void writeCoeffToken(BitWriter& writer, int nc, uint32_t total_coeff, uint32_t trailing_ones) {
+    if (nc >= 8) {
+        writer.putBits(6, total_coeff == 0 ? 3 : ((total_coeff - 1) << 2) | trailing_ones);
+        return;
+    }
+    
+    uint32_t symbol = total_coeff * 4 + trailing_ones;
+    if (nc < 0) {
+        writer.putBits(kChromaDcTokenLength[symbol], kChromaDcTokenCode[symbol]);
+    } else {
+        uint32_t table = tokenTableIndex(nc);
+        writer.putBits(kCoeffTokenLength[table][symbol], kCoeffTokenCode[table][symbol]);
+    }
+}
+
+/**
+ * @brief Read level_prefix: leading zero bits before a one
+ * @return Number of zeros, or -1 if none of the next 32 bits is set
+ */
+int readLevelPrefix(BitReader& reader) {
+    uint32_t bits = reader.peekBits(32);
+    if (bits == 0) {
+        return -1;
+    }
+    int zeros = __builtin_clz(bits);
+    reader.skipBits(static_cast<size_t>(zeros) + 1);
+    return zeros;
+}
+
+void writeLevel(BitWriter& writer, uint32_t level_code, uint32_t suffix_length) {
+    // Regular codes: prefix below 14 (or 15 with a suffix), suffix_length bits
+    if (suffix_length == 0 && level_code < 14) {
+        writer.putBits(level_code + 1, 1);
+        return;
+    }
+    if (suffix_length == 0 && level_code < 30) {
+        writer.putBits(15, 1);
+        writer.putBits(4, level_code - 14);
+        return;
+    }
+    if (suffix_length > 0 && level_code < (15u << suffix_length)) {
+        writer.putBits((level_code >> suffix_length) + 1, 1);
+        writer.putBits(suffix_length, level_code & ((1u << suffix_length) - 1));
+        return;
+    }
+    
+    // Escape: level_prefix 15 carries 12 suffix bits, each further prefix
+    // bit doubles the range (level_prefix >= 16 is High profile only)
+    uint32_t escaped = level_code - (15u << suffix_length) - (suffix_length == 0 ? 15 : 0);
+    uint32_t prefix = 15;
+    while (escaped >= (2u << (prefix - 3)) - 4096) {
+        prefix++;
+    }
+    escaped -= (1u << (prefix - 3)) - 4096;
+    
+    writer.putBits(prefix, 0);
+    writer.putBits(1, 1);
+    writer.putBits(prefix - 3, escaped);
+}
+
+} // namespace
+
+int readResidualBlock(BitReader& reader, int nc, uint32_t max_coeff, int32_t* coeffs) {
+    for (uint32_t i = 0; i < max_coeff; ++i) {
+        coeffs[i] = 0;
+    }
+    
+    uint32_t total_coeff = 0;
+    uint32_t trailing_ones = 0;
+    if (!readCoeffToken(reader, nc, total_coeff, trailing_ones) || total_coeff > max_coeff) {
+        return -1;
+    }
+    if (total_coeff == 0) {
+        return 0;
+    }
+    
+    // Levels, highest frequency first
+    int32_t levels[16];
+    uint32_t suffix_length = total_coeff > 10 && trailing_ones < 3 ? 1 : 0;
+    for (uint32_t i = 0; i < total_coeff; ++i) {
+        if (i < trailing_ones) {
+            levels[i] = reader.readFlag() ? -1 : 1;
+            continue;
+        }
+        
+        int prefix = readLevelPrefix(reader);
+        if (prefix < 0) {
+            return -1;
+        }
+        
+        uint32_t level_code = static_cast<uint32_t>(std::min(15, prefix)) << suffix_length;
+        if (suffix_length > 0 || prefix >= 14) {
+            uint32_t suffix_size = prefix == 14 && suffix_length == 0 ? 4 :
+                                   prefix >= 15 ? static_cast<uint32_t>(prefix) - 3 : suffix_length;
+            if (suffix_size > 0) {
+                level_code += reader.readBits(suffix_size);
+            }
+        }
+        if (prefix >= 15 && suffix_length == 0) {
+            level_code += 15;
+        }
+        if (prefix >= 16) {
+            level_code += (1u << (prefix - 3)) - 4096;
+        }
+        if (i == trailing_ones && trailing_ones < 3) {
+            level_code += 2;
+        }
+        
+        levels[i] = (level_code & 1) ? -static_cast<int32_t>((level_code + 1) >> 1)
+                                     : static_cast<int32_t>((level_code + 2) >> 1);
+        
+        if (suffix_length == 0) {
+            suffix_length = 1;
+        }
+        if (static_cast<uint32_t>(std::abs(levels[i])) > (3u << (suffix_length - 1)) &&
+            suffix_length < 6) {
+            suffix_length++;
+        }
+    }
+    
+    // Zeros before the last coefficient, then the run below each coefficient
+    uint32_t zeros_left = 0;
+    if (total_coeff < max_coeff) {
+        int total_zeros;
+        if (nc < 0) {
+            total_zeros = readVlc(reader, kChromaDcTotalZerosLength[total_coeff - 1],
+                                  kChromaDcTotalZerosCode[total_coeff - 1], 4);
+        } else {
+            total_zeros = readVlc(reader, kTotalZerosLength[total_coeff - 1],
+                                  kTotalZerosCode[total_coeff - 1], 16);
+        }
+        if (total_zeros < 0 || static_cast<uint32_t>(total_zeros) + total_coeff > max_coeff) {
+            return -1;
+        }
+        zeros_left = static_cast<uint32_t>(total_zeros);
+    }
+    
+    int position = static_cast<int>(total_coeff + zeros_left) - 1;
+    for (uint32_t i = 0; i < total_coeff; ++i) {
+        coeffs[position] = levels[i];
+        
+        uint32_t run = 0;
+        if (i + 1 < total_coeff && zeros_left > 0) {
+            uint32_t table = std::min<uint32_t>(zeros_left, 7) - 1;
+            int value = readVlc(reader, kRunBeforeLength[table], kRunBeforeCode[table], 15);
+            if (value < 0 || static_cast<uint32_t>(value) > zeros_left) {
+                return -1;
+            }
+            run = static_cast<uint32_t>(value);
+        }
+        zeros_left -= run;
+        position -= static_cast<int>(run) + 1;
+    }
+    
+    return reader.overrun() ? -1 : static_cast<int>(total_coeff);
+}
+
+uint32_t writeResidualBlock(BitWriter& writer, int nc, uint32_t max_coeff, const int32_t* coeffs) {
+    // Nonzero levels from the highest frequency down, with the zeros below each
+    int32_t levels[16];
+    uint32_t runs[16];
+    uint32_t total_coeff = 0;
+    uint32_t total_zeros = 0;
+    
+    int position = static_cast<int>(max_coeff) - 1;
+    while (position >= 0 && coeffs[position] == 0) {
+        position--;
+    }
+    while (position >= 0) {
+        levels[total_coeff] = coeffs[position];
+        uint32_t run = 0;
+        position--;
+        while (position >= 0 && coeffs[position] == 0) {
+            run++;
+            position--;
+        }
+        runs[total_coeff++] = run;
+        total_zeros += run;
+    }
+    
+    uint32_t trailing_ones = 0;
+    while (trailing_ones < total_coeff && trailing_ones < 3 && std::abs(levels[trailing_ones]) == 1) {
+        trailing_ones++;
+    }
+    
+    writeCoeffToken(writer, nc, total_coeff, trailing_ones);
+    if (total_coeff == 0) {
+        return 0;
+    }
+    
+    for (uint32_t i = 0; i < trailing_ones; ++i) {
+        writer.putBits(1, levels[i] < 0 ? 1 : 0);
+    }
+    
+    uint32_t suffix_length = total_coeff > 10 && trailing_ones < 3 ? 1 : 0;
+    for (uint32_t i = trailing_ones; i < total_coeff; ++i) {
+        int32_t level = levels[i];
+        uint32_t level_code = level > 0 ? 2 * static_cast<uint32_t>(level) - 2
+                                        : 2 * static_cast<uint32_t>(-level) - 1;
+        if (i == trailing_ones && trailing_ones < 3) {
+            level_code -= 2;
+        }
+        writeLevel(writer, level_code, suffix_length);
+        
+        if (suffix_length == 0) {
+            suffix_length = 1;
+        }
+        if (static_cast<uint32_t>(std::abs(level)) > (3u << (suffix_length - 1)) &&
+            suffix_length < 6) {
+            suffix_length++;
+        }
+    }
+    
+    // The last coefficient's run is implied by the zeros left
+    if (total_coeff < max_coeff) {
+        if (nc < 0) {
+            writer.putBits(kChromaDcTotalZerosLength[total_coeff - 1][total_zeros],
+                           kChromaDcTotalZerosCode[total_coeff - 1][total_zeros]);
+        } else {
+            writer.putBits(kTotalZerosLength[total_coeff - 1][total_zeros],
+                           kTotalZerosCode[total_coeff - 1][total_zeros]);
+        }
+    }
+    
+    uint32_t zeros_left = total_zeros;
+    for (uint32_t i = 0; i + 1 < total_coeff && zeros_left > 0; ++i) {
+        uint32_t table = std::min<uint32_t>(zeros_left, 7) - 1;
+        writer.putBits(kRunBeforeLength[table][runs[i]], kRunBeforeCode[table][runs[i]]);
+        zeros_left -= runs[i];
+    }
+    
+    return total_coeff;
+}
+
+} // namespace phantomframe
@@ -0,0 +1,37 @@
+#ifndef PHANTOMFRAME_H264_CAVLC_H
+#define PHANTOMFRAME_H264_CAVLC_H
+
+#include <cstdint>
+#include "h264_bitstream.h"
+
+namespace phantomframe {
+
+// nC of 4:2:0 chroma DC blocks, which use their own coeff_token table
+constexpr int kChromaDcNc = -1;
+
+/**
+ * @brief Read one residual_block_cavlc()
+ * @param reader Reader positioned at coeff_token
+ * @param nc Predicted number of coefficients (nC), kChromaDcNc for chroma DC
+ * @param max_coeff maxNumCoeff of the block: 16, 15 (AC) or 4 (chroma DC)
+ * @param coeffs Output levels in scan order, max_coeff entries
+ * @return TotalCoeff of the block, or -1 on a syntax error
+ */
+int readResidualBlock(BitReader& reader, int nc, uint32_t max_coeff, int32_t* coeffs);
+
+/**
+ * @brief Write one residual_block_cavlc()
+ *
+ * Levels beyond the 12-bit escape use level_prefix 16 and up, which only
+ * High profiles allow; callers limit levels for other profiles.
+ * @param writer Writer to append to
+ * @param nc Predicted number of coefficients (nC), kChromaDcNc for chroma DC
+ * @param max_coeff maxNumCoeff of the block: 16, 15 (AC) or 4 (chroma DC)
+ * @param coeffs Levels in scan order, max_coeff entries
+ * @return TotalCoeff of the block
+ */
+uint32_t writeResidualBlock(BitWriter& writer, int nc, uint32_t max_coeff, const int32_t* coeffs);
+
+} // namespace phantomframe
+
+#endif // PHANTOMFRAME_H264_CAVLC_H
@@ -0,0 +1,944 @@
+#include "h264_rewriter.h"
+#include "h264_cavlc.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <sstream>
+
+namespace phantomframe {
+
+namespace {
+
+constexpr uint32_t kMaxSpsCount = 32;
+constexpr uint32_t kMaxPpsCount = 256;
+
+// TotalCoeff storage per macroblock: luma 4x4 blocks in raster order
+// (y * 4 + x), then the 2x2 Cb and Cr blocks
+constexpr uint32_t kBlocksPerMb = 24;
+constexpr uint32_t kCbBlock = 16;
+constexpr uint32_t kCrBlock = 20;
+
+constexpr uint8_t kNoQp = 0xFF;
+
+// Escaped bytes that hold any slice header short of long weight tables
+constexpr size_t kHeaderBytes = 256;
+
+// Largest level codable with level_prefix 15, and with the High escape
+constexpr int32_t kMaxLevel = 2063;
+constexpr int32_t kMaxLevelHigh = 32767;
+
+// Scan position to raster position, frame scans
+const uint8_t kZigzag4x4[16] = {
+    0, 1, 4, 8, 5, 2, 3, 6, 9, 12, 13, 10, 7, 11, 14, 15
+};
+
+const uint8_t kZigzag8x8[64] = {
+     0,  1,  8, 16,  9,  2,  3, 10, 17, 24, 32, 25, 18, 11,  4,  5,
+    12, 19, 26, 33, 40, 48, 41, 34, 27, 20, 13,  6,  7, 14, 21, 28,
+    35, 42, 49, 56, 57, 50, 43, 36, 29, 22, 15, 23, 30, 37, 44, 51,
+    58, 59, 52, 45, 38, 31, 39, 46, 53, 60, 61, 54, 47, 55, 62, 63
+};
+
+// normAdjust4x4/8x8 of the standard by QP % 6 and position class. Scaling
+// matrices multiply both sides of a requantisation equally and cancel.
+const uint8_t kNormAdjust4x4[6][3] = {
+    {10, 16, 13}, {11, 18, 14}, {13, 20, 16}, {14, 23, 18}, {16, 25, 20}, {18, 29, 23}
+};
+
+const uint8_t kNormAdjust8x8[6][6] = {
+    {20, 18, 32, 19, 25, 24}, {22, 19, 35, 21, 28, 26}, {26, 23, 42, 24, 33, 31},
+    {28, 25, 45, 26, 35, 33}, {32, 28, 51, 30, 40, 38}, {36, 32, 58, 34, 46, 43}
+};
+
+// QPc for qPI of 30 and above; below 30 QPc equals qPI
+const uint8_t kChromaQp[22] = {
+    29, 30, 31, 32, 32, 33, 34, 34, 35, 35, 36, 36, 37, 37, 37, 38, 38, 38, 39, 39, 39, 39
+};
+
+// coded_block_pattern me(v) mapping for chroma_format_idc 1 and 2
+const uint8_t kIntraCbp[48] = {
+    47, 31, 15,  0, 23, 27, 29, 30,  7, 11, 13, 14, 39, 43, 45, 46,
+    16,  3,  5, 10, 12, 19, 21, 26, 28, 35, 37, 42, 44,  1,  2,  4,
+     8, 17, 18, 20, 24,  6,  9, 22, 25, 32, 33, 34, 36, 40, 38, 41
+};
+
+const uint8_t kInterCbp[48] = {
+     0, 16,  1,  2,  4,  8, 32,  3,  5, 10, 12, 15, 47,  7, 11, 13,
+    14,  6,  9, 31, 35, 37, 42, 44, 33, 34, 36, 40, 39, 43, 45, 46,
+    17, 18, 20, 24, 19, 21, 26, 28, 23, 27, 29, 30, 22, 25, 38, 41
+};
+
+// Prediction lists of a partition: bit 0 list 0, bit 1 list 1
+constexpr uint8_t kPredL0 = 1;
+constexpr uint8_t kPredL1 = 2;
+
+// B_L0_L0_16x8 ... B_Bi_Bi_8x16, two mb_types per pair
+const uint8_t kBPartitionPairs[9][2] = {
+    {1, 1}, {2, 2}, {1, 2}, {2, 1}, {1, 3}, {2, 3}, {3, 1}, {3, 2}, {3, 3}
+};
+
+// B sub_mb_type: prediction lists and partition count; 0 is B_Direct_8x8
+const uint8_t kBSubPred[13] = {0, 1, 2, 3, 1, 1, 2, 2, 3, 3, 1, 2, 3};
+const uint8_t kBSubParts[13] = {4, 1, 1, 1, 2, 2, 2, 2, 2, 2, 4, 4, 4};
+const uint8_t kPSubParts[4] = {1, 2, 2, 4};
+
+inline uint32_t lumaBlockX(uint32_t blk_idx) {
+    return ((blk_idx >> 2) & 1) * 2 + (blk_idx & 1);
+}
+
+inline uint32_t lumaBlockY(uint32_t blk_idx) {
+    return ((blk_idx >> 3) & 1) * 2 + ((blk_idx >> 1) & 1);
+}
+
+int chromaQp(int qp, int offset) {
+    int qpi = std::min(std::max(qp + offset, 0), 51);
+    return qpi < 30 ? qpi : kChromaQp[qpi - 30];
+}
+
+uint32_t positionClass4x4(uint32_t raster) {
+    uint32_t row = raster >> 2;
+    uint32_t col = raster & 3;
+    if ((row & 1) == 0 && (col & 1) == 0) {
+        return 0;
+    }
+    return (row & 1) && (col & 1) ? 1 : 2;
+}
+
+uint32_t positionClass8x8(uint32_t raster) {
+    uint32_t row = raster >> 3;
+    uint32_t col = raster & 7;
+    if (row % 4 == 0 && col % 4 == 0) {
+        return 0;
+    }
+    if ((row & 1) && (col & 1)) {
+        return 1;
+    }
+    if (row % 4 == 2 && col % 4 == 2) {
+        return 2;
+    }
+    if ((row % 4 == 0 && (col & 1)) || ((row & 1) && col % 4 == 0)) {
+        return 3;
+    }
+    if ((row % 4 == 0 && col % 4 == 2) || (row % 4 == 2 && col % 4 == 0)) {
+        return 4;
+    }
+    return 5;
+}
+
+/**
+ * @brief Requantise levels so they reconstruct the same coefficients at a new QP
+ * @param levels Levels in scan order, updated
+ * @param count Number of levels
+ * @param raster Raster position of each level, or null for DC levels
+ * @param transform_8x8 Whether raster positions are in an 8x8 block
+ * @param qp_in QP the levels were coded at
+ * @param qp_out QP to code them at
+ * @param limit Largest codable magnitude
+ */
+void requantise(int32_t* levels, uint32_t count, const uint8_t* raster, bool transform_8x8,
+                int qp_in, int qp_out, int32_t limit) {
+    if (qp_in == qp_out) {
+        return;
+    }
+    
+    for (uint32_t i = 0; i < count; ++i) {
+        if (levels[i] == 0) {
+            continue;
+        }
+        int64_t num, den;
+        if (transform_8x8) {
+            uint32_t cls = positionClass8x8(raster[i]);
+            num = static_cast<int64_t>(kNormAdjust8x8[qp_in % 6][cls]) << (qp_in / 6);
+            den = static_cast<int64_t>(kNormAdjust8x8[qp_out % 6][cls]) << (qp_out / 6);
+        } else {
+            uint32_t cls = raster ? positionClass4x4(raster[i]) : 0;
+            num = static_cast<int64_t>(kNormAdjust4x4[qp_in % 6][cls]) << (qp_in / 6);
+            den = static_cast<int64_t>(kNormAdjust4x4[qp_out % 6][cls]) << (qp_out / 6);
+        }
+        int64_t magnitude = (2 * std::abs(static_cast<int64_t>(levels[i])) * num + den) / (2 * den);
+        magnitude = std::min<int64_t>(magnitude, limit);
+        levels[i] = static_cast<int32_t>(levels[i] < 0 ? -magnitude : magnitude);
+    }
+}
+
+// te(v) of a ref_idx with more than one active reference
+inline void skipRefIdx(BitReader& reader, uint32_t count) {
+    if (count == 2) {
+        reader.skipBits(1);
+    } else {
+        reader.readUE();
+    }
+}
+
+} // namespace
+
+struct H264Rewriter::Macroblock {
+    uint32_t addr;
+    bool pcm;
+    bool intra16x16;
+    bool transform_8x8;
+    uint32_t cbp_luma;
+    uint32_t cbp_chroma;
+};
+
+struct H264Rewriter::SliceState {
+    const SequenceParameterSet* sps;
+    const PictureParameterSet* pps;
+    const SliceHeader* header;
+    uint32_t slice_id;
+    int qp_in;                  // QP_Y of the previous macroblock as parsed
+    int qp_out;                 // QP_Y of the previous macroblock as written
+    int32_t level_limit;        // Largest level the profile can code
+    bool changed;               // Whether any syntax differs from the input
+};
+
+H264Rewriter::H264Rewriter(const RewriteConfig& config)
+    : config_(config),
+      sps_(new SequenceParameterSet[kMaxSpsCount]()),
+      pps_(new PictureParameterSet[kMaxPpsCount]()),
+      encoder_width_(0), encoder_height_(0),
+      frame_index_(0), period_base_(0), period_frames_(0),
+      prev_poc_msb_(0), prev_poc_lsb_(0), decode_count_(0),
+      picture_marked_(false), width_mbs_(0), height_mbs_(0),
+      slice_counter_(1), stats_{} {
+    // No pixels reach the encoder, so nothing may depend on frame analysis
+    config_.watermark.adaptive_embedding = false;
+    config_.watermark.scene_cut_threshold = 0.0f;
+    config_.watermark.frame_budget_us = 0;
+}
+
+H264Rewriter::~H264Rewriter() = default;
+
+bool H264Rewriter::loadParameterSets(const uint8_t* data, size_t size) {
+    if (!data || size == 0) {
+        return false;
+    }
+    
+    std::vector<uint8_t> discard;
+    if (size >= 7 && data[0] == 1) {
+        // avcC: SPS count in the low 5 bits of byte 5, then 16-bit lengths
+        size_t pos = 5;
+        for (int list = 0; list < 2 && pos < size; ++list) {
+            uint32_t count = list == 0 ? (data[pos] & 0x1F) : data[pos];
+            pos++;
+            for (uint32_t i = 0; i < count; ++i) {
+                if (pos + 2 > size) {
+                    return false;
+                }
+                size_t length = (static_cast<size_t>(data[pos]) << 8) | data[pos + 1];
+                pos += 2;
+                if (length > size - pos) {
+                    return false;
+                }
+                processNal(data + pos, length, discard);
+                pos += length;
+            }
+        }
+    } else {
+        rewriteAnnexB(data, size, discard);
+    }
+    
+    bool have_sps = false;
+    bool have_pps = false;
+    for (uint32_t i = 0; i < kMaxSpsCount; ++i) {
+        have_sps = have_sps || sps_[i].valid;
+    }
+    for (uint32_t i = 0; i < kMaxPpsCount; ++i) {
+        have_pps = have_pps || pps_[i].valid;
+    }
+    return have_sps && have_pps;
+}
+
+bool H264Rewriter::rewriteAnnexB(const uint8_t* data, size_t size, std::vector<uint8_t>& out) {
+    out.clear();
+    out.reserve(size);
+    findNalUnits(data, size, nals_);
+    
+    bool ok = true;
+    size_t pos = 0;
+    for (const NalRange& nal : nals_) {
+        out.insert(out.end(), data + pos, data + nal.begin);
+        ok = processNal(data + nal.begin, nal.end - nal.begin, out) && ok;
+        pos = nal.end;
+    }
+    out.insert(out.end(), data + pos, data + size);
+    return ok;
+}
+
+bool H264Rewriter::rewriteLengthPrefixed(const uint8_t* data, size_t size, uint32_t length_size,
+                                         std::vector<uint8_t>& out) {
+    out.clear();
+    if (length_size != 1 && length_size != 2 && length_size != 4) {
+        out.insert(out.end(), data, data + size);
+        return false;
+    }
+    out.reserve(size);
+    
+    bool ok = true;
+    size_t pos = 0;
+    while (size - pos >= length_size) {
+        size_t length = 0;
+        for (uint32_t i = 0; i < length_size; ++i) {
+            length = (length << 8) | data[pos + i];
+        }
+        if (length > size - pos - length_size) {
+            break;
+        }
+        
+        size_t prefix = out.size();
+        out.resize(prefix + length_size);
+        ok = processNal(data + pos + length_size, length, out) && ok;
+        
+        // A rewritten NAL unit that outgrew a short length field goes out unchanged
+        size_t written = out.size() - prefix - length_size;
+        if (length_size < 4 && written >> (8 * length_size) != 0) {
+            out.resize(prefix);
+            out.insert(out.end(), data + pos, data + pos + length_size + length);
+            stats_.slices_rewritten--;
+            stats_.slices_failed++;
+            ok = false;
+        } else {
+            for (uint32_t i = 0; i < length_size; ++i) {
+                out[prefix + i] = static_cast<uint8_t>(written >> (8 * (length_size - 1 - i)));
+            }
+        }
+        pos += length_size + length;
+    }
+    
+    if (pos != size) {
+        out.insert(out.end(), data + pos, data + size);
+        ok = false;
+    }
+    return ok;
+}
+
+std::string H264Rewriter::getStats() const {
+    std::ostringstream oss;
+    oss << "H264Rewriter Stats:\n"
+        << "  Pictures: " << stats_.pictures << "\n"
+        << "  Slices copied: " << stats_.slices_copied << "\n"
+        << "  Slices rewritten: " << stats_.slices_rewritten << "\n"
+        << "  Slices unsupported: " << stats_.slices_unsupported << "\n"
+        << "  Slices failed: " << stats_.slices_failed << "\n"
+        << "  Macroblocks marked: " << stats_.macroblocks_marked << "\n"
+        << "  Macroblocks unmarkable: " << stats_.macroblocks_unmarkable;
+    if (encoder_) {
+        oss << "\n" << encoder_->getStats();
+    }
+    
+    return oss.str();
+}
+
+bool H264Rewriter::processNal(const uint8_t* nal, size_t size, std::vector<uint8_t>& out) {
+    if (size == 0) {
+        return true;
+    }
+    
+    uint32_t nal_type = nal[0] & 0x1F;
+    uint32_t nal_ref_idc = (nal[0] >> 5) & 3;
+    bool is_slice = nal_type == static_cast<uint32_t>(NalType::Slice) ||
+                    nal_type == static_cast<uint32_t>(NalType::SliceIdr);
+    if (!is_slice && nal_type != static_cast<uint32_t>(NalType::Sps) &&
+        nal_type != static_cast<uint32_t>(NalType::Pps)) {
+        out.insert(out.end(), nal, nal + size);
+        return true;
+    }
+    
+    // Most slices pass through, so only their header is unescaped until a
+    // slice turns out to need rewriting
+    size_t escaped = is_slice ? std::min(size - 1, kHeaderBytes) : size - 1;
+    unescapeRbsp(nal + 1, escaped, rbsp_);
+    BitReader reader(rbsp_.data(), rbsp_.size());
+    out.insert(out.end(), nal, nal + size);
+    
+    if (nal_type == static_cast<uint32_t>(NalType::Sps)) {
+        SequenceParameterSet sps;
+        uint32_t sps_id;
+        if (!parseSps(reader, sps, sps_id)) {
+            return false;
+        }
+        sps_[sps_id] = sps;
+        return true;
+    }
+    if (nal_type == static_cast<uint32_t>(NalType::Pps)) {
+        PictureParameterSet pps;
+        uint32_t pps_id;
+        if (!parsePps(reader, sps_.get(), pps, pps_id)) {
+            return false;
+        }
+        pps_[pps_id] = pps;
+        return true;
+    }
+    
+    // From here the NAL unit is already in the output and is replaced only
+    // when the slice was rewritten
+    SliceHeader header;
+    bool parsed = parseSliceHeader(reader, nal_type, nal_ref_idc, sps_.get(), pps_.get(), header);
+    if (!parsed && escaped < size - 1) {
+        escaped = size - 1;
+        unescapeRbsp(nal + 1, escaped, rbsp_);
+        reader = BitReader(rbsp_.data(), rbsp_.size());
+        parsed = parseSliceHeader(reader, nal_type, nal_ref_idc, sps_.get(), pps_.get(), header);
+    }
+    if (!parsed) {
+        stats_.slices_failed++;
+        return false;
+    }
+    const PictureParameterSet& pps = pps_[header.pps_id];
+    const SequenceParameterSet& sps = sps_[pps.sps_id];
+    if (header.first_mb == 0) {
+        beginPicture(header, sps, nal_type, nal_ref_idc);
+    }
+    
+    if (!picture_marked_ && !config_.reencode_unmarked) {
+        stats_.slices_copied++;
+        return true;
+    }
+    bool supported = isSupported(nal_type, sps, pps, header) &&
+                     sps.width_mbs == width_mbs_ && sps.height_map_units == height_mbs_ &&
+                     header.first_mb < offsets_.size();
+    if (!supported) {
+        if (picture_marked_) {
+            stats_.slices_unsupported++;
+        } else {
+            stats_.slices_copied++;
+        }
+        return true;
+    }
+    
+    if (escaped < size - 1) {
+        unescapeRbsp(nal + 1, size - 1, rbsp_);
+        reader = BitReader(rbsp_.data(), rbsp_.size());
+        reader.seek(header.data_bit);
+    }
+    
+    SliceState state{&sps, &pps, &header, slice_counter_++, header.slice_qp, header.slice_qp,
+                     sps.high_profile ? kMaxLevelHigh : kMaxLevel, false};
+    writer_.clear();
+    writer_.copyBits(reader, 0, header.data_bit);
+    if (!rewriteSliceData(reader, state)) {
+        stats_.slices_failed++;
+        return false;
+    }
+    if (!state.changed && !config_.reencode_unmarked) {
+        stats_.slices_copied++;
+        return true;
+    }
+    
+    writer_.putTrailingBits();
+    const std::vector<uint8_t>& rbsp = writer_.bytes();
+    out.resize(out.size() - size);
+    out.push_back(nal[0]);
+    appendEscaped(rbsp.data(), rbsp.size(), out);
+    stats_.slices_rewritten++;
+    return true;
+}
+
+void H264Rewriter::beginPicture(const SliceHeader& header, const SequenceParameterSet& sps,
+                                uint32_t nal_type, uint32_t nal_ref_idc) {
+    stats_.pictures++;
+    bool idr = nal_type == static_cast<uint32_t>(NalType::SliceIdr);
+    frame_index_ = displayIndex(header, sps, idr, nal_ref_idc);
+    
+    if (!encoder_ || encoder_width_ != sps.width || encoder_height_ != sps.height) {
+        encoder_.reset(new WatermarkEncoder(config_.watermark));
+        encoder_width_ = sps.width;
+        encoder_height_ = sps.height;
+        if (!encoder_->initialize(sps.width, sps.height, config_.fps)) {
+            encoder_.reset();
+        }
+    }
+    
+    width_mbs_ = sps.width_mbs;
+    height_mbs_ = sps.height_map_units;
+    size_t mb_count = static_cast<size_t>(width_mbs_) * height_mbs_;
+    if (mb_slice_.size() != mb_count) {
+        mb_slice_.assign(mb_count, 0);
+        coeffs_in_.assign(mb_count * kBlocksPerMb, 0);
+        coeffs_out_.assign(mb_count * kBlocksPerMb, 0);
+    }
+    offsets_.resize(mb_count);
+    picture_qp_.assign(mb_count, kNoQp);
+    picture_marked_ = false;
+    if (!encoder_) {
+        return;
+    }
+    
+    // The first slice's type stands for the picture, as x264 codes one type per picture
+    FrameType type = header.type == SliceType::I ? FrameType::I :
+                     header.type == SliceType::B ? FrameType::B : FrameType::P;
+    encoder_->beginFrame(frame_index_, FrameInfo{type, nal_ref_idc != 0});
+    QuantOffsetPlane plane{offsets_.data(), width_mbs_, height_mbs_};
+    picture_marked_ = encoder_->renderQuantOffsets(frame_index_, plane) > 0;
+}
+
+uint32_t H264Rewriter::displayIndex(const SliceHeader& header, const SequenceParameterSet& sps,
+                                    bool idr, uint32_t nal_ref_idc) {
+    if (idr) {
+        period_base_ += period_frames_;
+        period_frames_ = 0;
+        prev_poc_msb_ = 0;
+        prev_poc_lsb_ = 0;
+        decode_count_ = 0;
+    }
+    
+    // Encoders count frames in POC steps of two; without POC lsb in the
+    // slice header (types 1 and 2) decoding order is used instead
+    uint32_t offset = decode_count_;
+    if (sps.pic_order_cnt_type == 0) {
+        int32_t max_lsb = 1 << sps.log2_max_poc_lsb;
+        int32_t lsb = static_cast<int32_t>(header.poc_lsb);
+        int32_t prev_lsb = static_cast<int32_t>(prev_poc_lsb_);
+        int32_t msb = prev_poc_msb_;
+        if (lsb < prev_lsb && prev_lsb - lsb >= max_lsb / 2) {
+            msb += max_lsb;
+        } else if (lsb > prev_lsb && lsb - prev_lsb > max_lsb / 2) {
+            msb -= max_lsb;
+        }
+        if (nal_ref_idc != 0) {
+            prev_poc_msb_ = msb;
+            prev_poc_lsb_ = header.poc_lsb;
+        }
+        int32_t top = msb + lsb;
+        int32_t poc = std::min(top, top + header.delta_poc_bottom);
+        offset = poc > 0 ? static_cast<uint32_t>(poc) / 2 : 0;
+    }
+    decode_count_++;
+    
+    uint32_t index = period_base_ + offset;
+    period_frames_ = std::max(period_frames_, offset + 1);
+    
+    // memory_management_control_operation 5 restarts POC after this picture
+    if (header.memory_management_5) {
+        period_base_ = index;
+        period_frames_ = 1;
+        prev_poc_msb_ = 0;
+        prev_poc_lsb_ = 0;
+        decode_count_ = 1;
+    }
+    return index;
+}
+
+bool H264Rewriter::isSupported(uint32_t nal_type, const SequenceParameterSet& sps,
+                               const PictureParameterSet& pps, const SliceHeader& header) {
+    bool slice = nal_type == static_cast<uint32_t>(NalType::Slice) ||
+                 nal_type == static_cast<uint32_t>(NalType::SliceIdr);
+    bool type = header.type == SliceType::I || header.type == SliceType::P ||
+                header.type == SliceType::B;
+    return slice && type && !pps.cabac && pps.num_slice_groups == 1 &&
+           sps.frame_mbs_only && !header.field_pic &&
+           sps.chroma_format_idc == 1 && !sps.separate_colour_plane &&
+           sps.bit_depth_luma == 8 && sps.bit_depth_chroma == 8 && !sps.transform_bypass;
+}
+
+bool H264Rewriter::rewriteSliceData(BitReader& reader, SliceState& state) {
+    const uint32_t mb_count = width_mbs_ * height_mbs_;
+    const bool intra_slice = state.header->type == SliceType::I;
+    uint32_t addr = state.header->first_mb;
+    
+    while (true) {
+        if (!intra_slice) {
+            uint32_t run = reader.readUE();
+            writer_.putUE(run);
+            if (reader.overrun() || run > mb_count - addr) {
+                return false;
+            }
+            
+            // Skipped macroblocks code no residual and keep the predicted QP
+            for (uint32_t i = 0; i < run; ++i, ++addr) {
+                mb_slice_[addr] = state.slice_id;
+                std::fill_n(coeffs_in_.begin() + addr * kBlocksPerMb, kBlocksPerMb, 0);
+                std::fill_n(coeffs_out_.begin() + addr * kBlocksPerMb, kBlocksPerMb, 0);
+                picture_qp_[addr] = static_cast<uint8_t>(state.qp_out);
+                if (std::lround(offsets_[addr]) != 0) {
+                    stats_.macroblocks_unmarkable++;
+                }
+            }
+            if (run > 0 && !reader.moreRbspData()) {
+                break;
+            }
+        }
+        if (addr >= mb_count) {
+            return false;
+        }
+        
+        Macroblock mb;
+        mb.addr = addr;
+        mb_slice_[addr] = state.slice_id;
+        if (!copyMacroblockPrediction(reader, state, mb)) {
+            return false;
+        }
+        
+        int target = static_cast<int>(std::lround(offsets_[addr]));
+        uint32_t base = addr * kBlocksPerMb;
+        if (mb.pcm) {
+            std::fill_n(coeffs_in_.begin() + base, kBlocksPerMb, 16);
+            std::fill_n(coeffs_out_.begin() + base, kBlocksPerMb, 16);
+            if (target != 0) {
+                stats_.macroblocks_unmarkable++;
+            }
+        } else if (mb.cbp_luma != 0 || mb.cbp_chroma != 0 || mb.intra16x16) {
+            int32_t delta_in = reader.readSE();
+            if (delta_in < -26 || delta_in > 25) {
+                return false;
+            }
+            int qp_in = (state.qp_in + delta_in + 52) % 52;
+            int qp_out = std::min(std::max(qp_in + target, 0), 51);
+            
+            // mb_qp_delta wraps modulo 52 within [-26, 25]
+            int delta_out = qp_out - state.qp_out;
+            if (delta_out < -26) {
+                delta_out += 52;
+            } else if (delta_out > 25) {
+                delta_out -= 52;
+            }
+            writer_.putSE(delta_out);
+            state.changed = state.changed || delta_out != delta_in;
+            if (qp_out != qp_in) {
+                stats_.macroblocks_marked++;
+            } else if (target != 0) {
+                stats_.macroblocks_unmarkable++;
+            }
+            
+            state.qp_in = qp_in;
+            state.qp_out = qp_out;
+            if (!rewriteResidual(reader, state, mb, qp_in, qp_out)) {
+                return false;
+            }
+        } else {
+            std::fill_n(coeffs_in_.begin() + base, kBlocksPerMb, 0);
+            std::fill_n(coeffs_out_.begin() + base, kBlocksPerMb, 0);
+            if (target != 0) {
+                stats_.macroblocks_unmarkable++;
+            }
+        }
+        picture_qp_[addr] = static_cast<uint8_t>(state.qp_out);
+        if (reader.overrun()) {
+            return false;
+        }
+        
+        addr++;
+        if (!reader.moreRbspData()) {
+            break;
+        }
+    }
+    return !reader.overrun();
+}
+
+bool H264Rewriter::copyMacroblockPrediction(BitReader& reader, SliceState& state, Macroblock& mb) {
+    const SliceHeader& header = *state.header;
+    const size_t start = reader.position();
+    uint32_t mb_type = reader.readUE();
+    
+    // Intra types of P and B slices follow their inter types
+    int intra_type = -1;
+    if (header.type == SliceType::I) {
+        intra_type = static_cast<int>(mb_type);
+    } else if (header.type == SliceType::P && mb_type >= 5) {
+        intra_type = static_cast<int>(mb_type - 5);
+    } else if (header.type == SliceType::B && mb_type >= 23) {
+        intra_type = static_cast<int>(mb_type - 23);
+    }
+    if (intra_type > 25) {
+        return false;
+    }
+    
+    mb.pcm = false;
+    mb.intra16x16 = false;
+    mb.transform_8x8 = false;
+    mb.cbp_luma = 0;
+    mb.cbp_chroma = 0;
+    
+    if (intra_type == 25) {
+        // I_PCM: samples are byte aligned in both streams
+        writer_.copyBits(reader, start, reader.position());
+        reader.skipBits((8 - (reader.position() & 7)) & 7);
+        writer_.alignZero();
+        size_t samples = reader.position();
+        reader.skipBits(384 * 8);
+        if (reader.overrun()) {
+            return false;
+        }
+        writer_.copyBits(reader, samples, reader.position());
+        mb.pcm = true;
+        return true;
+    }
+    
+    uint32_t cbp = 0;
+    if (intra_type == 0) {
+        if (state.pps->transform_8x8_mode) {
+            mb.transform_8x8 = reader.readFlag();
+        }
+        uint32_t modes = mb.transform_8x8 ? 4 : 16;
+        for (uint32_t i = 0; i < modes; ++i) {
+            if (!reader.readFlag()) {
+                reader.skipBits(3);
+            }
+        }
+        reader.readUE();  // intra_chroma_pred_mode
+        uint32_t code = reader.readUE();
+        if (code >= 48) {
+            return false;
+        }
+        cbp = kIntraCbp[code];
+    } else if (intra_type > 0) {
+        reader.readUE();  // intra_chroma_pred_mode
+        mb.intra16x16 = true;
+        cbp = (intra_type >= 13 ? 15 : 0) | ((((intra_type - 1) / 4) % 3) << 4);
+    } else {
+        const uint32_t ref_l0 = header.num_ref_idx_l0;
+        const uint32_t ref_l1 = header.num_ref_idx_l1;
+        bool small_parts = false;
+        bool direct16x16 = false;
+        
+        bool sub_mb = (header.type == SliceType::P && mb_type >= 3) ||
+                      (header.type == SliceType::B && mb_type == 22);
+        if (sub_mb) {
+            uint8_t pred[4];
+            uint8_t parts[4];
+            for (int i = 0; i < 4; ++i) {
+                uint32_t sub_type = reader.readUE();
+                if (header.type == SliceType::P) {
+                    if (sub_type > 3) {
+                        return false;
+                    }
+                    pred[i] = kPredL0;
+                    parts[i] = kPSubParts[sub_type];
+                    small_parts = small_parts || sub_type != 0;
+                } else {
+                    if (sub_type > 12) {
+                        return false;
+                    }
+                    pred[i] = kBSubPred[sub_type];
+                    parts[i] = kBSubParts[sub_type];
+                    small_parts = small_parts ||
+                                  (sub_type == 0 ? !state.sps->direct_8x8_inference : parts[i] > 1);
+                }
+            }
+            
+            // P_8x8ref0 codes no ref_idx_l0
+            bool refs_l0 = ref_l0 > 1 && !(header.type == SliceType::P && mb_type == 4);
+            for (int i = 0; i < 4; ++i) {
+                if (refs_l0 && (pred[i] & kPredL0)) {
+                    skipRefIdx(reader, ref_l0);
+                }
+            }
+            for (int i = 0; i < 4; ++i) {
+                if (ref_l1 > 1 && (pred[i] & kPredL1)) {
+                    skipRefIdx(reader, ref_l1);
+                }
+            }
+            for (uint8_t list : {kPredL0, kPredL1}) {
+                for (int i = 0; i < 4; ++i) {
+                    if (pred[i] & list) {
+                        for (uint32_t part = 0; part < parts[i]; ++part) {
+                            reader.readSE();
+                            reader.readSE();
+                        }
+                    }
+                }
+            }
+        } else {
+            uint8_t pred[2] = {0, 0};
+            uint32_t parts = 1;
+            if (header.type == SliceType::P) {
+                pred[0] = pred[1] = kPredL0;
+                parts = mb_type == 0 ? 1 : 2;
+            } else if (mb_type == 0) {
+                direct16x16 = true;
+                parts = 0;
+            } else if (mb_type <= 3) {
+                pred[0] = static_cast<uint8_t>(mb_type);
+            } else {
+                pred[0] = kBPartitionPairs[(mb_type - 4) / 2][0];
+                pred[1] = kBPartitionPairs[(mb_type - 4) / 2][1];
+                parts = 2;
+            }
+            
+            for (uint32_t part = 0; part < parts; ++part) {
+                if (ref_l0 > 1 && (pred[part] & kPredL0)) {
+                    skipRefIdx(reader, ref_l0);
+                }
+            }
+            for (uint32_t part = 0; part < parts; ++part) {
+                if (ref_l1 > 1 && (pred[part] & kPredL1)) {
+                    skipRefIdx(reader, ref_l1);
+                }
+            }
+            for (uint8_t list : {kPredL0, kPredL1}) {
+                for (uint32_t part = 0; part < parts; ++part) {
+                    if (pred[part] & list) {
+                        reader.readSE();
+                        reader.readSE();
+                    }
+                }
+            }
+        }
+        
+        uint32_t code = reader.readUE();
+        if (code >= 48) {
+            return false;
+        }
+        cbp = kInterCbp[code];
+        if ((cbp & 15) != 0 && state.pps->transform_8x8_mode && !small_parts &&
+            (!direct16x16 || state.sps->direct_8x8_inference)) {
+            mb.transform_8x8 = reader.readFlag();
+        }
+    }
+    
+    mb.cbp_luma = cbp & 15;
+    mb.cbp_chroma = cbp >> 4;
+    if (reader.overrun()) {
+        return false;
+    }
+    writer_.copyBits(reader, start, reader.position());
+    return true;
+}
+
+bool H264Rewriter::rewriteResidual(BitReader& reader, SliceState& state, const Macroblock& mb,
+                                   int qp_in, int qp_out) {
+    const uint32_t base = mb.addr * kBlocksPerMb;
+    const int32_t limit = state.level_limit;
+    int32_t levels[16];
+    
+    // Parse a 4x4 block at the input nC, requantise it, code it at the output nC
+    auto rewriteBlock = [&](uint32_t plane, uint32_t x, uint32_t y, uint32_t per_row,
+                            uint32_t max_coeff, const uint8_t* raster, int q_in, int q_out,
+                            bool store) {
+        int total = readResidualBlock(reader, predictCount(coeffs_in_, mb.addr, plane, x, y, per_row),
+                                      max_coeff, levels);
+        if (total < 0) {
+            return false;
+        }
+        requantise(levels, max_coeff, raster, false, q_in, q_out, limit);
+        uint32_t written = writeResidualBlock(
+            writer_, predictCount(coeffs_out_, mb.addr, plane, x, y, per_row), max_coeff, levels);
+        if (store) {
+            coeffs_in_[base + plane + y * per_row + x] = static_cast<uint8_t>(total);
+            coeffs_out_[base + plane + y * per_row + x] = static_cast<uint8_t>(written);
+        }
+        return true;
+    };
+    
+    // Intra16x16DCLevel is predicted like luma block 0 but stores no count
+    if (mb.intra16x16 && !rewriteBlock(0, 0, 0, 4, 16, nullptr, qp_in, qp_out, false)) {
+        return false;
+    }
+    
+    for (uint32_t i8x8 = 0; i8x8 < 4; ++i8x8) {
+        if (!(mb.cbp_luma & (1u << i8x8))) {
+            for (uint32_t i4x4 = 0; i4x4 < 4; ++i4x4) {
+                uint32_t blk_idx = i8x8 * 4 + i4x4;
+                uint32_t index = base + lumaBlockY(blk_idx) * 4 + lumaBlockX(blk_idx);
+                coeffs_in_[index] = 0;
+                coeffs_out_[index] = 0;
+            }
+            continue;
+        }
+        
+        if (mb.transform_8x8) {
+            // CAVLC codes an 8x8 block as four interleaved 4x4 blocks
+            int32_t level8x8[64];
+            for (uint32_t i4x4 = 0; i4x4 < 4; ++i4x4) {
+                uint32_t blk_idx = i8x8 * 4 + i4x4;
+                uint32_t x = lumaBlockX(blk_idx);
+                uint32_t y = lumaBlockY(blk_idx);
+                int total = readResidualBlock(reader, predictCount(coeffs_in_, mb.addr, 0, x, y, 4),
+                                              16, levels);
+                if (total < 0) {
+                    return false;
+                }
+                coeffs_in_[base + y * 4 + x] = static_cast<uint8_t>(total);
+                for (uint32_t k = 0; k < 16; ++k) {
+                    level8x8[4 * k + i4x4] = levels[k];
+                }
+            }
+            requantise(level8x8, 64, kZigzag8x8, true, qp_in, qp_out, limit);
+            for (uint32_t i4x4 = 0; i4x4 < 4; ++i4x4) {
+                uint32_t blk_idx = i8x8 * 4 + i4x4;
+                uint32_t x = lumaBlockX(blk_idx);
+                uint32_t y = lumaBlockY(blk_idx);
+                for (uint32_t k = 0; k < 16; ++k) {
+                    levels[k] = level8x8[4 * k + i4x4];
+                }
+                coeffs_out_[base + y * 4 + x] = static_cast<uint8_t>(writeResidualBlock(
+                    writer_, predictCount(coeffs_out_, mb.addr, 0, x, y, 4), 16, levels));
+            }
+            continue;
+        }
+        
+        for (uint32_t i4x4 = 0; i4x4 < 4; ++i4x4) {
+            uint32_t blk_idx = i8x8 * 4 + i4x4;
+            bool ok = mb.intra16x16 ?
+                rewriteBlock(0, lumaBlockX(blk_idx), lumaBlockY(blk_idx), 4, 15, kZigzag4x4 + 1,
+                             qp_in, qp_out, true) :
+                rewriteBlock(0, lumaBlockX(blk_idx), lumaBlockY(blk_idx), 4, 16, kZigzag4x4,
+                             qp_in, qp_out, true);
+            if (!ok) {
+                return false;
+            }
+        }
+    }
+    
+    const uint32_t planes[2] = {kCbBlock, kCrBlock};
+    const int offsets[2] = {state.pps->chroma_qp_index_offset,
+                            state.pps->second_chroma_qp_index_offset};
+    int chroma_in[2], chroma_out[2];
+    for (int c = 0; c < 2; ++c) {
+        chroma_in[c] = chromaQp(qp_in, offsets[c]);
+        chroma_out[c] = chromaQp(qp_out, offsets[c]);
+    }
+    
+    if (mb.cbp_chroma != 0) {
+        for (int c = 0; c < 2; ++c) {
+            if (readResidualBlock(reader, kChromaDcNc, 4, levels) < 0) {
+                return false;
+            }
+            requantise(levels, 4, nullptr, false, chroma_in[c], chroma_out[c], limit);
+            writeResidualBlock(writer_, kChromaDcNc, 4, levels);
+        }
+    }
+    if (mb.cbp_chroma & 2) {
+        for (int c = 0; c < 2; ++c) {
+            for (uint32_t blk_idx = 0; blk_idx < 4; ++blk_idx) {
+                if (!rewriteBlock(planes[c], blk_idx & 1, blk_idx >> 1, 2, 15, kZigzag4x4 + 1,
+                                  chroma_in[c], chroma_out[c], true)) {
+                    return false;
+                }
+            }
+        }
+    } else {
+        std::fill_n(coeffs_in_.begin() + base + kCbBlock, 8, 0);
+        std::fill_n(coeffs_out_.begin() + base + kCbBlock, 8, 0);
+    }
+    return !reader.overrun();
+}
+
+int H264Rewriter::predictCount(const std::vector<uint8_t>& counts, uint32_t mb_addr,
+                               uint32_t block, uint32_t x, uint32_t y, uint32_t blocks_per_row) const {
+    // Neighbours count only inside the current slice
+    const uint32_t slice_id = mb_slice_[mb_addr];
+    int left = -1;
+    int top = -1;
+    if (x > 0) {
+        left = counts[mb_addr * kBlocksPerMb + block + y * blocks_per_row + x - 1];
+    } else if (mb_addr % width_mbs_ != 0 && mb_slice_[mb_addr - 1] == slice_id) {
+        left = counts[(mb_addr - 1) * kBlocksPerMb + block + y * blocks_per_row + blocks_per_row - 1];
+    }
+    if (y > 0) {
+        top = counts[mb_addr * kBlocksPerMb + block + (y - 1) * blocks_per_row + x];
+    } else if (mb_addr >= width_mbs_ && mb_slice_[mb_addr - width_mbs_] == slice_id) {
+        top = counts[(mb_addr - width_mbs_) * kBlocksPerMb + block +
+                     (blocks_per_row - 1) * blocks_per_row + x];
+    }
+    
+    if (left >= 0 && top >= 0) {
+        return (left + top + 1) >> 1;
+    }
+    if (left >= 0) {
+        return left;
+    }
+    return top >= 0 ? top : 0;
+}
+
+} // namespace phantomframe
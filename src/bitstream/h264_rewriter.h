@@ -0,0 +1,251 @@
+#ifndef PHANTOMFRAME_H264_REWRITER_H
+#define PHANTOMFRAME_H264_REWRITER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+#include "h264_bitstream.h"
+#include "h264_syntax.h"
+#include "encoder/watermark_encoder.h"
+
+namespace phantomframe {
+
+/**
+ * @brief Configuration for compressed-domain watermarking
+ */
+struct RewriteConfig {
+    WatermarkConfig watermark;  // Schedule parameters, as for WatermarkEncoder
+    float fps;                  // Frame rate reported to the encoder
+    bool reencode_unmarked;     // Re-entropy-code every supported slice, not only marked ones
+};
+
+/**
+ * @brief Counters of a rewriter since construction
+ */
+struct RewriteStats {
+    uint64_t pictures;                  // Pictures seen
+    uint64_t slices_copied;             // Slices passed through bit-exact
+    uint64_t slices_rewritten;          // Slices re-entropy-coded
+    uint64_t slices_unsupported;        // Marked slices passed through (CABAC, interlaced, ...)
+    uint64_t slices_failed;             // Slices passed through after a parse error
+    uint64_t macroblocks_marked;        // Macroblocks whose QP was changed
+    uint64_t macroblocks_unmarkable;    // Scheduled macroblocks coded without mb_qp_delta
+};
+
+/**
+ * @brief Watermark an H.264 stream by rewriting its slices
+ *
+ * Takes the per-macroblock QP deltas that WatermarkEncoder renders for
+ * x264 and applies them to an already encoded stream: the mb_qp_delta of
+ * each scheduled macroblock is changed, its residual levels are
+ * requantised to the new QP, and the slice is entropy-coded again.
+ * Prediction syntax (macroblock types, intra modes, motion vectors, coded
+ * block patterns) is copied bit for bit. Slices of pictures without marks,
+ * and NAL units other than slices, pass through unchanged.
+ *
+ * Frame indices are derived from picture order counts, so pictures are
+ * marked in display order like the encode pipeline does. There are no
+ * pixels in the compressed domain, so adaptive embedding and scene-cut
+ * restarts are not available.
+ *
+ * CAVLC slices of 8-bit 4:2:0 progressive streams are rewritten. Slices
+ * the rewriter cannot parse (CABAC, field or MBAFF coding, FMO, data
+ * partitioning, other chroma formats) are passed through and counted.
+ * Requantised macroblocks change what later pictures predict from, so the
+ * deltas drift until the next IDR picture like any requantising transcoder.
+ *
+ * Only macroblocks that code a residual carry mb_qp_delta; a scheduled
+ * skipped or residual-free macroblock cannot take a delta and is counted
+ * as unmarkable.
+ */
+class H264Rewriter {
+public:
+    explicit H264Rewriter(const RewriteConfig& config);
+    ~H264Rewriter();
+
+    /**
+     * @brief Load parameter sets from codec extradata
+     *
+     * Accepts an avcC record (MP4/MKV) or Annex B SPS/PPS NAL units.
+     * @param data Extradata bytes
+     * @param size Size of data in bytes
+     * @return true if at least one SPS and PPS were loaded
+     */
+    bool loadParameterSets(const uint8_t* data, size_t size);
+
+    /**
+     * @brief Rewrite an Annex B byte stream chunk
+     *
+     * Chunks must hold whole NAL units, e.g. one access unit or a whole file.
+     * @param data Input bytes
+     * @param size Size of data in bytes
+     * @param out Output bytes, replaced
+     * @return true if every NAL unit was handled; on false the output still
+     *         holds the rest of the chunk unchanged
+     */
+    bool rewriteAnnexB(const uint8_t* data, size_t size, std::vector<uint8_t>& out);
+
+    /**
+     * @brief Rewrite NAL units with big-endian length prefixes (MP4 samples)
+     * @param data Input bytes
+     * @param size Size of data in bytes
+     * @param length_size Bytes per length prefix: 1, 2 or 4
+     * @param out Output bytes, replaced
+     * @return true if every NAL unit was handled
+     */
+    bool rewriteLengthPrefixed(const uint8_t* data, size_t size, uint32_t length_size,
+                               std::vector<uint8_t>& out);
+
+    /**
+     * @brief Display-order index of the last picture seen
+     * @return Frame index used for the watermark schedule
+     */
+    uint32_t lastFrameIndex() const { return frame_index_; }
+
+    /**
+     * @brief QP of each macroblock of the last picture as written
+     *
+     * Lets a compressed-domain detector read the embedded deltas without
+     * decoding. Entries of slices passed through without parsing are 0xFF;
+     * set reencode_unmarked to parse every supported slice.
+     * @return Raster-order QPs, one per macroblock
+     */
+    const std::vector<uint8_t>& macroblockQp() const { return picture_qp_; }
+
+    /**
+     * @brief Get the counters since construction
+     * @return Rewrite counters
+     */
+    RewriteStats getRewriteStats() const { return stats_; }
+
+    /**
+     * @brief Get rewriter statistics
+     * @return Statistics string
+     */
+    std::string getStats() const;
+
+private:
+    struct Macroblock;
+    struct SliceState;
+
+    RewriteConfig config_;
+    std::unique_ptr<WatermarkEncoder> encoder_;
+    std::unique_ptr<SequenceParameterSet[]> sps_;
+    std::unique_ptr<PictureParameterSet[]> pps_;
+    uint32_t encoder_width_, encoder_height_;
+
+    // Display order: pictures are numbered from the picture order count,
+    // offset by the frames of earlier IDR periods
+    uint32_t frame_index_;
+    uint32_t period_base_;
+    uint32_t period_frames_;
+    int32_t prev_poc_msb_;
+    uint32_t prev_poc_lsb_;
+    uint32_t decode_count_;
+
+    // Marks of the current picture and its macroblock state
+    std::vector<float> offsets_;
+    bool picture_marked_;
+    uint32_t width_mbs_, height_mbs_;
+    std::vector<uint8_t> picture_qp_;
+    std::vector<uint32_t> mb_slice_;
+    std::vector<uint8_t> coeffs_in_;    // Per 4x4 block TotalCoeff as parsed
+    std::vector<uint8_t> coeffs_out_;   // Per 4x4 block TotalCoeff as written
+    uint32_t slice_counter_;
+
+    // Scratch reused across NAL units
+    std::vector<uint8_t> rbsp_;
+    std::vector<NalRange> nals_;
+    BitWriter writer_;
+
+    RewriteStats stats_;
+
+    /**
+     * @brief Handle one NAL unit and append it to the output
+     * @param nal NAL unit including its header byte
+     * @param size Size of nal in bytes
+     * @param out Output to append the (possibly rewritten) NAL unit to
+     * @return false if the NAL unit is malformed
+     */
+    bool processNal(const uint8_t* nal, size_t size, std::vector<uint8_t>& out);
+
+    /**
+     * @brief Start a new picture: number it and render its marks
+     * @param header First slice header of the picture
+     * @param sps Active sequence parameter set
+     * @param nal_type nal_unit_type of the slice
+     * @param nal_ref_idc nal_ref_idc of the slice
+     */
+    void beginPicture(const SliceHeader& header, const SequenceParameterSet& sps,
+                      uint32_t nal_type, uint32_t nal_ref_idc);
+
+    /**
+     * @brief Display-order index of a picture
+     * @param header Slice header of the picture
+     * @param sps Active sequence parameter set
+     * @param idr Whether the picture is an IDR picture
+     * @param nal_ref_idc nal_ref_idc of the picture
+     * @return Frame index
+     */
+    uint32_t displayIndex(const SliceHeader& header, const SequenceParameterSet& sps,
+                          bool idr, uint32_t nal_ref_idc);
+
+    /**
+     * @brief Whether the rewriter can parse a slice
+     * @param nal_type nal_unit_type of the slice
+     * @param sps Active sequence parameter set
+     * @param pps Active picture parameter set
+     * @param header Slice header
+     * @return true for CAVLC slices of supported streams
+     */
+    static bool isSupported(uint32_t nal_type, const SequenceParameterSet& sps,
+                            const PictureParameterSet& pps, const SliceHeader& header);
+
+    /**
+     * @brief Parse and re-encode the slice_data() of one slice
+     * @param reader Reader positioned at the start of slice_data()
+     * @param state Slice parameters and QP tracking
+     * @return true if the slice was parsed to its trailing bits
+     */
+    bool rewriteSliceData(BitReader& reader, SliceState& state);
+
+    /**
+     * @brief Parse macroblock syntax up to mb_qp_delta, copying it
+     * @param reader Reader positioned at mb_type
+     * @param state Slice parameters
+     * @param mb Output macroblock description
+     * @return false on a syntax error
+     */
+    bool copyMacroblockPrediction(BitReader& reader, SliceState& state, Macroblock& mb);
+
+    /**
+     * @brief Parse, requantise and write the residual of a macroblock
+     * @param reader Reader positioned at the first residual block
+     * @param state Slice parameters
+     * @param mb Macroblock being rewritten
+     * @param qp_in QP the residual was coded at
+     * @param qp_out QP to code the residual at
+     * @return false on a syntax error
+     */
+    bool rewriteResidual(BitReader& reader, SliceState& state, const Macroblock& mb,
+                         int qp_in, int qp_out);
+
+    /**
+     * @brief Predicted TotalCoeff (nC) of a 4x4 block
+     * @param counts coeffs_in_ or coeffs_out_
+     * @param mb_addr Macroblock address
+     * @param block Block index within the macroblock storage (see .cpp)
+     * @param x Block column in its plane, in blocks
+     * @param y Block row in its plane, in blocks
+     * @param blocks_per_row Blocks per macroblock row of the plane (4 luma, 2 chroma)
+     * @return nC
+     */
+    int predictCount(const std::vector<uint8_t>& counts, uint32_t mb_addr,
+                     uint32_t block, uint32_t x, uint32_t y, uint32_t blocks_per_row) const;
+};
+
+} // namespace phantomframe
+
+#endif // PHANTOMFRAME_H264_REWRITER_H
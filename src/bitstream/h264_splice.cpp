@@ -0,0 +1,220 @@
+#include "h264_splice.h"
+#include "h264_syntax.h"
+#include <algorithm>
+
+namespace phantomframe {
+
+namespace {
+
+// avcC: version, profile, compatibility, level, length size, SPS count
+constexpr size_t kAvcCHeaderBytes = 6;
+
+// Enough RBSP to reach the id of any SPS or PPS
+constexpr size_t kIdBytes = 16;
+
+bool isAvcC(const uint8_t* extradata, size_t size) {
+    return extradata && size >= kAvcCHeaderBytes + 1 && extradata[0] == 1;
+}
+
+/**
+ * @brief Walk one avcC parameter set list
+ * @return Position after the list, 0 if it is truncated
+ */
+size_t readAvcCList(const uint8_t* data, size_t size, size_t pos, uint32_t count,
+                    std::vector<std::vector<uint8_t>>* sets) {
+    for (uint32_t i = 0; i < count; ++i) {
+        if (pos + 2 > size) {
+            return 0;
+        }
+        size_t length = (static_cast<size_t>(data[pos]) << 8) | data[pos + 1];
+        pos += 2;
+        if (length > size - pos) {
+            return 0;
+        }
+        if (sets) {
+            sets->emplace_back(data + pos, data + pos + length);
+        }
+        pos += length;
+    }
+    return pos;
+}
+
+void writeAvcCList(const std::vector<std::vector<uint8_t>>& sets, std::vector<uint8_t>& out) {
+    for (const auto& nal : sets) {
+        out.push_back(static_cast<uint8_t>(nal.size() >> 8));
+        out.push_back(static_cast<uint8_t>(nal.size()));
+        out.insert(out.end(), nal.begin(), nal.end());
+    }
+}
+
+} // namespace
+
+uint32_t nalLengthSize(const uint8_t* extradata, size_t size) {
+    return isAvcC(extradata, size) ? (extradata[4] & 3u) + 1 : 0;
+}
+
+bool splitNalUnits(const uint8_t* data, size_t size, uint32_t length_size,
+                   std::vector<NalRange>& nals) {
+    if (length_size == 0) {
+        findNalUnits(data, size, nals);
+        return true;
+    }
+    
+    nals.clear();
+    size_t pos = 0;
+    while (size - pos >= length_size) {
+        size_t length = 0;
+        for (uint32_t i = 0; i < length_size; ++i) {
+            length = (length << 8) | data[pos + i];
+        }
+        pos += length_size;
+        if (length > size - pos) {
+            return false;
+        }
+        if (length > 0) {
+            nals.push_back({pos, pos + length});
+        }
+        pos += length;
+    }
+    return pos == size;
+}
+
+bool isIdrAccessUnit(const uint8_t* data, size_t size, uint32_t length_size) {
+    std::vector<NalRange> nals;
+    splitNalUnits(data, size, length_size, nals);
+    
+    for (const NalRange& nal : nals) {
+        if ((data[nal.begin] & 0x1F) == static_cast<uint8_t>(NalType::SliceIdr)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool readParameterSets(const uint8_t* extradata, size_t size, ParameterSets& sets) {
+    if (!extradata || size == 0) {
+        return true;
+    }
+    
+    if (isAvcC(extradata, size)) {
+        size_t pos = readAvcCList(extradata, size, kAvcCHeaderBytes, extradata[5] & 0x1F, &sets.sps);
+        if (pos == 0 || pos >= size) {
+            return false;
+        }
+        return readAvcCList(extradata, size, pos + 1, extradata[pos], &sets.pps) != 0;
+    }
+    
+    std::vector<NalRange> nals;
+    findNalUnits(extradata, size, nals);
+    for (const NalRange& nal : nals) {
+        uint8_t type = extradata[nal.begin] & 0x1F;
+        if (type == static_cast<uint8_t>(NalType::Sps)) {
+            sets.sps.emplace_back(extradata + nal.begin, extradata + nal.end);
+        } else if (type == static_cast<uint8_t>(NalType::Pps)) {
+            sets.pps.emplace_back(extradata + nal.begin, extradata + nal.end);
+        }
+    }
+    return true;
+}
+
+int parameterSetId(const uint8_t* nal, size_t size) {
+    if (!nal || size < 2) {
+        return -1;
+    }
+    
+    std::vector<uint8_t> rbsp;
+    unescapeRbsp(nal + 1, std::min(size - 1, kIdBytes), rbsp);
+    BitReader reader(rbsp.data(), rbsp.size());
+    
+    uint8_t type = nal[0] & 0x1F;
+    if (type == static_cast<uint8_t>(NalType::Sps)) {
+        // profile_idc, constraint flags, level_idc
+        reader.skipBits(24);
+    } else if (type != static_cast<uint8_t>(NalType::Pps)) {
+        return -1;
+    }
+    
+    uint32_t id = reader.readUE();
+    return reader.overrun() ? -1 : static_cast<int>(id);
+}
+
+int unusedParameterSetId(const ParameterSets& sets) {
+    bool used[32] = {};
+    for (const auto* list : {&sets.sps, &sets.pps}) {
+        for (const auto& nal : *list) {
+            int id = parameterSetId(nal.data(), nal.size());
+            if (id >= 0 && id < 32) {
+                used[id] = true;
+            }
+        }
+    }
+    
+    for (int id = 31; id >= 0; --id) {
+        if (!used[id]) {
+            return id;
+        }
+    }
+    return -1;
+}
+
+bool appendParameterSets(const uint8_t* extradata, size_t size, const ParameterSets& extra,
+                         std::vector<uint8_t>& out) {
+    out.clear();
+    
+    if (!isAvcC(extradata, size)) {
+        static const uint8_t kStartCode[4] = {0, 0, 0, 1};
+        if (extradata) {
+            out.assign(extradata, extradata + size);
+        }
+        for (const auto* list : {&extra.sps, &extra.pps}) {
+            for (const auto& nal : *list) {
+                out.insert(out.end(), kStartCode, kStartCode + 4);
+                out.insert(out.end(), nal.begin(), nal.end());
+            }
+        }
+        return true;
+    }
+    
+    uint32_t sps_count = extradata[5] & 0x1F;
+    size_t sps_end = readAvcCList(extradata, size, kAvcCHeaderBytes, sps_count, nullptr);
+    if (sps_end == 0 || sps_end >= size) {
+        return false;
+    }
+    uint32_t pps_count = extradata[sps_end];
+    size_t pps_end = readAvcCList(extradata, size, sps_end + 1, pps_count, nullptr);
+    if (pps_end == 0 || sps_count + extra.sps.size() > 31 || pps_count + extra.pps.size() > 255) {
+        return false;
+    }
+    
+    // The list counts change; profile, level and any High profile trailer stay
+    out.assign(extradata, extradata + sps_end);
+    out[5] = static_cast<uint8_t>(0xE0 | (sps_count + extra.sps.size()));
+    writeAvcCList(extra.sps, out);
+    out.push_back(static_cast<uint8_t>(pps_count + extra.pps.size()));
+    out.insert(out.end(), extradata + sps_end + 1, extradata + pps_end);
+    writeAvcCList(extra.pps, out);
+    out.insert(out.end(), extradata + pps_end, extradata + size);
+    return true;
+}
+
+bool annexBToLengthPrefixed(const uint8_t* data, size_t size, uint32_t length_size,
+                            std::vector<uint8_t>& out) {
+    out.clear();
+    out.reserve(size);
+    
+    std::vector<NalRange> nals;
+    findNalUnits(data, size, nals);
+    for (const NalRange& nal : nals) {
+        size_t length = nal.end - nal.begin;
+        if (length_size < 4 && length >> (8 * length_size) != 0) {
+            return false;
+        }
+        for (uint32_t i = 0; i < length_size; ++i) {
+            out.push_back(static_cast<uint8_t>(length >> (8 * (length_size - 1 - i))));
+        }
+        out.insert(out.end(), data + nal.begin, data + nal.end);
+    }
+    return true;
+}
+
+} // namespace phantomframe
@@ -0,0 +1,99 @@
+#ifndef PHANTOMFRAME_H264_SPLICE_H
+#define PHANTOMFRAME_H264_SPLICE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "h264_bitstream.h"
+
+namespace phantomframe {
+
+/**
+ * @brief SPS and PPS NAL units of a stream, headers included, no start codes
+ */
+struct ParameterSets {
+    std::vector<std::vector<uint8_t>> sps;  // Sequence parameter sets
+    std::vector<std::vector<uint8_t>> pps;  // Picture parameter sets
+};
+
+/**
+ * @brief Get the NAL unit length field size of a stream's packets
+ * @param extradata Codec extradata, avcC or Annex B
+ * @param size Size of extradata in bytes
+ * @return 1, 2 or 4 for avcC (length-prefixed packets), 0 for Annex B
+ */
+uint32_t nalLengthSize(const uint8_t* extradata, size_t size);
+
+/**
+ * @brief Find the NAL units of a packet in either framing
+ * @param data Packet bytes
+ * @param size Size of data in bytes
+ * @param length_size NAL length field size, 0 for Annex B
+ * @param nals Output ranges in packet order, replaced
+ * @return false if a length field runs past the packet
+ */
+bool splitNalUnits(const uint8_t* data, size_t size, uint32_t length_size,
+                   std::vector<NalRange>& nals);
+
+/**
+ * @brief Whether a packet holds an IDR picture, i.e. starts a closed GOP
+ * @param data Packet bytes
+ * @param size Size of data in bytes
+ * @param length_size NAL length field size, 0 for Annex B
+ * @return true if the packet has a slice with nal_unit_type 5
+ */
+bool isIdrAccessUnit(const uint8_t* data, size_t size, uint32_t length_size);
+
+/**
+ * @brief Read the parameter sets stored in codec extradata
+ * @param extradata Codec extradata, avcC or Annex B
+ * @param size Size of extradata in bytes
+ * @param sets Output parameter sets, appended to
+ * @return false if avcC extradata is truncated
+ */
+bool readParameterSets(const uint8_t* extradata, size_t size, ParameterSets& sets);
+
+/**
+ * @brief Get the id an SPS or PPS is stored under
+ * @param nal SPS or PPS NAL unit, header included
+ * @param size Size of nal in bytes
+ * @return seq_parameter_set_id or pic_parameter_set_id, -1 if unreadable
+ */
+int parameterSetId(const uint8_t* nal, size_t size);
+
+/**
+ * @brief Find an id no SPS or PPS of a stream uses
+ *
+ * x264 stores its SPS and PPS under the same id, so the id must be free in
+ * both tables. The highest free id is returned because encoders number
+ * their parameter sets from 0.
+ * @param sets Parameter sets of the stream
+ * @return Free id in [0, 31], or -1 if there is none
+ */
+int unusedParameterSetId(const ParameterSets& sets);
+
+/**
+ * @brief Add parameter sets to codec extradata, keeping its format
+ * @param extradata Codec extradata, avcC or Annex B
+ * @param size Size of extradata in bytes
+ * @param extra Parameter sets to add after the existing ones
+ * @param out Output extradata, replaced
+ * @return false if avcC extradata is malformed or a list would overflow
+ */
+bool appendParameterSets(const uint8_t* extradata, size_t size, const ParameterSets& extra,
+                         std::vector<uint8_t>& out);
+
+/**
+ * @brief Convert an Annex B access unit to length-prefixed NAL units
+ * @param data Annex B bytes
+ * @param size Size of data in bytes
+ * @param length_size NAL length field size: 1, 2 or 4
+ * @param out Output bytes, replaced
+ * @return false if a NAL unit is too long for the length field
+ */
+bool annexBToLengthPrefixed(const uint8_t* data, size_t size, uint32_t length_size,
+                            std::vector<uint8_t>& out);
+
+} // namespace phantomframe
+
+#endif // PHANTOMFRAME_H264_SPLICE_H
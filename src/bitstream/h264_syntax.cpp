@@ -0,0 +1,371 @@
+#include "h264_syntax.h"
+#include <cmath>
+
+namespace phantomframe {
+
+namespace {
+
+constexpr uint32_t kMaxSpsCount = 32;
+constexpr uint32_t kMaxPpsCount = 256;
+
+bool isHighProfile(uint32_t profile_idc) {
+    switch (profile_idc) {
+    case 100: case 110: case 122: case 244: case 44:
+    case 83: case 86: case 118: case 128: case 138:
+    case 139: case 134: case 135:
+        return true;
+    default:
+        return false;
+    }
+}
+
+// Scaling matrices do not affect requantisation, so they are only skipped
+void skipScalingList(BitReader& reader, uint32_t size) {
+    int32_t last_scale = 8;
+    int32_t next_scale = 8;
+    for (uint32_t j = 0; j < size; ++j) {
+        if (next_scale != 0) {
+            int32_t delta = reader.readSE();
+            next_scale = (last_scale + delta + 256) % 256;
+        }
+        last_scale = next_scale == 0 ? last_scale : next_scale;
+    }
+}
+
+void skipRefPicListModification(BitReader& reader) {
+    if (!reader.readFlag()) {
+        return;
+    }
+    
+    uint32_t idc;
+    do {
+        idc = reader.readUE();
+        if (idc <= 2) {
+            reader.readUE();
+        }
+    } while (idc != 3 && !reader.overrun());
+}
+
+void skipPredWeightTable(BitReader& reader, const SequenceParameterSet& sps,
+                         const SliceHeader& header) {
+    uint32_t chroma_array_type = sps.separate_colour_plane ? 0 : sps.chroma_format_idc;
+    reader.readUE();
+    if (chroma_array_type != 0) {
+        reader.readUE();
+    }
+    
+    uint32_t lists = header.type == SliceType::B ? 2 : 1;
+    for (uint32_t list = 0; list < lists; ++list) {
+        uint32_t count = list == 0 ? header.num_ref_idx_l0 : header.num_ref_idx_l1;
+        for (uint32_t i = 0; i < count; ++i) {
+            if (reader.readFlag()) {
+                reader.readSE();
+                reader.readSE();
+            }
+            if (chroma_array_type != 0 && reader.readFlag()) {
+                for (int j = 0; j < 4; ++j) {
+                    reader.readSE();
+                }
+            }
+        }
+    }
+}
+
+} // namespace
+
+bool parseSps(BitReader& reader, SequenceParameterSet& sps, uint32_t& sps_id) {
+    sps = SequenceParameterSet{};
+    sps.profile_idc = reader.readBits(8);
+    reader.skipBits(16);  // constraint flags and level_idc
+    sps_id = reader.readUE();
+    if (sps_id >= kMaxSpsCount) {
+        return false;
+    }
+    
+    sps.chroma_format_idc = 1;
+    sps.bit_depth_luma = 8;
+    sps.bit_depth_chroma = 8;
+    sps.high_profile = isHighProfile(sps.profile_idc);
+    if (sps.high_profile) {
+        sps.chroma_format_idc = reader.readUE();
+        if (sps.chroma_format_idc > 3) {
+            return false;
+        }
+        if (sps.chroma_format_idc == 3) {
+            sps.separate_colour_plane = reader.readFlag();
+        }
+        sps.bit_depth_luma = reader.readUE() + 8;
+        sps.bit_depth_chroma = reader.readUE() + 8;
+        sps.transform_bypass = reader.readFlag();
+        if (reader.readFlag()) {
+            uint32_t lists = sps.chroma_format_idc != 3 ? 8 : 12;
+            for (uint32_t i = 0; i < lists; ++i) {
+                if (reader.readFlag()) {
+                    skipScalingList(reader, i < 6 ? 16 : 64);
+                }
+            }
+        }
+    }
+    
+    sps.log2_max_frame_num = reader.readUE() + 4;
+    sps.pic_order_cnt_type = reader.readUE();
+    if (sps.log2_max_frame_num > 16 || sps.pic_order_cnt_type > 2) {
+        return false;
+    }
+    if (sps.pic_order_cnt_type == 0) {
+        sps.log2_max_poc_lsb = reader.readUE() + 4;
+        if (sps.log2_max_poc_lsb > 16) {
+            return false;
+        }
+    } else if (sps.pic_order_cnt_type == 1) {
+        sps.delta_pic_order_always_zero = reader.readFlag();
+        reader.readSE();
+        reader.readSE();
+        uint32_t cycle = reader.readUE();
+        if (cycle > 255) {
+            return false;
+        }
+        for (uint32_t i = 0; i < cycle; ++i) {
+            reader.readSE();
+        }
+    }
+    
+    reader.readUE();  // max_num_ref_frames
+    reader.readFlag();  // gaps_in_frame_num_value_allowed_flag
+    sps.width_mbs = reader.readUE() + 1;
+    sps.height_map_units = reader.readUE() + 1;
+    sps.frame_mbs_only = reader.readFlag();
+    if (!sps.frame_mbs_only) {
+        reader.readFlag();  // mb_adaptive_frame_field_flag
+    }
+    sps.direct_8x8_inference = reader.readFlag();
+    
+    uint32_t height_mbs = sps.height_map_units * (sps.frame_mbs_only ? 1 : 2);
+    sps.width = sps.width_mbs * 16;
+    sps.height = height_mbs * 16;
+    if (reader.readFlag()) {
+        uint32_t left = reader.readUE();
+        uint32_t right = reader.readUE();
+        uint32_t top = reader.readUE();
+        uint32_t bottom = reader.readUE();
+        
+        uint32_t chroma_array_type = sps.separate_colour_plane ? 0 : sps.chroma_format_idc;
+        uint32_t unit_x = chroma_array_type == 1 || chroma_array_type == 2 ? 2 : 1;
+        uint32_t unit_y = (chroma_array_type == 1 ? 2 : 1) * (sps.frame_mbs_only ? 1 : 2);
+        uint32_t crop_x = (left + right) * unit_x;
+        uint32_t crop_y = (top + bottom) * unit_y;
+        if (crop_x >= sps.width || crop_y >= sps.height) {
+            return false;
+        }
+        sps.width -= crop_x;
+        sps.height -= crop_y;
+    }
+    
+    // VUI parameters follow and are not needed
+    sps.valid = !reader.overrun();
+    return sps.valid;
+}
+
+bool parsePps(BitReader& reader, const SequenceParameterSet* sps_table,
+              PictureParameterSet& pps, uint32_t& pps_id) {
+    pps = PictureParameterSet{};
+    pps_id = reader.readUE();
+    pps.sps_id = reader.readUE();
+    if (pps_id >= kMaxPpsCount || pps.sps_id >= kMaxSpsCount || !sps_table[pps.sps_id].valid) {
+        return false;
+    }
+    const SequenceParameterSet& sps = sps_table[pps.sps_id];
+    
+    pps.cabac = reader.readFlag();
+    pps.bottom_field_pic_order_present = reader.readFlag();
+    pps.num_slice_groups = reader.readUE() + 1;
+    if (pps.num_slice_groups > 8) {
+        return false;
+    }
+    if (pps.num_slice_groups > 1) {
+        pps.slice_group_map_type = reader.readUE();
+        if (pps.slice_group_map_type == 0) {
+            for (uint32_t i = 0; i < pps.num_slice_groups; ++i) {
+                reader.readUE();
+            }
+        } else if (pps.slice_group_map_type == 2) {
+            for (uint32_t i = 0; i + 1 < pps.num_slice_groups; ++i) {
+                reader.readUE();
+                reader.readUE();
+            }
+        } else if (pps.slice_group_map_type >= 3 && pps.slice_group_map_type <= 5) {
+            reader.readFlag();
+            pps.slice_group_change_rate = reader.readUE() + 1;
+        } else if (pps.slice_group_map_type == 6) {
+            uint32_t units = reader.readUE() + 1;
+            uint32_t bits = 0;
+            while ((1u << bits) < pps.num_slice_groups) {
+                bits++;
+            }
+            reader.skipBits(static_cast<size_t>(units) * bits);
+        }
+    }
+    
+    pps.num_ref_idx_l0_default = reader.readUE() + 1;
+    pps.num_ref_idx_l1_default = reader.readUE() + 1;
+    pps.weighted_pred = reader.readFlag();
+    pps.weighted_bipred_idc = reader.readBits(2);
+    pps.pic_init_qp = 26 + reader.readSE();
+    reader.readSE();  // pic_init_qs_minus26
+    pps.chroma_qp_index_offset = reader.readSE();
+    pps.second_chroma_qp_index_offset = pps.chroma_qp_index_offset;
+    pps.deblocking_filter_control_present = reader.readFlag();
+    pps.constrained_intra_pred = reader.readFlag();
+    pps.redundant_pic_cnt_present = reader.readFlag();
+    
+    if (reader.moreRbspData()) {
+        pps.transform_8x8_mode = reader.readFlag();
+        if (reader.readFlag()) {
+            uint32_t lists = 6 + (pps.transform_8x8_mode ? (sps.chroma_format_idc != 3 ? 2 : 6) : 0);
+            for (uint32_t i = 0; i < lists; ++i) {
+                if (reader.readFlag()) {
+                    skipScalingList(reader, i < 6 ? 16 : 64);
+                }
+            }
+        }
+        pps.second_chroma_qp_index_offset = reader.readSE();
+    }
+    
+    pps.valid = !reader.overrun() && pps.num_ref_idx_l0_default <= 32 &&
+                pps.num_ref_idx_l1_default <= 32;
+    return pps.valid;
+}
+
+bool parseSliceHeader(BitReader& reader, uint32_t nal_type, uint32_t nal_ref_idc,
+                      const SequenceParameterSet* sps_table,
+                      const PictureParameterSet* pps_table,
+                      SliceHeader& header) {
+    header = SliceHeader{};
+    header.first_mb = reader.readUE();
+    uint32_t slice_type = reader.readUE();
+    header.pps_id = reader.readUE();
+    if (slice_type > 9 || header.pps_id >= kMaxPpsCount || !pps_table[header.pps_id].valid) {
+        return false;
+    }
+    header.type = static_cast<SliceType>(slice_type % 5);
+    
+    const PictureParameterSet& pps = pps_table[header.pps_id];
+    const SequenceParameterSet& sps = sps_table[pps.sps_id];
+    if (!sps.valid) {
+        return false;
+    }
+    
+    bool idr = nal_type == static_cast<uint32_t>(NalType::SliceIdr);
+    if (sps.separate_colour_plane) {
+        reader.skipBits(2);
+    }
+    header.frame_num = reader.readBits(sps.log2_max_frame_num);
+    if (!sps.frame_mbs_only) {
+        header.field_pic = reader.readFlag();
+        if (header.field_pic) {
+            reader.readFlag();
+        }
+    }
+    if (idr) {
+        reader.readUE();  // idr_pic_id
+    }
+    if (sps.pic_order_cnt_type == 0) {
+        header.poc_lsb = reader.readBits(sps.log2_max_poc_lsb);
+        if (pps.bottom_field_pic_order_present && !header.field_pic) {
+            header.delta_poc_bottom = reader.readSE();
+        }
+    }
+    if (sps.pic_order_cnt_type == 1 && !sps.delta_pic_order_always_zero) {
+        reader.readSE();
+        if (pps.bottom_field_pic_order_present && !header.field_pic) {
+            reader.readSE();
+        }
+    }
+    if (pps.redundant_pic_cnt_present) {
+        reader.readUE();
+    }
+    
+    bool is_b = header.type == SliceType::B;
+    bool is_p = header.type == SliceType::P || header.type == SliceType::SP;
+    if (is_b) {
+        header.direct_spatial_mv_pred = reader.readFlag();
+    }
+    if (is_p || is_b) {
+        header.num_ref_idx_l0 = pps.num_ref_idx_l0_default;
+        header.num_ref_idx_l1 = is_b ? pps.num_ref_idx_l1_default : 0;
+        if (reader.readFlag()) {
+            header.num_ref_idx_l0 = reader.readUE() + 1;
+            if (is_b) {
+                header.num_ref_idx_l1 = reader.readUE() + 1;
+            }
+        }
+        if (header.num_ref_idx_l0 > 32 || header.num_ref_idx_l1 > 32) {
+            return false;
+        }
+    }
+    
+    if (header.type != SliceType::I && header.type != SliceType::SI) {
+        skipRefPicListModification(reader);
+        if (is_b) {
+            skipRefPicListModification(reader);
+        }
+    }
+    
+    if ((pps.weighted_pred && is_p) || (pps.weighted_bipred_idc == 1 && is_b)) {
+        skipPredWeightTable(reader, sps, header);
+    }
+    
+    if (nal_ref_idc != 0) {
+        if (idr) {
+            reader.skipBits(2);
+        } else if (reader.readFlag()) {
+            uint32_t operation;
+            do {
+                operation = reader.readUE();
+                if (operation == 1 || operation == 3) {
+                    reader.readUE();
+                }
+                if (operation == 2) {
+                    reader.readUE();
+                }
+                if (operation == 3 || operation == 6) {
+                    reader.readUE();
+                }
+                if (operation == 4) {
+                    reader.readUE();
+                }
+                if (operation == 5) {
+                    header.memory_management_5 = true;
+                }
+            } while (operation != 0 && !reader.overrun());
+        }
+    }
+    
+    if (pps.cabac && header.type != SliceType::I && header.type != SliceType::SI) {
+        reader.readUE();  // cabac_init_idc
+    }
+    header.slice_qp = pps.pic_init_qp + reader.readSE();
+    if (header.type == SliceType::SP || header.type == SliceType::SI) {
+        if (header.type == SliceType::SP) {
+            reader.readFlag();
+        }
+        reader.readSE();
+    }
+    if (pps.deblocking_filter_control_present) {
+        if (reader.readUE() != 1) {
+            reader.readSE();
+            reader.readSE();
+        }
+    }
+    if (pps.num_slice_groups > 1 && pps.slice_group_map_type >= 3 && pps.slice_group_map_type <= 5) {
+        double units = static_cast<double>(sps.width_mbs) * sps.height_map_units;
+        uint32_t bits = static_cast<uint32_t>(
+            std::ceil(std::log2(units / pps.slice_group_change_rate + 1.0)));
+        reader.skipBits(bits);
+    }
+    
+    header.data_bit = reader.position();
+    return !reader.overrun() && header.slice_qp >= 0 && header.slice_qp <= 51;
+}
+
+} // namespace phantomframe
@@ -0,0 +1,134 @@
+#ifndef PHANTOMFRAME_H264_SYNTAX_H
+#define PHANTOMFRAME_H264_SYNTAX_H
+
+#include <cstdint>
+#include "h264_bitstream.h"
+
+namespace phantomframe {
+
+/**
+ * @brief H.264 NAL unit types handled by the rewriter
+ */
+enum class NalType : uint8_t {
+    Slice = 1,                  // Coded slice of a non-IDR picture
+    SliceIdr = 5,               // Coded slice of an IDR picture
+    Sps = 7,                    // Sequence parameter set
+    Pps = 8                     // Picture parameter set
+};
+
+/**
+ * @brief Slice types, slice_type % 5
+ */
+enum class SliceType : uint8_t {
+    P = 0,
+    B = 1,
+    I = 2,
+    SP = 3,
+    SI = 4
+};
+
+/**
+ * @brief Sequence parameter set fields needed to parse slices
+ */
+struct SequenceParameterSet {
+    bool valid;
+    uint32_t profile_idc;
+    bool high_profile;                  // Profile allowing level_prefix above 15
+    uint32_t chroma_format_idc;
+    bool separate_colour_plane;
+    uint32_t bit_depth_luma;
+    uint32_t bit_depth_chroma;
+    bool transform_bypass;              // qpprime_y_zero_transform_bypass_flag
+    uint32_t log2_max_frame_num;
+    uint32_t pic_order_cnt_type;
+    uint32_t log2_max_poc_lsb;
+    bool delta_pic_order_always_zero;
+    uint32_t width_mbs;
+    uint32_t height_map_units;
+    bool frame_mbs_only;
+    bool direct_8x8_inference;
+    uint32_t width;                     // Cropped luma width in pixels
+    uint32_t height;                    // Cropped luma height in pixels
+};
+
+/**
+ * @brief Picture parameter set fields needed to parse slices
+ */
+struct PictureParameterSet {
+    bool valid;
+    uint32_t sps_id;
+    bool cabac;                         // entropy_coding_mode_flag
+    bool bottom_field_pic_order_present;
+    uint32_t num_slice_groups;
+    uint32_t slice_group_map_type;
+    uint32_t slice_group_change_rate;
+    uint32_t num_ref_idx_l0_default;    // num_ref_idx_l0_default_active_minus1 + 1
+    uint32_t num_ref_idx_l1_default;
+    bool weighted_pred;
+    uint32_t weighted_bipred_idc;
+    int32_t pic_init_qp;
+    int32_t chroma_qp_index_offset;
+    int32_t second_chroma_qp_index_offset;
+    bool deblocking_filter_control_present;
+    bool constrained_intra_pred;
+    bool redundant_pic_cnt_present;
+    bool transform_8x8_mode;
+};
+
+/**
+ * @brief Slice header fields used by the rewriter
+ */
+struct SliceHeader {
+    uint32_t first_mb;
+    SliceType type;
+    uint32_t pps_id;
+    uint32_t frame_num;
+    bool field_pic;
+    uint32_t poc_lsb;
+    int32_t delta_poc_bottom;
+    bool direct_spatial_mv_pred;
+    uint32_t num_ref_idx_l0;            // Active references in list 0
+    uint32_t num_ref_idx_l1;            // Active references in list 1
+    bool memory_management_5;           // Marking resets frame_num and POC
+    int32_t slice_qp;                   // SliceQP_Y
+    size_t data_bit;                    // First bit of slice_data() in the RBSP
+};
+
+/**
+ * @brief Parse a sequence parameter set RBSP
+ * @param reader Reader positioned after the NAL unit header
+ * @param sps Output fields
+ * @param sps_id Output seq_parameter_set_id
+ * @return true if the SPS was parsed
+ */
+bool parseSps(BitReader& reader, SequenceParameterSet& sps, uint32_t& sps_id);
+
+/**
+ * @brief Parse a picture parameter set RBSP
+ * @param reader Reader positioned after the NAL unit header
+ * @param sps_table The 32 sequence parameter sets by id
+ * @param pps Output fields
+ * @param pps_id Output pic_parameter_set_id
+ * @return true if the PPS was parsed and refers to a known SPS
+ */
+bool parsePps(BitReader& reader, const SequenceParameterSet* sps_table,
+              PictureParameterSet& pps, uint32_t& pps_id);
+
+/**
+ * @brief Parse a slice header
+ * @param reader Reader positioned after the NAL unit header
+ * @param nal_type nal_unit_type of the slice
+ * @param nal_ref_idc nal_ref_idc of the slice
+ * @param sps_table The 32 sequence parameter sets by id
+ * @param pps_table The 256 picture parameter sets by id
+ * @param header Output fields
+ * @return true if the header was parsed and its parameter sets are known
+ */
+bool parseSliceHeader(BitReader& reader, uint32_t nal_type, uint32_t nal_ref_idc,
+                      const SequenceParameterSet* sps_table,
+                      const PictureParameterSet* pps_table,
+                      SliceHeader& header);
+
+} // namespace phantomframe
+
+#endif // PHANTOMFRAME_H264_SYNTAX_H
@@ -0,0 +1,165 @@
+#ifndef PHANTOMFRAME_H
+#define PHANTOMFRAME_H
+
+/*
+ * C interface to the watermark encoder for C encoder hosts (VLC,
+ * GStreamer, OBS), exported by libphantomframe.so.
+ *
+ * All memory is allocated by phantomframe_create(). The per-frame call
+ * writes into a caller-provided x264 quant_offsets buffer and allocates
+ * nothing, so it can run on the host's encode thread.
+ *
+ * Every piece of mutable state lives in the handle; there is no global
+ * state and nothing to set up or clean up per process. Separate handles may
+ * be driven from separate threads at the same time without sharing a lock;
+ * one handle must only be driven from one thread at a time.
+ *
+ * The library never writes to stdout, which the host may be using for its
+ * own output; failures are reported through return values.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#if defined(__GNUC__)
+#define PHANTOMFRAME_API __attribute__((visibility("default")))
+#else
+#define PHANTOMFRAME_API
+#endif
+
+/* Error codes returned by the functions below */
+#define PHANTOMFRAME_OK              0
+#define PHANTOMFRAME_ERROR_INVALID  (-1)  /* Null handle or invalid argument */
+#define PHANTOMFRAME_ERROR_BUFFER   (-2)  /* Offset buffer too small */
+
+/* Picture types for phantomframe_set_frame_type(), as in x264's i_type */
+#define PHANTOMFRAME_FRAME_UNKNOWN   0
+#define PHANTOMFRAME_FRAME_I         1
+#define PHANTOMFRAME_FRAME_P         2
+#define PHANTOMFRAME_FRAME_B         3
+
+typedef struct phantomframe_handle phantomframe_handle;
+
+/**
+ * @brief Stream parameters, fixed for the lifetime of a handle
+ */
+typedef struct phantomframe_config {
+    const char* payload_hex;    /* 128-bit payload, up to 32 hexadecimal digits */
+    uint32_t seed;              /* Block selection seed */
+    float block_density;        /* Fraction of blocks to modify */
+    uint32_t temporal_period;   /* Frames between pattern repetition */
+    int adaptive_embedding;     /* Non-zero to move deltas toward texture (needs luma) */
+    float quality_threshold;    /* Adaptive search strength (0-1) */
+    uint32_t frame_budget_us;   /* Embedding deadline per frame in microseconds, 0 for none */
+    uint32_t width;             /* Frame width in pixels */
+    uint32_t height;            /* Frame height in pixels */
+    float fps;                  /* Frames per second */
+    float scene_cut_threshold;  /* Mean luma change (0-255) that restarts the pattern, 0 for none (needs luma) */
+    uint32_t window_frames;     /* Any run of this many frames carries the whole payload, 0 for no guarantee */
+    uint32_t window_repeats;    /* Times each payload bit is carried in such a run */
+    float pilot_density;        /* Fraction of pilot cells carrying the sync pilot, 0 for none */
+} phantomframe_config;
+
+/**
+ * @brief Counters read by phantomframe_get_stats()
+ */
+typedef struct phantomframe_stats {
+    uint32_t frames_processed;  /* Frames passed to phantomframe_apply_watermark() */
+    uint32_t blocks_modified;   /* Blocks carrying a QP delta */
+    uint32_t analysis_skipped;  /* Frames embedded without adaptive analysis */
+    uint32_t maps_reused;       /* Frames that kept the previous map */
+    uint32_t density_reduced;   /* Frames embedded with fewer blocks */
+    uint32_t deadline_misses;   /* Frames whose embedding overran the deadline */
+} phantomframe_stats;
+
+/**
+ * @brief Fill a config with defaults (0.8% density, 30 frame period, no deadline)
+ * @param config Config to fill; stream fields are zeroed
+ */
+PHANTOMFRAME_API void phantomframe_config_init(phantomframe_config* config);
+
+/**
+ * @brief Create a watermark encoder for one stream
+ * @param config Stream parameters
+ * @return Handle, or NULL on invalid parameters or allocation failure
+ */
+PHANTOMFRAME_API phantomframe_handle* phantomframe_create(const phantomframe_config* config);
+
+/**
+ * @brief Size of the offset buffer phantomframe_apply_watermark() writes
+ * @param handle Handle
+ * @param mb_width Receives macroblocks per row (may be NULL)
+ * @param mb_height Receives macroblock rows (may be NULL)
+ * @return Number of floats, ((width + 15) / 16) * ((height + 15) / 16), or 0
+ */
+PHANTOMFRAME_API size_t phantomframe_offset_count(const phantomframe_handle* handle,
+                                                  uint32_t* mb_width, uint32_t* mb_height);
+
+/**
+ * @brief Report a frame's picture type before it is watermarked
+ *
+ * Optional; must precede phantomframe_apply_watermark() for the frame,
+ * with frames in display order. A non-reference frame gets an all-zero
+ * map and its blocks are carried by the next reference frame, so a GOP
+ * keeps its block budget on frames whose deltas survive re-encoding.
+ *
+ * Only useful to a host that knows the type before it builds the map,
+ * such as a bitstream rewriter. x264 picks slice types in its lookahead,
+ * after x264_encoder_encode() has taken the frame and its quant_offsets,
+ * so a host feeding x264 with X264_TYPE_AUTO cannot call this. Forcing
+ * types through x264_picture_t.i_type would make them known, but an
+ * extractor that is not given the same types, such as analyzeVideo(),
+ * then looks for marks on frames that carry none. The x264 hosts in this
+ * tree leave it uncalled and mark every frame.
+ * @param handle Handle
+ * @param frame_index Index of the frame in the stream
+ * @param frame_type One of the PHANTOMFRAME_FRAME_* values
+ * @param is_reference Non-zero if later pictures predict from this one
+ * @return PHANTOMFRAME_OK or a negative error code
+ */
+PHANTOMFRAME_API int phantomframe_set_frame_type(phantomframe_handle* handle, uint32_t frame_index,
+                                                 int frame_type, int is_reference);
+
+/**
+ * @brief Write one frame's watermark as x264 quant_offsets
+ *
+ * Overwrites the buffer with one QP offset per 16x16 macroblock in raster
+ * order, ready for x264_picture_t.prop.quant_offsets. When the frame
+ * deadline calls for reusing the previous map the buffer is left as it
+ * is, so hosts should pass the same buffer every frame. Performs no heap
+ * allocation.
+ * @param handle Handle
+ * @param frame_index Index of the frame in the stream
+ * @param luma Luma plane of the frame for adaptive embedding and scene cuts, or NULL
+ * @param luma_stride Bytes between the starts of two luma rows
+ * @param quant_offsets Buffer of at least phantomframe_offset_count() floats
+ * @param offset_count Capacity of quant_offsets in floats
+ * @return Number of macroblocks given a QP delta, or a negative error code
+ */
+PHANTOMFRAME_API int phantomframe_apply_watermark(phantomframe_handle* handle, uint32_t frame_index,
+                                                  const uint8_t* luma, size_t luma_stride,
+                                                  float* quant_offsets, size_t offset_count);
+
+/**
+ * @brief Read the handle's counters; safe from any thread
+ * @param handle Handle
+ * @param stats Receives the counters
+ * @return PHANTOMFRAME_OK or a negative error code
+ */
+PHANTOMFRAME_API int phantomframe_get_stats(const phantomframe_handle* handle,
+                                            phantomframe_stats* stats);
+
+/**
+ * @brief Destroy a handle; NULL is ignored
+ */
+PHANTOMFRAME_API void phantomframe_destroy(phantomframe_handle* handle);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* PHANTOMFRAME_H */
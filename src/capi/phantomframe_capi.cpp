@@ -0,0 +1,141 @@
+#include "phantomframe.h"
+#include "encoder/watermark_encoder.h"
+#include "common/utils.h"
+
+struct phantomframe_handle {
+    phantomframe::WatermarkEncoder encoder;
+    uint32_t width, height;
+    uint32_t mb_width, mb_height;
+
+    explicit phantomframe_handle(const phantomframe::WatermarkConfig& config)
+        : encoder(config), width(0), height(0), mb_width(0), mb_height(0) {}
+};
+
+extern "C" void phantomframe_config_init(phantomframe_config* config) {
+    if (!config) {
+        return;
+    }
+
+    config->payload_hex = nullptr;
+    config->seed = 0;
+    config->block_density = 0.008f;
+    config->temporal_period = 30;
+    config->adaptive_embedding = 0;
+    config->quality_threshold = 0.0f;
+    config->frame_budget_us = 0;
+    config->width = 0;
+    config->height = 0;
+    config->fps = 0.0f;
+    config->scene_cut_threshold = 0.0f;
+    config->window_frames = 0;
+    config->window_repeats = 1;
+    config->pilot_density = 0.0f;
+}
+
+extern "C" phantomframe_handle* phantomframe_create(const phantomframe_config* config) {
+    if (!config) {
+        return nullptr;
+    }
+
+    // Everything the per-frame path touches is sized here
+    try {
+        phantomframe::WatermarkConfig watermark;
+        watermark.payload = config->payload_hex ?
+            phantomframe::utils::hexToPayload(config->payload_hex) : phantomframe::Payload();
+        watermark.seed = config->seed;
+        watermark.block_density = config->block_density;
+        watermark.temporal_period = config->temporal_period;
+        watermark.adaptive_embedding = config->adaptive_embedding != 0;
+        watermark.quality_threshold = config->quality_threshold;
+        watermark.frame_budget_us = config->frame_budget_us;
+        watermark.scene_cut_threshold = config->scene_cut_threshold;
+        watermark.window_frames = config->window_frames;
+        watermark.window_repeats = config->window_repeats;
+        watermark.pilot_density = config->pilot_density;
+        watermark.marked_period_interval = 1;
+        watermark.enable_encryption = false;
+
+        auto* handle = new phantomframe_handle(watermark);
+        if (!handle->encoder.initialize(config->width, config->height, config->fps)) {
+            delete handle;
+            return nullptr;
+        }
+
+        handle->width = config->width;
+        handle->height = config->height;
+        handle->mb_width = (config->width + 15) / 16;
+        handle->mb_height = (config->height + 15) / 16;
+        return handle;
+    } catch (...) {
+        return nullptr;
+    }
+}
+
+extern "C" size_t phantomframe_offset_count(const phantomframe_handle* handle,
+                                            uint32_t* mb_width, uint32_t* mb_height) {
+    if (!handle) {
+        return 0;
+    }
+
+    if (mb_width) {
+        *mb_width = handle->mb_width;
+    }
+    if (mb_height) {
+        *mb_height = handle->mb_height;
+    }
+    return static_cast<size_t>(handle->mb_width) * handle->mb_height;
+}
+
+extern "C" int phantomframe_set_frame_type(phantomframe_handle* handle, uint32_t frame_index,
+                                          int frame_type, int is_reference) {
+    if (!handle || frame_type < PHANTOMFRAME_FRAME_UNKNOWN || frame_type > PHANTOMFRAME_FRAME_B) {
+        return PHANTOMFRAME_ERROR_INVALID;
+    }
+
+    // The C values follow the FrameType order
+    phantomframe::FrameInfo info{static_cast<phantomframe::FrameType>(frame_type), is_reference != 0};
+    handle->encoder.beginFrame(frame_index, info);
+    return PHANTOMFRAME_OK;
+}
+
+extern "C" int phantomframe_apply_watermark(phantomframe_handle* handle, uint32_t frame_index,
+                                            const uint8_t* luma, size_t luma_stride,
+                                            float* quant_offsets, size_t offset_count) {
+    if (!handle || !quant_offsets) {
+        return PHANTOMFRAME_ERROR_INVALID;
+    }
+    if (offset_count < static_cast<size_t>(handle->mb_width) * handle->mb_height) {
+        return PHANTOMFRAME_ERROR_BUFFER;
+    }
+
+    // Analysis only reads the plane; the view is non-const for the C++ API
+    if (luma && handle->encoder.needsAnalysis()) {
+        phantomframe::FrameView view{const_cast<uint8_t*>(luma), luma_stride,
+                                     handle->width, handle->height,
+                                     phantomframe::PlaneLayout::Planar, 1};
+        handle->encoder.analyzeFrame(view, frame_index);
+    }
+
+    phantomframe::QuantOffsetPlane plane{quant_offsets, handle->mb_width, handle->mb_height};
+    return static_cast<int>(handle->encoder.renderQuantOffsets(frame_index, plane));
+}
+
+extern "C" int phantomframe_get_stats(const phantomframe_handle* handle, phantomframe_stats* stats) {
+    if (!handle || !stats) {
+        return PHANTOMFRAME_ERROR_INVALID;
+    }
+
+    phantomframe::DeadlineStats deadline = handle->encoder.getDeadlineStats();
+    stats->frames_processed = handle->encoder.getFramesProcessed();
+    stats->blocks_modified = handle->encoder.getBlocksModified();
+    stats->analysis_skipped = deadline.analysis_skipped;
+    stats->maps_reused = deadline.maps_reused;
+    stats->density_reduced = deadline.density_reduced;
+    stats->deadline_misses = deadline.deadline_misses;
+
+    return PHANTOMFRAME_OK;
+}
+
+extern "C" void phantomframe_destroy(phantomframe_handle* handle) {
+    delete handle;
+}
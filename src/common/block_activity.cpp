@@ -0,0 +1,191 @@
+#include "block_activity.h"
+#include <algorithm>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define PHANTOMFRAME_X86 1
+#endif
+
+namespace phantomframe {
+
+namespace {
+
+inline uint32_t activityFromSums(uint32_t sum, uint32_t sum_sq) {
+    return 64 * sum_sq - sum * sum;
+}
+
+/**
+ * @brief Activity of the full blocks [first_block, last_block) of one block row
+ */
+void activityRowScalar(const uint8_t* row, size_t stride,
+                       uint32_t first_block, uint32_t last_block, uint32_t* out) {
+    for (uint32_t bx = first_block; bx < last_block; ++bx) {
+        uint32_t sum = 0;
+        uint32_t sum_sq = 0;
+        for (uint32_t y = 0; y < 8; ++y) {
+            const uint8_t* p = row + y * stride + bx * 8;
+            for (uint32_t x = 0; x < 8; ++x) {
+                sum += p[x];
+                sum_sq += p[x] * p[x];
+            }
+        }
+        out[bx] = activityFromSums(sum, sum_sq);
+    }
+}
+
+#ifdef PHANTOMFRAME_X86
+
+/**
+ * @brief Two blocks per 16-byte load; psadbw yields the sum of each half
+ */
+__attribute__((target("sse2")))
+uint32_t activityRowSSE2(const uint8_t* row, size_t stride, uint32_t full_blocks, uint32_t* out) {
+    const __m128i zero = _mm_setzero_si128();
+    uint32_t bx = 0;
+    
+    for (; bx + 2 <= full_blocks; bx += 2) {
+        __m128i sum = zero;
+        __m128i sq_lo = zero;
+        __m128i sq_hi = zero;
+        
+        for (uint32_t y = 0; y < 8; ++y) {
+            __m128i p = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row + y * stride + bx * 8));
+            sum = _mm_add_epi64(sum, _mm_sad_epu8(p, zero));
+            
+            __m128i lo = _mm_unpacklo_epi8(p, zero);
+            __m128i hi = _mm_unpackhi_epi8(p, zero);
+            sq_lo = _mm_add_epi32(sq_lo, _mm_madd_epi16(lo, lo));
+            sq_hi = _mm_add_epi32(sq_hi, _mm_madd_epi16(hi, hi));
+        }
+        
+        // Horizontal sums of the four squared partials of each block
+        sq_lo = _mm_add_epi32(sq_lo, _mm_shuffle_epi32(sq_lo, _MM_SHUFFLE(1, 0, 3, 2)));
+        sq_lo = _mm_add_epi32(sq_lo, _mm_shuffle_epi32(sq_lo, _MM_SHUFFLE(2, 3, 0, 1)));
+        sq_hi = _mm_add_epi32(sq_hi, _mm_shuffle_epi32(sq_hi, _MM_SHUFFLE(1, 0, 3, 2)));
+        sq_hi = _mm_add_epi32(sq_hi, _mm_shuffle_epi32(sq_hi, _MM_SHUFFLE(2, 3, 0, 1)));
+        
+        out[bx] = activityFromSums(static_cast<uint32_t>(_mm_cvtsi128_si32(sum)),
+                                   static_cast<uint32_t>(_mm_cvtsi128_si32(sq_lo)));
+        out[bx + 1] = activityFromSums(static_cast<uint32_t>(_mm_cvtsi128_si32(_mm_srli_si128(sum, 8))),
+                                       static_cast<uint32_t>(_mm_cvtsi128_si32(sq_hi)));
+    }
+    
+    return bx;
+}
+
+/**
+ * @brief Four blocks per 32-byte load
+ *
+ * Byte unpacks work within 128-bit lanes, so the low unpack holds blocks
+ * 0 and 2 and the high unpack blocks 1 and 3.
+ */
+__attribute__((target("avx2")))
+uint32_t activityRowAVX2(const uint8_t* row, size_t stride, uint32_t full_blocks, uint32_t* out) {
+    const __m256i zero = _mm256_setzero_si256();
+    uint32_t bx = 0;
+    
+    for (; bx + 4 <= full_blocks; bx += 4) {
+        __m256i sum = zero;
+        __m256i sq_lo = zero;
+        __m256i sq_hi = zero;
+        
+        for (uint32_t y = 0; y < 8; ++y) {
+            __m256i p = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(row + y * stride + bx * 8));
+            sum = _mm256_add_epi64(sum, _mm256_sad_epu8(p, zero));
+            
+            __m256i lo = _mm256_unpacklo_epi8(p, zero);
+            __m256i hi = _mm256_unpackhi_epi8(p, zero);
+            sq_lo = _mm256_add_epi32(sq_lo, _mm256_madd_epi16(lo, lo));
+            sq_hi = _mm256_add_epi32(sq_hi, _mm256_madd_epi16(hi, hi));
+        }
+        
+        // Per lane: [b0 b0 b1 b1] then [b0 b1 b0 b1] (lane 1 holds b2, b3)
+        __m256i sq = _mm256_hadd_epi32(sq_lo, sq_hi);
+        sq = _mm256_hadd_epi32(sq, sq);
+        
+        alignas(32) uint64_t sums[4];
+        alignas(32) uint32_t sq_sums[8];
+        _mm256_store_si256(reinterpret_cast<__m256i*>(sums), sum);
+        _mm256_store_si256(reinterpret_cast<__m256i*>(sq_sums), sq);
+        
+        out[bx] = activityFromSums(static_cast<uint32_t>(sums[0]), sq_sums[0]);
+        out[bx + 1] = activityFromSums(static_cast<uint32_t>(sums[1]), sq_sums[1]);
+        out[bx + 2] = activityFromSums(static_cast<uint32_t>(sums[2]), sq_sums[4]);
+        out[bx + 3] = activityFromSums(static_cast<uint32_t>(sums[3]), sq_sums[5]);
+    }
+    
+    return bx;
+}
+
+#endif // PHANTOMFRAME_X86
+
+} // namespace
+
+void computeBlockActivity(const uint8_t* luma, size_t stride,
+                          uint32_t width, uint32_t height,
+                          uint32_t* activity, SimdLevel level) {
+    if (!luma || !activity) {
+        return;
+    }
+    
+    uint32_t blocks_x = (width + 7) / 8;
+    uint32_t blocks_y = (height + 7) / 8;
+    uint32_t full_x = width / 8;
+    uint32_t full_y = height / 8;
+    
+    for (uint32_t by = 0; by < blocks_y; ++by) {
+        uint32_t* out = activity + static_cast<size_t>(by) * blocks_x;
+        std::fill(out + full_x, out + blocks_x, 0u);
+        
+        if (by >= full_y) {
+            std::fill(out, out + full_x, 0u);
+            continue;
+        }
+        
+        const uint8_t* row = luma + static_cast<size_t>(by) * 8 * stride;
+        uint32_t done = 0;
+        
+#ifdef PHANTOMFRAME_X86
+        if (level == SimdLevel::AVX2) {
+            done = activityRowAVX2(row, stride, full_x, out);
+        }
+        if (level >= SimdLevel::SSE2) {
+            done += activityRowSSE2(row + done * 8, stride, full_x - done, out + done);
+        }
+#endif
+        
+        activityRowScalar(row, stride, done, full_x, out);
+    }
+}
+
+int adaptiveSearchRadius(float quality_threshold) {
+    // Widest move, reached at quality_threshold = 1
+    constexpr int kMaxSearchRadius = 2;
+    
+    float strength = std::max(0.0f, std::min(1.0f, quality_threshold));
+    return static_cast<int>(strength * kMaxSearchRadius + 0.5f);
+}
+
+uint32_t mostTexturedBlock(const uint32_t* activity_row, uint32_t width, uint32_t x, int radius) {
+    uint32_t best_x = x;
+    uint32_t best_activity = activity_row[x / 8];
+    
+    for (int step = 1; step <= radius; ++step) {
+        for (int sign = -1; sign <= 1; sign += 2) {
+            int64_t candidate = static_cast<int64_t>(x) + sign * step * 16;
+            if (candidate < 0 || candidate >= static_cast<int64_t>(width)) {
+                continue;
+            }
+            
+            uint32_t activity = activity_row[candidate / 8];
+            if (activity > best_activity) {
+                best_activity = activity;
+                best_x = static_cast<uint32_t>(candidate);
+            }
+        }
+    }
+    
+    return best_x;
+}
+
+} // namespace phantomframe
@@ -0,0 +1,52 @@
+#ifndef PHANTOMFRAME_BLOCK_ACTIVITY_H
+#define PHANTOMFRAME_BLOCK_ACTIVITY_H
+
+#include <cstddef>
+#include <cstdint>
+#include "cpu_features.h"
+
+namespace phantomframe {
+
+/**
+ * @brief Compute the texture activity of every 8x8 luma block
+ *
+ * Activity is the block variance scaled by 64 * 64, i.e.
+ * 64 * sum(p^2) - sum(p)^2, which is exact in 32 bits. Blocks cut off by
+ * the right or bottom edge get zero activity.
+ * @param luma First byte of the luma plane
+ * @param stride Bytes between the starts of two rows
+ * @param width Plane width in pixels
+ * @param height Plane height in pixels
+ * @param activity Output, ((width + 7) / 8) * ((height + 7) / 8) entries
+ *        in raster order
+ * @param level Kernel to use, no higher than detectSimdLevel()
+ */
+void computeBlockActivity(const uint8_t* luma, size_t stride,
+                          uint32_t width, uint32_t height,
+                          uint32_t* activity,
+                          SimdLevel level = detectSimdLevel());
+
+/**
+ * @brief Macroblocks searched on each side of a scheduled block
+ * @param quality_threshold Adaptive search strength (0-1)
+ * @return Search radius in macroblocks (0-2)
+ */
+int adaptiveSearchRadius(float quality_threshold);
+
+/**
+ * @brief Pick the most textured block near a scheduled block
+ *
+ * Candidates lie on the same block row at whole-macroblock offsets, nearest
+ * first, and a candidate must be strictly more active to win. Encoder and
+ * extractor share this rule so both land on the same block.
+ * @param activity_row Activity of the block row holding the scheduled block
+ * @param width Frame width in pixels
+ * @param x Scheduled block x in pixels
+ * @param radius Search radius in macroblocks
+ * @return x of the selected block in pixels
+ */
+uint32_t mostTexturedBlock(const uint32_t* activity_row, uint32_t width, uint32_t x, int radius);
+
+} // namespace phantomframe
+
+#endif // PHANTOMFRAME_BLOCK_ACTIVITY_H
@@ -0,0 +1,101 @@
+#include "block_schedule.h"
+#include <algorithm>
+
+namespace phantomframe {
+
+namespace {
+
+// splitmix64 finaliser, used to derive independent round keys from the seed
+uint64_t mix64(uint64_t x) {
+    x += 0x9e3779b97f4a7c15ULL;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+
+// Round function: cheap 32-bit integer hash of the right half and key
+uint32_t roundFunction(uint32_t value, uint32_t key) {
+    uint32_t h = value ^ key;
+    h ^= h >> 16;
+    h *= 0x7feb352dU;
+    h ^= h >> 15;
+    h *= 0x846ca68bU;
+    h ^= h >> 16;
+    return h;
+}
+
+} // namespace
+
+BlockSchedule::BlockSchedule()
+    : total_blocks_(0), blocks_per_period_(0), temporal_period_(1),
+      half_bits_(0), half_mask_(0), round_keys_{} {
+}
+
+BlockSchedule::BlockSchedule(uint32_t seed, uint32_t total_blocks, 
+                             float block_density, uint32_t temporal_period)
+    : total_blocks_(total_blocks), blocks_per_period_(0), 
+      temporal_period_(std::max<uint32_t>(1, temporal_period)),
+      half_bits_(0), half_mask_(0), round_keys_{} {
+    if (total_blocks_ == 0) {
+        return;
+    }
+    
+    // Calculate how many blocks to modify each period; rounding per frame
+    // instead would leave small frames with none at all
+    float density = std::min(std::max(block_density, 0.0f), 1.0f);
+    blocks_per_period_ = std::min(
+        static_cast<uint32_t>(total_blocks_ * density),
+        total_blocks_
+    );
+    
+    // Smallest power-of-four domain covering all blocks, so the balanced
+    // Feistel network never needs more than ~4 cycle-walking steps
+    uint32_t bits = 0;
+    while ((1ULL << bits) < total_blocks_) {
+        bits++;
+    }
+    half_bits_ = std::max<uint32_t>(1, (bits + 1) / 2);
+    half_mask_ = (1U << half_bits_) - 1;
+    
+    uint64_t state = seed;
+    for (int r = 0; r < kRounds; ++r) {
+        state = mix64(state);
+        round_keys_[r] = static_cast<uint32_t>(state);
+    }
+}
+
+uint32_t BlockSchedule::blocksInFrame(uint32_t frame_index) const {
+    // Slots i * period + phase below blocks_per_period_ belong to the frame
+    uint32_t phase = frame_index % temporal_period_;
+    return (blocks_per_period_ + temporal_period_ - 1 - phase) / temporal_period_;
+}
+
+uint32_t BlockSchedule::blockIndex(uint32_t frame_index, uint32_t i) const {
+    // Frames of one temporal period interleave over disjoint slots
+    uint64_t slot = static_cast<uint64_t>(i) * temporal_period_ + frame_index % temporal_period_;
+    return permute(static_cast<uint32_t>(slot % total_blocks_));
+}
+
+uint32_t BlockSchedule::permute(uint32_t slot) const {
+    // Cycle-walk until the value falls back inside [0, total_blocks)
+    uint32_t value = encrypt(slot);
+    while (value >= total_blocks_) {
+        value = encrypt(value);
+    }
+    return value;
+}
+
+uint32_t BlockSchedule::encrypt(uint32_t value) const {
+    uint32_t left = value >> half_bits_;
+    uint32_t right = value & half_mask_;
+    
+    for (int r = 0; r < kRounds; ++r) {
+        uint32_t next = left ^ (roundFunction(right, round_keys_[r]) & half_mask_);
+        left = right;
+        right = next;
+    }
+    
+    return (left << half_bits_) | right;
+}
+
+} // namespace phantomframe
@@ -0,0 +1,89 @@
+#ifndef PHANTOMFRAME_BLOCK_SCHEDULE_H
+#define PHANTOMFRAME_BLOCK_SCHEDULE_H
+
+#include <cstdint>
+
+namespace phantomframe {
+
+/**
+ * @brief Stateless, seed-keyed selection of watermark blocks
+ *
+ * Maps the k-th schedule slot onto a block through a keyed Feistel
+ * permutation of [0, total_blocks), so any block of any frame can be
+ * computed in O(1) without per-resolution tables. Encoder and extractor
+ * construct it from the same parameters to obtain the same schedule.
+ */
+class BlockSchedule {
+public:
+    BlockSchedule();
+    BlockSchedule(uint32_t seed, uint32_t total_blocks, 
+                  float block_density, uint32_t temporal_period);
+
+    /**
+     * @brief Number of blocks modified over one temporal period
+     *
+     * The blocks of a period are spread over its frames as evenly as
+     * possible, the first blocksPerPeriod() % period frames taking one
+     * more, so a density too low for one block in every frame still
+     * marks some frames.
+     * @return Blocks per period
+     */
+    uint32_t blocksPerPeriod() const { return blocks_per_period_; }
+
+    /**
+     * @brief Most blocks modified in any one frame
+     * @return Blocks per frame, rounded up
+     */
+    uint32_t blocksPerFrame() const {
+        return (blocks_per_period_ + temporal_period_ - 1) / temporal_period_;
+    }
+
+    /**
+     * @brief Number of blocks modified in a frame
+     * @param frame_index Frame index
+     * @return blocksPerFrame() or one less
+     */
+    uint32_t blocksInFrame(uint32_t frame_index) const;
+
+    /**
+     * @brief Total number of blocks the schedule selects from
+     * @return Total blocks
+     */
+    uint32_t totalBlocks() const { return total_blocks_; }
+
+    /**
+     * @brief Block index of the i-th block modified in a frame
+     * @param frame_index Frame index
+     * @param i Position of the block within the frame (< blocksInFrame())
+     * @return Block index in raster order
+     */
+    uint32_t blockIndex(uint32_t frame_index, uint32_t i) const;
+
+    /**
+     * @brief Apply the keyed permutation to a schedule slot
+     * @param slot Slot number in [0, totalBlocks())
+     * @return Permuted block index in [0, totalBlocks())
+     */
+    uint32_t permute(uint32_t slot) const;
+
+private:
+    static constexpr int kRounds = 4;
+
+    uint32_t total_blocks_;
+    uint32_t blocks_per_period_;
+    uint32_t temporal_period_;
+    uint32_t half_bits_;
+    uint32_t half_mask_;
+    uint32_t round_keys_[kRounds];
+
+    /**
+     * @brief One pass of the Feistel network over the power-of-four domain
+     * @param value Value to encrypt
+     * @return Encrypted value
+     */
+    uint32_t encrypt(uint32_t value) const;
+};
+
+} // namespace phantomframe
+
+#endif // PHANTOMFRAME_BLOCK_SCHEDULE_H
@@ -0,0 +1,174 @@
+#include "buffer_pool.h"
+#include <cstdlib>
+#if defined(__linux__)
+#include <sys/mman.h>
+#endif
+
+namespace phantomframe {
+
+namespace {
+    
+// Idle buffers kept before the free list itself has to grow
+constexpr size_t kInitialIdleCapacity = 32;
+    
+} // namespace
+
+BufferPool::Buffer::Buffer(Buffer&& other) noexcept
+    : pool_(other.pool_), data_(other.data_), size_(other.size_), capacity_(other.capacity_) {
+    other.pool_ = nullptr;
+    other.data_ = nullptr;
+    other.size_ = 0;
+    other.capacity_ = 0;
+}
+
+BufferPool::Buffer& BufferPool::Buffer::operator=(Buffer&& other) noexcept {
+    if (this != &other) {
+        release();
+        pool_ = other.pool_;
+        data_ = other.data_;
+        size_ = other.size_;
+        capacity_ = other.capacity_;
+        other.pool_ = nullptr;
+        other.data_ = nullptr;
+        other.size_ = 0;
+        other.capacity_ = 0;
+    }
+    return *this;
+}
+
+void BufferPool::Buffer::release() {
+    if (!data_) {
+        return;
+    }
+    
+    if (pool_) {
+        pool_->recycle(data_, capacity_);
+    } else {
+        std::free(data_);
+    }
+    
+    pool_ = nullptr;
+    data_ = nullptr;
+    size_ = 0;
+    capacity_ = 0;
+}
+
+BufferPool::BufferPool(bool huge_pages)
+    : huge_pages_(huge_pages), hits_(0), misses_(0), bytes_allocated_(0), huge_page_buffers_(0) {
+    idle_.reserve(kInitialIdleCapacity);
+}
+
+BufferPool::~BufferPool() {
+    trim();
+}
+
+BufferPool::Buffer BufferPool::acquire(size_t size) {
+    Buffer buffer;
+    if (size == 0) {
+        return buffer;
+    }
+    
+    size_t capacity = roundSize(size, huge_pages_);
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (size_t i = 0; i < idle_.size(); ++i) {
+            if (idle_[i].capacity == capacity) {
+                buffer.data_ = idle_[i].data;
+                idle_[i] = idle_.back();
+                idle_.pop_back();
+                break;
+            }
+        }
+    }
+    
+    if (buffer.data_) {
+        hits_.fetch_add(1, std::memory_order_relaxed);
+    } else {
+        bool advised = false;
+        buffer.data_ = allocate(capacity, huge_pages_, advised);
+        if (!buffer.data_) {
+            return buffer;
+        }
+    
+        misses_.fetch_add(1, std::memory_order_relaxed);
+        bytes_allocated_.fetch_add(capacity, std::memory_order_relaxed);
+        if (advised) {
+            huge_page_buffers_.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+    
+    buffer.pool_ = this;
+    buffer.size_ = size;
+    buffer.capacity_ = capacity;
+    return buffer;
+}
+
+BufferPool::Buffer BufferPool::acquire(BufferPool* pool, size_t size) {
+    if (pool) {
+        return pool->acquire(size);
+    }
+    
+    Buffer buffer;
+    if (size == 0) {
+        return buffer;
+    }
+    
+    bool advised = false;
+    size_t capacity = roundSize(size, false);
+    buffer.data_ = allocate(capacity, false, advised);
+    if (buffer.data_) {
+        buffer.size_ = size;
+        buffer.capacity_ = capacity;
+    }
+    return buffer;
+}
+
+void BufferPool::trim() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (const Idle& idle : idle_) {
+        std::free(idle.data);
+    }
+    idle_.clear();
+}
+
+BufferPoolStats BufferPool::getStats() const {
+    BufferPoolStats stats;
+    stats.hits = hits_.load(std::memory_order_relaxed);
+    stats.misses = misses_.load(std::memory_order_relaxed);
+    stats.bytes_allocated = bytes_allocated_.load(std::memory_order_relaxed);
+    stats.huge_page_buffers = huge_page_buffers_.load(std::memory_order_relaxed);
+    return stats;
+}
+
+size_t BufferPool::roundSize(size_t size, bool huge_pages) {
+    // Whole huge pages, so the tail of a frame is not left on 4 KB pages
+    if (huge_pages && size >= kHugePageSize) {
+        return (size + kHugePageSize - 1) & ~(kHugePageSize - 1);
+    }
+    return (size + kAlignment - 1) & ~(kAlignment - 1);
+}
+
+uint8_t* BufferPool::allocate(size_t capacity, bool huge_pages, bool& advised) {
+    bool huge = huge_pages && capacity >= kHugePageSize;
+    void* memory = nullptr;
+    if (posix_memalign(&memory, huge ? kHugePageSize : kAlignment, capacity) != 0) {
+        return nullptr;
+    }
+    
+    // Only a hint: without THP support the buffer stays on normal pages
+    advised = false;
+#if defined(__linux__) && defined(MADV_HUGEPAGE)
+    if (huge) {
+        advised = madvise(memory, capacity, MADV_HUGEPAGE) == 0;
+    }
+#endif
+    
+    return static_cast<uint8_t*>(memory);
+}
+
+void BufferPool::recycle(uint8_t* data, size_t capacity) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    idle_.push_back({data, capacity});
+}
+
+} // namespace phantomframe
@@ -0,0 +1,181 @@
+#ifndef PHANTOMFRAME_BUFFER_POOL_H
+#define PHANTOMFRAME_BUFFER_POOL_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+namespace phantomframe {
+
+/**
+ * @brief Counters read by BufferPool::getStats()
+ */
+struct BufferPoolStats {
+    uint64_t hits;              // Requests served from an idle buffer
+    uint64_t misses;            // Requests that allocated a new buffer
+    uint64_t bytes_allocated;   // Total bytes ever allocated by the pool
+    uint32_t huge_page_buffers; // Buffers advised for transparent huge pages
+};
+
+/**
+ * @brief Recycling pool of 64-byte aligned frame and offset-map buffers
+ *
+ * Buffers are handed out as move-only Buffer handles and return to the
+ * pool's free list when the handle is destroyed. A request is served from
+ * an idle buffer of exactly the same rounded size, so every resolution a
+ * stream uses settles on its own set of buffers and a steady stream stops
+ * allocating after its first frames. With huge pages enabled, buffers of
+ * 2 MB and more are aligned to 2 MB and advised for transparent huge pages
+ * on Linux, which cuts TLB misses on full-frame passes.
+ *
+ * Pools are owned by the caller and attached to encoders, extractors and
+ * QuantOffsetBuffer, so one pool can serve every stage of a process.
+ * acquire() and buffer release are thread-safe; the pool must outlive
+ * every buffer it handed out.
+ */
+class BufferPool {
+public:
+    static constexpr size_t kAlignment = 64;
+    static constexpr size_t kHugePageSize = 2 * 1024 * 1024;
+
+    /**
+     * @brief Aligned buffer owned by a handle, recycled on destruction
+     */
+    class Buffer {
+    public:
+        Buffer() : pool_(nullptr), data_(nullptr), size_(0), capacity_(0) {}
+        Buffer(Buffer&& other) noexcept;
+        Buffer& operator=(Buffer&& other) noexcept;
+        ~Buffer() { release(); }
+
+        Buffer(const Buffer&) = delete;
+        Buffer& operator=(const Buffer&) = delete;
+
+        /**
+         * @brief Get the buffer memory, aligned to kAlignment
+         * @return Pointer to size() bytes, or null for an empty handle
+         */
+        uint8_t* data() const { return data_; }
+
+        /**
+         * @brief Get the buffer memory as an array of T
+         * @return Pointer to size() / sizeof(T) elements
+         */
+        template <typename T>
+        T* as() const { return reinterpret_cast<T*>(data_); }
+
+        /**
+         * @brief Get the requested size
+         * @return Size in bytes
+         */
+        size_t size() const { return size_; }
+
+        /**
+         * @brief Check whether the handle owns memory
+         * @return true if no buffer is held
+         */
+        bool empty() const { return data_ == nullptr; }
+
+        /**
+         * @brief Return the buffer to its pool, or free it if it has none
+         */
+        void release();
+
+    private:
+        friend class BufferPool;
+
+        BufferPool* pool_;  // Owning pool, null for a standalone buffer
+        uint8_t* data_;
+        size_t size_;       // Requested size
+        size_t capacity_;   // Rounded size the buffer was allocated with
+    };
+
+    /**
+     * @brief Create an empty pool
+     * @param huge_pages Back buffers of 2 MB and more with transparent huge pages
+     */
+    explicit BufferPool(bool huge_pages = false);
+    ~BufferPool();
+
+    BufferPool(const BufferPool&) = delete;
+    BufferPool& operator=(const BufferPool&) = delete;
+
+    /**
+     * @brief Get a buffer of at least size bytes
+     *
+     * Contents are unspecified; recycled buffers keep their old data.
+     * @param size Size in bytes
+     * @return Buffer, empty if size is 0 or allocation failed
+     */
+    Buffer acquire(size_t size);
+
+    /**
+     * @brief Get a buffer from a pool, or a standalone aligned buffer without one
+     * @param pool Pool to draw from, or null
+     * @param size Size in bytes
+     * @return Buffer, empty if size is 0 or allocation failed
+     */
+    static Buffer acquire(BufferPool* pool, size_t size);
+
+    /**
+     * @brief Free all idle buffers
+     */
+    void trim();
+
+    /**
+     * @brief Check whether huge pages were requested
+     * @return true if large buffers are advised for huge pages
+     */
+    bool hugePages() const { return huge_pages_; }
+
+    /**
+     * @brief Read the pool's counters; safe from any thread
+     * @return Hit, miss and allocation counters
+     */
+    BufferPoolStats getStats() const;
+
+private:
+    struct Idle {
+        uint8_t* data;
+        size_t capacity;
+    };
+
+    bool huge_pages_;
+    std::mutex mutex_;
+    std::vector<Idle> idle_;  // Released buffers, guarded by mutex_
+
+    std::atomic<uint64_t> hits_;
+    std::atomic<uint64_t> misses_;
+    std::atomic<uint64_t> bytes_allocated_;
+    std::atomic<uint32_t> huge_page_buffers_;
+
+    /**
+     * @brief Round a request up to the size class it is allocated with
+     * @param size Requested size in bytes
+     * @param huge_pages Whether large sizes round to whole huge pages
+     * @return Allocation size
+     */
+    static size_t roundSize(size_t size, bool huge_pages);
+
+    /**
+     * @brief Allocate aligned memory, advising huge pages where asked
+     * @param capacity Rounded size in bytes
+     * @param huge_pages Whether to align and advise for huge pages
+     * @param advised Set to true if the memory was advised for huge pages
+     * @return Memory or null
+     */
+    static uint8_t* allocate(size_t capacity, bool huge_pages, bool& advised);
+
+    /**
+     * @brief Put a released buffer on the free list
+     * @param data Buffer memory
+     * @param capacity Rounded size of the buffer
+     */
+    void recycle(uint8_t* data, size_t capacity);
+};
+
+} // namespace phantomframe
+
+#endif // PHANTOMFRAME_BUFFER_POOL_H
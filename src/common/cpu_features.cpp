@@ -0,0 +1,35 @@
+#include "cpu_features.h"
+
+namespace phantomframe {
+
+namespace {
+
+SimdLevel probeSimdLevel() {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        return SimdLevel::AVX2;
+    }
+    if (__builtin_cpu_supports("sse2")) {
+        return SimdLevel::SSE2;
+    }
+#endif
+    return SimdLevel::Scalar;
+}
+
+} // namespace
+
+SimdLevel detectSimdLevel() {
+    static const SimdLevel level = probeSimdLevel();
+    return level;
+}
+
+const char* simdLevelName(SimdLevel level) {
+    switch (level) {
+        case SimdLevel::AVX2: return "avx2";
+        case SimdLevel::SSE2: return "sse2";
+        default: return "scalar";
+    }
+}
+
+} // namespace phantomframe
@@ -0,0 +1,30 @@
+#ifndef PHANTOMFRAME_CPU_FEATURES_H
+#define PHANTOMFRAME_CPU_FEATURES_H
+
+namespace phantomframe {
+
+/**
+ * @brief Instruction set levels with dedicated kernels
+ */
+enum class SimdLevel {
+    Scalar,                     // Portable C++
+    SSE2,                       // x86 baseline on 64-bit builds
+    AVX2                        // Haswell and later
+};
+
+/**
+ * @brief Detect the best SIMD level supported by the running CPU
+ * @return Highest usable level, cached after the first call
+ */
+SimdLevel detectSimdLevel();
+
+/**
+ * @brief Get a printable name for a SIMD level
+ * @param level SIMD level
+ * @return Level name
+ */
+const char* simdLevelName(SimdLevel level);
+
+} // namespace phantomframe
+
+#endif // PHANTOMFRAME_CPU_FEATURES_H
@@ -0,0 +1,361 @@
+#include "embedding_schedule.h"
+#include "block_schedule.h"
+#include "payload_code.h"
+#include "worker_pool.h"
+#include <algorithm>
+
+namespace phantomframe {
+
+namespace {
+
+// Normalized coordinates are fractions of the frame in 1/65536 units
+constexpr uint32_t kNormBits = 16;
+
+// Centre of block b out of n, so mapping back onto the same grid is exact
+uint16_t normalizeBlock(uint32_t block, uint32_t blocks) {
+    return static_cast<uint16_t>(((2ull * block + 1) << kNormBits) / (2ull * blocks));
+}
+
+uint32_t denormalize(uint16_t value, uint32_t blocks) {
+    return static_cast<uint32_t>((static_cast<uint64_t>(value) * blocks) >> kNormBits);
+}
+
+} // namespace
+
+EmbeddingSchedule::EmbeddingSchedule(uint32_t seed, float block_density, uint32_t temporal_period,
+                                     uint32_t reference_width, uint32_t reference_height,
+                                     uint32_t window_frames, uint32_t window_repeats,
+                                     uint32_t marked_period_interval)
+    : seed_(seed), block_density_(block_density), 
+      period_(std::max<uint32_t>(1, temporal_period)),
+      reference_width_(reference_width), reference_height_(reference_height),
+      blocks_per_frame_(0), cycle_(period_), 
+      window_frames_(window_frames), window_repeats_(window_repeats),
+      marked_period_interval_(std::max<uint32_t>(1, marked_period_interval)) {
+}
+
+std::shared_ptr<const EmbeddingSchedule> EmbeddingSchedule::create(uint32_t seed, float block_density,
+                                                                   uint32_t temporal_period,
+                                                                   uint32_t reference_width,
+                                                                   uint32_t reference_height,
+                                                                   WorkerPool* pool,
+                                                                   const CodedPayload* codeword,
+                                                                   uint32_t window_frames,
+                                                                   uint32_t window_repeats,
+                                                                   float pilot_density,
+                                                                   uint32_t marked_period_interval) {
+    std::shared_ptr<EmbeddingSchedule> schedule(new EmbeddingSchedule(
+        seed, block_density, temporal_period, reference_width, reference_height,
+        window_frames, window_repeats, marked_period_interval));
+    
+    uint32_t blocks_x = (reference_width + 7) / 8;
+    uint32_t blocks_y = (reference_height + 7) / 8;
+    uint32_t total = blocks_x * blocks_y;
+    uint32_t period = schedule->period_;
+    
+    // The pilot marks the top-left block of each of its cells, which is
+    // the whole cell's macroblock on the reference grid
+    schedule->pilot_ = PilotPattern(seed, pilot_density, period);
+    if (schedule->pilot_.enabled()) {
+        uint32_t step = PilotPattern::kCellPixels / 8;
+        for (uint32_t by = 0; by < blocks_y; by += step) {
+            for (uint32_t bx = 0; bx < blocks_x; bx += step) {
+                int8_t value = schedule->pilot_.cell(bx / step, by / step);
+                if (value != 0) {
+                    schedule->pilot_u_.push_back(normalizeBlock(bx, blocks_x));
+                    schedule->pilot_v_.push_back(normalizeBlock(by, blocks_y));
+                    schedule->pilot_delta_.push_back(value);
+                }
+            }
+        }
+        size_t count = schedule->pilot_delta_.size();
+        for (size_t i = 0; i < count; ++i) {
+            schedule->pilot_delta_.push_back(static_cast<int8_t>(-schedule->pilot_delta_[i]));
+        }
+        schedule->pilot_channel_.assign(count, kPilotChannel);
+    }
+    BlockSchedule selection(seed, total, block_density, temporal_period);
+    
+    // Every block of the period is selected at a density of 1
+    uint32_t limit = total / period;
+    if (window_frames == 0 || selection.blocksPerFrame() >= limit) {
+        schedule->build(selection, blocks_x, blocks_y, pool, codeword);
+        return schedule;
+    }
+    
+    // Start from the blocks a window needs when about two thirds of them
+    // carry a bit (calculateQPDelta() leaves the rest unmodulated) and
+    // only its marked periods count, then grow until every window is
+    // covered, including those that span the restart of the dealing at
+    // the end of the cycle
+    uint32_t repeats = std::max<uint32_t>(1, window_repeats);
+    uint64_t marked = std::max<uint32_t>(1, window_frames / schedule->marked_period_interval_);
+    uint64_t needed = (3ull * kPayloadCodedBits * repeats + 2ull * marked - 1) / (2ull * marked);
+    uint32_t per_frame = static_cast<uint32_t>(std::min<uint64_t>(
+        std::max<uint64_t>(selection.blocksPerFrame(), needed), limit));
+    for (;;) {
+        float density = std::max(block_density, (per_frame * period + 0.5f) / total);
+        schedule->build(BlockSchedule(seed, total, density, temporal_period), 
+                        blocks_x, blocks_y, pool, codeword);
+        if (per_frame == limit || schedule->coverage(window_frames) >= repeats) {
+            break;
+        }
+        per_frame = std::min(limit, per_frame + std::max<uint32_t>(1, per_frame / 32));
+    }
+    
+    return schedule;
+}
+
+void EmbeddingSchedule::build(const BlockSchedule& selection, uint32_t blocks_x, uint32_t blocks_y,
+                              WorkerPool* pool, const CodedPayload* codeword) {
+    uint32_t period = period_;
+    size_t entries = selection.blocksPerPeriod();
+    
+    blocks_per_frame_ = selection.blocksPerFrame();
+    cycle_ = period;
+    phase_start_.resize(period + 1);
+    phase_start_[0] = 0;
+    for (uint32_t phase = 0; phase < period; ++phase) {
+        phase_start_[phase + 1] = phase_start_[phase] + selection.blocksInFrame(phase);
+    }
+    u_.resize(entries);
+    v_.resize(entries);
+    qp_delta_.resize(entries);
+    channel_.assign(entries, 0);
+    
+    if (entries == 0) {
+        return;
+    }
+    
+    // Where each phase's i-th selected block lands once the phase is sorted
+    std::vector<uint32_t> slots(entries);
+    
+    EmbeddingSchedule& target = *this;
+    auto fill_phase = [&target, &selection, &slots, blocks_x, blocks_y](uint32_t phase) {
+        size_t offset = target.phase_start_[phase];
+        uint32_t count = target.phase_start_[phase + 1] - target.phase_start_[phase];
+        std::vector<std::pair<uint32_t, uint32_t>> blocks(count);
+        for (uint32_t i = 0; i < count; ++i) {
+            blocks[i] = {selection.blockIndex(phase, i), i};
+        }
+        
+        // Raster order on the reference grid is (v, u) order
+        std::sort(blocks.begin(), blocks.end());
+        
+        for (uint32_t i = 0; i < count; ++i) {
+            uint32_t block_idx = blocks[i].first;
+            target.u_[offset + i] = normalizeBlock(block_idx % blocks_x, blocks_x);
+            target.v_[offset + i] = normalizeBlock(block_idx / blocks_x, blocks_y);
+            target.qp_delta_[offset + i] = target.calculateQPDelta(block_idx, phase);
+            slots[offset + blocks[i].second] = i;
+        }
+    };
+    
+    // Phases own disjoint ranges of the table
+    if (pool && period > 1) {
+        pool->run(period, fill_phase);
+    } else {
+        for (uint32_t phase = 0; phase < period; ++phase) {
+            fill_phase(phase);
+        }
+    }
+    
+    // Deal the channel bits out in selection order, which is spread over
+    // the picture, repeating the block pattern until every bit is carried
+    std::vector<int8_t> chips(qp_delta_);
+    size_t carrying = entries - std::count(chips.begin(), chips.end(), 0);
+    uint32_t repeats = carrying == 0 ? 1 : 
+        static_cast<uint32_t>((kPayloadCodedBits + carrying - 1) / carrying);
+    cycle_ = period * repeats;
+    qp_delta_.assign(entries * repeats, 0);
+    channel_.assign(entries * repeats, 0);
+    
+    uint32_t channel = 0;
+    for (uint32_t r = 0; r < repeats; ++r) {
+        for (uint32_t phase = 0; phase < period; ++phase) {
+            size_t offset = phase_start_[phase];
+            for (size_t e = offset; e < phase_start_[phase + 1]; ++e) {
+                size_t slot = offset + slots[e];
+                if (chips[slot] == 0) {
+                    continue;
+                }
+                size_t entry = r * entries + slot;
+                channel_[entry] = static_cast<uint16_t>(channel);
+                qp_delta_[entry] = codeword && (*codeword)[channel] ? -chips[slot] : chips[slot];
+                channel = (channel + 1) % kPayloadCodedBits;
+            }
+        }
+    }
+}
+
+EmbeddingSchedule::Phase EmbeddingSchedule::phase(uint32_t frame_index) const {
+    if (blocks_per_frame_ == 0) {
+        return {nullptr, nullptr, nullptr, nullptr, 0};
+    }
+    
+    if (!marksFrame(frame_index)) {
+        return {nullptr, nullptr, nullptr, nullptr, 0};
+    }
+    
+    // Only marked periods advance through the cycle; deltas of repetition
+    // r of the block pattern follow those of r - 1
+    uint32_t marked_frame = frame_index / period_ / marked_period_interval_ * period_ + 
+                            frame_index % period_;
+    uint32_t phase = marked_frame % period_;
+    size_t offset = phase_start_[phase];
+    size_t delta_offset = static_cast<size_t>(marked_frame % cycle_ / period_) * u_.size() + offset;
+    return {u_.data() + offset, v_.data() + offset, qp_delta_.data() + delta_offset, 
+            channel_.data() + delta_offset, phase_start_[phase + 1] - phase_start_[phase]};
+}
+
+uint32_t EmbeddingSchedule::mapFrame(uint32_t frame_index, uint32_t width, uint32_t height,
+                                     uint16_t* x, uint16_t* y) const {
+    Phase blocks = phase(frame_index);
+    uint32_t blocks_x = (width + 7) / 8;
+    uint32_t blocks_y = (height + 7) / 8;
+    
+    for (uint32_t i = 0; i < blocks.count; ++i) {
+        x[i] = static_cast<uint16_t>(denormalize(blocks.u[i], blocks_x) * 8);
+        y[i] = static_cast<uint16_t>(denormalize(blocks.v[i], blocks_y) * 8);
+    }
+    
+    return blocks.count;
+}
+
+uint32_t EmbeddingSchedule::mapFrames(uint32_t frame_index, uint32_t phases, uint32_t width, 
+                                      uint32_t height, uint16_t* x, uint16_t* y, 
+                                      int8_t* qp_delta, uint16_t* channel) const {
+    phases = std::min(phases, maxFramePhases());
+    uint32_t pilot_count = pilotBlocks();
+    if (phases == 0 || (blocks_per_frame_ == 0 && pilot_count == 0)) {
+        return 0;
+    }
+    
+    // Earlier frames' phases wrap around the cycle
+    Phase sources[kMaxFramePhases + 1];
+    uint32_t next[kMaxFramePhases + 1] = {};
+    uint32_t full_cycle = cycle();
+    uint32_t current = frame_index % full_cycle;
+    for (uint32_t p = 0; p < phases; ++p) {
+        uint32_t back = phases - 1 - p;
+        sources[p] = phase((current + full_cycle - back) % full_cycle);
+    }
+    uint32_t source_count = phases;
+    if (pilot_count > 0 && marksFrame(frame_index)) {
+        const int8_t* deltas = pilot_delta_.data() + (pilot_.sign(frame_index) > 0 ? 0 : pilot_count);
+        sources[source_count++] = {pilot_u_.data(), pilot_v_.data(), deltas, 
+                                   pilot_channel_.data(), pilot_count};
+    }
+    
+    // Each phase is sorted by (v, u) and the mapping is monotonic, so a
+    // k-way merge straight from the table keeps the output in row order
+    uint32_t blocks_x = (width + 7) / 8;
+    uint32_t blocks_y = (height + 7) / 8;
+    uint32_t total = 0;
+    for (uint32_t p = 0; p < source_count; ++p) {
+        total += sources[p].count;
+    }
+    for (uint32_t i = 0; i < total; ++i) {
+        uint32_t best = source_count;
+        uint32_t best_key = 0;
+        for (uint32_t p = 0; p < source_count; ++p) {
+            if (next[p] == sources[p].count) {
+                continue;
+            }
+            uint32_t key = (static_cast<uint32_t>(sources[p].v[next[p]]) << kNormBits) | 
+                           sources[p].u[next[p]];
+            if (best == source_count || key < best_key) {
+                best = p;
+                best_key = key;
+            }
+        }
+        
+        const Phase& source = sources[best];
+        uint32_t j = next[best]++;
+        x[i] = static_cast<uint16_t>(denormalize(source.u[j], blocks_x) * 8);
+        y[i] = static_cast<uint16_t>(denormalize(source.v[j], blocks_y) * 8);
+        qp_delta[i] = source.qp_delta[j];
+        if (channel) {
+            channel[i] = source.channel[j];
+        }
+    }
+    
+    return total;
+}
+
+uint32_t EmbeddingSchedule::coverage(uint32_t frames) const {
+    if (blocks_per_frame_ == 0 || frames == 0) {
+        return 0;
+    }
+    
+    std::vector<int32_t> counts(kPayloadCodedBits, 0);
+    auto count_frame = [this, &counts](uint32_t frame, int32_t step) {
+        Phase blocks = phase(frame);
+        for (uint32_t i = 0; i < blocks.count; ++i) {
+            if (blocks.qp_delta[i] != 0) {
+                counts[blocks.channel[i]] += step;
+            }
+        }
+    };
+    
+    // Slide the window once around the cycle
+    for (uint32_t frame = 0; frame < frames; ++frame) {
+        count_frame(frame, 1);
+    }
+    int32_t fewest = *std::min_element(counts.begin(), counts.end());
+    for (uint32_t first = 1; first < cycle(); ++first) {
+        count_frame(first - 1, -1);
+        count_frame(first + frames - 1, 1);
+        fewest = std::min(fewest, *std::min_element(counts.begin(), counts.end()));
+    }
+    
+    return static_cast<uint32_t>(fewest);
+}
+
+bool EmbeddingSchedule::marksFrame(uint32_t frame_index) const {
+    return frame_index / period_ % marked_period_interval_ == 0;
+}
+
+uint32_t EmbeddingSchedule::maxFramePhases() const {
+    return std::min(kMaxFramePhases, period_);
+}
+
+uint32_t EmbeddingSchedule::maxBlocksPerFrame() const {
+    return blocks_per_frame_ * maxFramePhases() + pilotBlocks();
+}
+
+int8_t EmbeddingSchedule::calculateQPDelta(uint32_t block_index, uint32_t phase) const {
+    // Use block index and frame phase to determine QP delta
+    // This creates a pseudo-random but deterministic pattern
+    
+    // Simple hash function for demonstration
+    uint32_t hash = block_index * 31 + phase * 17 + seed_;
+    hash = ((hash << 13) ^ hash) >> 19;
+    
+    // Map to QP delta: -1, 0, or +1
+    uint32_t mod = hash % 3;
+    if (mod == 0) return -1;
+    if (mod == 1) return 0;
+    return 1;
+}
+
+uint32_t PhaseCarry::next(const FrameInfo& info, uint32_t temporal_period) {
+    if (!isReference(info)) {
+        skipped_++;
+        return 0;
+    }
+    
+    // Beyond the limit the oldest skipped phases are dropped
+    uint32_t limit = std::min(EmbeddingSchedule::kMaxFramePhases, 
+                              std::max<uint32_t>(1, temporal_period));
+    uint32_t phases = std::min(skipped_ + 1, limit);
+    skipped_ = 0;
+    
+    return phases;
+}
+
+bool PhaseCarry::isReference(const FrameInfo& info) {
+    return info.type == FrameType::Unknown || info.type == FrameType::I || info.is_reference;
+}
+
+} // namespace phantomframe
@@ -0,0 +1,302 @@
+#ifndef PHANTOMFRAME_EMBEDDING_SCHEDULE_H
+#define PHANTOMFRAME_EMBEDDING_SCHEDULE_H
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include "pilot_sync.h"
+
+namespace phantomframe {
+
+class BlockSchedule;
+class WorkerPool;
+struct CodedPayload;
+
+/**
+ * @brief Picture type reported by the host encoder
+ */
+enum class FrameType {
+    Unknown,                    // Not reported; treated as a reference frame
+    I,                          // Intra picture
+    P,                          // Predicted picture
+    B                           // Bi-predicted picture
+};
+
+/**
+ * @brief Coding decisions of the host encoder for one frame
+ */
+struct FrameInfo {
+    FrameType type;             // Picture type
+    bool is_reference;          // Whether later pictures predict from this one
+};
+
+/**
+ * @brief Resolution-independent watermark schedule for one stream
+ *
+ * Selects blocks on a reference 8x8 grid with BlockSchedule and stores
+ * them as normalized block centres (1/65536 of the frame) plus QP deltas,
+ * one phase per frame of the temporal period. The blocks a density selects
+ * over the period are spread across its phases, which differ by at most
+ * one block, so small frames still carry some. Every rendition of a stream
+ * maps the same immutable schedule onto its own grid, so the schedule is
+ * built once and the mark lands on the same picture areas across an ABR
+ * ladder. Instances are shared read-only through shared_ptr.
+ *
+ * Each block with a non-zero delta carries one channel bit of the coded
+ * payload (see payload_code.h): the bits are dealt out round-robin in the
+ * order BlockSchedule selects the blocks, which scatters neighbouring bits
+ * across the picture, and a set bit flips the sign of the block's delta.
+ * When one period has fewer carrying blocks than channel bits, the deltas
+ * continue over further repetitions of the block pattern until every bit
+ * is carried; cycle() is the length of that longer pattern. A schedule
+ * built without a codeword holds the unmodulated pattern an extractor
+ * correlates against.
+ *
+ * Because the bits are dealt in frame order, any run of frames carrying
+ * enough blocks holds the whole codeword, so a clip cut from anywhere in
+ * the stream can be decoded. A window guarantee makes this explicit: the
+ * schedule adds blocks per frame beyond the block density until every run
+ * of window_frames frames carries each channel bit window_repeats times.
+ *
+ * An optional sync pilot (see PilotPattern) adds one block per pilot cell
+ * of the reference grid to every frame, on its own channel kPilotChannel.
+ * Its deltas follow the pilot's sign sequence over the period, so the
+ * pilot is only merged in by mapFrames() and never appears in phase().
+ *
+ * A marked period interval N above 1 makes the schedule sparse in time:
+ * only every N-th temporal period carries blocks (and the pilot), the
+ * periods in between none at all, and the cycle stretches by N. Encoders
+ * that re-encode only what carries marks (GopSplicer) then leave most of
+ * a stream untouched, and an extractor built with the same interval
+ * takes no evidence from the unmarked frames.
+ */
+class EmbeddingSchedule {
+public:
+    /**
+     * @brief Blocks of one phase in normalized coordinates
+     */
+    struct Phase {
+        const uint16_t* u;          // Horizontal block centre, 0-65535
+        const uint16_t* v;          // Vertical block centre, 0-65535
+        const int8_t* qp_delta;     // QP modification per block
+        const uint16_t* channel;    // Channel bit per block, where qp_delta is not 0
+        uint32_t count;             // Number of blocks
+    };
+
+    /**
+     * @brief Build a schedule
+     * @param seed Block selection seed
+     * @param block_density Fraction of reference blocks modified per period
+     * @param temporal_period Frames between pattern repetition
+     * @param reference_width Width of the reference grid in pixels
+     * @param reference_height Height of the reference grid in pixels
+     * @param pool Optional pool to build the phases on
+     * @param codeword Coded payload to modulate the deltas with, or null
+     *        for the unmodulated pattern
+     * @param window_frames Frames in which every channel bit must be
+     *        carried, 0 for no guarantee
+     * @param window_repeats Times every channel bit is carried in any
+     *        window of window_frames frames
+     * @param pilot_density Fraction of pilot cells carrying the sync pilot,
+     *        0 for none
+     * @param marked_period_interval Mark one temporal period in this many,
+     *        0 or 1 for every period
+     * @return Immutable schedule
+     */
+    static std::shared_ptr<const EmbeddingSchedule> create(uint32_t seed, float block_density,
+                                                           uint32_t temporal_period,
+                                                           uint32_t reference_width,
+                                                           uint32_t reference_height,
+                                                           WorkerPool* pool = nullptr,
+                                                           const CodedPayload* codeword = nullptr,
+                                                           uint32_t window_frames = 0,
+                                                           uint32_t window_repeats = 1,
+                                                           float pilot_density = 0.0f,
+                                                           uint32_t marked_period_interval = 1);
+
+    /**
+     * @brief Get the blocks of the phase a frame belongs to
+     * @param frame_index Frame index
+     * @return Phase, sorted by (v, u); empty outside marked periods
+     */
+    Phase phase(uint32_t frame_index) const;
+
+    /**
+     * @brief Whether a frame falls in a marked period
+     * @param frame_index Frame index
+     * @return true unless the marked period interval skips its period
+     */
+    bool marksFrame(uint32_t frame_index) const;
+
+    /**
+     * @brief Map the blocks of a frame onto a frame's 8x8 block grid
+     *
+     * On the reference grid this reproduces the selected blocks exactly.
+     * Row order is preserved on every grid, so the output is sorted by y.
+     * @param frame_index Frame index
+     * @param width Frame width in pixels
+     * @param height Frame height in pixels
+     * @param x Output block x coordinates in pixels, blocksPerFrame() entries
+     * @param y Output block y coordinates in pixels, blocksPerFrame() entries
+     * @return Number of blocks written
+     */
+    uint32_t mapFrame(uint32_t frame_index, uint32_t width, uint32_t height,
+                      uint16_t* x, uint16_t* y) const;
+
+    /**
+     * @brief Map the blocks of consecutive frames onto one frame's grid
+     *
+     * Merges the phases of frames [frame_index - phases + 1, frame_index]
+     * into a single list sorted by y, as carried by a reference frame that
+     * takes over the blocks of the non-reference frames before it. The
+     * pilot blocks of the frame itself are merged in as well.
+     * @param frame_index Frame index of the last phase
+     * @param phases Number of phases, at most maxFramePhases()
+     * @param width Frame width in pixels
+     * @param height Frame height in pixels
+     * @param x Output block x coordinates, maxBlocksPerFrame() entries
+     * @param y Output block y coordinates, maxBlocksPerFrame() entries
+     * @param qp_delta Output QP deltas, maxBlocksPerFrame() entries
+     * @param channel Optional output channel bits, maxBlocksPerFrame() entries
+     * @return Number of blocks written
+     */
+    uint32_t mapFrames(uint32_t frame_index, uint32_t phases, uint32_t width, uint32_t height,
+                       uint16_t* x, uint16_t* y, int8_t* qp_delta,
+                       uint16_t* channel = nullptr) const;
+
+    /**
+     * @brief Most phases a single frame carries
+     * @return kMaxFramePhases, or the period if shorter so phases never repeat
+     */
+    uint32_t maxFramePhases() const;
+
+    /**
+     * @brief Most blocks mapFrames() writes for one frame
+     * @return Blocks of maxFramePhases() phases plus the pilot blocks
+     */
+    uint32_t maxBlocksPerFrame() const;
+
+    /**
+     * @brief Fewest times a channel bit is carried in a run of frames
+     *
+     * Checks every run of the given length within the cycle, wrapping at
+     * its end, the way a clip taken from anywhere in the stream would see
+     * the schedule (within one scene).
+     * @param frames Length of the run in frames
+     * @return Smallest number of blocks carrying any one channel bit
+     */
+    uint32_t coverage(uint32_t frames) const;
+
+    // Upper bound on the phases one reference frame carries, its own included
+    static constexpr uint32_t kMaxFramePhases = 8;
+
+    // Channel of pilot blocks, outside the range of payload channel bits
+    static constexpr uint16_t kPilotChannel = 0xFFFF;
+
+    uint32_t blocksPerFrame() const { return blocks_per_frame_; }
+    uint32_t period() const { return period_; }
+    uint32_t cycle() const { return cycle_ * marked_period_interval_; }
+    uint32_t seed() const { return seed_; }
+    float blockDensity() const { return block_density_; }
+    uint32_t referenceWidth() const { return reference_width_; }
+    uint32_t referenceHeight() const { return reference_height_; }
+    uint32_t windowFrames() const { return window_frames_; }
+    uint32_t windowRepeats() const { return window_repeats_; }
+    uint32_t markedPeriodInterval() const { return marked_period_interval_; }
+    uint32_t pilotBlocks() const { return static_cast<uint32_t>(pilot_u_.size()); }
+    const PilotPattern& pilot() const { return pilot_; }
+
+private:
+    EmbeddingSchedule(uint32_t seed, float block_density, uint32_t temporal_period,
+                      uint32_t reference_width, uint32_t reference_height,
+                      uint32_t window_frames, uint32_t window_repeats,
+                      uint32_t marked_period_interval);
+
+    uint32_t seed_;
+    float block_density_;
+    uint32_t period_;
+    uint32_t reference_width_;
+    uint32_t reference_height_;
+    uint32_t blocks_per_frame_; // Most blocks in one phase
+    uint32_t cycle_;            // Marked frames before the deltas repeat, a multiple of period_
+    uint32_t window_frames_;    // Window guarantee requested, 0 for none
+    uint32_t window_repeats_;
+    uint32_t marked_period_interval_;   // Periods per marked period, at least 1
+
+    // Phase p owns entries [phase_start_[p], phase_start_[p + 1]); positions
+    // repeat every period, deltas and channel bits every cycle
+    std::vector<uint32_t> phase_start_;
+    std::vector<uint16_t> u_;
+    std::vector<uint16_t> v_;
+    std::vector<int8_t> qp_delta_;
+    std::vector<uint16_t> channel_;
+
+    // Pilot blocks sorted by (v, u); deltas for a positive frame sign
+    // followed by the same for a negative one
+    PilotPattern pilot_;
+    std::vector<uint16_t> pilot_u_;
+    std::vector<uint16_t> pilot_v_;
+    std::vector<int8_t> pilot_delta_;
+    std::vector<uint16_t> pilot_channel_;
+
+    /**
+     * @brief Fill the tables from a block selection
+     * @param selection Blocks selected on the reference grid
+     * @param blocks_x Reference grid width in blocks
+     * @param blocks_y Reference grid height in blocks
+     * @param pool Optional pool to build the phases on
+     * @param codeword Coded payload to modulate the deltas with, or null
+     */
+    void build(const BlockSchedule& selection, uint32_t blocks_x, uint32_t blocks_y,
+               WorkerPool* pool, const CodedPayload* codeword);
+
+    /**
+     * @brief Calculate the unmodulated QP delta for a reference block
+     * @param block_index Block index on the reference grid
+     * @param phase Frame index modulo the temporal period
+     * @return QP delta value, 0 for a block that carries no channel bit
+     */
+    int8_t calculateQPDelta(uint32_t block_index, uint32_t phase) const;
+};
+
+/**
+ * @brief Moves the blocks of non-reference frames onto reference frames
+ *
+ * QP deltas on non-reference frames rarely survive a re-encode, so a
+ * non-reference frame carries no blocks and its phase is taken over by the
+ * next reference frame in display order. Each GOP keeps its block budget,
+ * all of it on I/P and reference B frames. Encoder and extractor feed the
+ * same frame types in display order to agree on which frame carries what.
+ */
+class PhaseCarry {
+public:
+    PhaseCarry() : skipped_(0) {}
+
+    /**
+     * @brief Account for the next frame in display order
+     * @param info Frame type reported for the frame
+     * @param temporal_period Period of the schedule the phases belong to
+     * @return Phases the frame carries, ending with its own (see
+     *         EmbeddingSchedule::mapFrames()); 0 for a non-reference frame
+     */
+    uint32_t next(const FrameInfo& info, uint32_t temporal_period);
+
+    /**
+     * @brief Forget skipped frames, e.g. after a seek
+     */
+    void reset() { skipped_ = 0; }
+
+    /**
+     * @brief Whether a frame carries blocks
+     * @param info Frame type reported for the frame
+     * @return true for I frames, reference frames and frames of unknown type
+     */
+    static bool isReference(const FrameInfo& info);
+
+private:
+    uint32_t skipped_;          // Non-reference frames since the last reference frame
+};
+
+} // namespace phantomframe
+
+#endif // PHANTOMFRAME_EMBEDDING_SCHEDULE_H
@@ -0,0 +1,80 @@
+#ifndef PHANTOMFRAME_PAYLOAD_H
+#define PHANTOMFRAME_PAYLOAD_H
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+namespace phantomframe {
+
+/**
+ * @brief 128-bit watermark payload
+ *
+ * Stored as 16 bytes, most significant first, so bytes[0] holds the first
+ * two hex digits of payloadToHex() and bit(0) is the first bit embedded.
+ * A 64-bit value converts implicitly into the low half.
+ */
+struct Payload {
+    static constexpr size_t kBytes = 16;
+    static constexpr size_t kBits = kBytes * 8;
+
+    std::array<uint8_t, kBytes> bytes;  // Most significant byte first
+
+    Payload() : bytes{} {}
+
+    Payload(uint64_t low) : Payload(0, low) {}
+
+    Payload(uint64_t high, uint64_t low) : bytes{} {
+        for (size_t i = 0; i < 8; ++i) {
+            bytes[i] = static_cast<uint8_t>(high >> (56 - 8 * i));
+            bytes[8 + i] = static_cast<uint8_t>(low >> (56 - 8 * i));
+        }
+    }
+
+    uint8_t& operator[](size_t i) { return bytes[i]; }
+    uint8_t operator[](size_t i) const { return bytes[i]; }
+
+    /**
+     * @brief Get the upper 64 bits
+     */
+    uint64_t high() const { return word(0); }
+
+    /**
+     * @brief Get the lower 64 bits
+     */
+    uint64_t low() const { return word(8); }
+
+    /**
+     * @brief Get bit i, counted from the most significant bit of bytes[0]
+     */
+    bool bit(size_t i) const { return (bytes[i / 8] >> (7 - i % 8)) & 1; }
+
+    /**
+     * @brief Whether every bit is zero, as reported when nothing was decoded
+     */
+    bool empty() const { return high() == 0 && low() == 0; }
+
+    Payload operator^(const Payload& other) const {
+        Payload result;
+        for (size_t i = 0; i < kBytes; ++i) {
+            result.bytes[i] = bytes[i] ^ other.bytes[i];
+        }
+        return result;
+    }
+
+    bool operator==(const Payload& other) const { return bytes == other.bytes; }
+    bool operator!=(const Payload& other) const { return bytes != other.bytes; }
+
+private:
+    uint64_t word(size_t first) const {
+        uint64_t value = 0;
+        for (size_t i = 0; i < 8; ++i) {
+            value = (value << 8) | bytes[first + i];
+        }
+        return value;
+    }
+};
+
+} // namespace phantomframe
+
+#endif // PHANTOMFRAME_PAYLOAD_H
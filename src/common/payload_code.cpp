@@ -0,0 +1,507 @@
+#include "payload_code.h"
+#include <algorithm>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define PHANTOMFRAME_X86 1
+#endif
+
+namespace phantomframe {
+
+namespace {
+
+// Shift register taps, newest input bit in bit 0
+constexpr uint32_t kGenerator0 = 0x79;  // 171 octal
+constexpr uint32_t kGenerator1 = 0x5B;  // 133 octal
+
+constexpr uint32_t kStates = 1u << kConvolutionalMemory;
+constexpr uint32_t kInfoBits = kPayloadCodeBytes * 8;
+constexpr uint32_t kSteps = kInfoBits + kConvolutionalMemory;
+
+// Metric of a path the decoder cannot be on
+constexpr float kUnreachable = -1e30f;
+
+inline uint8_t parity(uint32_t value) {
+    return static_cast<uint8_t>(__builtin_parity(value));
+}
+
+/**
+ * @brief GF(256) tables and the Reed-Solomon generator polynomial
+ *
+ * Field polynomial x^8 + x^4 + x^3 + x^2 + 1; the generator has the roots
+ * alpha^0 to alpha^7.
+ */
+struct GaloisField {
+    uint8_t exp[512];
+    uint8_t log[256];
+    uint8_t generator[kPayloadParityBytes + 1];     // Highest degree first, generator[0] = 1
+    uint8_t generator_masks[kPayloadParityBytes][8]; // Per output bit, the input bits of
+                                                     // a product with generator[j + 1]
+    
+    GaloisField() {
+        uint32_t value = 1;
+        for (uint32_t i = 0; i < 255; ++i) {
+            exp[i] = static_cast<uint8_t>(value);
+            log[value] = static_cast<uint8_t>(i);
+            value <<= 1;
+            if (value & 0x100) {
+                value ^= 0x11D;
+            }
+        }
+        for (uint32_t i = 255; i < 512; ++i) {
+            exp[i] = exp[i - 255];
+        }
+        log[0] = 0;
+        
+        // Multiply (x + alpha^j) into the generator one root at a time
+        std::fill(generator, generator + kPayloadParityBytes + 1, 0);
+        generator[0] = 1;
+        for (uint32_t j = 0; j < kPayloadParityBytes; ++j) {
+            for (uint32_t i = j + 1; i > 0; --i) {
+                generator[i] ^= mul(generator[i - 1], exp[j]);
+            }
+        }
+        
+        // Multiplying by a constant is linear over GF(2): output bit o is
+        // the XOR of the input bits b whose product c * x^b has bit o set
+        for (uint32_t j = 0; j < kPayloadParityBytes; ++j) {
+            for (uint32_t o = 0; o < 8; ++o) {
+                uint8_t mask = 0;
+                for (uint32_t b = 0; b < 8; ++b) {
+                    mask |= static_cast<uint8_t>(((mul(generator[j + 1], 1u << b) >> o) & 1) << b);
+                }
+                generator_masks[j][o] = mask;
+            }
+        }
+    }
+    
+    uint8_t mul(uint32_t a, uint32_t b) const {
+        return a && b ? exp[log[a] + log[b]] : 0;
+    }
+    
+    uint8_t div(uint32_t a, uint32_t b) const {
+        return a ? exp[log[a] + 255 - log[b]] : 0;
+    }
+};
+
+const GaloisField& field() {
+    static const GaloisField gf;
+    return gf;
+}
+
+/**
+ * @brief Append the Reed-Solomon parity of the first Payload::kBytes bytes
+ * @param code kPayloadCodeBytes bytes, payload first
+ */
+void appendParity(uint8_t* code) {
+    const GaloisField& gf = field();
+    uint8_t* parity_bytes = code + Payload::kBytes;
+    std::fill(parity_bytes, parity_bytes + kPayloadParityBytes, 0);
+    
+    for (uint32_t k = 0; k < Payload::kBytes; ++k) {
+        uint8_t feedback = code[k] ^ parity_bytes[0];
+        for (uint32_t j = 0; j + 1 < kPayloadParityBytes; ++j) {
+            parity_bytes[j] = parity_bytes[j + 1] ^ gf.mul(feedback, gf.generator[j + 1]);
+        }
+        parity_bytes[kPayloadParityBytes - 1] = gf.mul(feedback, gf.generator[kPayloadParityBytes]);
+    }
+}
+
+/**
+ * @brief Correct up to kPayloadParityBytes / 2 byte errors in place
+ * @param code Received codeword
+ * @param corrected Receives the number of bytes corrected
+ * @return false if the word is beyond correction
+ */
+bool correctBytes(uint8_t* code, uint32_t& corrected) {
+    const GaloisField& gf = field();
+    constexpr uint32_t n = kPayloadCodeBytes;
+    constexpr uint32_t nsym = kPayloadParityBytes;
+    corrected = 0;
+    
+    // Syndromes: the received word evaluated at each generator root
+    uint8_t syndromes[nsym];
+    bool clean = true;
+    for (uint32_t j = 0; j < nsym; ++j) {
+        uint8_t s = 0;
+        for (uint32_t i = 0; i < n; ++i) {
+            s = gf.mul(s, gf.exp[j]) ^ code[i];
+        }
+        syndromes[j] = s;
+        clean = clean && s == 0;
+    }
+    if (clean) {
+        return true;
+    }
+    
+    // Berlekamp-Massey: error locator, lowest degree first
+    uint8_t locator[nsym + 1] = {1};
+    uint8_t previous[nsym + 1] = {1};
+    uint32_t length = 0;
+    uint32_t shift = 1;
+    uint8_t previous_discrepancy = 1;
+    for (uint32_t r = 0; r < nsym; ++r) {
+        uint8_t discrepancy = syndromes[r];
+        for (uint32_t i = 1; i <= length; ++i) {
+            discrepancy ^= gf.mul(locator[i], syndromes[r - i]);
+        }
+        if (discrepancy == 0) {
+            shift++;
+            continue;
+        }
+        
+        uint8_t scale = gf.div(discrepancy, previous_discrepancy);
+        uint8_t saved[nsym + 1];
+        std::copy(locator, locator + nsym + 1, saved);
+        for (uint32_t i = 0; i + shift <= nsym; ++i) {
+            locator[i + shift] ^= gf.mul(scale, previous[i]);
+        }
+        if (2 * length <= r) {
+            length = r + 1 - length;
+            std::copy(saved, saved + nsym + 1, previous);
+            previous_discrepancy = discrepancy;
+            shift = 1;
+        } else {
+            shift++;
+        }
+    }
+    if (length > nsym / 2) {
+        return false;
+    }
+    
+    // Error evaluator: syndromes times locator, modulo x^nsym
+    uint8_t evaluator[nsym] = {};
+    for (uint32_t i = 0; i < nsym; ++i) {
+        for (uint32_t j = 0; j <= std::min(i, length); ++j) {
+            evaluator[i] ^= gf.mul(syndromes[i - j], locator[j]);
+        }
+    }
+    
+    // Chien search over the byte positions; byte i is the coefficient of
+    // x^(n - 1 - i), located by X = alpha^(n - 1 - i)
+    uint32_t roots = 0;
+    for (uint32_t i = 0; i < n; ++i) {
+        uint32_t power = n - 1 - i;
+        uint32_t inverse = (255 - power) % 255;
+        
+        uint8_t value = 0;
+        uint8_t derivative = 0;
+        for (uint32_t k = 0; k <= length; ++k) {
+            uint8_t term = gf.mul(locator[k], gf.exp[(inverse * k) % 255]);
+            value ^= term;
+            if (k & 1) {
+                // Formal derivative term k * L_k * x^(k-1), taken at X^-1
+                derivative ^= gf.mul(locator[k], gf.exp[(inverse * (k - 1)) % 255]);
+            }
+        }
+        if (value != 0) {
+            continue;
+        }
+        if (derivative == 0) {
+            return false;
+        }
+        
+        // Forney, first root alpha^0: e = X * Omega(X^-1) / Lambda'(X^-1)
+        uint8_t omega = 0;
+        for (uint32_t k = 0; k < nsym; ++k) {
+            omega ^= gf.mul(evaluator[k], gf.exp[(inverse * k) % 255]);
+        }
+        code[i] ^= gf.mul(gf.exp[power], gf.div(omega, derivative));
+        roots++;
+    }
+    if (roots != length) {
+        return false;
+    }
+    
+    // A locator whose roots all landed in the shortened range can still be
+    // a miscorrection; a codeword has zero syndromes
+    for (uint32_t j = 0; j < nsym; ++j) {
+        uint8_t s = 0;
+        for (uint32_t i = 0; i < n; ++i) {
+            s = gf.mul(s, gf.exp[j]) ^ code[i];
+        }
+        if (s != 0) {
+            return false;
+        }
+    }
+    
+    corrected = roots;
+    return true;
+}
+
+/**
+ * @brief Transpose a 64x64 bit matrix in place: bit c of row r swaps with
+ *        bit r of row c
+ */
+inline void transpose64(uint64_t* rows) {
+    uint64_t mask = 0x00000000FFFFFFFFull;
+    for (uint32_t j = 32; j != 0; j >>= 1, mask ^= mask << j) {
+        for (uint32_t k = 0; k < 64; k = ((k | j) + 1) & ~j) {
+            uint64_t t = ((rows[k] >> j) ^ rows[k | j]) & mask;
+            rows[k | j] ^= t;
+            rows[k] ^= t << j;
+        }
+    }
+}
+
+/**
+ * @brief Plane holding payload bit i after transposing high() and low()
+ */
+constexpr uint32_t messagePlane(uint32_t i) {
+    return (i & ~63u) | (63 - (i & 63));
+}
+
+/**
+ * @brief Bit-sliced encoder for 64 * W payloads
+ *
+ * Each plane holds one bit position of every payload, lane l in bit l % 64
+ * of word l / 64. Inlined into each dispatch target so the word loops are
+ * vectorized for that instruction set.
+ * @param message Payload::kBits planes of W words, see messagePlane()
+ * @param coded Output, kPayloadCodedBits planes of W words
+ */
+template <size_t W>
+__attribute__((always_inline)) inline void encodeSliced(const uint64_t* message, uint64_t* coded) {
+    const GaloisField& gf = field();
+    
+    // Information bits of the convolutional code in order, with the zero
+    // register state before and the zero tail after
+    uint64_t info[(kConvolutionalMemory + kSteps) * W] = {};
+    uint64_t* bits = info + kConvolutionalMemory * W;
+    for (uint32_t i = 0; i < Payload::kBits; ++i) {
+        for (size_t w = 0; w < W; ++w) {
+            bits[i * W + w] = message[messagePlane(i) * W + w];
+        }
+    }
+    
+    // Reed-Solomon parity, one plane per bit b (LSB first) of each parity
+    // register; multiplying by a generator coefficient is a fixed XOR
+    // network over the feedback planes
+    uint64_t parity[kPayloadParityBytes][8][W] = {};
+    for (uint32_t k = 0; k < Payload::kBytes; ++k) {
+        uint64_t feedback[8][W];
+        for (uint32_t b = 0; b < 8; ++b) {
+            for (size_t w = 0; w < W; ++w) {
+                feedback[b][w] = bits[(8 * k + 7 - b) * W + w] ^ parity[0][b][w];
+            }
+        }
+        for (uint32_t j = 0; j < kPayloadParityBytes; ++j) {
+            for (uint32_t o = 0; o < 8; ++o) {
+                uint64_t product[W];
+                for (size_t w = 0; w < W; ++w) {
+                    product[w] = j + 1 < kPayloadParityBytes ? parity[j + 1][o][w] : 0;
+                }
+                for (uint32_t b = 0; b < 8; ++b) {
+                    if ((gf.generator_masks[j][o] >> b) & 1) {
+                        for (size_t w = 0; w < W; ++w) {
+                            product[w] ^= feedback[b][w];
+                        }
+                    }
+                }
+                for (size_t w = 0; w < W; ++w) {
+                    parity[j][o][w] = product[w];
+                }
+            }
+        }
+    }
+    for (uint32_t j = 0; j < kPayloadParityBytes; ++j) {
+        for (uint32_t b = 0; b < 8; ++b) {
+            for (size_t w = 0; w < W; ++w) {
+                bits[((Payload::kBytes + j) * 8 + 7 - b) * W + w] = parity[j][b][w];
+            }
+        }
+    }
+    
+    // Register bit k at step t is information bit t - k
+    for (uint32_t t = 0; t < kSteps; ++t) {
+        for (size_t w = 0; w < W; ++w) {
+            uint64_t out0 = 0;
+            uint64_t out1 = 0;
+            for (uint32_t k = 0; k <= kConvolutionalMemory; ++k) {
+                uint64_t bit = info[(kConvolutionalMemory + t - k) * W + w];
+                out0 ^= (kGenerator0 >> k) & 1 ? bit : 0;
+                out1 ^= (kGenerator1 >> k) & 1 ? bit : 0;
+            }
+            coded[(2 * t) * W + w] = out0;
+            coded[(2 * t + 1) * W + w] = out1;
+        }
+    }
+}
+
+template <size_t W>
+__attribute__((always_inline)) inline void encodeBatch(const Payload* payloads, size_t count,
+                                                       CodedPayload* coded) {
+    constexpr size_t lanes = 64 * W;
+    uint64_t message[Payload::kBits * W];
+    uint64_t sliced[CodedPayload::kWords * 64 * W] = {};
+    uint64_t rows[64];
+    
+    for (size_t first = 0; first < count; first += lanes) {
+        size_t batch = std::min(lanes, count - first);
+        
+        // Rows are payloads, so a transpose turns them into planes; unused
+        // lanes encode the zero payload
+        for (size_t w = 0; w < W; ++w) {
+            for (uint32_t half = 0; half < 2; ++half) {
+                for (size_t l = 0; l < 64; ++l) {
+                    size_t lane = w * 64 + l;
+                    const Payload* payload = lane < batch ? &payloads[first + lane] : nullptr;
+                    rows[l] = payload ? (half ? payload->low() : payload->high()) : 0;
+                }
+                transpose64(rows);
+                for (uint32_t q = 0; q < 64; ++q) {
+                    message[(64 * half + q) * W + w] = rows[q];
+                }
+            }
+        }
+        
+        encodeSliced<W>(message, sliced);
+        
+        // And back: 64 planes at a time become one word of each codeword
+        for (size_t w = 0; w < W; ++w) {
+            for (uint32_t g = 0; g < CodedPayload::kWords; ++g) {
+                for (uint32_t q = 0; q < 64; ++q) {
+                    rows[q] = sliced[(64 * g + q) * W + w];
+                }
+                transpose64(rows);
+                for (size_t l = 0; l < 64 && w * 64 + l < batch; ++l) {
+                    coded[first + w * 64 + l].words[g] = rows[l];
+                }
+            }
+        }
+    }
+}
+
+void encodeBatchScalar(const Payload* payloads, size_t count, CodedPayload* coded) {
+    encodeBatch<1>(payloads, count, coded);
+}
+
+#ifdef PHANTOMFRAME_X86
+
+__attribute__((target("sse2")))
+void encodeBatchSSE2(const Payload* payloads, size_t count, CodedPayload* coded) {
+    encodeBatch<2>(payloads, count, coded);
+}
+
+__attribute__((target("avx2")))
+void encodeBatchAVX2(const Payload* payloads, size_t count, CodedPayload* coded) {
+    encodeBatch<4>(payloads, count, coded);
+}
+
+#endif
+
+} // namespace
+
+void encodePayload(const Payload& payload, CodedPayload& coded) {
+    uint8_t code[kPayloadCodeBytes];
+    std::copy(payload.bytes.begin(), payload.bytes.end(), code);
+    appendParity(code);
+    
+    coded.words.fill(0);
+    uint32_t reg = 0;
+    for (uint32_t t = 0; t < kSteps; ++t) {
+        uint32_t bit = t < kInfoBits ? (code[t / 8] >> (7 - t % 8)) & 1 : 0;
+        reg = ((reg << 1) | bit) & (2 * kStates - 1);
+        uint64_t pair = parity(reg & kGenerator0) | (parity(reg & kGenerator1) << 1);
+        coded.words[t / 32] |= pair << (2 * (t % 32));
+    }
+}
+
+void encodePayloads(const Payload* payloads, size_t count, CodedPayload* coded, SimdLevel level) {
+    if (!payloads || !coded || count == 0) {
+        return;
+    }
+    
+    level = std::min(level, detectSimdLevel());
+
+#ifdef PHANTOMFRAME_X86
+    if (level == SimdLevel::AVX2) {
+        encodeBatchAVX2(payloads, count, coded);
+        return;
+    }
+    if (level >= SimdLevel::SSE2) {
+        encodeBatchSSE2(payloads, count, coded);
+        return;
+    }
+#endif
+
+    encodeBatchScalar(payloads, count, coded);
+}
+
+bool decodePayloadSoft(const float* soft, Payload& payload, SoftDecodeInfo* info) {
+    if (!soft) {
+        return false;
+    }
+    
+    // Channel bit pair of every register value
+    uint8_t outputs[2 * kStates];
+    for (uint32_t reg = 0; reg < 2 * kStates; ++reg) {
+        outputs[reg] = static_cast<uint8_t>((parity(reg & kGenerator0) << 1) | parity(reg & kGenerator1));
+    }
+    
+    // Viterbi over correlation metrics; the encoder starts in state 0
+    float metrics[kStates];
+    float next[kStates];
+    std::fill(metrics, metrics + kStates, kUnreachable);
+    metrics[0] = 0.0f;
+    std::vector<uint64_t> decisions(kSteps);
+    
+    for (uint32_t t = 0; t < kSteps; ++t) {
+        float s0 = soft[2 * t];
+        float s1 = soft[2 * t + 1];
+        const float branch[4] = {s0 + s1, s0 - s1, s1 - s0, -s0 - s1};
+        
+        // State ns is reached from (ns >> 1) and (ns >> 1) | 32 with input ns & 1
+        uint64_t chosen = 0;
+        for (uint32_t ns = 0; ns < kStates; ++ns) {
+            float from0 = metrics[ns >> 1] + branch[outputs[ns]];
+            float from1 = metrics[(ns >> 1) | (kStates >> 1)] + branch[outputs[ns | kStates]];
+            if (from1 > from0) {
+                next[ns] = from1;
+                chosen |= 1ull << ns;
+            } else {
+                next[ns] = from0;
+            }
+        }
+        decisions[t] = chosen;
+        std::copy(next, next + kStates, metrics);
+    }
+    
+    // The tail returns the encoder to state 0
+    uint8_t code[kPayloadCodeBytes] = {};
+    uint32_t state = 0;
+    for (uint32_t t = kSteps; t-- > 0;) {
+        if (t < kInfoBits) {
+            code[t / 8] |= static_cast<uint8_t>((state & 1) << (7 - t % 8));
+        }
+        uint32_t from = static_cast<uint32_t>((decisions[t] >> state) & 1);
+        state = (state >> 1) | (from << (kConvolutionalMemory - 1));
+    }
+    
+    uint32_t corrected = 0;
+    if (!correctBytes(code, corrected)) {
+        return false;
+    }
+    
+    Payload decoded;
+    std::copy(code, code + Payload::kBytes, decoded.bytes.begin());
+    
+    if (info) {
+        // Re-encode to see how well the evidence matches what was decoded
+        CodedPayload expected;
+        encodePayload(decoded, expected);
+        double dot = 0.0;
+        double total = 0.0;
+        for (uint32_t j = 0; j < kPayloadCodedBits; ++j) {
+            dot += expected[j] ? -soft[j] : soft[j];
+            total += soft[j] < 0.0f ? -soft[j] : soft[j];
+        }
+        info->corrected_bytes = corrected;
+        info->agreement = total > 0.0 ? static_cast<float>(dot / total) : 0.0f;
+    }
+    
+    payload = decoded;
+    return true;
+}
+
+} // namespace phantomframe
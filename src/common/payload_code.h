@@ -0,0 +1,88 @@
+#ifndef PHANTOMFRAME_PAYLOAD_CODE_H
+#define PHANTOMFRAME_PAYLOAD_CODE_H
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include "cpu_features.h"
+#include "payload.h"
+
+namespace phantomframe {
+
+// Outer code: Reed-Solomon over GF(256), 16 payload bytes and 8 parity
+// bytes, correcting any 4 byte errors
+constexpr uint32_t kPayloadParityBytes = 8;
+constexpr uint32_t kPayloadCodeBytes = Payload::kBytes + kPayloadParityBytes;
+
+// Inner code: rate 1/2 convolutional code, constraint length 7
+// (generators 171 and 133 octal), terminated with 6 zero tail bits
+constexpr uint32_t kConvolutionalMemory = 6;
+
+// Channel bits carried by the watermark for one payload
+constexpr uint32_t kPayloadCodedBits = 2 * (kPayloadCodeBytes * 8 + kConvolutionalMemory);
+
+/**
+ * @brief Channel bits of one payload, packed 64 to a word
+ */
+struct CodedPayload {
+    static constexpr size_t kWords = (kPayloadCodedBits + 63) / 64;
+
+    std::array<uint64_t, kWords> words; // Bit j in bit j % 64 of words[j / 64]
+
+    bool operator[](size_t j) const { return (words[j / 64] >> (j % 64)) & 1; }
+
+    bool operator==(const CodedPayload& other) const { return words == other.words; }
+    bool operator!=(const CodedPayload& other) const { return words != other.words; }
+};
+
+/**
+ * @brief Details of a soft-decision decode
+ */
+struct SoftDecodeInfo {
+    uint32_t corrected_bytes;   // Byte errors the outer code corrected after Viterbi
+    float agreement;            // Correlation of the evidence with the decoded codeword, -1 to 1
+};
+
+/**
+ * @brief Encode a payload into channel bits
+ * @param payload Payload to encode
+ * @param coded Output channel bits
+ */
+void encodePayload(const Payload& payload, CodedPayload& coded);
+
+/**
+ * @brief Encode many payloads at once
+ *
+ * Bit-sliced: bit i of every payload in a batch is packed into one lane
+ * word, so each XOR of the Reed-Solomon and convolutional encoders works
+ * on 64 payloads (scalar), 128 (SSE2) or 256 (AVX2) at a time. Output is
+ * identical to encodePayload() for each payload; use it when codewords
+ * are needed for many viewers or sessions.
+ * @param payloads Payloads to encode
+ * @param count Number of payloads
+ * @param coded Output channel bits, count entries
+ * @param level Kernel to use, clamped to what the CPU supports
+ */
+void encodePayloads(const Payload* payloads, size_t count, CodedPayload* coded,
+                    SimdLevel level = detectSimdLevel());
+
+/**
+ * @brief Decode a payload from soft evidence on its channel bits
+ *
+ * Runs a soft-decision Viterbi decoder over the evidence and corrects the
+ * remaining byte errors with the outer code. Evidence is summed over all
+ * frames before decoding, so weak per-frame correlations add up and a
+ * payload is recovered from fewer frames than hard decisions would need.
+ * Evidence that fits no codeword within the outer code's reach is
+ * rejected, which doubles as an integrity check.
+ * @param soft Evidence per channel bit, kPayloadCodedBits entries; positive
+ *        favours 0, negative favours 1, magnitude is reliability
+ * @param payload Output payload, left unchanged on failure
+ * @param info Optional decode details
+ * @return true if a payload was decoded
+ */
+bool decodePayloadSoft(const float* soft, Payload& payload, SoftDecodeInfo* info = nullptr);
+
+} // namespace phantomframe
+
+#endif // PHANTOMFRAME_PAYLOAD_CODE_H
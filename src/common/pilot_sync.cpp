@@ -0,0 +1,376 @@
+#include "pilot_sync.h"
+#include <algorithm>
+#include <cmath>
+#include <complex>
+
+namespace phantomframe {
+
+namespace {
+
+using Complex = std::complex<float>;
+
+constexpr double kPi = 3.14159265358979323846;
+
+// Locks below this peak-to-RMS ratio are rejected; the largest of the
+// 4096 cells of a correlation surface of pure noise stays under about 5
+constexpr float kLockThreshold = 7.0f;
+
+// Fold cells are 8 reference pixels, so a tile is 64 x 64 of them
+constexpr uint32_t kFoldPixels = 8;
+constexpr uint32_t kFoldCells = PilotPattern::kTilePixels / kFoldPixels;
+
+// Scale refinement: steps either side of the autocorrelation estimate
+constexpr int kRefineSteps = 4;
+constexpr float kRefineStep = 0.0025f;
+
+uint64_t mix64(uint64_t x) {
+    x += 0x9e3779b97f4a7c15ULL;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+
+uint32_t nextPowerOfTwo(uint32_t value) {
+    uint32_t n = 1;
+    while (n < value) {
+        n <<= 1;
+    }
+    return n;
+}
+
+// In-place iterative radix-2 FFT; n must be a power of two. The inverse
+// is unscaled.
+void fft(Complex* data, uint32_t n, bool inverse) {
+    for (uint32_t i = 1, j = 0; i < n; ++i) {
+        uint32_t bit = n >> 1;
+        for (; j & bit; bit >>= 1) {
+            j ^= bit;
+        }
+        j ^= bit;
+        if (i < j) {
+            std::swap(data[i], data[j]);
+        }
+    }
+    
+    for (uint32_t len = 2; len <= n; len <<= 1) {
+        double angle = (inverse ? 2.0 : -2.0) * kPi / len;
+        Complex step(static_cast<float>(std::cos(angle)), static_cast<float>(std::sin(angle)));
+        for (uint32_t start = 0; start < n; start += len) {
+            Complex w(1.0f, 0.0f);
+            for (uint32_t k = 0; k < len / 2; ++k) {
+                Complex even = data[start + k];
+                Complex odd = data[start + k + len / 2] * w;
+                data[start + k] = even + odd;
+                data[start + k + len / 2] = even - odd;
+                w *= step;
+            }
+        }
+    }
+}
+
+// 2D FFT of a size x size row-major array
+void fft2(Complex* data, uint32_t size, bool inverse) {
+    for (uint32_t row = 0; row < size; ++row) {
+        fft(data + static_cast<size_t>(row) * size, size, inverse);
+    }
+    
+    std::vector<Complex> column(size);
+    for (uint32_t col = 0; col < size; ++col) {
+        for (uint32_t row = 0; row < size; ++row) {
+            column[row] = data[static_cast<size_t>(row) * size + col];
+        }
+        fft(column.data(), size, inverse);
+        for (uint32_t row = 0; row < size; ++row) {
+            data[static_cast<size_t>(row) * size + col] = column[row];
+        }
+    }
+}
+
+struct OffsetPeak {
+    float x;
+    float y;
+    float strength;
+};
+
+// Peak position between three samples, from a parabola through them
+float interpolatePeak(float left, float centre, float right) {
+    float curvature = left - 2.0f * centre + right;
+    float shift = curvature < 0.0f ? 0.5f * (left - right) / curvature : 0.0f;
+    return std::max(-0.5f, std::min(0.5f, shift));
+}
+
+// Fold the demodulated map onto one tile at the given scale and find the
+// circular shift that best matches the pilot tile
+OffsetPeak correlateTile(const std::vector<float>& map, uint32_t blocks_x, uint32_t blocks_y,
+                         float scale, const std::vector<Complex>& tile_spectrum) {
+    std::vector<float> sums(kFoldCells * kFoldCells, 0.0f);
+    std::vector<uint32_t> counts(kFoldCells * kFoldCells, 0);
+    for (uint32_t by = 0; by < blocks_y; ++by) {
+        uint32_t fy = static_cast<uint32_t>((by * 8 + 4) / scale / kFoldPixels) % kFoldCells;
+        for (uint32_t bx = 0; bx < blocks_x; ++bx) {
+            uint32_t fx = static_cast<uint32_t>((bx * 8 + 4) / scale / kFoldPixels) % kFoldCells;
+            sums[fy * kFoldCells + fx] += map[static_cast<size_t>(by) * blocks_x + bx];
+            counts[fy * kFoldCells + fx]++;
+        }
+    }
+    
+    double mean = 0.0;
+    uint32_t filled = 0;
+    for (size_t i = 0; i < sums.size(); ++i) {
+        if (counts[i] > 0) {
+            sums[i] /= counts[i];
+            mean += sums[i];
+            filled++;
+        }
+    }
+    mean = filled > 0 ? mean / filled : 0.0;
+    
+    std::vector<Complex> folded(sums.size());
+    for (size_t i = 0; i < sums.size(); ++i) {
+        folded[i] = counts[i] > 0 ? Complex(static_cast<float>(sums[i] - mean), 0.0f) : Complex();
+    }
+    
+    // C(d) = sum_f F(f) T(f + d), so the peak is the tile position of the
+    // frame's corner
+    fft2(folded.data(), kFoldCells, false);
+    for (size_t i = 0; i < folded.size(); ++i) {
+        folded[i] = std::conj(folded[i]) * tile_spectrum[i];
+    }
+    fft2(folded.data(), kFoldCells, true);
+    
+    uint32_t best = 0;
+    double energy = 0.0;
+    for (uint32_t i = 0; i < kFoldCells * kFoldCells; ++i) {
+        float value = folded[i].real();
+        energy += static_cast<double>(value) * value;
+        if (value > folded[best].real()) {
+            best = i;
+        }
+    }
+    
+    // The correlation is circular, so the neighbours wrap
+    uint32_t x = best % kFoldCells;
+    uint32_t y = best / kFoldCells;
+    auto at = [&folded](uint32_t cx, uint32_t cy) {
+        return folded[(cy % kFoldCells) * kFoldCells + cx % kFoldCells].real();
+    };
+    float peak = at(x, y);
+    OffsetPeak result;
+    result.x = x + interpolatePeak(at(x + kFoldCells - 1, y), peak, at(x + 1, y));
+    result.y = y + interpolatePeak(at(x, y + kFoldCells - 1), peak, at(x, y + 1));
+    
+    double rms = std::sqrt(energy / (kFoldCells * kFoldCells));
+    result.strength = rms > 0.0 ? static_cast<float>(peak / rms) : 0.0f;
+    return result;
+}
+
+} // namespace
+
+PilotPattern::PilotPattern()
+    : density_(0.0f), tile_(kTileCells * kTileCells, 0), signs_(1, 1) {
+}
+
+PilotPattern::PilotPattern(uint32_t seed, float density, uint32_t temporal_period)
+    : density_(density),
+      tile_(kTileCells * kTileCells, 0) {
+    uint64_t key = mix64(0x70696c6f74ULL ^ seed);
+    
+    if (density_ > 0.0f) {
+        uint64_t threshold = static_cast<uint64_t>(density_ * 16777216.0);
+        for (uint32_t i = 0; i < tile_.size(); ++i) {
+            uint64_t h = mix64(key + i);
+            if ((h & 0xFFFFFF) < threshold) {
+                tile_[i] = (h >> 63) ? 1 : -1;
+            }
+        }
+    }
+    
+    // Balanced so the static picture cancels when the phases are summed
+    uint32_t period = std::max<uint32_t>(1, temporal_period);
+    signs_.resize(period);
+    for (uint32_t i = 0; i < period; ++i) {
+        signs_[i] = i < (period + 1) / 2 ? 1 : -1;
+    }
+    for (uint32_t i = period; i > 1; --i) {
+        uint32_t j = static_cast<uint32_t>(mix64(key ^ (static_cast<uint64_t>(i) << 32)) % i);
+        std::swap(signs_[i - 1], signs_[j]);
+    }
+}
+
+PilotSync::PilotSync(const PilotPattern& pattern, uint32_t blocks_x, uint32_t blocks_y)
+    : pattern_(pattern), blocks_x_(blocks_x), blocks_y_(blocks_y), frames_(0),
+      total_(static_cast<size_t>(blocks_x) * blocks_y, 0.0),
+      phase_sums_(static_cast<size_t>(blocks_x) * blocks_y * pattern.period(), 0.0),
+      phase_counts_(pattern.period(), 0) {
+}
+
+void PilotSync::addFrame(const float* activity, uint32_t frame_index) {
+    size_t count = total_.size();
+    if (count == 0) {
+        return;
+    }
+    
+    // A flattened block has less activity, so negate to make a positive
+    // pilot cell a positive response; the frame mean follows brightness
+    double mean = 0.0;
+    for (size_t i = 0; i < count; ++i) {
+        mean += activity[i];
+    }
+    mean /= count;
+    
+    uint32_t phase = frame_index % pattern_.period();
+    double* sums = phase_sums_.data() + phase * count;
+    for (size_t i = 0; i < count; ++i) {
+        double response = mean - activity[i];
+        total_[i] += response;
+        sums[i] += response;
+    }
+    phase_counts_[phase]++;
+    frames_++;
+}
+
+PilotLock PilotSync::lock() const {
+    PilotLock result = {false, 1.0f, 0, 0, 0, 0.0f};
+    uint32_t period = pattern_.period();
+    size_t count = total_.size();
+    if (!pattern_.enabled() || period < 2 || frames_ < 2 || count == 0) {
+        return result;
+    }
+    
+    // Per-phase means with the static picture removed; a phase without
+    // frames contributes nothing
+    std::vector<float> phases(count * period, 0.0f);
+    for (uint32_t k = 0; k < period; ++k) {
+        if (phase_counts_[k] == 0) {
+            continue;
+        }
+        const double* sums = phase_sums_.data() + k * count;
+        float* out = phases.data() + k * count;
+        for (size_t i = 0; i < count; ++i) {
+            out[i] = static_cast<float>(sums[i] / phase_counts_[k] - total_[i] / frames_);
+        }
+    }
+    
+    // Energy of the map demodulated at phase p is s' G s with s the sign
+    // sequence shifted by p, so one Gram matrix serves every phase
+    std::vector<double> gram(static_cast<size_t>(period) * period, 0.0);
+    for (uint32_t a = 0; a < period; ++a) {
+        for (uint32_t b = a; b < period; ++b) {
+            const float* pa = phases.data() + a * count;
+            const float* pb = phases.data() + b * count;
+            double dot = 0.0;
+            for (size_t i = 0; i < count; ++i) {
+                dot += static_cast<double>(pa[i]) * pb[i];
+            }
+            gram[a * period + b] = dot;
+            gram[b * period + a] = dot;
+        }
+    }
+    
+    double best_energy = -INFINITY;
+    for (uint32_t p = 0; p < period; ++p) {
+        double energy = 0.0;
+        for (uint32_t a = 0; a < period; ++a) {
+            double row = 0.0;
+            for (uint32_t b = 0; b < period; ++b) {
+                row += pattern_.sign(b + p) * gram[a * period + b];
+            }
+            energy += pattern_.sign(a + p) * row;
+        }
+        if (energy > best_energy) {
+            best_energy = energy;
+            result.phase = p;
+        }
+    }
+    
+    std::vector<float> map(count, 0.0f);
+    for (uint32_t k = 0; k < period; ++k) {
+        float sign = pattern_.sign(k + result.phase);
+        const float* pk = phases.data() + k * count;
+        for (size_t i = 0; i < count; ++i) {
+            map[i] += sign * pk[i];
+        }
+    }
+    
+    // Scale: summed row autocorrelation, unbiased by the overlap, peaks at
+    // the tile period in blocks
+    const float tile_blocks = PilotPattern::kTilePixels / 8.0f;
+    uint32_t min_lag = static_cast<uint32_t>(std::floor(tile_blocks * PilotSync::kMinScale));
+    uint32_t max_lag = std::min(static_cast<uint32_t>(std::ceil(tile_blocks * PilotSync::kMaxScale)),
+                                blocks_x_ * 3 / 4);
+    if (max_lag <= min_lag + 1) {
+        return result;
+    }
+    
+    uint32_t n = nextPowerOfTwo(2 * blocks_x_);
+    std::vector<Complex> row(n);
+    std::vector<float> power(n, 0.0f);
+    for (uint32_t y = 0; y < blocks_y_; ++y) {
+        std::fill(row.begin(), row.end(), Complex());
+        for (uint32_t x = 0; x < blocks_x_; ++x) {
+            row[x] = Complex(map[static_cast<size_t>(y) * blocks_x_ + x], 0.0f);
+        }
+        fft(row.data(), n, false);
+        for (uint32_t i = 0; i < n; ++i) {
+            power[i] += std::norm(row[i]);
+        }
+    }
+    for (uint32_t i = 0; i < n; ++i) {
+        row[i] = Complex(power[i], 0.0f);
+    }
+    fft(row.data(), n, true);
+    
+    std::vector<float> autocorr(max_lag + 2, 0.0f);
+    float peak = -INFINITY;
+    for (uint32_t lag = min_lag - 1; lag <= max_lag + 1; ++lag) {
+        autocorr[lag] = row[lag].real() / (blocks_x_ - lag);
+        if (lag >= min_lag && lag <= max_lag) {
+            peak = std::max(peak, autocorr[lag]);
+        }
+    }
+    if (!(peak > 0.0f)) {
+        return result;
+    }
+    
+    // Multiples of the period also peak, so take the first strong one
+    uint32_t lag = min_lag;
+    for (uint32_t l = min_lag; l <= max_lag; ++l) {
+        if (autocorr[l] >= 0.6f * peak && autocorr[l] >= autocorr[l - 1] &&
+            autocorr[l] >= autocorr[l + 1]) {
+            lag = l;
+            break;
+        }
+    }
+    float estimate = (lag + interpolatePeak(autocorr[lag - 1], autocorr[lag], autocorr[lag + 1])) / 
+                     tile_blocks;
+    
+    // Offset: a few fold-and-correlate passes around the estimate, which
+    // also refine the scale
+    std::vector<Complex> tile_spectrum(kFoldCells * kFoldCells);
+    for (uint32_t y = 0; y < kFoldCells; ++y) {
+        for (uint32_t x = 0; x < kFoldCells; ++x) {
+            uint32_t per_cell = PilotPattern::kCellPixels / kFoldPixels;
+            tile_spectrum[y * kFoldCells + x] = Complex(pattern_.cell(x / per_cell, y / per_cell), 0.0f);
+        }
+    }
+    fft2(tile_spectrum.data(), kFoldCells, false);
+    
+    for (int step = -kRefineSteps; step <= kRefineSteps; ++step) {
+        float scale = estimate * (1.0f + step * kRefineStep);
+        OffsetPeak offset = correlateTile(map, blocks_x_, blocks_y_, scale, tile_spectrum);
+        if (offset.strength > result.strength) {
+            result.strength = offset.strength;
+            result.scale = scale;
+            float tile = static_cast<float>(PilotPattern::kTilePixels);
+            result.offset_x = static_cast<uint32_t>(std::lround(offset.x * kFoldPixels + tile)) % 
+                              PilotPattern::kTilePixels;
+            result.offset_y = static_cast<uint32_t>(std::lround(offset.y * kFoldPixels + tile)) % 
+                              PilotPattern::kTilePixels;
+        }
+    }
+    
+    result.locked = result.strength >= kLockThreshold;
+    return result;
+}
+
+} // namespace phantomframe
@@ -0,0 +1,140 @@
+#ifndef PHANTOMFRAME_PILOT_SYNC_H
+#define PHANTOMFRAME_PILOT_SYNC_H
+
+#include <cstdint>
+#include <vector>
+
+namespace phantomframe {
+
+/**
+ * @brief Keyed sync pilot carried next to the payload
+ *
+ * A sparse +-1 pattern on cells of one macroblock of the reference
+ * picture, repeated as a tile of kTileCells x kTileCells cells, and
+ * multiplied per frame by a balanced +-1 sequence over the temporal
+ * period. The pilot carries no information; it gives the extractor
+ * something known to lock onto when a clip has been cropped, rescaled or
+ * cut from the middle of a stream. Its period in the picture reveals the
+ * scale, its position within the tile the crop offset, and its sign
+ * sequence the frame phase.
+ */
+class PilotPattern {
+public:
+    static constexpr uint32_t kCellPixels = 16;     // Reference pixels per cell side, one macroblock
+    static constexpr uint32_t kTileCells = 32;      // Cells per tile side
+    static constexpr uint32_t kTilePixels = kCellPixels * kTileCells;
+
+    PilotPattern();
+
+    /**
+     * @brief Build the pattern
+     * @param seed Watermark seed
+     * @param density Fraction of cells carrying the pilot, 0 for none
+     * @param temporal_period Period of the schedule the pilot runs with
+     */
+    PilotPattern(uint32_t seed, float density, uint32_t temporal_period);
+
+    /**
+     * @brief Pilot value of a cell of the reference picture
+     * @param cell_x Cell column, any value (the tile repeats)
+     * @param cell_y Cell row, any value
+     * @return +1 or -1 on a pilot cell, 0 elsewhere
+     */
+    int8_t cell(uint32_t cell_x, uint32_t cell_y) const {
+        return tile_[(cell_y % kTileCells) * kTileCells + cell_x % kTileCells];
+    }
+
+    /**
+     * @brief Sign the pilot is multiplied with in a frame
+     * @param frame_index Scene-relative frame index, as the schedule uses
+     * @return +1 or -1
+     */
+    int8_t sign(uint32_t frame_index) const { return signs_[frame_index % signs_.size()]; }
+
+    bool enabled() const { return density_ > 0.0f; }
+    float density() const { return density_; }
+    uint32_t period() const { return static_cast<uint32_t>(signs_.size()); }
+
+private:
+    float density_;
+    std::vector<int8_t> tile_;  // kTileCells * kTileCells cells, row-major
+    std::vector<int8_t> signs_; // One sign per phase of the period, half of them +1
+};
+
+/**
+ * @brief Geometry and frame phase recovered from the pilot
+ */
+struct PilotLock {
+    bool locked;                // Whether the correlation peak cleared the threshold
+    float scale;                // Frame pixels per reference pixel
+    uint32_t offset_x;          // Reference column at the frame's left edge, modulo kTilePixels
+    uint32_t offset_y;          // Reference row at the frame's top edge, modulo kTilePixels
+    uint32_t phase;             // Add to a frame's scene-relative index to get the encoder's, modulo the period
+    float strength;             // Correlation peak over the RMS of the correlation surface
+};
+
+/**
+ * @brief Locks onto the pilot in per-block flatness maps of a clip
+ *
+ * Frames are added as maps of one activity value per 8x8 block of the
+ * frame (block standard deviation, as the extractor samples marks with),
+ * together with their scene-relative index. lock() then takes a few
+ * correlation passes instead of searching offset, scale and phase
+ * exhaustively:
+ *  - Phase: the static picture is removed by subtracting the mean map,
+ *    the rest is averaged per phase of the period, and the phase whose
+ *    sign sequence concentrates the most energy is picked from the Gram
+ *    matrix of the phase maps. This needs no geometry.
+ *  - Scale: the demodulated map repeats with the tile, so its horizontal
+ *    autocorrelation, computed with one FFT per row, peaks at the tile
+ *    period in blocks.
+ *  - Offset: the map is folded modulo the tile at that scale and circularly
+ *    cross-correlated with the tile through a 2D FFT; the peak gives the
+ *    reference position of the frame's corner to within one block.
+ * Scales between kMinScale and kMaxScale are searched; below that a cell
+ * falls under one 8x8 block and the pilot blurs away.
+ */
+class PilotSync {
+public:
+    static constexpr float kMinScale = 0.5f;
+    static constexpr float kMaxScale = 1.5f;
+
+    /**
+     * @brief Create a search
+     * @param pattern Pilot to look for
+     * @param blocks_x Map width in 8x8 blocks
+     * @param blocks_y Map height in 8x8 blocks
+     */
+    PilotSync(const PilotPattern& pattern, uint32_t blocks_x, uint32_t blocks_y);
+
+    /**
+     * @brief Add one frame
+     *
+     * All frames added must share the unknown phase, i.e. come from one
+     * scene of the clip.
+     * @param activity blocks_x * blocks_y block activities, row-major
+     * @param frame_index Scene-relative index of the frame
+     */
+    void addFrame(const float* activity, uint32_t frame_index);
+
+    /**
+     * @brief Search for the pilot in the frames added so far
+     * @return Lock; locked is false when no pilot was found
+     */
+    PilotLock lock() const;
+
+    uint32_t frameCount() const { return frames_; }
+
+private:
+    PilotPattern pattern_;
+    uint32_t blocks_x_;
+    uint32_t blocks_y_;
+    uint32_t frames_;
+    std::vector<double> total_;         // Sum of all maps
+    std::vector<double> phase_sums_;    // Sum of the maps of each phase, period maps
+    std::vector<uint32_t> phase_counts_;
+};
+
+} // namespace phantomframe
+
+#endif // PHANTOMFRAME_PILOT_SYNC_H
@@ -0,0 +1,230 @@
+#include "scene_cut.h"
+#include <algorithm>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define PHANTOMFRAME_X86 1
+#endif
+
+namespace phantomframe {
+
+namespace {
+
+// Rows sampled in each macroblock, every kRowStep-th from the top
+constexpr uint32_t kRowStep = 4;
+constexpr uint32_t kSampleRows = 16 / kRowStep;
+
+// A cut scores at least this many times the scene's recent average
+constexpr float kCutRatio = 3.0f;
+
+/**
+ * @brief Thumbnail entries [first_mb, last_mb) of one macroblock row
+ */
+void thumbnailRowScalar(const uint8_t* row, size_t stride,
+                        uint32_t first_mb, uint32_t last_mb, uint8_t* out) {
+    for (uint32_t mb = first_mb; mb < last_mb; ++mb) {
+        uint32_t sum = 0;
+        for (uint32_t r = 0; r < kSampleRows; ++r) {
+            const uint8_t* p = row + r * kRowStep * stride + mb * 16;
+            for (uint32_t x = 0; x < 16; ++x) {
+                sum += p[x];
+            }
+        }
+        out[mb] = static_cast<uint8_t>(sum / (16 * kSampleRows));
+    }
+}
+
+uint64_t sumAbsDiffScalar(const uint8_t* a, const uint8_t* b, size_t count) {
+    uint64_t sum = 0;
+    for (size_t i = 0; i < count; ++i) {
+        sum += a[i] > b[i] ? a[i] - b[i] : b[i] - a[i];
+    }
+    return sum;
+}
+
+#ifdef PHANTOMFRAME_X86
+
+/**
+ * @brief One macroblock per 16-byte load; psadbw against zero sums each half
+ */
+__attribute__((target("sse2")))
+uint32_t thumbnailRowSSE2(const uint8_t* row, size_t stride, uint32_t full_mbs, uint8_t* out) {
+    const __m128i zero = _mm_setzero_si128();
+    
+    for (uint32_t mb = 0; mb < full_mbs; ++mb) {
+        __m128i sum = zero;
+        for (uint32_t r = 0; r < kSampleRows; ++r) {
+            __m128i p = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row + r * kRowStep * stride + mb * 16));
+            sum = _mm_add_epi64(sum, _mm_sad_epu8(p, zero));
+        }
+        sum = _mm_add_epi64(sum, _mm_srli_si128(sum, 8));
+        out[mb] = static_cast<uint8_t>(static_cast<uint32_t>(_mm_cvtsi128_si32(sum)) / (16 * kSampleRows));
+    }
+    
+    return full_mbs;
+}
+
+/**
+ * @brief Two macroblocks per 32-byte load, one in each 128-bit lane
+ */
+__attribute__((target("avx2")))
+uint32_t thumbnailRowAVX2(const uint8_t* row, size_t stride, uint32_t full_mbs, uint8_t* out) {
+    const __m256i zero = _mm256_setzero_si256();
+    uint32_t mb = 0;
+    
+    for (; mb + 2 <= full_mbs; mb += 2) {
+        __m256i sum = zero;
+        for (uint32_t r = 0; r < kSampleRows; ++r) {
+            __m256i p = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(row + r * kRowStep * stride + mb * 16));
+            sum = _mm256_add_epi64(sum, _mm256_sad_epu8(p, zero));
+        }
+        
+        alignas(32) uint64_t sums[4];
+        _mm256_store_si256(reinterpret_cast<__m256i*>(sums), sum);
+        out[mb] = static_cast<uint8_t>((sums[0] + sums[1]) / (16 * kSampleRows));
+        out[mb + 1] = static_cast<uint8_t>((sums[2] + sums[3]) / (16 * kSampleRows));
+    }
+    
+    return mb;
+}
+
+__attribute__((target("sse2")))
+size_t sumAbsDiffSSE2(const uint8_t* a, const uint8_t* b, size_t count, uint64_t& total) {
+    __m128i sum = _mm_setzero_si128();
+    size_t i = 0;
+    
+    for (; i + 16 <= count; i += 16) {
+        __m128i pa = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i));
+        __m128i pb = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i));
+        sum = _mm_add_epi64(sum, _mm_sad_epu8(pa, pb));
+    }
+    
+    alignas(16) uint64_t sums[2];
+    _mm_store_si128(reinterpret_cast<__m128i*>(sums), sum);
+    total += sums[0] + sums[1];
+    return i;
+}
+
+__attribute__((target("avx2")))
+size_t sumAbsDiffAVX2(const uint8_t* a, const uint8_t* b, size_t count, uint64_t& total) {
+    __m256i sum = _mm256_setzero_si256();
+    size_t i = 0;
+    
+    for (; i + 32 <= count; i += 32) {
+        __m256i pa = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + i));
+        __m256i pb = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + i));
+        sum = _mm256_add_epi64(sum, _mm256_sad_epu8(pa, pb));
+    }
+    
+    alignas(32) uint64_t sums[4];
+    _mm256_store_si256(reinterpret_cast<__m256i*>(sums), sum);
+    total += sums[0] + sums[1] + sums[2] + sums[3];
+    return i;
+}
+
+#endif // PHANTOMFRAME_X86
+
+} // namespace
+
+void computeLumaThumbnail(const uint8_t* luma, size_t stride,
+                          uint32_t width, uint32_t height,
+                          uint8_t* thumbnail, SimdLevel level) {
+    if (!luma || !thumbnail) {
+        return;
+    }
+    
+    uint32_t mbs_x = width / 16;
+    uint32_t mbs_y = height / 16;
+    
+    for (uint32_t mby = 0; mby < mbs_y; ++mby) {
+        const uint8_t* row = luma + static_cast<size_t>(mby) * 16 * stride;
+        uint8_t* out = thumbnail + static_cast<size_t>(mby) * mbs_x;
+        uint32_t done = 0;
+        
+#ifdef PHANTOMFRAME_X86
+        if (level == SimdLevel::AVX2) {
+            done = thumbnailRowAVX2(row, stride, mbs_x, out);
+        }
+        if (level >= SimdLevel::SSE2) {
+            done += thumbnailRowSSE2(row + done * 16, stride, mbs_x - done, out + done);
+        }
+#endif
+        
+        thumbnailRowScalar(row, stride, done, mbs_x, out);
+    }
+}
+
+uint64_t sumAbsDiff(const uint8_t* a, const uint8_t* b, size_t count, SimdLevel level) {
+    if (!a || !b) {
+        return 0;
+    }
+    
+    uint64_t total = 0;
+    size_t done = 0;
+    
+#ifdef PHANTOMFRAME_X86
+    if (level == SimdLevel::AVX2) {
+        done = sumAbsDiffAVX2(a, b, count, total);
+    }
+    if (level >= SimdLevel::SSE2) {
+        done += sumAbsDiffSSE2(a + done, b + done, count - done, total);
+    }
+#endif
+    
+    return total + sumAbsDiffScalar(a + done, b + done, count - done);
+}
+
+SceneCutDetector::SceneCutDetector(float threshold, SimdLevel level)
+    : threshold_(threshold), level_(std::min(level, detectSimdLevel())), has_previous_(false), 
+      average_score_(0.0f), last_score_(0.0f) {
+}
+
+bool SceneCutDetector::process(const uint8_t* luma, size_t stride, uint32_t width, uint32_t height) {
+    size_t cells = static_cast<size_t>(width / 16) * (height / 16);
+    if (!enabled() || !luma || cells == 0) {
+        return false;
+    }
+    
+    // A new size cannot be compared with the last frame
+    if (current_.size() != cells) {
+        reserve(width, height);
+    }
+    
+    computeLumaThumbnail(luma, stride, width, height, current_.data(), level_);
+    if (!has_previous_) {
+        current_.swap(previous_);
+        has_previous_ = true;
+        average_score_ = 0.0f;
+        last_score_ = 0.0f;
+        return false;
+    }
+    
+    last_score_ = static_cast<float>(sumAbsDiff(current_.data(), previous_.data(), cells, level_)) / cells;
+    current_.swap(previous_);
+    
+    // After a cut the average restarts at a third of the cut's score, so a
+    // scene with heavy motion does not cut again on every frame
+    bool cut = last_score_ >= threshold_ && last_score_ > kCutRatio * average_score_;
+    if (cut) {
+        average_score_ = last_score_ / kCutRatio;
+    } else {
+        average_score_ += (last_score_ - average_score_) / 8.0f;
+    }
+    
+    return cut;
+}
+
+void SceneCutDetector::reserve(uint32_t width, uint32_t height) {
+    size_t cells = static_cast<size_t>(width / 16) * (height / 16);
+    current_.assign(cells, 0);
+    previous_.assign(cells, 0);
+    has_previous_ = false;
+}
+
+void SceneCutDetector::reset() {
+    has_previous_ = false;
+    average_score_ = 0.0f;
+    last_score_ = 0.0f;
+}
+
+} // namespace phantomframe
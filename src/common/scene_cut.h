@@ -0,0 +1,108 @@
+#ifndef PHANTOMFRAME_SCENE_CUT_H
+#define PHANTOMFRAME_SCENE_CUT_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "cpu_features.h"
+
+namespace phantomframe {
+
+/**
+ * @brief Compute an 8-bit thumbnail of a luma plane, one value per macroblock
+ *
+ * Each entry is the mean of rows 0, 4, 8 and 12 of a 16x16 macroblock, so
+ * a quarter of the rows is read. Macroblocks cut off by the right or
+ * bottom edge are left out.
+ * @param luma First byte of the luma plane
+ * @param stride Bytes between the starts of two rows
+ * @param width Plane width in pixels
+ * @param height Plane height in pixels
+ * @param thumbnail Output, (width / 16) * (height / 16) entries in raster order
+ * @param level Kernel to use, no higher than detectSimdLevel()
+ */
+void computeLumaThumbnail(const uint8_t* luma, size_t stride,
+                          uint32_t width, uint32_t height,
+                          uint8_t* thumbnail,
+                          SimdLevel level = detectSimdLevel());
+
+/**
+ * @brief Sum of absolute differences of two byte arrays
+ * @param a First array
+ * @param b Second array
+ * @param count Number of bytes
+ * @param level Kernel to use, no higher than detectSimdLevel()
+ * @return Sum of |a[i] - b[i]|
+ */
+uint64_t sumAbsDiff(const uint8_t* a, const uint8_t* b, size_t count,
+                    SimdLevel level = detectSimdLevel());
+
+/**
+ * @brief Hard cut detector on downsampled luma
+ *
+ * Scores each frame by the mean absolute change of its thumbnail against
+ * the previous frame's, in luma levels. A frame starts a new scene when
+ * its score reaches the threshold and is several times the recent average,
+ * so steady motion and slow fades do not trigger. The encoder and the
+ * extractor run the same detector on the same picture content and agree
+ * on the cuts up to compression noise, which is far below a cut's score.
+ */
+class SceneCutDetector {
+public:
+    /**
+     * @brief Create a detector
+     * @param threshold Minimum score of a cut in luma levels (0-255), 0 disables
+     * @param level Kernel to use, clamped here to what the CPU supports
+     */
+    explicit SceneCutDetector(float threshold = 0.0f, SimdLevel level = detectSimdLevel());
+
+    /**
+     * @brief Score the next frame in display order
+     * @param luma First byte of the luma plane
+     * @param stride Bytes between the starts of two rows
+     * @param width Plane width in pixels
+     * @param height Plane height in pixels
+     * @return true if the frame starts a new scene
+     */
+    bool process(const uint8_t* luma, size_t stride, uint32_t width, uint32_t height);
+
+    /**
+     * @brief Size the thumbnails for frames of the given size, so that
+     * process() allocates nothing for them
+     * @param width Plane width in pixels
+     * @param height Plane height in pixels
+     */
+    void reserve(uint32_t width, uint32_t height);
+
+    /**
+     * @brief Forget the previous frame, e.g. after a seek
+     */
+    void reset();
+
+    /**
+     * @brief Change the cut threshold
+     * @param threshold Minimum score of a cut, 0 disables
+     */
+    void setThreshold(float threshold) { threshold_ = threshold; }
+
+    bool enabled() const { return threshold_ > 0.0f; }
+    float threshold() const { return threshold_; }
+    float lastScore() const { return last_score_; }
+
+private:
+    float threshold_;
+    SimdLevel level_;
+    
+    // Thumbnails of the current and previous frame, swapped every frame
+    std::vector<uint8_t> current_;
+    std::vector<uint8_t> previous_;
+    bool has_previous_;
+    
+    // Smoothed score of recent frames within the scene
+    float average_score_;
+    float last_score_;
+};
+
+} // namespace phantomframe
+
+#endif // PHANTOMFRAME_SCENE_CUT_H
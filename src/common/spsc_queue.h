@@ -0,0 +1,171 @@
+#ifndef PHANTOMFRAME_SPSC_QUEUE_H
+#define PHANTOMFRAME_SPSC_QUEUE_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+namespace phantomframe {
+
+/**
+ * @brief Bounded lock-free single-producer/single-consumer ring buffer
+ *
+ * Exactly one thread may call the push functions and exactly one other
+ * thread the pop functions. Storage is allocated once at construction.
+ *
+ * The blocking push() and pop() retry briefly, then sleep on a condition
+ * variable until the other side makes progress, so a stage waiting on a
+ * slower one does not take a core from it. The mutex is only touched when
+ * a side is actually asleep.
+ */
+template<typename T>
+class SpscQueue {
+public:
+    explicit SpscQueue(size_t capacity)
+        : slots_(roundUpPowerOfTwo(capacity + 1)), mask_(slots_.size() - 1),
+          head_(0), tail_(0), sleepers_(0) {
+    }
+
+    SpscQueue(const SpscQueue&) = delete;
+    SpscQueue& operator=(const SpscQueue&) = delete;
+
+    /**
+     * @brief Push an item if there is room
+     * @param item Item to push
+     * @return false if the queue is full
+     */
+    bool tryPush(const T& item) {
+        size_t tail = tail_.load(std::memory_order_relaxed);
+        size_t next = (tail + 1) & mask_;
+        if (next == head_.load(std::memory_order_acquire)) {
+            return false;
+        }
+        slots_[tail] = item;
+        tail_.store(next, std::memory_order_release);
+        notify();
+        return true;
+    }
+
+    /**
+     * @brief Pop an item if one is available
+     * @param item Receives the popped item
+     * @return false if the queue is empty
+     */
+    bool tryPop(T& item) {
+        size_t head = head_.load(std::memory_order_relaxed);
+        if (head == tail_.load(std::memory_order_acquire)) {
+            return false;
+        }
+        item = slots_[head];
+        head_.store((head + 1) & mask_, std::memory_order_release);
+        notify();
+        return true;
+    }
+
+    /**
+     * @brief Push an item, sleeping while the queue is full
+     * @param item Item to push
+     * @param abort Flag that makes the call give up when set; whoever
+     *              sets it must call wake() afterwards
+     * @return false if aborted before the item was pushed
+     */
+    bool push(const T& item, const std::atomic<bool>& abort) {
+        for (uint32_t attempt = 0; !tryPush(item); ++attempt) {
+            if (abort.load(std::memory_order_relaxed)) {
+                return false;
+            }
+            if (attempt >= kSpinAttempts) {
+                waitUntil(abort, [this]() {
+                    return ((tail_.load(std::memory_order_relaxed) + 1) & mask_) !=
+                           head_.load(std::memory_order_acquire);
+                });
+            }
+        }
+        return true;
+    }
+
+    /**
+     * @brief Pop an item, sleeping while the queue is empty
+     * @param item Receives the popped item
+     * @param abort Flag that makes the call give up when set; whoever
+     *              sets it must call wake() afterwards
+     * @return false if aborted before an item was popped
+     */
+    bool pop(T& item, const std::atomic<bool>& abort) {
+        for (uint32_t attempt = 0; !tryPop(item); ++attempt) {
+            if (abort.load(std::memory_order_relaxed)) {
+                return false;
+            }
+            if (attempt >= kSpinAttempts) {
+                waitUntil(abort, [this]() {
+                    return head_.load(std::memory_order_relaxed) !=
+                           tail_.load(std::memory_order_acquire);
+                });
+            }
+        }
+        return true;
+    }
+
+    /**
+     * @brief Wake a blocked push() or pop() so it rechecks its abort flag
+     */
+    void wake() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        ready_.notify_all();
+    }
+
+private:
+    // Retries before sleeping, far shorter than a frame's worth of work
+    static constexpr uint32_t kSpinAttempts = 256;
+
+    /**
+     * @brief Sleep until the other side makes progress or abort is set
+     *
+     * Registering as a sleeper before the final check, with notify()
+     * checking for sleepers after its index store, means one of the two
+     * always sees the other: either the check passes or notify() locks.
+     */
+    template<typename Ready>
+    void waitUntil(const std::atomic<bool>& abort, Ready ready) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        sleepers_.fetch_add(1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        ready_.wait(lock, [&]() { return ready() || abort.load(std::memory_order_relaxed); });
+        sleepers_.fetch_sub(1, std::memory_order_relaxed);
+    }
+
+    void notify() {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (sleepers_.load(std::memory_order_relaxed) > 0) {
+            std::lock_guard<std::mutex> lock(mutex_);
+            ready_.notify_all();
+        }
+    }
+
+    static size_t roundUpPowerOfTwo(size_t value) {
+        size_t result = 2;
+        while (result < value) {
+            result <<= 1;
+        }
+        return result;
+    }
+
+    std::vector<T> slots_;
+    const size_t mask_;
+
+    // Producer and consumer indices live on separate cache lines
+    alignas(64) std::atomic<size_t> head_;
+    alignas(64) std::atomic<size_t> tail_;
+
+    // Only used once a side gives up spinning
+    alignas(64) std::atomic<uint32_t> sleepers_;
+    std::mutex mutex_;
+    std::condition_variable ready_;
+};
+
+} // namespace phantomframe
+
+#endif // PHANTOMFRAME_SPSC_QUEUE_H
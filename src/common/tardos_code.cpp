@@ -0,0 +1,338 @@
+#include "tardos_code.h"
+#include "worker_pool.h"
+#include <algorithm>
+#include <cmath>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define PHANTOMFRAME_X86 1
+#endif
+
+namespace phantomframe {
+
+namespace {
+
+constexpr double kPi = 3.14159265358979323846;
+
+// Largest quantised weight; 8 bytes of 8 weights each stay within int16
+constexpr int32_t kMaxWeight = 511;
+
+// Codeword bytes accumulated in 16-bit lanes before widening
+constexpr uint32_t kWidenBytes = 8;
+
+// Blocks per task, enough to amortise claiming a task
+constexpr size_t kBlocksPerTask = 64;
+
+// splitmix64 finaliser, used to derive per-viewer streams from the seed
+uint64_t mix64(uint64_t x) {
+    x += 0x9e3779b97f4a7c15ULL;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+
+/**
+ * @brief Weights of the score and the tables the kernels look them up in
+ */
+struct ScoreTables {
+    double base;                        // Score of the all-zero codeword
+    double scale;                       // Score per unit of quantised weight
+    double norm;                        // sqrt(sum b_i^2)
+    std::vector<int32_t> byte_sums;     // Per codeword byte, weight sum of each of 256 values
+    std::vector<uint8_t> nibble_sums;   // Per codeword byte, 4 x 16 bytes: low nibble low/high
+                                        // bytes, high nibble low/high bytes of 16-bit sums
+};
+
+void buildTables(const TardosCode& code, uint32_t row_bytes, const float* soft, ScoreTables& tables) {
+    std::vector<double> weights(static_cast<size_t>(row_bytes) * 8, 0.0);
+    tables.base = 0.0;
+    tables.norm = 0.0;
+    double max_weight = 0.0;
+    for (uint32_t i = 0; i < code.length(); ++i) {
+        double p = code.bias(i);
+        double b = -soft[i];
+        tables.base -= b * std::sqrt(p / (1.0 - p));
+        tables.norm += b * b;
+        weights[i] = b / std::sqrt(p * (1.0 - p));
+        max_weight = std::max(max_weight, std::fabs(weights[i]));
+    }
+    tables.norm = std::sqrt(tables.norm);
+    tables.scale = max_weight > 0.0 ? max_weight / kMaxWeight : 1.0;
+    
+    std::vector<int32_t> quantised(weights.size());
+    for (size_t i = 0; i < weights.size(); ++i) {
+        quantised[i] = static_cast<int32_t>(std::lround(weights[i] / tables.scale));
+    }
+    
+    tables.byte_sums.assign(static_cast<size_t>(row_bytes) * 256, 0);
+    tables.nibble_sums.assign(static_cast<size_t>(row_bytes) * 64, 0);
+    for (uint32_t k = 0; k < row_bytes; ++k) {
+        const int32_t* q = &quantised[k * 8];
+        int32_t* bytes = &tables.byte_sums[k * 256];
+        for (uint32_t value = 0; value < 256; ++value) {
+            for (uint32_t t = 0; t < 8; ++t) {
+                bytes[value] += (value >> t) & 1 ? q[t] : 0;
+            }
+        }
+        
+        uint8_t* nibbles = &tables.nibble_sums[k * 64];
+        for (uint32_t value = 0; value < 16; ++value) {
+            int16_t low = static_cast<int16_t>(bytes[value]);
+            int16_t high = static_cast<int16_t>(bytes[value << 4]);
+            nibbles[value] = static_cast<uint8_t>(low & 0xFF);
+            nibbles[16 + value] = static_cast<uint8_t>((low >> 8) & 0xFF);
+            nibbles[32 + value] = static_cast<uint8_t>(high & 0xFF);
+            nibbles[48 + value] = static_cast<uint8_t>((high >> 8) & 0xFF);
+        }
+    }
+}
+
+/**
+ * @brief Quantised sums of one block, one table lookup per codeword byte
+ */
+void scoreBlockScalar(const uint8_t* block, uint32_t row_bytes, const int32_t* byte_sums,
+                      int32_t* sums) {
+    std::fill(sums, sums + AccusationScorer::kBlockViewers, 0);
+    for (uint32_t k = 0; k < row_bytes; ++k) {
+        const uint8_t* bytes = block + static_cast<size_t>(k) * AccusationScorer::kBlockViewers;
+        const int32_t* table = byte_sums + static_cast<size_t>(k) * 256;
+        for (uint32_t v = 0; v < AccusationScorer::kBlockViewers; ++v) {
+            sums[v] += table[bytes[v]];
+        }
+    }
+}
+
+#ifdef PHANTOMFRAME_X86
+
+/**
+ * @brief Quantised sums of one block, 32 viewers per shuffle
+ *
+ * Each nibble indexes the low and the high byte of its 16-bit weight sum
+ * in two pshufb tables; interleaving the two results gives the sums of 32
+ * viewers in 16-bit lanes. Byte unpacks work within 128-bit lanes, so the
+ * low unpack holds viewers 0-7 and 16-23 and the high unpack 8-15 and
+ * 24-31.
+ */
+__attribute__((target("avx2")))
+void scoreBlockAVX2(const uint8_t* block, uint32_t row_bytes, const uint8_t* nibble_sums,
+                    int32_t* sums) {
+    const __m256i low_nibble = _mm256_set1_epi8(0x0F);
+    __m256i acc0 = _mm256_setzero_si256();
+    __m256i acc1 = _mm256_setzero_si256();
+    __m256i acc2 = _mm256_setzero_si256();
+    __m256i acc3 = _mm256_setzero_si256();
+    
+    for (uint32_t k0 = 0; k0 < row_bytes; k0 += kWidenBytes) {
+        uint32_t k_end = std::min(row_bytes, k0 + kWidenBytes);
+        __m256i part_lo = _mm256_setzero_si256();
+        __m256i part_hi = _mm256_setzero_si256();
+        
+        for (uint32_t k = k0; k < k_end; ++k) {
+            __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(
+                block + static_cast<size_t>(k) * AccusationScorer::kBlockViewers));
+            __m256i lo = _mm256_and_si256(x, low_nibble);
+            __m256i hi = _mm256_and_si256(_mm256_srli_epi16(x, 4), low_nibble);
+            
+            const __m128i* table = reinterpret_cast<const __m128i*>(nibble_sums + static_cast<size_t>(k) * 64);
+            __m256i lo_bytes = _mm256_shuffle_epi8(_mm256_broadcastsi128_si256(_mm_loadu_si128(table)), lo);
+            __m256i lo_high = _mm256_shuffle_epi8(_mm256_broadcastsi128_si256(_mm_loadu_si128(table + 1)), lo);
+            __m256i hi_bytes = _mm256_shuffle_epi8(_mm256_broadcastsi128_si256(_mm_loadu_si128(table + 2)), hi);
+            __m256i hi_high = _mm256_shuffle_epi8(_mm256_broadcastsi128_si256(_mm_loadu_si128(table + 3)), hi);
+            
+            part_lo = _mm256_add_epi16(part_lo, _mm256_unpacklo_epi8(lo_bytes, lo_high));
+            part_hi = _mm256_add_epi16(part_hi, _mm256_unpackhi_epi8(lo_bytes, lo_high));
+            part_lo = _mm256_add_epi16(part_lo, _mm256_unpacklo_epi8(hi_bytes, hi_high));
+            part_hi = _mm256_add_epi16(part_hi, _mm256_unpackhi_epi8(hi_bytes, hi_high));
+        }
+        
+        acc0 = _mm256_add_epi32(acc0, _mm256_cvtepi16_epi32(_mm256_castsi256_si128(part_lo)));
+        acc1 = _mm256_add_epi32(acc1, _mm256_cvtepi16_epi32(_mm256_castsi256_si128(part_hi)));
+        acc2 = _mm256_add_epi32(acc2, _mm256_cvtepi16_epi32(_mm256_extracti128_si256(part_lo, 1)));
+        acc3 = _mm256_add_epi32(acc3, _mm256_cvtepi16_epi32(_mm256_extracti128_si256(part_hi, 1)));
+    }
+    
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(sums), acc0);
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(sums + 8), acc1);
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(sums + 16), acc2);
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(sums + 24), acc3);
+}
+
+#endif // PHANTOMFRAME_X86
+
+// Upper tail of the standard normal distribution
+double normalTail(double z) {
+    return 0.5 * std::erfc(z / std::sqrt(2.0));
+}
+
+} // namespace
+
+TardosCode::TardosCode(uint64_t seed, uint32_t length, uint32_t colluders)
+    : seed_(seed), length_(length), thresholds_(length) {
+    // Arcsine density on [t, 1 - t]: p = sin^2(r), r uniform between the cutoffs
+    double cutoff = 1.0 / (300.0 * std::max<uint32_t>(1, colluders));
+    double r_min = std::asin(std::sqrt(cutoff));
+    double r_max = kPi / 2.0 - r_min;
+    
+    uint64_t key = mix64(0x7461726473ULL ^ seed);
+    for (uint32_t i = 0; i < length; ++i) {
+        double u = (mix64(key + i) >> 11) * (1.0 / 9007199254740992.0);
+        double s = std::sin(r_min + u * (r_max - r_min));
+        long threshold = std::lround(s * s * 65536.0);
+        thresholds_[i] = static_cast<uint16_t>(std::min(65535L, std::max(1L, threshold)));
+    }
+}
+
+uint32_t TardosCode::recommendedLength(uint32_t colluders, double false_positive) {
+    double c = std::max<uint32_t>(1, colluders);
+    double m = kPi * kPi * c * c * std::log(1.0 / false_positive);
+    return static_cast<uint32_t>(std::ceil(m));
+}
+
+void TardosCode::codeword(uint64_t viewer_id, uint64_t* words) const {
+    // Four 16-bit uniform draws per step of the viewer's stream
+    uint64_t state = mix64(seed_ ^ mix64(viewer_id));
+    for (size_t w = 0; w < this->words(); ++w) {
+        uint32_t first = static_cast<uint32_t>(w * 64);
+        uint32_t last = std::min(length_, first + 64);
+        uint64_t word = 0;
+        for (uint32_t i = first; i < last; i += 4) {
+            uint64_t draws = mix64(state + i);
+            uint32_t count = std::min(4u, last - i);
+            for (uint32_t t = 0; t < count; ++t) {
+                uint64_t bit = static_cast<uint16_t>(draws >> (16 * t)) < thresholds_[i + t];
+                word |= bit << (i + t - first);
+            }
+        }
+        words[w] = word;
+    }
+}
+
+AccusationScorer::AccusationScorer(const TardosCode& code)
+    : code_(code), row_bytes_((code.length() + 7) / 8) {
+}
+
+void AccusationScorer::setViewers(const uint64_t* viewer_ids, size_t count, WorkerPool* pool) {
+    viewer_ids_.assign(viewer_ids, viewer_ids + count);
+    size_t blocks = (count + kBlockViewers - 1) / kBlockViewers;
+    size_t block_bytes = static_cast<size_t>(row_bytes_) * kBlockViewers;
+    blocks_.assign(blocks * block_bytes, 0);
+    
+    // Generate each codeword and transpose it into its block's byte runs
+    auto fill = [&](size_t first_block, size_t last_block) {
+        std::vector<uint64_t> words(code_.words());
+        for (size_t b = first_block; b < last_block; ++b) {
+            uint8_t* block = &blocks_[b * block_bytes];
+            for (uint32_t v = 0; v < kBlockViewers; ++v) {
+                size_t j = b * kBlockViewers + v;
+                if (j >= count) {
+                    break;
+                }
+                code_.codeword(viewer_ids_[j], words.data());
+                for (uint32_t k = 0; k < row_bytes_; ++k) {
+                    block[k * kBlockViewers + v] = static_cast<uint8_t>(words[k / 8] >> (8 * (k % 8)));
+                }
+            }
+        }
+    };
+    
+    if (pool && pool->size() > 1 && blocks > kBlocksPerTask) {
+        uint32_t tasks = static_cast<uint32_t>((blocks + kBlocksPerTask - 1) / kBlocksPerTask);
+        pool->run(tasks, [&](uint32_t task) {
+            fill(task * kBlocksPerTask, std::min(blocks, (task + 1) * kBlocksPerTask));
+        });
+    }
+    else {
+        fill(0, blocks);
+    }
+}
+
+void AccusationScorer::score(const float* soft, float* scores, WorkerPool* pool, SimdLevel level) const {
+    if (!soft || !scores || viewer_ids_.empty()) {
+        return;
+    }
+    
+    level = std::min(level, detectSimdLevel());
+    
+    ScoreTables tables;
+    buildTables(code_, row_bytes_, soft, tables);
+    if (tables.norm == 0.0) {
+        std::fill(scores, scores + viewer_ids_.size(), 0.0f);
+        return;
+    }
+    
+    size_t count = viewer_ids_.size();
+    size_t blocks = (count + kBlockViewers - 1) / kBlockViewers;
+    size_t block_bytes = static_cast<size_t>(row_bytes_) * kBlockViewers;
+    
+    auto run = [&](size_t first_block, size_t last_block) {
+        int32_t sums[kBlockViewers];
+        for (size_t b = first_block; b < last_block; ++b) {
+            const uint8_t* block = &blocks_[b * block_bytes];
+#ifdef PHANTOMFRAME_X86
+            if (level == SimdLevel::AVX2) {
+                scoreBlockAVX2(block, row_bytes_, tables.nibble_sums.data(), sums);
+            }
+            else
+#endif
+            {
+                // SSE2 has no byte shuffle; the table lookup beats expanding bits
+                scoreBlockScalar(block, row_bytes_, tables.byte_sums.data(), sums);
+            }
+            
+            size_t first = b * kBlockViewers;
+            size_t n = std::min<size_t>(kBlockViewers, count - first);
+            for (size_t v = 0; v < n; ++v) {
+                scores[first + v] = static_cast<float>((tables.base + tables.scale * sums[v]) / tables.norm);
+            }
+        }
+    };
+    
+    if (pool && pool->size() > 1 && blocks > kBlocksPerTask) {
+        uint32_t tasks = static_cast<uint32_t>((blocks + kBlocksPerTask - 1) / kBlocksPerTask);
+        pool->run(tasks, [&](uint32_t task) {
+            run(task * kBlocksPerTask, std::min(blocks, (task + 1) * kBlocksPerTask));
+        });
+    }
+    else {
+        run(0, blocks);
+    }
+}
+
+std::vector<Accusation> AccusationScorer::accuse(const float* soft, float threshold, size_t max_accused,
+                                                 WorkerPool* pool, SimdLevel level) const {
+    std::vector<float> scores(viewer_ids_.size());
+    score(soft, scores.data(), pool, level);
+    
+    std::vector<Accusation> accused;
+    for (size_t j = 0; j < scores.size(); ++j) {
+        if (scores[j] > threshold) {
+            accused.push_back({viewer_ids_[j], scores[j]});
+        }
+    }
+    std::sort(accused.begin(), accused.end(), [](const Accusation& a, const Accusation& b) {
+        return a.score > b.score;
+    });
+    if (max_accused > 0 && accused.size() > max_accused) {
+        accused.resize(max_accused);
+    }
+    return accused;
+}
+
+float AccusationScorer::threshold(double false_positive, size_t viewers) {
+    // Bisect the normal tail for the per-viewer false-positive rate
+    double target = false_positive / std::max<size_t>(1, viewers);
+    double low = 0.0;
+    double high = 40.0;
+    for (int i = 0; i < 100; ++i) {
+        double mid = 0.5 * (low + high);
+        if (normalTail(mid) > target) {
+            low = mid;
+        }
+        else {
+            high = mid;
+        }
+    }
+    return static_cast<float>(high);
+}
+
+} // namespace phantomframe
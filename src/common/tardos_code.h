@@ -0,0 +1,168 @@
+#ifndef PHANTOMFRAME_TARDOS_CODE_H
+#define PHANTOMFRAME_TARDOS_CODE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "cpu_features.h"
+
+namespace phantomframe {
+
+class WorkerPool;
+
+/**
+ * @brief Keyed Tardos fingerprinting code over viewer IDs
+ *
+ * Position i of the code has a secret bias p_i drawn from the arcsine
+ * distribution, cut off at t = 1 / (300 c) for c colluders, and bit i of
+ * a viewer's codeword is 1 with probability p_i. Both the biases and the
+ * codewords are derived from the seed, so a codeword never has to be
+ * stored: anything holding the seed can regenerate the codeword of a
+ * viewer ID. Colluders who mix their copies can only output bits they
+ * share at positions where they agree, which is what the accusation
+ * score (AccusationScorer) rewards.
+ *
+ * Codewords are meant to be carried one bit per segment by the A/B
+ * segment variants (SessionSequence), which makes averaging copies the
+ * only attack left to colluders.
+ */
+class TardosCode {
+public:
+    /**
+     * @brief Build the code
+     * @param seed Secret key of the code
+     * @param length Codeword length in bits
+     * @param colluders Coalition size the bias cutoff is chosen for
+     */
+    TardosCode(uint64_t seed, uint32_t length, uint32_t colluders);
+
+    /**
+     * @brief Code length for the symmetric score, m = pi^2 c^2 ln(1 / eps1)
+     * @param colluders Coalition size c
+     * @param false_positive Probability eps1 of accusing one given innocent viewer
+     * @return Codeword length in bits
+     */
+    static uint32_t recommendedLength(uint32_t colluders, double false_positive);
+
+    /**
+     * @brief Generate the codeword of a viewer
+     * @param viewer_id Viewer or session ID
+     * @param words Output, words() entries; bit i in bit i % 64 of words[i / 64]
+     */
+    void codeword(uint64_t viewer_id, uint64_t* words) const;
+
+    /**
+     * @brief Probability of a 1 at a position, as quantised for generation
+     */
+    double bias(uint32_t position) const { return thresholds_[position] / 65536.0; }
+
+    uint32_t length() const { return length_; }
+    size_t words() const { return (length_ + 63) / 64; }
+
+private:
+    uint64_t seed_;
+    uint32_t length_;
+    std::vector<uint16_t> thresholds_;  // A 16-bit draw below this gives a 1
+};
+
+/**
+ * @brief One accused viewer
+ */
+struct Accusation {
+    uint64_t viewer_id;         // Registered viewer ID
+    float score;                // Normalised accusation score
+};
+
+/**
+ * @brief Accusation scores of registered viewers against an extracted code
+ *
+ * Uses the symmetric Tardos score with soft input: with b_i the evidence
+ * for a 1 at position i, viewer j scores
+ *   S_j = sum_i b_i * (x_ji ? sqrt((1 - p_i) / p_i) : -sqrt(p_i / (1 - p_i)))
+ * divided by sqrt(sum_i b_i^2). An innocent viewer's codeword is
+ * independent of the evidence, so its score has mean 0 and variance 1;
+ * colluders average about 2 sqrt(m) / (pi c) with clean evidence.
+ *
+ * S_j is a constant plus the sum of per-position weights over the set bits
+ * of the codeword. The weights are quantised to integers once per call and
+ * the codewords of registered viewers are stored in blocks of
+ * kBlockViewers, byte-transposed so byte k of all viewers of a block is
+ * contiguous. The scalar kernel adds one table entry per codeword byte;
+ * the AVX2 kernel looks up the weight sums of 32 viewers' nibbles with one
+ * shuffle, in 16-bit lanes widened every 8 bytes. Both produce identical
+ * integer sums. Blocks are spread over a WorkerPool, and at 1 bit per
+ * viewer and position memory bandwidth is the limit: 10 million viewers
+ * with 1024-bit codewords are 1.3 GB, scored in well under a second on a
+ * few cores.
+ */
+class AccusationScorer {
+public:
+    static constexpr uint32_t kBlockViewers = 32;
+
+    /**
+     * @brief Create a scorer with no viewers registered
+     * @param code Code the viewers were issued codewords of
+     */
+    explicit AccusationScorer(const TardosCode& code);
+
+    /**
+     * @brief Register viewers, replacing any registered before
+     * @param viewer_ids Viewer IDs
+     * @param count Number of viewers
+     * @param pool Optional pool to generate codewords on
+     */
+    void setViewers(const uint64_t* viewer_ids, size_t count, WorkerPool* pool = nullptr);
+
+    /**
+     * @brief Score every registered viewer
+     * @param soft Evidence per code position, length() entries; positive
+     *        favours 0, negative favours 1, 0 for an erased position
+     *        (segment evidence folded modulo the length, see
+     *        segmentVariantEvidence())
+     * @param scores Output, viewerCount() normalised scores
+     * @param pool Optional pool to score on
+     * @param level Kernel to use, clamped to what the CPU supports
+     */
+    void score(const float* soft, float* scores, WorkerPool* pool = nullptr,
+               SimdLevel level = detectSimdLevel()) const;
+
+    /**
+     * @brief Viewers scoring above a threshold, highest first
+     * @param soft Evidence per code position, as for score()
+     * @param threshold Score to exceed, see threshold()
+     * @param max_accused Most viewers to return, 0 for all
+     * @param pool Optional pool to score on
+     * @param level Kernel to use, clamped to what the CPU supports
+     * @return Accused viewers
+     */
+    std::vector<Accusation> accuse(const float* soft, float threshold, size_t max_accused = 0,
+                                   WorkerPool* pool = nullptr,
+                                   SimdLevel level = detectSimdLevel()) const;
+
+    /**
+     * @brief Score above which fewer than false_positive innocents are
+     *        expected to be accused among viewers, Gaussian approximation
+     * @param false_positive Probability of accusing any innocent viewer
+     * @param viewers Number of registered viewers
+     * @return Score threshold
+     */
+    static float threshold(double false_positive, size_t viewers);
+
+    size_t viewerCount() const { return viewer_ids_.size(); }
+    uint32_t length() const { return code_.length(); }
+
+    /**
+     * @brief Bytes held for registered codewords
+     */
+    size_t memoryBytes() const { return blocks_.size(); }
+
+private:
+    TardosCode code_;
+    uint32_t row_bytes_;                // Codeword bytes per viewer
+    std::vector<uint64_t> viewer_ids_;
+    std::vector<uint8_t> blocks_;       // Per block, row_bytes_ runs of kBlockViewers bytes
+};
+
+} // namespace phantomframe
+
+#endif // PHANTOMFRAME_TARDOS_CODE_H
@@ -6,12 +6,94 @@
 #include <chrono>
 #include <filesystem>
 #include <algorithm>
+#include <array>
+#include <cctype>
 #include <cstring>
 
 namespace phantomframe {
 
 namespace utils {
 
+namespace {
+
+const uint32_t kSha256Rounds[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2};
+
+uint32_t rotr(uint32_t x, int n) {
+    return (x >> n) | (x << (32 - n));
+}
+
+/**
+ * @brief SHA-256 (FIPS 180-4) of a message, for keyedPayload()
+ */
+std::array<uint8_t, 32> sha256(const std::vector<uint8_t>& message) {
+    uint32_t h[8] = {0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+                     0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19};
+    
+    // Pad with a 1 bit, zeros and the bit length to a multiple of 64 bytes
+    std::vector<uint8_t> padded(message);
+    uint64_t bit_length = static_cast<uint64_t>(message.size()) * 8;
+    padded.push_back(0x80);
+    while (padded.size() % 64 != 56) {
+        padded.push_back(0);
+    }
+    for (int i = 7; i >= 0; --i) {
+        padded.push_back(static_cast<uint8_t>(bit_length >> (8 * i)));
+    }
+    
+    for (size_t block = 0; block < padded.size(); block += 64) {
+        uint32_t w[64];
+        for (int i = 0; i < 16; ++i) {
+            const uint8_t* p = &padded[block + 4 * i];
+            w[i] = (uint32_t(p[0]) << 24) | (uint32_t(p[1]) << 16) | (uint32_t(p[2]) << 8) | p[3];
+        }
+        for (int i = 16; i < 64; ++i) {
+            uint32_t s0 = rotr(w[i - 15], 7) ^ rotr(w[i - 15], 18) ^ (w[i - 15] >> 3);
+            uint32_t s1 = rotr(w[i - 2], 17) ^ rotr(w[i - 2], 19) ^ (w[i - 2] >> 10);
+            w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+        }
+        
+        uint32_t a = h[0], b = h[1], c = h[2], d = h[3];
+        uint32_t e = h[4], f = h[5], g = h[6], k = h[7];
+        for (int i = 0; i < 64; ++i) {
+            uint32_t t1 = k + (rotr(e, 6) ^ rotr(e, 11) ^ rotr(e, 25)) + ((e & f) ^ (~e & g)) +
+                          kSha256Rounds[i] + w[i];
+            uint32_t t2 = (rotr(a, 2) ^ rotr(a, 13) ^ rotr(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+            k = g;
+            g = f;
+            f = e;
+            e = d + t1;
+            d = c;
+            c = b;
+            b = a;
+            a = t1 + t2;
+        }
+        h[0] += a;
+        h[1] += b;
+        h[2] += c;
+        h[3] += d;
+        h[4] += e;
+        h[5] += f;
+        h[6] += g;
+        h[7] += k;
+    }
+    
+    std::array<uint8_t, 32> digest;
+    for (int i = 0; i < 32; ++i) {
+        digest[i] = static_cast<uint8_t>(h[i / 4] >> (24 - 8 * (i % 4)));
+    }
+    return digest;
+}
+
+} // namespace
+
 uint32_t generateRandomSeed() {
     std::random_device rd;
     std::mt19937 gen(rd());
@@ -19,29 +101,71 @@ uint32_t generateRandomSeed() {
     return dis(gen);
 }
 
-uint64_t generatePayloadFromString(const std::string& input) {
-    uint64_t hash = 0;
+Payload generatePayloadFromString(const std::string& input) {
+    // Two independent 64-bit hashes: djb2 for the low half, FNV-1a for the high
+    uint64_t low = 0;
+    uint64_t high = 0xcbf29ce484222325ull;
     for (char c : input) {
-        hash = ((hash << 5) + hash) + c; // hash * 33 + c
+        low = ((low << 5) + low) + c; // hash * 33 + c
+        high ^= static_cast<uint8_t>(c);
+        high *= 0x100000001b3ull;
     }
-    return hash;
+    return Payload(high, low);
 }
 
-std::string payloadToHex(uint64_t payload) {
+Payload keyedPayload(const std::string& key, const std::string& message) {
+    // HMAC (RFC 2104): keys longer than a block are hashed first
+    std::vector<uint8_t> block(key.begin(), key.end());
+    if (block.size() > 64) {
+        std::array<uint8_t, 32> hashed = sha256(block);
+        block.assign(hashed.begin(), hashed.end());
+    }
+    block.resize(64, 0);
+    
+    std::vector<uint8_t> inner(block.size());
+    std::vector<uint8_t> outer(block.size());
+    for (size_t i = 0; i < block.size(); ++i) {
+        inner[i] = block[i] ^ 0x36;
+        outer[i] = block[i] ^ 0x5c;
+    }
+    inner.insert(inner.end(), message.begin(), message.end());
+    std::array<uint8_t, 32> inner_digest = sha256(inner);
+    outer.insert(outer.end(), inner_digest.begin(), inner_digest.end());
+    std::array<uint8_t, 32> mac = sha256(outer);
+    
+    Payload payload;
+    std::copy(mac.begin(), mac.begin() + Payload::kBytes, payload.bytes.begin());
+    return payload;
+}
+
+std::string payloadToHex(const Payload& payload) {
     std::ostringstream oss;
-    oss << "0x" << std::hex << std::setw(16) << std::setfill('0') << payload;
+    oss << "0x" << std::hex << std::setfill('0');
+    for (uint8_t byte : payload.bytes) {
+        oss << std::setw(2) << static_cast<int>(byte);
+    }
     return oss.str();
 }
 
-uint64_t hexToPayload(const std::string& hex_string) {
+Payload hexToPayload(const std::string& hex_string) {
     std::string hex = hex_string;
     if (hex.substr(0, 2) == "0x") {
         hex = hex.substr(2);
     }
     
-    std::istringstream iss(hex);
-    uint64_t payload;
-    iss >> std::hex >> payload;
+    // Shift each digit in at the low end
+    Payload payload;
+    for (char c : hex) {
+        if (!std::isxdigit(static_cast<unsigned char>(c))) {
+            break;
+        }
+        uint8_t digit = static_cast<uint8_t>(std::isdigit(static_cast<unsigned char>(c)) ? 
+                                             c - '0' : std::tolower(c) - 'a' + 10);
+        for (size_t i = 0; i + 1 < Payload::kBytes; ++i) {
+            payload[i] = static_cast<uint8_t>((payload[i] << 4) | (payload[i + 1] >> 4));
+        }
+        payload[Payload::kBytes - 1] = static_cast<uint8_t>((payload[Payload::kBytes - 1] << 4) | digit);
+    }
     return payload;
 }
 
@@ -54,7 +178,7 @@ uint32_t calculateHash(const uint8_t* data, size_t length) {
     return hash;
 }
 
-uint64_t xorEncrypt(uint64_t data, uint64_t key) {
+Payload xorEncrypt(const Payload& data, const Payload& key) {
     return data ^ key;
 }
 
@@ -5,6 +5,7 @@
 #include <string>
 #include <vector>
 #include <random>
+#include "payload.h"
 
 namespace phantomframe {
 
@@ -24,21 +25,37 @@ uint32_t generateRandomSeed();
  * @param input Input string
  * @return 128-bit payload
  */
-uint64_t generatePayloadFromString(const std::string& input);
+Payload generatePayloadFromString(const std::string& input);
+
+/**
+ * @brief Derive a 128-bit payload with a keyed PRF
+ *
+ * HMAC-SHA-256 of the message under the key, truncated to its first 16
+ * bytes. Unlike generatePayloadFromString(), knowing the payloads of some
+ * messages says nothing about those of others without the key.
+ * @param key Secret key
+ * @param message Message to derive the payload of
+ * @return 128-bit payload
+ */
+Payload keyedPayload(const std::string& key, const std::string& message);
 
 /**
  * @brief Convert payload to hexadecimal string
  * @param payload Payload to convert
- * @return Hexadecimal string representation
+ * @return "0x" and 32 hexadecimal digits
  */
-std::string payloadToHex(uint64_t payload);
+std::string payloadToHex(const Payload& payload);
 
 /**
  * @brief Convert hexadecimal string to payload
+ *
+ * Up to 32 digits, with or without "0x"; shorter strings fill the low
+ * bits, so a 64-bit value keeps its meaning. Parsing stops at the first
+ * character that is not a hexadecimal digit.
  * @param hex_string Hexadecimal string
  * @return Payload value
  */
-uint64_t hexToPayload(const std::string& hex_string);
+Payload hexToPayload(const std::string& hex_string);
 
 /**
  * @brief Calculate hash of input data
@@ -54,7 +71,7 @@ uint32_t calculateHash(const uint8_t* data, size_t length);
  * @param key Encryption key
  * @return Encrypted/decrypted data
  */
-uint64_t xorEncrypt(uint64_t data, uint64_t key);
+Payload xorEncrypt(const Payload& data, const Payload& key);
 
 /**
  * @brief Validate video file format
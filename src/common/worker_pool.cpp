@@ -0,0 +1,90 @@
+#include "worker_pool.h"
+#include <algorithm>
+
+namespace phantomframe {
+
+WorkerPool::WorkerPool(uint32_t num_threads)
+    : task_(nullptr), task_count_(0), next_task_(0), busy_workers_(0),
+      generation_(0), stopping_(false) {
+    if (num_threads == 0) {
+        num_threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    
+    // The caller of run() is the first thread of the pool
+    workers_.reserve(num_threads - 1);
+    for (uint32_t i = 1; i < num_threads; ++i) {
+        workers_.emplace_back(&WorkerPool::workerLoop, this);
+    }
+}
+
+WorkerPool::~WorkerPool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+    }
+    start_cv_.notify_all();
+    
+    for (auto& worker : workers_) {
+        worker.join();
+    }
+}
+
+void WorkerPool::run(uint32_t task_count, const std::function<void(uint32_t)>& task) {
+    if (task_count == 0) {
+        return;
+    }
+    
+    // Not worth waking anyone up
+    if (workers_.empty() || task_count == 1) {
+        for (uint32_t i = 0; i < task_count; ++i) {
+            task(i);
+        }
+        return;
+    }
+    
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        task_ = &task;
+        task_count_ = task_count;
+        next_task_.store(0, std::memory_order_relaxed);
+        busy_workers_ = static_cast<uint32_t>(workers_.size());
+        generation_++;
+    }
+    start_cv_.notify_all();
+    
+    drain();
+    
+    std::unique_lock<std::mutex> lock(mutex_);
+    done_cv_.wait(lock, [this] { return busy_workers_ == 0; });
+    task_ = nullptr;
+}
+
+void WorkerPool::workerLoop() {
+    uint64_t seen_generation = 0;
+    
+    std::unique_lock<std::mutex> lock(mutex_);
+    for (;;) {
+        start_cv_.wait(lock, [&] { return stopping_ || generation_ != seen_generation; });
+        if (stopping_) {
+            return;
+        }
+        seen_generation = generation_;
+        
+        lock.unlock();
+        drain();
+        lock.lock();
+        
+        if (--busy_workers_ == 0) {
+            done_cv_.notify_one();
+        }
+    }
+}
+
+void WorkerPool::drain() {
+    uint32_t index;
+    while ((index = next_task_.fetch_add(1, std::memory_order_relaxed)) < task_count_) {
+        (*task_)(index);
+    }
+}
+
+} // namespace phantomframe
@@ -0,0 +1,74 @@
+#ifndef PHANTOMFRAME_WORKER_POOL_H
+#define PHANTOMFRAME_WORKER_POOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace phantomframe {
+
+/**
+ * @brief Fixed pool of threads for fork-join data parallelism
+ *
+ * run() splits a job into numbered tasks that the workers and the calling
+ * thread claim from a shared atomic counter until none are left. Tasks are
+ * expected to write disjoint outputs, so no locking happens inside a job.
+ * run() must not be called concurrently or from inside a task.
+ */
+class WorkerPool {
+public:
+    /**
+     * @brief Start the pool
+     * @param num_threads Total threads including the caller of run(),
+     *        0 for std::thread::hardware_concurrency()
+     */
+    explicit WorkerPool(uint32_t num_threads = 0);
+    ~WorkerPool();
+
+    WorkerPool(const WorkerPool&) = delete;
+    WorkerPool& operator=(const WorkerPool&) = delete;
+
+    /**
+     * @brief Number of threads executing tasks, including the caller
+     * @return Thread count
+     */
+    uint32_t size() const { return static_cast<uint32_t>(workers_.size()) + 1; }
+
+    /**
+     * @brief Run task(0) .. task(task_count - 1) and wait for all of them
+     * @param task_count Number of tasks
+     * @param task Task body, called once per task index
+     */
+    void run(uint32_t task_count, const std::function<void(uint32_t)>& task);
+
+private:
+    std::vector<std::thread> workers_;
+    std::mutex mutex_;
+    std::condition_variable start_cv_;
+    std::condition_variable done_cv_;
+
+    const std::function<void(uint32_t)>* task_; // Current job
+    uint32_t task_count_;                       // Tasks in the current job
+    std::atomic<uint32_t> next_task_;           // Next unclaimed task index
+    uint32_t busy_workers_;                     // Workers still inside the job
+    uint64_t generation_;                       // Incremented for every job
+    bool stopping_;
+
+    /**
+     * @brief Thread body of a worker
+     */
+    void workerLoop();
+
+    /**
+     * @brief Claim and execute tasks until the current job is exhausted
+     */
+    void drain();
+};
+
+} // namespace phantomframe
+
+#endif // PHANTOMFRAME_WORKER_POOL_H
@@ -0,0 +1,67 @@
+#include "quant_offset_buffer.h"
+#include <algorithm>
+
+namespace phantomframe {
+
+QuantOffsetBuffer::QuantOffsetBuffer(uint32_t width, uint32_t height, uint32_t depth,
+                                     BufferPool* pool)
+    : mb_width_((width + 15) / 16), mb_height_((height + 15) / 16),
+      slots_(std::max<uint32_t>(1, depth)), next_slot_(0) {
+    size_t mb_count = static_cast<size_t>(mb_width_) * mb_height_;
+    
+    for (auto& slot : slots_) {
+        slot.storage = BufferPool::acquire(pool, std::max<size_t>(1, mb_count) * sizeof(float));
+        std::fill(slot.storage.as<float>(), slot.storage.as<float>() + mb_count, 0.0f);
+        slot.touched.resize(mb_count);
+        slot.touched_count = 0;
+        slot.needs_full_clear = false;
+        slot.plane = {slot.storage.as<float>(), mb_width_, mb_height_};
+    }
+}
+
+QuantOffsetBuffer::~QuantOffsetBuffer() = default;
+
+const QuantOffsetPlane& QuantOffsetBuffer::fill(WatermarkEncoder& encoder, uint32_t frame_index) {
+    // Over the deadline the last frame's plane is handed out again; the
+    // ring does not advance, so earlier planes stay valid as promised
+    if (encoder.beginFrame(frame_index) == EmbedStep::ReuseMap) {
+        Slot& last = slots_[(next_slot_ + slots_.size() - 1) % slots_.size()];
+        encoder.writeQuantOffsets(frame_index, last.plane);
+        return last.plane;
+    }
+    
+    Slot& slot = slots_[next_slot_];
+    next_slot_ = (next_slot_ + 1) % slots_.size();
+    
+    // Slice workers overwrite every row, so nothing needs resetting
+    if (encoder.getWorkerPool()) {
+        encoder.renderQuantOffsets(frame_index, slot.plane);
+        slot.touched_count = 0;
+        slot.needs_full_clear = false;
+        return slot.plane;
+    }
+    
+    resetSlot(slot);
+    
+    size_t written = encoder.writeQuantOffsets(frame_index, slot.plane, 
+                                               slot.touched.data(), slot.touched.size());
+    slot.touched_count = std::min(written, slot.touched.size());
+    slot.needs_full_clear = written > slot.touched.size();
+    
+    return slot.plane;
+}
+
+void QuantOffsetBuffer::resetSlot(Slot& slot) {
+    if (slot.needs_full_clear) {
+        std::fill(slot.plane.offsets, slot.plane.offsets + slot.touched.size(), 0.0f);
+    } else {
+        for (size_t i = 0; i < slot.touched_count; ++i) {
+            slot.plane.offsets[slot.touched[i]] = 0.0f;
+        }
+    }
+    
+    slot.touched_count = 0;
+    slot.needs_full_clear = false;
+}
+
+} // namespace phantomframe
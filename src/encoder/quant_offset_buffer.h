@@ -0,0 +1,79 @@
+#ifndef PHANTOMFRAME_QUANT_OFFSET_BUFFER_H
+#define PHANTOMFRAME_QUANT_OFFSET_BUFFER_H
+
+#include <cstdint>
+#include <vector>
+#include "common/buffer_pool.h"
+#include "watermark_encoder.h"
+
+namespace phantomframe {
+
+/**
+ * @brief Ring of reusable x264 quant_offsets planes
+ *
+ * Planes are allocated once. Each fill() reuses the oldest plane, resetting
+ * only the macroblocks its previous frame touched before writing the new
+ * frame's deltas. With the default depth of two, the encode thread can
+ * hand one plane to x264 while the next frame's plane is being filled.
+ * When the encoder has a worker pool attached, planes are instead rendered
+ * in full by renderQuantOffsets(). Frames for which the encoder's deadline
+ * calls for EmbedStep::ReuseMap get the previous plane again.
+ */
+class QuantOffsetBuffer {
+public:
+    /**
+     * @brief Allocate the planes for a resolution
+     * @param width Frame width in pixels
+     * @param height Frame height in pixels
+     * @param depth Number of planes in the ring
+     * @param pool Pool to take the planes from, owned by the caller, or null
+     */
+    QuantOffsetBuffer(uint32_t width, uint32_t height, uint32_t depth = 2,
+                      BufferPool* pool = nullptr);
+    ~QuantOffsetBuffer();
+
+    /**
+     * @brief Fill the next plane with the watermark for a frame
+     * @param encoder Encoder providing the block schedule
+     * @param frame_index Current frame index
+     * @return Plane for x264_picture_t.prop.quant_offsets, valid until
+     *         depth further calls to fill()
+     */
+    const QuantOffsetPlane& fill(WatermarkEncoder& encoder, uint32_t frame_index);
+
+    /**
+     * @brief Get macroblocks per row
+     * @return Plane width in macroblocks
+     */
+    uint32_t mbWidth() const { return mb_width_; }
+
+    /**
+     * @brief Get macroblock rows
+     * @return Plane height in macroblocks
+     */
+    uint32_t mbHeight() const { return mb_height_; }
+
+private:
+    struct Slot {
+        BufferPool::Buffer storage;     // Aligned plane storage
+        std::vector<uint32_t> touched;  // Macroblocks written by the last fill
+        size_t touched_count;           // Valid entries in touched
+        bool needs_full_clear;          // touched overflowed
+        QuantOffsetPlane plane;         // View handed to the caller
+    };
+
+    uint32_t mb_width_;
+    uint32_t mb_height_;
+    std::vector<Slot> slots_;
+    uint32_t next_slot_;
+
+    /**
+     * @brief Reset the entries written by a slot's previous frame
+     * @param slot Slot to reset
+     */
+    void resetSlot(Slot& slot);
+};
+
+} // namespace phantomframe
+
+#endif // PHANTOMFRAME_QUANT_OFFSET_BUFFER_H
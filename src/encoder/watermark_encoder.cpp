@@ -1,6 +1,10 @@
 #include "watermark_encoder.h"
-#include <random>
+#include "common/worker_pool.h"
+#include "common/block_activity.h"
+#include "common/payload_code.h"
+#include "common/utils.h"
 #include <algorithm>
+#include <atomic>
 #include <cstring>
 #include <iostream>
 #include <iomanip>
@@ -8,15 +12,59 @@
 
 namespace phantomframe {
 
+namespace {
+
+// Consecutive frames that may reuse a map before density is dropped instead;
+// a map repeated for longer would no longer follow the temporal schedule
+constexpr uint32_t kMaxReusedFrames = 2;
+
+// Density is halved at most this many times (1/16 of the blocks)
+constexpr uint32_t kMaxDensityShift = 4;
+
+int64_t elapsedNs(std::chrono::steady_clock::time_point since) {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - since).count();
+}
+
+// Smooth a cost estimate over the last few frames
+void recordCost(int64_t& estimate, int64_t sample) {
+    estimate = estimate == 0 ? sample : estimate + (sample - estimate) / 4;
+}
+
+} // namespace
+
 WatermarkEncoder::WatermarkEncoder(const WatermarkConfig& config)
-    : config_(config), width_(0), height_(0), fps_(0.0f), 
-      total_blocks_(0), current_block_index_(0), 
-      frames_processed_(0), blocks_modified_(0) {
+    : width_(0), height_(0), fps_(0.0f), total_blocks_(0), config_(config),
+      reference_width_(0), reference_height_(0),
+      active_(nullptr), staged_(nullptr), pending_(nullptr), retired_(nullptr),
+      pool_(nullptr), buffer_pool_(nullptr), simd_level_(SimdLevel::Scalar), activity_frame_(0), activity_valid_(false),
+      frame_index_(0), frame_started_(false), frame_finished_(false), 
+      frame_step_(EmbedStep::Full), analysis_cost_ns_(0), render_cost_ns_(0), reused_streak_(0),
+      frame_phases_(1), scene_start_(0), scene_frame_(0), scene_tracked_(false),
+      frames_processed_(0), blocks_modified_(0), analysis_skipped_(0), maps_reused_(0),
+      density_reduced_(0), deadline_misses_(0), density_shift_(0), scene_cuts_(0) {
 }
 
-WatermarkEncoder::~WatermarkEncoder() = default;
+WatermarkEncoder::~WatermarkEncoder() {
+    delete active_;
+    delete staged_;
+    delete pending_.exchange(nullptr);
+    collectRetired();
+}
 
 bool WatermarkEncoder::initialize(uint32_t width, uint32_t height, float fps) {
+    return initialize(width, height, fps, nullptr);
+}
+
+bool WatermarkEncoder::initialize(uint32_t width, uint32_t height, float fps,
+                                  std::shared_ptr<const EmbeddingSchedule> schedule) {
+    // Block coordinates are stored as 16-bit values in the schedule table
+    if (width == 0 || height == 0 || fps <= 0.0f || width > 65535 || height > 65535) {
+        std::cerr << "WatermarkEncoder: invalid video parameters " << width << "x" << height 
+                  << " @ " << fps << "fps" << std::endl;
+        return false;
+    }
+    
     width_ = width;
     height_ = height;
     fps_ = fps;
@@ -26,11 +74,44 @@ bool WatermarkEncoder::initialize(uint32_t width, uint32_t height, float fps) {
     uint32_t blocks_y = (height + 7) / 8;
     total_blocks_ = blocks_x * blocks_y;
     
-    // Generate block selection pattern
-    generateBlockSelection();
+    // The kernels trust the level they are given, so the CPU is queried
+    // here and not on every frame
+    simd_level_ = detectSimdLevel();
+    activity_.assign(total_blocks_, 0);
+    activity_valid_ = false;
     
-    std::cout << "WatermarkEncoder initialized: " << width << "x" << height 
-              << " @ " << fps << "fps, " << total_blocks_ << " blocks" << std::endl;
+    // Costs depend on the resolution, so measure them afresh
+    frame_started_ = false;
+    analysis_cost_ns_ = 0;
+    render_cost_ns_ = 0;
+    reused_streak_ = 0;
+    density_shift_.store(0, std::memory_order_relaxed);
+    phase_carry_.reset();
+    frame_phases_ = 1;
+    
+    // Scenes start afresh with the stream; the thumbnails are sized here so
+    // the first frame allocates nothing
+    scene_detector_ = SceneCutDetector(0.0f, simd_level_);
+    scene_detector_.reserve(width, height);
+    scene_start_ = 0;
+    scene_tracked_ = false;
+    scene_cuts_.store(0, std::memory_order_relaxed);
+    
+    // Generate block selection pattern; no frames are in flight yet, so the
+    // state is installed directly and anything still pending is dropped
+    std::unique_ptr<EmbeddingState> state;
+    {
+        std::lock_guard<std::mutex> lock(update_mutex_);
+        reference_width_ = schedule ? schedule->referenceWidth() : width;
+        reference_height_ = schedule ? schedule->referenceHeight() : height;
+        state = buildState(config_, std::move(schedule), pool_);
+    }
+    delete active_;
+    delete staged_;
+    delete pending_.exchange(nullptr);
+    collectRetired();
+    active_ = state.release();
+    staged_ = nullptr;
     
     return true;
 }
@@ -38,103 +119,687 @@ bool WatermarkEncoder::initialize(uint32_t width, uint32_t height, float fps) {
 std::vector<uint8_t> WatermarkEncoder::processFrame(const uint8_t* frame_data, 
                                                    size_t frame_size, 
                                                    uint32_t frame_index) {
+    if (!frame_data || frame_size == 0) {
+        return {};
+    }
+    
     // Create a copy of the frame data
     std::vector<uint8_t> modified_frame(frame_data, frame_data + frame_size);
+    processPackedFrame(modified_frame.data(), frame_size, frame_index);
     
-    // Get blocks to modify for this frame
-    auto blocks = getBlocksForFrame(frame_index);
+    return modified_frame;
+}
+
+BufferPool::Buffer WatermarkEncoder::processFrameBuffer(const uint8_t* frame_data,
+                                                        size_t frame_size,
+                                                        uint32_t frame_index) {
+    if (!frame_data || frame_size == 0) {
+        return {};
+    }
     
-    // Apply watermark modifications
-    for (const auto& block : blocks) {
-        applyQPModification(modified_frame.data(), block);
-        blocks_modified_++;
+    BufferPool::Buffer modified_frame = BufferPool::acquire(buffer_pool_, frame_size);
+    if (modified_frame.empty()) {
+        return modified_frame;
     }
     
-    frames_processed_++;
+    std::memcpy(modified_frame.data(), frame_data, frame_size);
+    processPackedFrame(modified_frame.data(), frame_size, frame_index);
     
     return modified_frame;
 }
 
+void WatermarkEncoder::processPackedFrame(uint8_t* data, size_t frame_size, uint32_t frame_index) {
+    // Treat the buffer as tightly packed rows of the configured width
+    uint64_t pixels = static_cast<uint64_t>(width_) * height_;
+    uint32_t bytes_per_pixel = pixels > 0 ? 
+        static_cast<uint32_t>(std::max<uint64_t>(1, frame_size / pixels)) : 1;
+    
+    FrameView view;
+    view.data = data;
+    view.stride = static_cast<size_t>(width_) * bytes_per_pixel;
+    view.width = width_;
+    view.height = static_cast<uint32_t>(std::min<uint64_t>(height_, frame_size / std::max<size_t>(1, view.stride)));
+    view.layout = bytes_per_pixel == 1 ? PlaneLayout::Planar : PlaneLayout::Packed;
+    view.bytes_per_pixel = bytes_per_pixel;
+    
+    processFrame(view, frame_index, nullptr, 0);
+}
+
+size_t WatermarkEncoder::processFrame(const FrameView& frame,
+                                      uint32_t frame_index,
+                                      BlockInfo* blocks,
+                                      size_t max_blocks) {
+    if (!frame.data) {
+        return 0;
+    }
+    
+    if (frame.width == width_ && frame.height == height_) {
+        trackScene(frame, frame_index);
+    }
+    
+    EmbedStep step = beginFrame(frame_index);
+    if (step == EmbedStep::Full && active_ && active_->config.adaptive_embedding) {
+        analyzeFrame(frame, frame_index);
+    }
+    
+    if (step == EmbedStep::NonReference) {
+        frames_processed_.fetch_add(1, std::memory_order_relaxed);
+        return 0;
+    }
+    
+    // Pixels carry no map over from the previous frame, so a reused map
+    // leaves this frame unmodified
+    auto render_start = std::chrono::steady_clock::now();
+    size_t count = 0;
+    if (step != EmbedStep::ReuseMap) {
+        BlockSpan span = getScheduleForFrame(frame_index);
+        AdaptiveSearch search = adaptiveSearch(frame_index);
+        uint32_t block_step = blockStep();
+        
+        // Apply watermark modifications directly to the caller's frame
+        for (uint32_t i = 0; i < span.count; i += block_step) {
+            BlockInfo block{selectTexturedBlock(search, span.x[i], span.y[i]), span.y[i], 
+                            span.qp_delta[i], frame_index};
+            applyQPModification(frame, block);
+            
+            if (blocks && count < max_blocks) {
+                blocks[count] = block;
+            }
+            count++;
+        }
+    }
+    finishFrame(render_start);
+    
+    blocks_modified_.fetch_add(static_cast<uint32_t>(count), std::memory_order_relaxed);
+    frames_processed_.fetch_add(1, std::memory_order_relaxed);
+    
+    return count;
+}
+
+bool WatermarkEncoder::analyzeFrame(const FrameView& frame, uint32_t frame_index) {
+    if (!frame.data || frame.layout != PlaneLayout::Planar ||
+        frame.width != width_ || frame.height != height_) {
+        return false;
+    }
+    
+    // Cuts are tracked on every frame so the pattern restarts where the
+    // extractor expects it, whatever the deadline
+    trackScene(frame, frame_index);
+    
+    // Analysis is the first work dropped when a frame would overrun
+    if (beginFrame(frame_index) != EmbedStep::Full || !active_->config.adaptive_embedding) {
+        return false;
+    }
+    
+    auto start = std::chrono::steady_clock::now();
+    computeBlockActivity(frame.data, frame.stride, frame.width, frame.height, activity_.data(),
+                         simd_level_);
+    activity_frame_ = frame_index;
+    activity_valid_ = true;
+    recordCost(analysis_cost_ns_, elapsedNs(start));
+    
+    return true;
+}
+
+size_t WatermarkEncoder::processFrame(const PlanarFrame& frame,
+                                      uint32_t frame_index,
+                                      BlockInfo* blocks,
+                                      size_t max_blocks) {
+    return processFrame(lumaView(frame), frame_index, blocks, max_blocks);
+}
+
+bool WatermarkEncoder::analyzeFrame(const PlanarFrame& frame, uint32_t frame_index) {
+    return analyzeFrame(lumaView(frame), frame_index);
+}
+
+bool WatermarkEncoder::needsAnalysis() const {
+    return active_ && (active_->config.adaptive_embedding || active_->config.scene_cut_threshold > 0.0f);
+}
+
+FrameView WatermarkEncoder::lumaView(const PlanarFrame& frame) {
+    // Y is the first plane of both I420 and NV12
+    return {frame.planes[0], frame.strides[0], frame.width, frame.height, PlaneLayout::Planar, 1};
+}
+
+uint32_t WatermarkEncoder::getMaxBlocksPerFrame() const {
+    return active_ ? active_->schedule->maxBlocksPerFrame() : 0;
+}
+
 std::vector<BlockInfo> WatermarkEncoder::getBlocksForFrame(uint32_t frame_index) {
+    applyPendingConfig(frame_index);
+    BlockSpan span = getScheduleForFrame(frame_index);
+    
     std::vector<BlockInfo> blocks;
+    blocks.reserve(span.count);
     
-    // Calculate how many blocks to modify this frame
-    uint32_t blocks_per_frame = static_cast<uint32_t>(
-        total_blocks_ * config_.block_density / config_.temporal_period
-    );
+    for (uint32_t i = 0; i < span.count; ++i) {
+        blocks.push_back({span.x[i], span.y[i], span.qp_delta[i], frame_index});
+    }
     
-    // Ensure we don't exceed total blocks
-    blocks_per_frame = std::min(blocks_per_frame, total_blocks_);
+    return blocks;
+}
+
+BlockSpan WatermarkEncoder::getScheduleForFrame(uint32_t frame_index) {
+    if (!active_ || active_->schedule->maxBlocksPerFrame() == 0) {
+        return {nullptr, nullptr, nullptr, 0};
+    }
+    
+    // The frame being processed may carry the phases of skipped frames
+    uint32_t phases = frame_started_ && frame_index_ == frame_index ? frame_phases_ : 1;
+    if (phases == 0) {
+        return {nullptr, nullptr, nullptr, 0};
+    }
     
-    // Select blocks for this frame
-    for (uint32_t i = 0; i < blocks_per_frame; ++i) {
-        uint32_t block_idx = (frame_index + i * config_.temporal_period) % total_blocks_;
+    // Map each phase onto this grid once, then reuse it for the whole frame;
+    // deltas repeat with the cycle, positions within it. The pilot is only
+    // merged in by mapFrames().
+    EmbeddingState& state = *active_;
+    uint32_t index = scheduleIndex(frame_index);
+    uint32_t phase = index % state.schedule->cycle();
+    if (phases == 1 && state.schedule->pilotBlocks() == 0) {
+        if (state.mapped_phase != phase || state.mapped_phases != 1) {
+            state.schedule->mapFrame(index, width_, height_, 
+                                     state.mapped_x.data(), state.mapped_y.data());
+            state.mapped_phase = phase;
+            state.mapped_phases = 1;
+        }
         
-        // Calculate block coordinates
-        uint32_t blocks_x = (width_ + 7) / 8;
-        uint32_t x = (block_idx % blocks_x) * 8;
-        uint32_t y = (block_idx / blocks_x) * 8;
+        EmbeddingSchedule::Phase blocks = state.schedule->phase(index);
+        return {state.mapped_x.data(), state.mapped_y.data(), blocks.qp_delta, blocks.count};
+    }
+    
+    if (state.mapped_phase != phase || state.mapped_phases != phases) {
+        state.mapped_count = state.schedule->mapFrames(index, phases, width_, height_, 
+                                                       state.mapped_x.data(), state.mapped_y.data(),
+                                                       state.mapped_qp.data());
+        state.mapped_phase = phase;
+        state.mapped_phases = phases;
+    }
+    
+    return {state.mapped_x.data(), state.mapped_y.data(), state.mapped_qp.data(), 
+            state.mapped_count};
+}
+
+bool WatermarkEncoder::carriesMarks(uint32_t first_frame, uint32_t frame_count) const {
+    if (!active_ || active_->schedule->maxBlocksPerFrame() == 0) {
+        return false;
+    }
+    
+    // The pilot is in every frame of a marked period; otherwise phases
+    // repeat, so one run of marked and unmarked periods decides a longer
+    // range
+    const EmbeddingSchedule& schedule = *active_->schedule;
+    uint32_t frames = std::min(frame_count, schedule.period() * schedule.markedPeriodInterval());
+    for (uint32_t f = 0; f < frames; ++f) {
+        uint32_t index = scheduleIndex(first_frame + f);
+        if (schedule.pilotBlocks() > 0 && schedule.marksFrame(index)) {
+            return true;
+        }
+        EmbeddingSchedule::Phase blocks = schedule.phase(index);
+        for (uint32_t i = 0; i < blocks.count; ++i) {
+            if (blocks.qp_delta[i] != 0) {
+                return true;
+            }
+        }
+    }
+    
+    return false;
+}
+
+size_t WatermarkEncoder::writeQuantOffsets(uint32_t frame_index,
+                                           const QuantOffsetPlane& plane,
+                                           uint32_t* touched,
+                                           size_t max_touched) {
+    if (!plane.offsets) {
+        return 0;
+    }
+    
+    EmbedStep step = beginFrame(frame_index);
+    if (step == EmbedStep::ReuseMap || step == EmbedStep::NonReference) {
+        frames_processed_.fetch_add(1, std::memory_order_relaxed);
+        return 0;
+    }
+    
+    auto render_start = std::chrono::steady_clock::now();
+    BlockSpan span = getScheduleForFrame(frame_index);
+    AdaptiveSearch search = adaptiveSearch(frame_index);
+    uint32_t block_step = blockStep();
+    uint32_t count = 0;
+    size_t written = 0;
+    
+    for (uint32_t i = 0; i < span.count; i += block_step) {
+        count++;
+        if (span.qp_delta[i] == 0) {
+            continue;
+        }
         
-        // Calculate QP delta
-        int8_t qp_delta = calculateQPDelta(block_idx, frame_index);
+        // Four 8x8 blocks share one 16x16 macroblock
+        uint32_t mb_x = selectTexturedBlock(search, span.x[i], span.y[i]) >> 4;
+        uint32_t mb_y = span.y[i] >> 4;
+        if (mb_x >= plane.mb_width || mb_y >= plane.mb_height) {
+            continue;
+        }
         
-        blocks.push_back({x, y, qp_delta, frame_index});
+        uint32_t mb_index = mb_y * plane.mb_width + mb_x;
+        plane.offsets[mb_index] += static_cast<float>(span.qp_delta[i]);
+        
+        if (touched && written < max_touched) {
+            touched[written] = mb_index;
+        }
+        written++;
     }
+    finishFrame(render_start);
     
-    return blocks;
+    blocks_modified_.fetch_add(count, std::memory_order_relaxed);
+    frames_processed_.fetch_add(1, std::memory_order_relaxed);
+    
+    return written;
 }
 
-void WatermarkEncoder::updateConfig(const WatermarkConfig& config) {
+size_t WatermarkEncoder::renderQuantOffsets(uint32_t frame_index, const QuantOffsetPlane& plane) {
+    if (!plane.offsets) {
+        return 0;
+    }
+    
+    // The plane is left holding the previous frame's map
+    EmbedStep step = beginFrame(frame_index);
+    if (step == EmbedStep::ReuseMap) {
+        frames_processed_.fetch_add(1, std::memory_order_relaxed);
+        return 0;
+    }
+    
+    // A non-reference frame goes out without offsets
+    if (step == EmbedStep::NonReference) {
+        std::fill(plane.offsets, plane.offsets + static_cast<size_t>(plane.mb_width) * plane.mb_height,
+                  0.0f);
+        frames_processed_.fetch_add(1, std::memory_order_relaxed);
+        return 0;
+    }
+    
+    auto render_start = std::chrono::steady_clock::now();
+    BlockSpan span = getScheduleForFrame(frame_index);
+    AdaptiveSearch search = adaptiveSearch(frame_index);
+    uint32_t block_step = blockStep();
+    size_t written = 0;
+    
+    // Small planes are not worth waking the pool for
+    constexpr uint32_t kMinSliceRows = 8;
+    uint32_t slices = pool_ ? std::min(pool_->size(), plane.mb_height / kMinSliceRows) : 1;
+    if (slices <= 1) {
+        written = renderSlice(span, search, block_step, plane, 0, plane.mb_height);
+    } else {
+        std::atomic<size_t> total(0);
+        
+        // Equal row counts; the first (mb_height % slices) slices take one extra row
+        struct SliceJob {
+            const BlockSpan& span;
+            const AdaptiveSearch& search;
+            uint32_t block_step;
+            const QuantOffsetPlane& plane;
+            uint32_t slices;
+            std::atomic<size_t>& total;
+        } job{span, search, block_step, plane, slices, total};
+        
+        pool_->run(slices, [&job](uint32_t slice) {
+            uint32_t rows = job.plane.mb_height / job.slices;
+            uint32_t extra = job.plane.mb_height % job.slices;
+            uint32_t first = slice * rows + std::min(slice, extra);
+            uint32_t last = first + rows + (slice < extra ? 1 : 0);
+            
+            size_t count = renderSlice(job.span, job.search, job.block_step, job.plane, first, last);
+            job.total.fetch_add(count, std::memory_order_relaxed);
+        });
+        
+        written = total.load(std::memory_order_relaxed);
+    }
+    finishFrame(render_start);
+    
+    blocks_modified_.fetch_add((span.count + block_step - 1) / block_step, std::memory_order_relaxed);
+    frames_processed_.fetch_add(1, std::memory_order_relaxed);
+    
+    return written;
+}
+
+void WatermarkEncoder::setWorkerPool(WorkerPool* pool) {
+    pool_ = pool;
+}
+
+void WatermarkEncoder::updateConfig(const WatermarkConfig& config, uint32_t gop_length) {
+    std::lock_guard<std::mutex> lock(update_mutex_);
     config_ = config;
-    generateBlockSelection();
+    
+    // The worker pool belongs to the encode thread, so build on this one
+    std::unique_ptr<EmbeddingState> state = buildState(config, nullptr, nullptr);
+    state->switch_interval = gop_length;
+    
+    // A previous update the encode thread never claimed is superseded
+    delete pending_.exchange(state.release(), std::memory_order_acq_rel);
+    collectRetired();
+}
+
+void WatermarkEncoder::updateConfig(const WatermarkConfig& config,
+                                    std::shared_ptr<const EmbeddingSchedule> schedule,
+                                    uint32_t gop_length) {
+    std::lock_guard<std::mutex> lock(update_mutex_);
+    config_ = config;
+    if (schedule) {
+        reference_width_ = schedule->referenceWidth();
+        reference_height_ = schedule->referenceHeight();
+    }
+    
+    std::unique_ptr<EmbeddingState> state = buildState(config, std::move(schedule), nullptr);
+    state->switch_interval = gop_length;
+    
+    delete pending_.exchange(state.release(), std::memory_order_acq_rel);
+    collectRetired();
+}
+
+bool WatermarkEncoder::applyPendingConfig(uint32_t frame_index) {
+    // Only a load on the common path where nothing was published
+    if (pending_.load(std::memory_order_acquire)) {
+        EmbeddingState* incoming = pending_.exchange(nullptr, std::memory_order_acq_rel);
+        if (incoming) {
+            if (staged_) {
+                retire(staged_);
+            }
+            staged_ = incoming;
+        }
+    }
+    
+    if (!staged_ || (staged_->switch_interval != 0 && frame_index % staged_->switch_interval != 0)) {
+        return false;
+    }
+    
+    if (active_) {
+        retire(active_);
+    }
+    active_ = staged_;
+    staged_ = nullptr;
+    
+    return true;
 }
 
 std::string WatermarkEncoder::getStats() const {
+    std::lock_guard<std::mutex> lock(update_mutex_);
+    
     std::ostringstream oss;
     oss << "WatermarkEncoder Stats:\n"
-        << "  Frames processed: " << frames_processed_ << "\n"
-        << "  Blocks modified: " << blocks_modified_ << "\n"
+        << "  Frames processed: " << frames_processed_.load(std::memory_order_relaxed) << "\n"
+        << "  Blocks modified: " << blocks_modified_.load(std::memory_order_relaxed) << "\n"
         << "  Total blocks: " << total_blocks_ << "\n"
         << "  Block density: " << (config_.block_density * 100) << "%\n"
         << "  Temporal period: " << config_.temporal_period << " frames\n"
-        << "  Payload: 0x" << std::hex << std::setw(16) << std::setfill('0') 
-        << config_.payload << std::dec;
+        << "  Frame budget: " << config_.frame_budget_us << " us\n"
+        << "  Analysis skipped: " << analysis_skipped_.load(std::memory_order_relaxed) << " frames\n"
+        << "  Maps reused: " << maps_reused_.load(std::memory_order_relaxed) << " frames\n"
+        << "  Density reduced: " << density_reduced_.load(std::memory_order_relaxed) << " frames\n"
+        << "  Deadline misses: " << deadline_misses_.load(std::memory_order_relaxed) << " frames\n"
+        << "  Scene cuts: " << scene_cuts_.load(std::memory_order_relaxed) << "\n"
+        << "  Payload: " << utils::payloadToHex(config_.payload);
+    
+    if (config_.window_frames > 0) {
+        oss << "\n  Payload window: " << config_.window_frames << " frames, each bit "
+            << std::max<uint32_t>(1, config_.window_repeats) << "x";
+    }
+    
+    if (config_.pilot_density > 0.0f) {
+        oss << "\n  Sync pilot: " << (config_.pilot_density * 100.0f) << "% of cells";
+    }
+    
+    if (config_.marked_period_interval > 1) {
+        oss << "\n  Marked periods: 1 in " << config_.marked_period_interval;
+    }
+    
+    if (buffer_pool_) {
+        BufferPoolStats pool = buffer_pool_->getStats();
+        oss << "\n  Buffer pool: " << pool.hits << " hits, " << pool.misses << " misses";
+    }
     
     return oss.str();
 }
 
-void WatermarkEncoder::generateBlockSelection() {
-    block_indices_.clear();
-    block_indices_.reserve(total_blocks_);
+EmbedStep WatermarkEncoder::beginFrame(uint32_t frame_index) {
+    return beginFrame(frame_index, FrameInfo{FrameType::Unknown, true});
+}
+
+EmbedStep WatermarkEncoder::beginFrame(uint32_t frame_index, const FrameInfo& info) {
+    applyPendingConfig(frame_index);
+    if (frame_started_ && frame_index_ == frame_index) {
+        return frame_phases_ == 0 ? EmbedStep::NonReference : frame_step_;
+    }
+    
+    frame_start_ = std::chrono::steady_clock::now();
+    frame_index_ = frame_index;
+    frame_started_ = true;
+    frame_finished_ = false;
+    
+    // Non-reference frames are not planned, so frame_step_ keeps the last
+    // planned step for the cost decay in planFrame()
+    frame_phases_ = phase_carry_.next(info, active_ ? active_->schedule->period() : 1);
+    if (frame_phases_ == 0) {
+        return EmbedStep::NonReference;
+    }
+    frame_step_ = planFrame();
+    
+    switch (frame_step_) {
+    case EmbedStep::Full:
+        reused_streak_ = 0;
+        break;
+    case EmbedStep::SkipAnalysis:
+        reused_streak_ = 0;
+        analysis_skipped_.fetch_add(1, std::memory_order_relaxed);
+        break;
+    case EmbedStep::ReuseMap:
+        reused_streak_++;
+        maps_reused_.fetch_add(1, std::memory_order_relaxed);
+        break;
+    case EmbedStep::ReduceDensity:
+        reused_streak_ = 0;
+        density_reduced_.fetch_add(1, std::memory_order_relaxed);
+        break;
+    case EmbedStep::NonReference:
+        break;
+    }
+    
+    return frame_step_;
+}
+
+DeadlineStats WatermarkEncoder::getDeadlineStats() const {
+    return {analysis_skipped_.load(std::memory_order_relaxed),
+            maps_reused_.load(std::memory_order_relaxed),
+            density_reduced_.load(std::memory_order_relaxed),
+            deadline_misses_.load(std::memory_order_relaxed),
+            density_shift_.load(std::memory_order_relaxed)};
+}
+
+void WatermarkEncoder::trackScene(const FrameView& frame, uint32_t frame_index) {
+    float threshold = active_ ? active_->config.scene_cut_threshold : 0.0f;
+    if (threshold <= 0.0f || frame.layout != PlaneLayout::Planar ||
+        (scene_tracked_ && scene_frame_ == frame_index)) {
+        return;
+    }
+    
+    scene_detector_.setThreshold(threshold);
+    scene_frame_ = frame_index;
+    scene_tracked_ = true;
+    
+    if (scene_detector_.process(frame.data, frame.stride, frame.width, frame.height)) {
+        scene_start_ = frame_index;
+        scene_cuts_.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+uint32_t WatermarkEncoder::scheduleIndex(uint32_t frame_index) const {
+    return frame_index >= scene_start_ ? frame_index - scene_start_ : frame_index;
+}
+
+EmbedStep WatermarkEncoder::planFrame() {
+    uint32_t budget_us = active_ ? active_->config.frame_budget_us : 0;
+    if (budget_us == 0) {
+        density_shift_.store(0, std::memory_order_relaxed);
+        return EmbedStep::Full;
+    }
     
-    // Generate sequence of all block indices
-    for (uint32_t i = 0; i < total_blocks_; ++i) {
-        block_indices_.push_back(i);
+    int64_t budget = static_cast<int64_t>(budget_us) * 1000;
+    bool adaptive = active_->config.adaptive_embedding;
+    
+    // Skipped work is not measured; let its estimate decay so it is tried
+    // again once the load that pushed it out has gone
+    if (frame_step_ != EmbedStep::Full) {
+        analysis_cost_ns_ -= analysis_cost_ns_ / 16;
+    }
+    if (frame_step_ == EmbedStep::ReuseMap) {
+        render_cost_ns_ -= render_cost_ns_ / 16;
     }
     
-    // Shuffle using the seed
-    std::mt19937 rng(config_.seed);
-    std::shuffle(block_indices_.begin(), block_indices_.end(), rng);
+    // A frame carrying skipped phases renders all of their blocks
+    int64_t full = render_cost_ns_ * frame_phases_;
     
-    current_block_index_ = 0;
+    // Give density back one halving at a time while the larger map fits
+    uint32_t shift = density_shift_.load(std::memory_order_relaxed);
+    while (shift > 0 && (full >> (shift - 1)) <= budget) {
+        shift--;
+    }
+    
+    EmbedStep step;
+    int64_t render = full >> shift;
+    if (shift == 0 && render + (adaptive ? analysis_cost_ns_ : 0) <= budget) {
+        step = EmbedStep::Full;
+    } else if (render <= budget) {
+        step = shift == 0 ? EmbedStep::SkipAnalysis : EmbedStep::ReduceDensity;
+    } else if (reused_streak_ < kMaxReusedFrames) {
+        step = EmbedStep::ReuseMap;
+    } else {
+        while (shift < kMaxDensityShift && (full >> shift) > budget) {
+            shift++;
+        }
+        step = EmbedStep::ReduceDensity;
+    }
+    
+    density_shift_.store(shift, std::memory_order_relaxed);
+    return step;
 }
 
-int8_t WatermarkEncoder::calculateQPDelta(uint32_t block_index, uint32_t frame_index) {
-    // Use block index and frame index to determine QP delta
-    // This creates a pseudo-random but deterministic pattern
+void WatermarkEncoder::finishFrame(std::chrono::steady_clock::time_point render_start) {
+    if (frame_finished_) {
+        return;
+    }
+    frame_finished_ = true;
     
-    // Simple hash function for demonstration
-    uint32_t hash = block_index * 31 + frame_index * 17 + config_.seed;
-    hash = ((hash << 13) ^ hash) >> 19;
+    // Scaled to one phase at full density
+    uint32_t shift = density_shift_.load(std::memory_order_relaxed);
+    recordCost(render_cost_ns_, (elapsedNs(render_start) << shift) / std::max<uint32_t>(1, frame_phases_));
     
-    // Map to QP delta: -1, 0, or +1
-    uint32_t mod = hash % 3;
-    if (mod == 0) return -1;
-    if (mod == 1) return 0;
-    return 1;
+    uint32_t budget_us = active_ ? active_->config.frame_budget_us : 0;
+    if (budget_us != 0 && elapsedNs(frame_start_) > static_cast<int64_t>(budget_us) * 1000) {
+        deadline_misses_.fetch_add(1, std::memory_order_relaxed);
+    }
 }
 
-void WatermarkEncoder::applyQPModification(uint8_t* frame_data, const BlockInfo& block_info) {
+uint32_t WatermarkEncoder::blockStep() const {
+    return 1u << density_shift_.load(std::memory_order_relaxed);
+}
+
+std::unique_ptr<WatermarkEncoder::EmbeddingState> 
+WatermarkEncoder::buildState(const WatermarkConfig& config,
+                             std::shared_ptr<const EmbeddingSchedule> schedule,
+                             WorkerPool* pool) const {
+    auto state = std::make_unique<EmbeddingState>();
+    state->config = config;
+    state->schedule = schedule ? std::move(schedule) :
+        createSchedule(config, reference_width_, reference_height_, pool);
+    size_t mapped = state->schedule->maxBlocksPerFrame();
+    state->mapped_x.resize(mapped);
+    state->mapped_y.resize(mapped);
+    state->mapped_qp.resize(mapped);
+    state->mapped_phase = UINT32_MAX;
+    state->mapped_phases = 0;
+    state->mapped_count = 0;
+    state->switch_interval = 0;
+    state->next_retired = nullptr;
+    
+    return state;
+}
+
+void WatermarkEncoder::retire(EmbeddingState* state) {
+    EmbeddingState* head = retired_.load(std::memory_order_relaxed);
+    do {
+        state->next_retired = head;
+    } while (!retired_.compare_exchange_weak(head, state, std::memory_order_release,
+                                             std::memory_order_relaxed));
+}
+
+void WatermarkEncoder::collectRetired() {
+    EmbeddingState* state = retired_.exchange(nullptr, std::memory_order_acquire);
+    while (state) {
+        EmbeddingState* next = state->next_retired;
+        delete state;
+        state = next;
+    }
+}
+
+WatermarkEncoder::AdaptiveSearch WatermarkEncoder::adaptiveSearch(uint32_t frame_index) const {
+    AdaptiveSearch search{nullptr, (width_ + 7) / 8, width_, 0};
+    if (!active_ || !active_->config.adaptive_embedding || 
+        !activity_valid_ || activity_frame_ != frame_index) {
+        return search;
+    }
+    
+    search.radius = adaptiveSearchRadius(active_->config.quality_threshold);
+    if (search.radius > 0) {
+        search.activity = activity_.data();
+    }
+    
+    return search;
+}
+
+uint32_t WatermarkEncoder::selectTexturedBlock(const AdaptiveSearch& search, uint32_t x, uint32_t y) {
+    if (!search.activity) {
+        return x;
+    }
+    
+    const uint32_t* row = search.activity + static_cast<size_t>(y / 8) * search.blocks_x;
+    return mostTexturedBlock(row, search.width, x, search.radius);
+}
+
+size_t WatermarkEncoder::renderSlice(const BlockSpan& span, const AdaptiveSearch& search, 
+                                     uint32_t step, const QuantOffsetPlane& plane,
+                                     uint32_t first_row, uint32_t last_row) {
+    if (first_row >= last_row) {
+        return 0;
+    }
+    
+    std::fill(plane.offsets + static_cast<size_t>(first_row) * plane.mb_width,
+              plane.offsets + static_cast<size_t>(last_row) * plane.mb_width, 0.0f);
+    
+    if (span.count == 0) {
+        return 0;
+    }
+    
+    // The span is raster sorted, so the slice's blocks are contiguous in it
+    const uint16_t* begin = std::lower_bound(span.y, span.y + span.count, first_row * 16);
+    const uint16_t* end = std::lower_bound(begin, span.y + span.count, last_row * 16);
+    
+    // Keep the block subset independent of how the plane is sliced
+    size_t first = begin - span.y;
+    first = (first + step - 1) / step * step;
+    
+    size_t written = 0;
+    for (size_t i = first; i < static_cast<size_t>(end - span.y); i += step) {
+        uint32_t mb_x = selectTexturedBlock(search, span.x[i], span.y[i]) >> 4;
+        if (span.qp_delta[i] == 0 || mb_x >= plane.mb_width) {
+            continue;
+        }
+        
+        uint32_t mb_index = (span.y[i] >> 4) * plane.mb_width + mb_x;
+        plane.offsets[mb_index] += static_cast<float>(span.qp_delta[i]);
+        written++;
+    }
+    
+    return written;
+}
+
+void WatermarkEncoder::applyQPModification(const FrameView& frame, const BlockInfo& block_info) {
     // This is a simplified implementation
     // In practice, this would modify the DCT coefficients or QP values
     // in the H.264 encoding process
@@ -143,27 +808,50 @@ void WatermarkEncoder::applyQPModification(uint8_t* frame_data, const BlockInfo&
     // this would modify the actual encoding parameters)
     
     // Calculate block offset in frame data
-    uint32_t block_offset = block_info.y * width_ + block_info.x;
+    size_t block_offset = block_info.y * frame.stride + 
+                          static_cast<size_t>(block_info.x) * frame.bytes_per_pixel;
     
     // In a real implementation, this would modify QP values
-    // frame_data[block_offset] += block_info.qp_delta;
+    // frame.data[block_offset] += block_info.qp_delta;
     
     // For demonstration, we'll just ensure the block is accessible
-    if (block_offset < width_ * height_) {
-        // Block is within frame bounds
+    if (block_info.x < frame.width && block_info.y < frame.height) {
+        // Block starts at block_offset within the frame
         // Actual QP modification would happen here
+        (void)block_offset;
+    }
+}
+
+std::shared_ptr<const EmbeddingSchedule> 
+WatermarkEncoder::createSchedule(const WatermarkConfig& config, uint32_t reference_width,
+                                 uint32_t reference_height, WorkerPool* pool) {
+    CodedPayload codeword;
+    encodePayload(encryptPayload(config), codeword);
+    auto schedule = EmbeddingSchedule::create(config.seed, config.block_density, 
+                                              config.temporal_period, reference_width, 
+                                              reference_height, pool, &codeword,
+                                              config.window_frames, config.window_repeats,
+                                              config.pilot_density, config.marked_period_interval);
+    
+    // Even every block of the period may not cover a very short window
+    if (config.window_frames > 0 && 
+        schedule->coverage(config.window_frames) < std::max<uint32_t>(1, config.window_repeats)) {
+        std::cerr << "Warning: " << config.window_frames << " frames carry each payload bit only "
+                  << schedule->coverage(config.window_frames) << " times" << std::endl;
     }
+    
+    return schedule;
 }
 
-uint64_t WatermarkEncoder::encryptPayload(uint64_t payload) {
-    if (!config_.enable_encryption) {
-        return payload;
+Payload WatermarkEncoder::encryptPayload(const WatermarkConfig& config) {
+    if (!config.enable_encryption) {
+        return config.payload;
     }
     
-    // Simple XOR encryption for demonstration
+    // Simple XOR encryption for demonstration; the key is hashed the same
+    // way on every platform so an extractor can undo it
     // In production, use proper cryptographic functions
-    uint64_t key = std::hash<std::string>{}(config_.encryption_key);
-    return payload ^ key;
+    return utils::xorEncrypt(config.payload, utils::generatePayloadFromString(config.encryption_key));
 }
 
 } // namespace phantomframe
@@ -1,21 +1,39 @@
 #ifndef PHANTOMFRAME_WATERMARK_ENCODER_H
 #define PHANTOMFRAME_WATERMARK_ENCODER_H
 
+#include <atomic>
+#include <chrono>
 #include <cstdint>
 #include <vector>
 #include <memory>
+#include <mutex>
 #include <string>
+#include "common/buffer_pool.h"
+#include "common/cpu_features.h"
+#include "common/embedding_schedule.h"
+#include "common/payload.h"
+#include "common/scene_cut.h"
 
 namespace phantomframe {
 
+class WorkerPool;
+
 /**
  * @brief Configuration for watermark embedding
  */
 struct WatermarkConfig {
-    uint64_t payload;           // 128-bit payload to embed
+    Payload payload;            // 128-bit payload to embed
     uint32_t seed;              // Pseudo-random seed for block selection
     float block_density;         // Percentage of blocks to modify (0.005-0.01)
     uint32_t temporal_period;   // Frames between pattern repetition
+    bool adaptive_embedding;    // Move deltas toward textured blocks
+    float quality_threshold;    // Adaptive search strength (0-1), higher searches wider
+    uint32_t frame_budget_us;   // Embedding deadline per frame in microseconds, 0 for none
+    float scene_cut_threshold;  // Mean luma change (0-255) that restarts the pattern, 0 for none
+    uint32_t window_frames;     // Any run of this many frames carries the whole payload, 0 for no guarantee
+    uint32_t window_repeats;    // Times each payload bit is carried in such a run
+    float pilot_density;        // Fraction of pilot cells carrying the sync pilot, 0 for none
+    uint32_t marked_period_interval; // Mark one temporal period in this many, 0 or 1 for every one
     bool enable_encryption;     // Whether to encrypt the payload
     std::string encryption_key; // Encryption key if enabled
 };
@@ -29,8 +47,116 @@ struct BlockInfo {
     uint32_t frame_index;       // Frame where this block is modified
 };
 
+/**
+ * @brief Read-only view of the blocks scheduled for one frame
+ */
+struct BlockSpan {
+    const uint16_t* x;          // Block x coordinates in pixels
+    const uint16_t* y;          // Block y coordinates in pixels
+    const int8_t* qp_delta;     // QP modification per block
+    uint32_t count;             // Number of blocks in the span
+};
+
+/**
+ * @brief Per-macroblock QP offset plane in x264 quant_offsets layout
+ *
+ * One float per 16x16 macroblock in raster order, exactly as consumed by
+ * x264_picture_t.prop.quant_offsets. x264 applies it on top of its own
+ * adaptive quantisation and reads it during x264_encoder_encode().
+ */
+struct QuantOffsetPlane {
+    float* offsets;             // mb_width * mb_height entries, caller-owned
+    uint32_t mb_width;          // Macroblocks per row, (width + 15) / 16
+    uint32_t mb_height;         // Macroblock rows, (height + 15) / 16
+};
+
+/**
+ * @brief Pixel layout of the memory referenced by a FrameView
+ */
+enum class PlaneLayout {
+    Planar,                     // Single 8-bit plane (e.g. Y of I420/NV12)
+    Packed                      // Interleaved samples, bytes_per_pixel each
+};
+
+/**
+ * @brief Non-owning view of a mutable frame
+ */
+struct FrameView {
+    uint8_t* data;              // First byte of the top-left pixel
+    size_t stride;              // Bytes between the starts of two rows
+    uint32_t width, height;     // Frame dimensions in pixels
+    PlaneLayout layout;         // How pixels are laid out in data
+    uint32_t bytes_per_pixel;   // Bytes per pixel (1 for Planar)
+};
+
+/**
+ * @brief Planar YUV 4:2:0 layouts accepted by the encoder
+ */
+enum class PixelFormat {
+    I420,                       // Y, U and V planes
+    NV12                        // Y plane and one interleaved UV plane
+};
+
+/**
+ * @brief Non-owning view of a planar YUV 4:2:0 frame
+ *
+ * Only the Y plane is read. Chroma pointers are carried so decoder output
+ * can be passed through as is, and may be null.
+ */
+struct PlanarFrame {
+    PixelFormat format;         // Plane layout
+    uint8_t* planes[3];         // Y, then U and V (I420) or UV (NV12)
+    size_t strides[3];          // Bytes between the starts of two rows, per plane
+    uint32_t width, height;     // Luma dimensions in pixels
+};
+
+/**
+ * @brief Embedding work done for a frame under its deadline
+ *
+ * Steps are ordered from the most to the least work; every step after
+ * Full also skips the adaptive analysis.
+ */
+enum class EmbedStep {
+    Full,                       // Adaptive analysis and a fresh map
+    SkipAnalysis,               // Fresh map without the adaptive move
+    ReuseMap,                   // Previous frame's map is used again
+    ReduceDensity,              // Fresh map with only part of the blocks
+    NonReference                // No blocks; they move to the next reference frame
+};
+
+/**
+ * @brief Degradations taken to keep embedding within the frame deadline
+ */
+struct DeadlineStats {
+    uint32_t analysis_skipped;  // Frames embedded without adaptive analysis
+    uint32_t maps_reused;       // Frames that reused the previous map
+    uint32_t density_reduced;   // Frames embedded with fewer blocks
+    uint32_t deadline_misses;   // Frames whose embedding overran the deadline anyway
+    uint32_t density_shift;     // Current reduction, every 2^shift-th block is kept
+};
+
 /**
  * @brief Main watermark encoder class
+ *
+ * One thread (the encode thread) calls the per-frame methods. Any other
+ * thread may call updateConfig() and getStats() concurrently; the new
+ * schedule is built on the caller's thread and picked up by the encode
+ * thread at the start of a later frame without blocking it.
+ *
+ * With a frame_budget_us deadline the encoder times its own work and, when
+ * a frame would overrun, degrades in steps (see EmbedStep) rather than
+ * delaying the frame. Each step is taken back once measurements show the
+ * work fits again.
+ *
+ * Hosts that know the picture type pass it to beginFrame() in display
+ * order. Non-reference frames are then left unmarked and the next
+ * reference frame carries their blocks (see PhaseCarry), so each GOP's
+ * block budget and deadline work go to frames whose deltas survive.
+ *
+ * With scene_cut_threshold set, every frame's luma is checked for a hard
+ * cut and the temporal pattern restarts from its first phase at each cut,
+ * so an extractor running the same detection resynchronises at every
+ * scene of edited content.
  */
 class WatermarkEncoder {
 public:
@@ -46,6 +172,45 @@ public:
      */
     bool initialize(uint32_t width, uint32_t height, float fps);
 
+    /**
+     * @brief Initialize the encoder with a schedule shared across renditions
+     *
+     * The schedule is mapped onto this encoder's block grid each frame; its
+     * seed, density, period and payload take precedence over the config's.
+     * Build it with createSchedule() so it carries the payload.
+     * @param width Video width
+     * @param height Video height
+     * @param fps Frames per second
+     * @param schedule Stream-wide schedule, or null to build one for this
+     *        resolution from the config
+     * @return true if successful
+     */
+    bool initialize(uint32_t width, uint32_t height, float fps,
+                    std::shared_ptr<const EmbeddingSchedule> schedule);
+
+    /**
+     * @brief Build a schedule carrying a configuration's payload
+     *
+     * The payload is encrypted if enabled, encoded with the payload code
+     * and modulated onto the deltas. With window_frames set, blocks are
+     * added beyond the block density until any run of that many frames
+     * carries every payload bit window_repeats times, so short clips
+     * decode. With pilot_density set, every frame also carries the sync
+     * pilot the extractor locks onto after a crop or rescale. With
+     * marked_period_interval above 1, only every so many temporal periods
+     * carry anything. Share the result across the renditions of a stream
+     * with the overloads that take a schedule.
+     * @param config Configuration to build from
+     * @param reference_width Width of the reference grid in pixels
+     * @param reference_height Height of the reference grid in pixels
+     * @param pool Optional pool to build on
+     * @return Immutable schedule
+     */
+    static std::shared_ptr<const EmbeddingSchedule> createSchedule(const WatermarkConfig& config,
+                                                                   uint32_t reference_width,
+                                                                   uint32_t reference_height,
+                                                                   WorkerPool* pool = nullptr);
+
     /**
      * @brief Process a frame and apply watermark
      * @param frame_data Raw frame data
@@ -57,18 +222,264 @@ public:
                                      size_t frame_size, 
                                      uint32_t frame_index);
 
+    /**
+     * @brief Process a frame into a recycled buffer
+     *
+     * Same as the vector overload, but the copy is taken from the attached
+     * buffer pool and goes back to it when the returned buffer is
+     * destroyed, so a steady stream does not allocate per frame. Without a
+     * pool the buffer is a standalone aligned allocation.
+     * @param frame_data Raw frame data
+     * @param frame_size Size of frame data
+     * @param frame_index Current frame index
+     * @return Modified frame data, empty on invalid input
+     */
+    BufferPool::Buffer processFrameBuffer(const uint8_t* frame_data,
+                                          size_t frame_size,
+                                          uint32_t frame_index);
+
+    /**
+     * @brief Apply watermark to a frame in place without allocating
+     * @param frame Mutable view of the frame to watermark
+     * @param frame_index Current frame index
+     * @param blocks Caller-owned array receiving the modified blocks (may be null)
+     * @param max_blocks Capacity of blocks, see getMaxBlocksPerFrame()
+     * @return Number of blocks modified in this frame
+     */
+    size_t processFrame(const FrameView& frame,
+                        uint32_t frame_index,
+                        BlockInfo* blocks,
+                        size_t max_blocks);
+
+    /**
+     * @brief Measure block texture of a frame for adaptive embedding
+     *
+     * Computes the per-8x8 luma activity that adaptive embedding uses to
+     * move each delta to the most textured macroblock within
+     * quality_threshold * 2 macroblocks of its scheduled position on the
+     * same row, and runs scene-cut detection. Callers of
+     * writeQuantOffsets()/renderQuantOffsets() must analyze every frame in
+     * display order first when needsAnalysis() is true; processFrame()
+     * does so itself.
+     * @param frame Luma plane of the frame (Planar layout)
+     * @param frame_index Index of the frame the activity belongs to
+     * @return true if the activity map was updated
+     */
+    bool analyzeFrame(const FrameView& frame, uint32_t frame_index);
+
+    /**
+     * @brief Measure block texture of a planar YUV frame's luma
+     * @param frame Planar I420 or NV12 frame
+     * @param frame_index Index of the frame the activity belongs to
+     * @return true if the activity map was updated
+     */
+    bool analyzeFrame(const PlanarFrame& frame, uint32_t frame_index);
+
+    /**
+     * @brief Whether frames must be passed to analyzeFrame()
+     * @return true with adaptive embedding or scene-cut detection enabled
+     */
+    bool needsAnalysis() const;
+
+    /**
+     * @brief Apply watermark to a planar YUV frame, touching only luma
+     * @param frame Planar I420 or NV12 frame
+     * @param frame_index Current frame index
+     * @param blocks Caller-owned array receiving the modified blocks (may be null)
+     * @param max_blocks Capacity of blocks, see getMaxBlocksPerFrame()
+     * @return Number of blocks modified in this frame
+     */
+    size_t processFrame(const PlanarFrame& frame,
+                        uint32_t frame_index,
+                        BlockInfo* blocks,
+                        size_t max_blocks);
+
+    /**
+     * @brief Get the largest number of blocks modified in a single frame
+     *
+     * Includes the blocks a reference frame carries for the non-reference
+     * frames before it.
+     * @return Capacity needed for the block list of processFrame()
+     */
+    uint32_t getMaxBlocksPerFrame() const;
+
     /**
      * @brief Get blocks to modify for current frame
+     *
+     * Reports the full schedule regardless of the frame deadline.
      * @param frame_index Current frame index
      * @return Vector of blocks to modify
      */
     std::vector<BlockInfo> getBlocksForFrame(uint32_t frame_index);
 
+    /**
+     * @brief Get the schedule of a frame on this encoder's grid without allocating
+     * @param frame_index Current frame index
+     * @return Span into the encoder's mapped schedule, sorted by row and
+     *         valid until the next frame is processed or the resolution
+     *         changes. Positions are before any adaptive move.
+     */
+    BlockSpan getScheduleForFrame(uint32_t frame_index);
+
+    /**
+     * @brief Whether the schedule gives any frame of a range a QP delta
+     *
+     * Answers from the schedule alone, without rendering or touching frame
+     * state, so callers can decide which GOPs need encoding with the
+     * watermark before decoding them. With a marked period interval above
+     * 1, ranges that fall between marked periods carry nothing.
+     * @param first_frame First frame index of the range
+     * @param frame_count Number of frames in the range
+     * @return true if at least one scheduled block has a non-zero delta
+     */
+    bool carriesMarks(uint32_t first_frame, uint32_t frame_count) const;
+
+    /**
+     * @brief Add this frame's QP deltas to an x264 quant_offsets plane
+     *
+     * Only the macroblocks covering scheduled blocks are written; all other
+     * entries are left untouched so the plane can be reused across frames.
+     * @param frame_index Current frame index
+     * @param plane Plane to update
+     * @param touched Optional array receiving the written macroblock indices
+     * @param max_touched Capacity of touched
+     * @return Number of macroblock entries written (may exceed max_touched)
+     */
+    size_t writeQuantOffsets(uint32_t frame_index,
+                             const QuantOffsetPlane& plane,
+                             uint32_t* touched = nullptr,
+                             size_t max_touched = 0);
+
+    /**
+     * @brief Render this frame's complete QP offset plane slice-parallel
+     *
+     * The plane is split into horizontal slices of macroblock rows, one task
+     * per slice on the attached worker pool. Each slice clears its own rows
+     * and adds the deltas of the blocks inside them, so workers write
+     * disjoint regions without locks. Without a pool the whole plane is
+     * rendered on the calling thread. When the deadline calls for
+     * EmbedStep::ReuseMap the plane is left as it is.
+     * @param frame_index Current frame index
+     * @param plane Plane to overwrite
+     * @return Number of macroblock entries written
+     */
+    size_t renderQuantOffsets(uint32_t frame_index, const QuantOffsetPlane& plane);
+
+    /**
+     * @brief Attach a worker pool for slice-parallel work
+     *
+     * Used by renderQuantOffsets() and when the schedule table is rebuilt.
+     * @param pool Pool to use, owned by the caller, or null for none
+     */
+    void setWorkerPool(WorkerPool* pool);
+
+    /**
+     * @brief Get the attached worker pool
+     * @return Worker pool or null
+     */
+    WorkerPool* getWorkerPool() const { return pool_; }
+
+    /**
+     * @brief Attach a buffer pool for frame copies
+     *
+     * Used by processFrameBuffer(); its counters are included in getStats().
+     * @param pool Pool to use, owned by the caller, or null for none
+     */
+    void setBufferPool(BufferPool* pool) { buffer_pool_ = pool; }
+
+    /**
+     * @brief Get the attached buffer pool
+     * @return Buffer pool or null
+     */
+    BufferPool* getBufferPool() const { return buffer_pool_; }
+
     /**
      * @brief Update watermark configuration
+     *
+     * Builds the new schedule on the calling thread and publishes it
+     * atomically; the encode thread switches over at the start of a frame
+     * and never waits for the build. Safe to call while frames are being
+     * processed. Updates published before the switch are superseded.
+     * @param config New configuration
+     * @param gop_length Switch only on a frame index that is a multiple of
+     *        this (the encoder's fixed keyint), so no GOP mixes two
+     *        schedules; 0 switches on the next frame
+     */
+    void updateConfig(const WatermarkConfig& config, uint32_t gop_length = 0);
+
+    /**
+     * @brief Update configuration to a schedule shared across renditions
+     *
+     * Same switching rules as updateConfig(); the schedule is not rebuilt.
      * @param config New configuration
+     * @param schedule Stream-wide schedule built by the caller
+     * @param gop_length See updateConfig()
+     */
+    void updateConfig(const WatermarkConfig& config,
+                      std::shared_ptr<const EmbeddingSchedule> schedule,
+                      uint32_t gop_length = 0);
+
+    /**
+     * @brief Switch to a published configuration if one is due
+     *
+     * Called implicitly by the per-frame methods; never blocks.
+     * @param frame_index Index of the frame about to be processed
+     * @return true if a new configuration took effect
      */
-    void updateConfig(const WatermarkConfig& config);
+    bool applyPendingConfig(uint32_t frame_index);
+
+    /**
+     * @brief Plan a frame's embedding work against the deadline
+     *
+     * Starts the frame's clock on the first call for a frame index and
+     * returns the same step for later calls with that index. Called
+     * implicitly by the per-frame methods. On ReuseMap they leave quant
+     * offset planes untouched and processFrame() modifies nothing, so
+     * callers that own several planes should hand out the last one again.
+     * @param frame_index Index of the frame about to be processed
+     * @return Work to do for this frame
+     */
+    EmbedStep beginFrame(uint32_t frame_index);
+
+    /**
+     * @brief Plan a frame's embedding work given its picture type
+     *
+     * Same as beginFrame(frame_index) for frames of unknown type. Must be
+     * the first call for the frame, with frames in display order. A
+     * non-reference frame returns EmbedStep::NonReference: it is not
+     * analyzed, processFrame() modifies nothing, renderQuantOffsets()
+     * clears the plane and writeQuantOffsets() leaves it untouched. The
+     * next reference frame carries the skipped blocks. Hosts feeding x264
+     * do not know the type yet and use beginFrame(frame_index).
+     * @param frame_index Index of the frame about to be processed
+     * @param info Picture type and reference status from the host encoder
+     * @return Work to do for this frame
+     */
+    EmbedStep beginFrame(uint32_t frame_index, const FrameInfo& info);
+
+    /**
+     * @brief Get the degradations taken to meet the frame deadline
+     * @return Counters since initialize()
+     */
+    DeadlineStats getDeadlineStats() const;
+
+    /**
+     * @brief Get the number of frames processed since construction
+     * @return Frames processed
+     */
+    uint32_t getFramesProcessed() const { return frames_processed_.load(std::memory_order_relaxed); }
+
+    /**
+     * @brief Get the number of blocks modified since construction
+     * @return Blocks modified
+     */
+    uint32_t getBlocksModified() const { return blocks_modified_.load(std::memory_order_relaxed); }
+
+    /**
+     * @brief Get the number of scene cuts that restarted the pattern
+     * @return Scene cuts since initialize()
+     */
+    uint32_t getSceneCuts() const { return scene_cuts_.load(std::memory_order_relaxed); }
 
     /**
      * @brief Get current watermark statistics
@@ -77,45 +488,216 @@ public:
     std::string getStats() const;
 
 private:
-    WatermarkConfig config_;
+    /**
+     * @brief Configuration and schedule, immutable once published
+     *
+     * Only the mapping scratch changes after publication, and only on the
+     * encode thread.
+     */
+    struct EmbeddingState {
+        WatermarkConfig config;         // Configuration in effect
+        std::shared_ptr<const EmbeddingSchedule> schedule; // Possibly shared with other renditions
+        std::vector<uint16_t> mapped_x; // Current frame's phases mapped onto this grid
+        std::vector<uint16_t> mapped_y;
+        std::vector<int8_t> mapped_qp;  // QP deltas when several phases are merged
+        uint32_t mapped_phase;          // Last phase held in mapped_x/y, UINT32_MAX for none
+        uint32_t mapped_phases;         // Number of phases merged into mapped_x/y
+        uint32_t mapped_count;          // Blocks merged into mapped_x/y, pilot included
+        uint32_t switch_interval;       // Frame index multiple to switch on, 0 for any
+        EmbeddingState* next_retired;   // Link in the retired list
+    };
+
     uint32_t width_, height_;
     float fps_;
     uint32_t total_blocks_;
     
-    // Block selection state
-    std::vector<uint32_t> block_indices_;
-    uint32_t current_block_index_;
+    // Latest requested configuration and the grid its schedule is built on,
+    // guarded by update_mutex_
+    WatermarkConfig config_;
+    uint32_t reference_width_, reference_height_;
+    mutable std::mutex update_mutex_;
+    
+    // Owned by the encode thread: the schedule in use, and a published
+    // schedule waiting for its GOP boundary
+    EmbeddingState* active_;
+    EmbeddingState* staged_;
+    
+    // Handoff from updateConfig(): the newest unclaimed schedule, and the
+    // lock-free list of replaced schedules for the updating thread to free
+    std::atomic<EmbeddingState*> pending_;
+    std::atomic<EmbeddingState*> retired_;
+    
+    // Optional threads for slice-parallel work
+    WorkerPool* pool_;
+    
+    // Optional recycled storage for frame copies
+    BufferPool* buffer_pool_;
+    
+    // Block activity of the last analyzed frame, computed with the kernel
+    // chosen at initialize() so frames touch no process-wide state
+    SimdLevel simd_level_;
+    std::vector<uint32_t> activity_;
+    uint32_t activity_frame_;
+    bool activity_valid_;
+    
+    // Deadline scheduling for the current frame, owned by the encode
+    // thread. Costs are smoothed estimates in nanoseconds, the render cost
+    // scaled to full density.
+    std::chrono::steady_clock::time_point frame_start_;
+    uint32_t frame_index_;
+    bool frame_started_;
+    bool frame_finished_;
+    EmbedStep frame_step_;
+    int64_t analysis_cost_ns_;
+    int64_t render_cost_ns_;
+    uint32_t reused_streak_;
+    
+    // Phases the current frame carries for skipped non-reference frames,
+    // 0 for a non-reference frame. Render costs are per phase.
+    PhaseCarry phase_carry_;
+    uint32_t frame_phases_;
+    
+    // Scene-cut detection on the encode thread; the schedule restarts its
+    // period at scene_start_
+    SceneCutDetector scene_detector_;
+    uint32_t scene_start_;
+    uint32_t scene_frame_;          // Last frame fed to the detector
+    bool scene_tracked_;
     
     // Statistics
-    uint32_t frames_processed_;
-    uint32_t blocks_modified_;
+    std::atomic<uint32_t> frames_processed_;
+    std::atomic<uint32_t> blocks_modified_;
+    std::atomic<uint32_t> analysis_skipped_;
+    std::atomic<uint32_t> maps_reused_;
+    std::atomic<uint32_t> density_reduced_;
+    std::atomic<uint32_t> deadline_misses_;
+    std::atomic<uint32_t> density_shift_;
+    std::atomic<uint32_t> scene_cuts_;
     
     /**
-     * @brief Generate pseudo-random block selection
+     * @brief View the luma plane of a planar frame
+     * @param frame Planar frame
+     * @return Planar view of the Y plane
+     */
+    static FrameView lumaView(const PlanarFrame& frame);
+    
+    /**
+     * @brief Parameters of the adaptive move for one frame
+     */
+    struct AdaptiveSearch {
+        const uint32_t* activity;       // Block activity, null when not adaptive
+        uint32_t blocks_x;              // Activity map stride in blocks
+        uint32_t width;                 // Frame width in pixels
+        int radius;                     // Macroblocks searched on each side
+    };
+
+    /**
+     * @brief Watermark a tightly packed copy of a frame in place
+     * @param data Frame copy
+     * @param frame_size Size of the copy in bytes
+     * @param frame_index Current frame index
+     */
+    void processPackedFrame(uint8_t* data, size_t frame_size, uint32_t frame_index);
+
+    /**
+     * @brief Feed a frame to the scene-cut detector once
+     * @param frame Luma plane of the frame (Planar layout)
+     * @param frame_index Index of the frame
      */
-    void generateBlockSelection();
+    void trackScene(const FrameView& frame, uint32_t frame_index);
     
     /**
-     * @brief Calculate QP delta for a block
-     * @param block_index Block index
+     * @brief Position of a frame in the schedule
      * @param frame_index Frame index
-     * @return QP delta value
+     * @return Frames since the start of the current scene
+     */
+    uint32_t scheduleIndex(uint32_t frame_index) const;
+    
+    /**
+     * @brief Choose the step for a new frame from the cost estimates
+     * @return Step that is expected to fit the deadline
+     */
+    EmbedStep planFrame();
+    
+    /**
+     * @brief Record the cost of a frame's map and check its deadline
+     * @param render_start When building the map started
+     */
+    void finishFrame(std::chrono::steady_clock::time_point render_start);
+    
+    /**
+     * @brief Blocks stride for the current frame's density
+     * @return 1 at full density, 2^shift when reduced
+     */
+    uint32_t blockStep() const;
+    
+    /**
+     * @brief Build the state for a configuration
+     * @param config Configuration to build from
+     * @param schedule Shared schedule, or null to build one on the reference grid
+     * @param pool Pool to build on, or null for the calling thread
+     * @return New state, not yet published
+     */
+    std::unique_ptr<EmbeddingState> buildState(const WatermarkConfig& config,
+                                               std::shared_ptr<const EmbeddingSchedule> schedule,
+                                               WorkerPool* pool) const;
+    
+    /**
+     * @brief Hand a replaced state to the updating thread for deletion
+     * @param state State no longer used by the encode thread
+     */
+    void retire(EmbeddingState* state);
+    
+    /**
+     * @brief Free all retired states
+     */
+    void collectRetired();
+    
+    /**
+     * @brief Get the adaptive move for a frame
+     * @param frame_index Current frame index
+     * @return Search parameters, with null activity if not adaptive
+     */
+    AdaptiveSearch adaptiveSearch(uint32_t frame_index) const;
+    
+    /**
+     * @brief Apply the adaptive move to a scheduled block
+     *
+     * Moves stay on the block's row, so they never leave its slice.
+     * @param search Search parameters
+     * @param x Scheduled block x in pixels
+     * @param y Scheduled block y in pixels
+     * @return x of the selected block in pixels
+     */
+    static uint32_t selectTexturedBlock(const AdaptiveSearch& search, uint32_t x, uint32_t y);
+    
+    /**
+     * @brief Render the macroblock rows [first_row, last_row) of a plane
+     * @param span Blocks scheduled for the frame
+     * @param search Adaptive move for the frame
+     * @param step Render every step-th block of the span
+     * @param plane Plane to overwrite
+     * @param first_row First macroblock row
+     * @param last_row One past the last macroblock row
+     * @return Number of macroblock entries written
      */
-    int8_t calculateQPDelta(uint32_t block_index, uint32_t frame_index);
+    static size_t renderSlice(const BlockSpan& span, const AdaptiveSearch& search, uint32_t step,
+                              const QuantOffsetPlane& plane,
+                              uint32_t first_row, uint32_t last_row);
     
     /**
      * @brief Apply QP modification to frame data
-     * @param frame_data Frame data to modify
+     * @param frame Frame to modify
      * @param block_info Block information
      */
-    void applyQPModification(uint8_t* frame_data, const BlockInfo& block_info);
+    void applyQPModification(const FrameView& frame, const BlockInfo& block_info);
     
     /**
-     * @brief Encrypt payload if enabled
-     * @param payload Payload to encrypt
-     * @return Encrypted payload
+     * @brief Get the payload as embedded, encrypted if enabled
+     * @param config Configuration holding the payload and key
+     * @return Payload to encode
      */
-    uint64_t encryptPayload(uint64_t payload);
+    static Payload encryptPayload(const WatermarkConfig& config);
 };
 
 } // namespace phantomframe
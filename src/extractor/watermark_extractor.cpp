@@ -1,16 +1,67 @@
 #include "watermark_extractor.h"
+#include "common/block_activity.h"
+#include "common/payload_code.h"
+#include "common/pilot_sync.h"
+#include "common/utils.h"
 #include <iostream>
 #include <fstream>
 #include <sstream>
 #include <algorithm>
+#include <array>
 #include <numeric>
 #include <cmath>
 
 namespace phantomframe {
 
+namespace {
+
+/**
+ * @brief Add one frame's soft evidence per channel bit
+ *
+ * A raised QP flattens its block, so a block sampling below the frame's
+ * other carrying blocks favours the unmodulated sign of its delta, i.e.
+ * channel bit 0; deviations are scaled to unit variance per frame. Pilot
+ * blocks carry no channel bit and are left out.
+ * @return false, adding nothing, if fewer than two blocks carry a bit
+ */
+bool addChannelEvidence(const double* samples, const int8_t* qp_delta, const uint16_t* channel,
+                        uint32_t count, float* evidence) {
+    double sum = 0.0;
+    double sum_sq = 0.0;
+    uint32_t carrying = 0;
+    for (uint32_t i = 0; i < count; ++i) {
+        if (qp_delta[i] != 0 && channel[i] < kPayloadCodedBits) {
+            sum += samples[i];
+            sum_sq += samples[i] * samples[i];
+            carrying++;
+        }
+    }
+    if (carrying < 2) {
+        return false;
+    }
+    double mean = sum / carrying;
+    double variance = sum_sq / carrying - mean * mean;
+    double scale = variance > 0.0 ? 1.0 / std::sqrt(variance) : 0.0;
+    
+    for (uint32_t i = 0; i < count; ++i) {
+        if (qp_delta[i] != 0 && channel[i] < kPayloadCodedBits) {
+            evidence[channel[i]] -= static_cast<float>(qp_delta[i] * (samples[i] - mean) * scale);
+        }
+    }
+    return true;
+}
+
+// Scales tried either side of the pilot's estimate, which is only good to
+// a few tenths of a percent; across a 1080p picture that is several blocks
+constexpr int kPilotScaleSteps = 3;
+constexpr float kPilotScaleStep = 0.0025f;
+
+} // namespace
+
 WatermarkExtractor::WatermarkExtractor(const ExtractionConfig& config)
     : config_(config), initialized_(false), frames_analyzed_(0), 
-      videos_processed_(0), watermarks_detected_(0) {
+      videos_processed_(0), watermarks_detected_(0), pilot_locks_(0), scene_start_(0), 
+      buffer_pool_(nullptr) {
 }
 
 WatermarkExtractor::~WatermarkExtractor() = default;
@@ -45,16 +96,19 @@ DetectionResult WatermarkExtractor::analyzeVideo(const std::string& video_path)
     
     std::vector<FrameAnalysis> frame_analyses;
     uint32_t frame_count = 0;
+    phase_carry_.reset();
+    scene_detector_.reset();
+    scene_start_ = 0;
     
-    // Analyze frames
+    // Analyze frames; the capture decodes into the same image every time
+    cv::Mat frame;
     while (cap.isOpened() && frame_count < config_.max_frames) {
-        cv::Mat frame;
         if (!cap.read(frame)) {
             break;
         }
         
-        auto analysis = analyzeFrame(frame, frame_count);
-        frame_analyses.push_back(analysis);
+        frame_analyses.emplace_back();
+        analyzeFrame(frame, frame_count, FrameInfo(), frame_analyses.back());
         frame_count++;
         
         if (frame_count % 100 == 0 && config_.enable_debug) {
@@ -77,22 +131,95 @@ DetectionResult WatermarkExtractor::analyzeVideo(const std::string& video_path)
     return extractWatermark(frame_analyses);
 }
 
-FrameAnalysis WatermarkExtractor::analyzeFrame(const cv::Mat& frame, uint32_t frame_index) {
+FrameAnalysis WatermarkExtractor::analyzeFrame(const cv::Mat& frame, uint32_t frame_index,
+                                               const FrameInfo& info) {
     FrameAnalysis analysis;
+    analyzeFrame(frame, frame_index, info, analysis);
+    return analysis;
+}
+
+void WatermarkExtractor::analyzeFrame(const cv::Mat& frame, uint32_t frame_index,
+                                      const FrameInfo& info, FrameAnalysis& analysis) {
     analysis.frame_index = frame_index;
     
+    // Weight evidence by the marks the encoder put on this frame
+    uint32_t phases = phase_carry_.next(info, config_.temporal_period);
+    analysis.weight = phases;
+    
+    // Sample the scheduled blocks on the native-resolution block grid
+    cv::Mat gray = frame;
+    if (frame.channels() == 3) {
+        gray = prepareWorkspace(gray_, frame.rows, frame.cols, CV_8UC1);
+        cv::cvtColor(frame, gray, cv::COLOR_BGR2GRAY);
+    }
+    
+    // Restart the pattern where the encoder did
+    scene_detector_.setThreshold(config_.scene_cut_threshold);
+    analysis.scene_cut = !gray.empty() && 
+        scene_detector_.process(gray.data, gray.step, gray.cols, gray.rows);
+    if (analysis.scene_cut) {
+        scene_start_ = frame_index;
+    }
+    uint32_t schedule_index = frame_index >= scene_start_ ? frame_index - scene_start_ : frame_index;
+    analysis.schedule_index = schedule_index;
+    sampleScheduledBlocks(gray, schedule_index, phases, analysis.scheduled_blocks,
+                          analysis.channel_evidence);
+    
+    // Keep what a search for the clip's position in the pattern needs
+    if ((config_.window_frames > 0 || config_.pilot_density > 0.0f) && !gray.empty()) {
+        recordBlockProxies(gray, analysis);
+    } else {
+        analysis.block_proxy.clear();
+        analysis.block_columns = 0;
+        analysis.block_rows = 0;
+    }
+    
     // Preprocess frame
-    cv::Mat processed = preprocessFrame(frame);
+    const cv::Mat& processed = preprocessFrame(gray);
     
     // Extract features
-    analysis.qp_values = extractQPValues(processed);
-    analysis.dct_coefficients = extractDCTCoefficients(processed);
+    extractQPValues(processed, analysis.qp_values);
+    extractDCTCoefficients(processed, analysis.dct_coefficients);
     analysis.entropy = calculateEntropy(processed);
     analysis.variance = calculateVariance(processed);
-    
+}
+
+FrameAnalysis WatermarkExtractor::analyzeLuma(const uint8_t* luma, size_t stride,
+                                              uint32_t width, uint32_t height, uint32_t frame_index,
+                                              const FrameInfo& info) {
+    FrameAnalysis analysis{};
+    analyzeLuma(luma, stride, width, height, frame_index, info, analysis);
     return analysis;
 }
 
+void WatermarkExtractor::analyzeLuma(const uint8_t* luma, size_t stride,
+                                     uint32_t width, uint32_t height, uint32_t frame_index,
+                                     const FrameInfo& info, FrameAnalysis& analysis) {
+    if (!luma || width == 0 || height == 0) {
+        // Keep the carry in step with the encoder's display order
+        phase_carry_.next(info, config_.temporal_period);
+        analysis.frame_index = frame_index;
+        analysis.qp_values.clear();
+        analysis.dct_coefficients.clear();
+        analysis.scheduled_blocks.clear();
+        analysis.channel_evidence.clear();
+        analysis.weight = 0.0;
+        analysis.scene_cut = false;
+        analysis.schedule_index = 0;
+        analysis.block_proxy.clear();
+        analysis.block_columns = 0;
+        analysis.block_rows = 0;
+        analysis.entropy = 0.0;
+        analysis.variance = 0.0;
+        return;
+    }
+    
+    // Wrap the plane in place; a single channel skips the colour conversion
+    cv::Mat gray(static_cast<int>(height), static_cast<int>(width), CV_8UC1,
+                 const_cast<uint8_t*>(luma), stride);
+    analyzeFrame(gray, frame_index, info, analysis);
+}
+
 DetectionResult WatermarkExtractor::extractWatermark(const std::vector<FrameAnalysis>& frames) {
     // Try statistical analysis first
     auto stat_result = statisticalAnalysis(frames);
@@ -113,6 +240,9 @@ DetectionResult WatermarkExtractor::extractWatermark(const std::vector<FrameAnal
 
 void WatermarkExtractor::updateConfig(const ExtractionConfig& config) {
     config_ = config;
+    phase_carry_.reset();
+    scene_detector_.reset();
+    scene_start_ = 0;
 }
 
 std::string WatermarkExtractor::getStats() const {
@@ -121,6 +251,7 @@ std::string WatermarkExtractor::getStats() const {
         << "  Videos processed: " << videos_processed_ << "\n"
         << "  Frames analyzed: " << frames_analyzed_ << "\n"
         << "  Watermarks detected: " << watermarks_detected_ << "\n"
+        << "  Pilot locks: " << pilot_locks_ << "\n"
         << "  Detection rate: " 
         << (videos_processed_ > 0 ? (double)watermarks_detected_ / videos_processed_ * 100 : 0)
         << "%\n"
@@ -128,6 +259,11 @@ std::string WatermarkExtractor::getStats() const {
         << "  Min frames: " << config_.min_frames << "\n"
         << "  Max frames: " << config_.max_frames;
     
+    if (buffer_pool_) {
+        BufferPoolStats pool = buffer_pool_->getStats();
+        oss << "\n  Buffer pool: " << pool.hits << " hits, " << pool.misses << " misses";
+    }
+    
     return oss.str();
 }
 
@@ -146,32 +282,43 @@ bool WatermarkExtractor::loadModel() {
     return true;
 }
 
-cv::Mat WatermarkExtractor::preprocessFrame(const cv::Mat& frame) {
-    cv::Mat processed;
+cv::Mat& WatermarkExtractor::prepareWorkspace(Workspace& workspace, int rows, int cols, int type) {
+    if (workspace.mat.rows == rows && workspace.mat.cols == cols && workspace.mat.type() == type) {
+        return workspace.mat;
+    }
     
-    // Convert to grayscale if needed
-    if (frame.channels() == 3) {
-        cv::cvtColor(frame, processed, cv::COLOR_BGR2GRAY);
+    // Pad rows to the pool alignment so every row starts on a cache line
+    size_t step = (static_cast<size_t>(cols) * CV_ELEM_SIZE(type) + BufferPool::kAlignment - 1) & 
+                  ~(BufferPool::kAlignment - 1);
+    workspace.mat.release();
+    workspace.buffer = BufferPool::acquire(buffer_pool_, step * rows);
+    if (workspace.buffer.empty()) {
+        workspace.mat.create(rows, cols, type);
     } else {
-        processed = frame.clone();
+        workspace.mat = cv::Mat(rows, cols, type, workspace.buffer.data(), step);
     }
     
+    return workspace.mat;
+}
+
+const cv::Mat& WatermarkExtractor::preprocessFrame(const cv::Mat& frame) {
     // Resize to standard size for analysis
-    cv::resize(processed, processed, cv::Size(720, 720));
+    cv::Mat& resized = prepareWorkspace(resized_, 720, 720, frame.type());
+    cv::resize(frame, resized, resized.size());
     
     // Normalize to 0-1 range
-    processed.convertTo(processed, CV_64F, 1.0/255.0);
+    cv::Mat& processed = prepareWorkspace(processed_, 720, 720, CV_MAKETYPE(CV_64F, frame.channels()));
+    resized.convertTo(processed, CV_64F, 1.0/255.0);
     
     return processed;
 }
 
-std::vector<double> WatermarkExtractor::extractQPValues(const cv::Mat& frame) {
+void WatermarkExtractor::extractQPValues(const cv::Mat& frame, std::vector<double>& qp_values) {
     // In a real implementation, this would extract actual QP values
     // from the H.264 stream. For now, we'll simulate this by analyzing
     // the frame's statistical properties
     
-    std::vector<double> qp_values;
-    qp_values.reserve(64); // 8x8 blocks
+    qp_values.clear();
     
     // Divide frame into 8x8 blocks and calculate "QP-like" values
     for (int y = 0; y < frame.rows; y += 8) {
@@ -187,33 +334,151 @@ std::vector<double> WatermarkExtractor::extractQPValues(const cv::Mat& frame) {
             qp_values.push_back(qp_value);
         }
     }
+}
+
+void WatermarkExtractor::prepareSchedule(uint32_t width, uint32_t height) {
+    // Rebuilt only when the schedule parameters change
+    uint32_t reference_width = config_.reference_width ? config_.reference_width : width;
+    uint32_t reference_height = config_.reference_height ? config_.reference_height : height;
+    if (schedule_ && schedule_->seed() == config_.seed && 
+        schedule_->blockDensity() == config_.block_density &&
+        schedule_->period() == std::max<uint32_t>(1, config_.temporal_period) &&
+        schedule_->referenceWidth() == reference_width && 
+        schedule_->referenceHeight() == reference_height &&
+        schedule_->windowFrames() == config_.window_frames &&
+        schedule_->windowRepeats() == config_.window_repeats &&
+        schedule_->pilot().density() == config_.pilot_density &&
+        schedule_->markedPeriodInterval() == std::max<uint32_t>(1, config_.marked_period_interval)) {
+        return;
+    }
     
-    return qp_values;
+    schedule_ = EmbeddingSchedule::create(config_.seed, config_.block_density, 
+                                          config_.temporal_period,
+                                          reference_width, reference_height, nullptr, nullptr,
+                                          config_.window_frames, config_.window_repeats,
+                                          config_.pilot_density, config_.marked_period_interval);
+    size_t mapped = schedule_->maxBlocksPerFrame();
+    mapped_x_.resize(mapped);
+    mapped_y_.resize(mapped);
+    mapped_qp_.resize(mapped);
+    mapped_channel_.resize(mapped);
 }
 
-std::vector<double> WatermarkExtractor::extractDCTCoefficients(const cv::Mat& frame) {
+void WatermarkExtractor::recordBlockProxies(const cv::Mat& gray, FrameAnalysis& analysis) {
+    uint32_t blocks_x = (gray.cols + 7) / 8;
+    uint32_t blocks_y = (gray.rows + 7) / 8;
+    analysis.block_columns = blocks_x;
+    analysis.block_rows = blocks_y;
+    analysis.block_proxy.resize(static_cast<size_t>(blocks_x) * blocks_y);
+    block_sums_.resize(2 * static_cast<size_t>(blocks_x));
+    
+    int radius = config_.adaptive_embedding ? adaptiveSearchRadius(config_.quality_threshold) : 0;
+    if (radius > 0) {
+        activity_.resize(static_cast<size_t>(blocks_x) * blocks_y);
+        computeBlockActivity(gray.data, gray.step, gray.cols, gray.rows, activity_.data());
+    }
+    
+    // Same variance-based QP proxy as sampleScheduledBlocks, one block row
+    // at a time; edge blocks cover only the pixels inside the frame
+    double* sums = block_sums_.data();
+    double* squares = sums + blocks_x;
+    for (uint32_t by = 0; by < blocks_y; ++by) {
+        std::fill(block_sums_.begin(), block_sums_.end(), 0.0);
+        int rows = std::min(8, gray.rows - static_cast<int>(by) * 8);
+        for (int r = 0; r < rows; ++r) {
+            const uint8_t* row = gray.ptr<uint8_t>(static_cast<int>(by) * 8 + r);
+            for (int x = 0; x < gray.cols; ++x) {
+                double value = row[x];
+                sums[x / 8] += value;
+                squares[x / 8] += value * value;
+            }
+        }
+        
+        float* proxy = analysis.block_proxy.data() + static_cast<size_t>(by) * blocks_x;
+        for (uint32_t bx = 0; bx < blocks_x; ++bx) {
+            int cols = std::min(8, gray.cols - static_cast<int>(bx) * 8);
+            double pixels = static_cast<double>(rows) * cols;
+            double mean = sums[bx] / pixels;
+            double variance = std::max(0.0, squares[bx] / pixels - mean * mean);
+            proxy[bx] = static_cast<float>(std::sqrt(variance) * 100 / 255.0);
+        }
+        
+        // Repeat the encoder's adaptive move, reading the unmoved row
+        if (radius > 0) {
+            std::copy(proxy, proxy + blocks_x, sums);
+            const uint32_t* activity = activity_.data() + static_cast<size_t>(by) * blocks_x;
+            for (uint32_t bx = 0; bx < blocks_x; ++bx) {
+                proxy[bx] = static_cast<float>(
+                    sums[mostTexturedBlock(activity, gray.cols, bx * 8, radius) / 8]);
+            }
+        }
+    }
+}
+
+void WatermarkExtractor::sampleScheduledBlocks(const cv::Mat& gray, uint32_t schedule_index,
+                                               uint32_t phases, std::vector<double>& samples,
+                                               std::vector<float>& evidence) {
+    samples.clear();
+    evidence.clear();
+    if (gray.empty() || phases == 0) {
+        return;
+    }
+    
+    // Map the encoder's stream-wide schedule onto this frame's grid
+    uint32_t blocks_x = (gray.cols + 7) / 8;
+    uint32_t blocks_y = (gray.rows + 7) / 8;
+    prepareSchedule(gray.cols, gray.rows);
+    uint32_t count = schedule_->mapFrames(schedule_index, phases, gray.cols, gray.rows, 
+                                          mapped_x_.data(), mapped_y_.data(), mapped_qp_.data(),
+                                          mapped_channel_.data());
+    
+    // Repeat the encoder's adaptive move on the decoded texture
+    int radius = config_.adaptive_embedding ? adaptiveSearchRadius(config_.quality_threshold) : 0;
+    if (radius > 0) {
+        activity_.resize(static_cast<size_t>(blocks_x) * blocks_y);
+        computeBlockActivity(gray.data, gray.step, gray.cols, gray.rows, activity_.data());
+    }
+    
+    for (uint32_t i = 0; i < count; ++i) {
+        int x = mapped_x_[i];
+        int y = mapped_y_[i];
+        if (radius > 0) {
+            const uint32_t* row = activity_.data() + static_cast<size_t>(y / 8) * blocks_x;
+            x = static_cast<int>(mostTexturedBlock(row, gray.cols, x, radius));
+        }
+        cv::Rect block_rect(x, y, std::min(8, gray.cols - x), std::min(8, gray.rows - y));
+        
+        // Same variance-based QP proxy as extractQPValues
+        cv::Scalar mean, stddev;
+        cv::meanStdDev(gray(block_rect), mean, stddev);
+        samples.push_back(stddev[0] * 100 / 255.0);
+    }
+    
+    evidence.assign(kPayloadCodedBits, 0.0f);
+    if (!addChannelEvidence(samples.data(), mapped_qp_.data(), mapped_channel_.data(), 
+                            count, evidence.data())) {
+        evidence.clear();
+    }
+}
+
+void WatermarkExtractor::extractDCTCoefficients(const cv::Mat& frame, std::vector<double>& coefficients) {
     // In a real implementation, this would extract actual DCT coefficients
     // For now, we'll simulate this by applying DCT to the frame
     
-    cv::Mat dct_frame;
+    cv::Mat& dct_frame = prepareWorkspace(dct_, frame.rows, frame.cols, frame.type());
     cv::dct(frame, dct_frame);
     
-    std::vector<double> coefficients;
-    coefficients.reserve(dct_frame.rows * dct_frame.cols);
-    
     // Flatten DCT coefficients
+    coefficients.resize(static_cast<size_t>(dct_frame.rows) * dct_frame.cols);
     for (int i = 0; i < dct_frame.rows; ++i) {
-        for (int j = 0; j < dct_frame.cols; ++j) {
-            coefficients.push_back(dct_frame.at<double>(i, j));
-        }
+        const double* row = dct_frame.ptr<double>(i);
+        std::copy(row, row + dct_frame.cols, coefficients.begin() + static_cast<size_t>(i) * dct_frame.cols);
     }
-    
-    return coefficients;
 }
 
 double WatermarkExtractor::calculateEntropy(const cv::Mat& frame) {
     // Calculate image entropy as a measure of information content
-    std::vector<int> histogram(256, 0);
+    std::array<int, 256> histogram{};
     
     for (int i = 0; i < frame.rows; ++i) {
         for (int j = 0; j < frame.cols; ++j) {
@@ -242,7 +507,15 @@ double WatermarkExtractor::calculateVariance(const cv::Mat& frame) {
 }
 
 DetectionResult WatermarkExtractor::statisticalAnalysis(const std::vector<FrameAnalysis>& frames) {
-    // Simple statistical analysis to detect watermark patterns
+    // A payload that decodes is conclusive however few frames it took
+    Payload payload;
+    double confidence = 0.0;
+    if (decodePayload(frames, payload, confidence)) {
+        return {true, confidence, payload, config_.seed, ""};
+    }
+    
+    // Otherwise fall back to simple statistical analysis to detect
+    // watermark patterns without a payload
     // This is a simplified version - real implementation would be more sophisticated
     
     if (frames.size() < 10) {
@@ -253,7 +526,8 @@ DetectionResult WatermarkExtractor::statisticalAnalysis(const std::vector<FrameA
     std::vector<double> qp_patterns;
     
     for (const auto& frame : frames) {
-        if (!frame.qp_values.empty()) {
+        // Non-reference frames were left unmarked by the encoder
+        if (!frame.qp_values.empty() && frame.weight > 0.0) {
             // Calculate average QP for this frame
             double avg_qp = std::accumulate(frame.qp_values.begin(), frame.qp_values.end(), 0.0) 
                            / frame.qp_values.size();
@@ -262,8 +536,6 @@ DetectionResult WatermarkExtractor::statisticalAnalysis(const std::vector<FrameA
     }
     
     // Look for periodic patterns that might indicate watermark
-    double confidence = 0.0;
-    uint64_t payload = 0;
     uint32_t seed = 0;
     
     // Simple pattern detection (in reality, this would be much more sophisticated)
@@ -282,12 +554,11 @@ DetectionResult WatermarkExtractor::statisticalAnalysis(const std::vector<FrameA
         double max_corr = *std::max_element(autocorr.begin(), autocorr.end());
         if (max_corr > 0.1) { // Threshold for pattern detection
             confidence = std::min(0.8, max_corr);
-            payload = static_cast<uint64_t>(max_corr * 1000000);
             seed = static_cast<uint32_t>(autocorr.size());
         }
     }
     
-    return {confidence > 0.5, confidence, payload, seed, ""};
+    return {confidence > 0.5, confidence, Payload(), seed, ""};
 }
 
 DetectionResult WatermarkExtractor::mlAnalysis(const std::vector<FrameAnalysis>& frames) {
@@ -301,6 +572,10 @@ DetectionResult WatermarkExtractor::mlAnalysis(const std::vector<FrameAnalysis>&
     // Extract features from frames
     std::vector<double> features;
     for (const auto& frame : frames) {
+        if (frame.weight <= 0.0) {
+            continue;
+        }
+        
         // Combine various frame features
         features.insert(features.end(), frame.qp_values.begin(), frame.qp_values.end());
         features.insert(features.end(), frame.dct_coefficients.begin(), frame.dct_coefficients.end());
@@ -318,33 +593,252 @@ DetectionResult WatermarkExtractor::mlAnalysis(const std::vector<FrameAnalysis>&
     confidence = std::tanh(confidence) * 0.5 + 0.5;
     confidence = std::max(0.0, std::min(1.0, confidence));
     
-    // Generate payload and seed from features
-    uint64_t payload = 0;
+    // Generate seed from features; payloads come from decodePayload() only
     uint32_t seed = 0;
     
-    for (size_t i = 0; i < std::min(features.size(), static_cast<size_t>(8)); ++i) {
-        payload |= static_cast<uint64_t>(features[i] * 255) << (i * 8);
-    }
-    
     for (size_t i = 0; i < std::min(features.size(), static_cast<size_t>(4)); ++i) {
         seed |= static_cast<uint32_t>(features[i] * 255) << (i * 8);
     }
     
-    return {confidence > 0.6, confidence, payload, seed, ""};
+    return {confidence > 0.6, confidence, Payload(), seed, ""};
+}
+
+bool WatermarkExtractor::decodePayload(const std::vector<FrameAnalysis>& frames, 
+                                       Payload& payload, double& confidence) {
+    // Weak per-frame correlations add up over the frames before deciding
+    std::vector<float> soft(kPayloadCodedBits, 0.0f);
+    bool any = false;
+    for (const auto& frame : frames) {
+        if (frame.channel_evidence.size() != kPayloadCodedBits) {
+            continue;
+        }
+        for (uint32_t j = 0; j < kPayloadCodedBits; ++j) {
+            soft[j] += frame.channel_evidence[j];
+        }
+        any = true;
+    }
+    
+    // Empty evidence decodes to the zero payload with an agreement of 0, so
+    // the evidence must also favour what was decoded; a clip cut from the
+    // middle of a stream, cropped or rescaled is sampled at the wrong
+    // position and needs a search, the pilot's first as it is cheaper
+    SoftDecodeInfo info;
+    Payload decoded;
+    bool found = any && decodePayloadSoft(soft.data(), decoded, &info) && info.agreement > 0.0f;
+    if (!found && config_.pilot_density > 0.0f) {
+        found = searchPilot(frames, decoded, info);
+    }
+    if (!found && config_.window_frames > 0) {
+        found = searchOffset(frames, decoded, info);
+    }
+    if (!found) {
+        return false;
+    }
+    
+    payload = config_.encryption_key.empty() ? decoded :
+        utils::xorEncrypt(decoded, utils::generatePayloadFromString(config_.encryption_key));
+    confidence = 0.5 + 0.5 * info.agreement;
+    return true;
+}
+
+bool WatermarkExtractor::searchOffset(const std::vector<FrameAnalysis>& frames, 
+                                      Payload& decoded, SoftDecodeInfo& info) {
+    // Frames after the first cut resynchronised with the encoder
+    size_t leading = 0;
+    while (leading < frames.size() && !frames[leading].scene_cut) {
+        leading++;
+    }
+    std::vector<float> base(kPayloadCodedBits, 0.0f);
+    for (size_t i = leading; i < frames.size(); ++i) {
+        if (frames[i].channel_evidence.size() == kPayloadCodedBits) {
+            for (uint32_t j = 0; j < kPayloadCodedBits; ++j) {
+                base[j] += frames[i].channel_evidence[j];
+            }
+        }
+    }
+    
+    const FrameAnalysis* sized = nullptr;
+    for (size_t i = 0; i < leading && !sized; ++i) {
+        if (!frames[i].block_proxy.empty()) {
+            sized = &frames[i];
+        }
+    }
+    if (!sized) {
+        return false;
+    }
+    if (!schedule_) {
+        prepareSchedule(sized->block_columns * 8, sized->block_rows * 8);
+    }
+    
+    std::vector<float> soft(kPayloadCodedBits);
+    std::vector<double> samples(mapped_x_.size());
+    float best = 0.0f;
+    bool found = false;
+    for (uint32_t offset = 1; offset < schedule_->cycle(); ++offset) {
+        soft = base;
+        for (size_t i = 0; i < leading; ++i) {
+            const FrameAnalysis& frame = frames[i];
+            uint32_t phases = static_cast<uint32_t>(frame.weight);
+            if (phases == 0 || frame.block_proxy.empty()) {
+                continue;
+            }
+            
+            uint32_t count = schedule_->mapFrames(frame.schedule_index + offset, phases,
+                                                  frame.block_columns * 8, frame.block_rows * 8,
+                                                  mapped_x_.data(), mapped_y_.data(),
+                                                  mapped_qp_.data(), mapped_channel_.data());
+            for (uint32_t k = 0; k < count; ++k) {
+                samples[k] = frame.block_proxy[static_cast<size_t>(mapped_y_[k] / 8) * 
+                                               frame.block_columns + mapped_x_[k] / 8];
+            }
+            addChannelEvidence(samples.data(), mapped_qp_.data(), mapped_channel_.data(),
+                               count, soft.data());
+        }
+        
+        Payload candidate;
+        SoftDecodeInfo candidate_info;
+        if (decodePayloadSoft(soft.data(), candidate, &candidate_info) && 
+            candidate_info.agreement > best) {
+            best = candidate_info.agreement;
+            decoded = candidate;
+            info = candidate_info;
+            found = true;
+        }
+    }
+    
+    return found;
 }
 
-uint64_t WatermarkExtractor::decodePayload(const std::vector<double>& pattern) {
-    // Decode 128-bit payload from detected watermark pattern
-    // This is a simplified implementation
+bool WatermarkExtractor::searchPilot(const std::vector<FrameAnalysis>& frames,
+                                     Payload& decoded, SoftDecodeInfo& info) {
+    // The phase is only shared by the frames before the first cut
+    size_t leading = 0;
+    while (leading < frames.size() && !frames[leading].scene_cut) {
+        leading++;
+    }
     
-    uint64_t payload = 0;
+    const FrameAnalysis* sized = nullptr;
+    for (size_t i = 0; i < frames.size() && !sized; ++i) {
+        if (!frames[i].block_proxy.empty()) {
+            sized = &frames[i];
+        }
+    }
+    if (!sized) {
+        return false;
+    }
+    uint32_t columns = sized->block_columns;
+    uint32_t rows = sized->block_rows;
+    if (!schedule_) {
+        prepareSchedule(columns * 8, rows * 8);
+    }
+    if (!schedule_->pilot().enabled()) {
+        return false;
+    }
     
-    for (size_t i = 0; i < std::min(pattern.size(), static_cast<size_t>(16)); ++i) {
-        uint8_t byte = static_cast<uint8_t>(pattern[i] * 255);
-        payload |= static_cast<uint64_t>(byte) << (i * 8);
+    PilotSync sync(schedule_->pilot(), columns, rows);
+    for (size_t i = 0; i < leading; ++i) {
+        const FrameAnalysis& frame = frames[i];
+        if (frame.weight > 0.0 && frame.block_columns == columns && frame.block_rows == rows) {
+            sync.addFrame(frame.block_proxy.data(), frame.schedule_index);
+        }
+    }
+    
+    PilotLock lock = sync.lock();
+    if (config_.enable_debug) {
+        std::cout << "Pilot " << (lock.locked ? "locked" : "not locked") 
+                  << ": strength " << lock.strength << ", scale " << lock.scale 
+                  << ", offset " << lock.offset_x << "," << lock.offset_y 
+                  << ", phase " << lock.phase << std::endl;
+    }
+    if (!lock.locked) {
+        return false;
+    }
+    pilot_locks_++;
+    
+    // The offset is known modulo the tile and the phase modulo the period,
+    // which leaves a few crop positions and cycle repetitions to decode
+    uint32_t reference_width = schedule_->referenceWidth();
+    uint32_t reference_height = schedule_->referenceHeight();
+    uint32_t span_x = static_cast<uint32_t>(columns * 8 / lock.scale);
+    uint32_t span_y = static_cast<uint32_t>(rows * 8 / lock.scale);
+    std::vector<uint32_t> origins_x;
+    std::vector<uint32_t> origins_y;
+    for (uint32_t x = lock.offset_x; origins_x.empty() || x + span_x <= reference_width + 8; 
+         x += PilotPattern::kTilePixels) {
+        origins_x.push_back(x);
+    }
+    for (uint32_t y = lock.offset_y; origins_y.empty() || y + span_y <= reference_height + 8; 
+         y += PilotPattern::kTilePixels) {
+        origins_y.push_back(y);
+    }
+    
+    uint32_t cycle = schedule_->cycle();
+    std::vector<double> samples;
+    std::vector<int8_t> deltas;
+    std::vector<uint16_t> channels;
+    std::vector<float> soft(kPayloadCodedBits);
+    float best = 0.0f;
+    bool found = false;
+    auto decode_candidate = [&](double scale, double origin_x, double origin_y, uint32_t offset) {
+        std::fill(soft.begin(), soft.end(), 0.0f);
+        for (size_t i = 0; i < frames.size(); ++i) {
+            const FrameAnalysis& frame = frames[i];
+            uint32_t phases = std::min(static_cast<uint32_t>(frame.weight), 
+                                       schedule_->maxFramePhases());
+            if (phases == 0 || frame.block_columns != columns || frame.block_rows != rows) {
+                continue;
+            }
+            
+            // Later scenes restarted the pattern with the encoder
+            uint32_t index = (frame.schedule_index + (i < leading ? offset : 0)) % cycle;
+            samples.clear();
+            deltas.clear();
+            channels.clear();
+            for (uint32_t back = 0; back < phases; ++back) {
+                EmbeddingSchedule::Phase blocks = schedule_->phase((index + cycle - back) % cycle);
+                for (uint32_t k = 0; k < blocks.count; ++k) {
+                    double x = (blocks.u[k] * (reference_width / 65536.0) - origin_x) * scale;
+                    double y = (blocks.v[k] * (reference_height / 65536.0) - origin_y) * scale;
+                    if (blocks.qp_delta[k] == 0 || x < 0.0 || y < 0.0 || 
+                        x >= columns * 8 || y >= rows * 8) {
+                        continue;
+                    }
+                    samples.push_back(frame.block_proxy[static_cast<size_t>(y / 8) * columns + 
+                                                        static_cast<size_t>(x / 8)]);
+                    deltas.push_back(blocks.qp_delta[k]);
+                    channels.push_back(blocks.channel[k]);
+                }
+            }
+            addChannelEvidence(samples.data(), deltas.data(), channels.data(),
+                               static_cast<uint32_t>(samples.size()), soft.data());
+        }
+        
+        Payload candidate;
+        SoftDecodeInfo candidate_info;
+        if (decodePayloadSoft(soft.data(), candidate, &candidate_info) && 
+            candidate_info.agreement > best) {
+            best = candidate_info.agreement;
+            decoded = candidate;
+            info = candidate_info;
+            found = true;
+        }
+    };
+    
+    // The offset fits the frame centre best, so another scale pivots there
+    for (int step = -kPilotScaleSteps; step <= kPilotScaleSteps; ++step) {
+        double scale = lock.scale * (1.0 + step * kPilotScaleStep);
+        double shift_x = columns * 4.0 * (1.0 / lock.scale - 1.0 / scale);
+        double shift_y = rows * 4.0 * (1.0 / lock.scale - 1.0 / scale);
+        for (uint32_t origin_y : origins_y) {
+            for (uint32_t origin_x : origins_x) {
+                for (uint32_t offset = lock.phase; offset < cycle; offset += schedule_->period()) {
+                    decode_candidate(scale, origin_x + shift_x, origin_y + shift_y, offset);
+                }
+            }
+        }
     }
     
-    return payload;
+    return found;
 }
 
 } // namespace phantomframe
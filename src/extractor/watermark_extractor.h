@@ -6,16 +6,22 @@
 #include <memory>
 #include <string>
 #include <opencv2/opencv.hpp>
+#include "common/buffer_pool.h"
+#include "common/embedding_schedule.h"
+#include "common/payload.h"
+#include "common/scene_cut.h"
 
 namespace phantomframe {
 
+struct SoftDecodeInfo;
+
 /**
  * @brief Watermark detection result
  */
 struct DetectionResult {
     bool detected;              // Whether watermark was detected
     double confidence;          // Detection confidence (0.0 - 1.0)
-    uint64_t payload;          // Extracted payload
+    Payload payload;           // Extracted payload, empty if none was decoded
     uint32_t seed;             // Detected seed
     std::string error_message; // Error message if detection failed
 };
@@ -29,6 +35,20 @@ struct ExtractionConfig {
     double confidence_threshold; // Minimum confidence for detection
     bool enable_debug;          // Enable debug output
     std::string model_path;     // Path to TensorFlow.js model
+    uint32_t seed;              // Block selection seed used by the encoder
+    float block_density;        // Block density used by the encoder
+    uint32_t temporal_period;   // Temporal period used by the encoder
+    bool adaptive_embedding;    // Whether the encoder moved deltas toward texture
+    float quality_threshold;    // Adaptive search strength used by the encoder
+    uint32_t reference_width;   // Grid the schedule was built on, 0 for the frame's
+    uint32_t reference_height;  // (the top rendition of an ABR ladder)
+    float scene_cut_threshold;  // Scene-cut threshold used by the encoder, 0 for none
+    uint32_t window_frames;     // Payload window used by the encoder, 0 for none; enables
+    uint32_t window_repeats;    // decoding clips that start anywhere in the stream
+    float pilot_density;        // Sync pilot density used by the encoder, 0 for none; enables
+                                // decoding cropped and rescaled clips
+    uint32_t marked_period_interval; // Marked period interval used by the encoder, 0 or 1 for every one
+    std::string encryption_key; // Key the encoder encrypted the payload with, empty for none
 };
 
 /**
@@ -38,6 +58,14 @@ struct FrameAnalysis {
     uint32_t frame_index;
     std::vector<double> qp_values;
     std::vector<double> dct_coefficients;
+    std::vector<double> scheduled_blocks; // QP proxy at the encoder's blocks for this frame
+    std::vector<float> channel_evidence;  // Soft evidence per payload channel bit, see decodePayloadSoft()
+    double weight;                        // Phases of marks carried, 0 for a non-reference frame
+    bool scene_cut;                       // Frame starts a new scene; the pattern restarts here
+    uint32_t schedule_index;              // Frames since the start of the scene, as sampled
+    std::vector<float> block_proxy;       // QP proxy of every 8x8 block, kept for a window or pilot
+    uint32_t block_columns;               // Blocks per row of block_proxy
+    uint32_t block_rows;                  // Block rows of block_proxy
     double entropy;
     double variance;
 };
@@ -65,11 +93,61 @@ public:
 
     /**
      * @brief Analyze a single frame
+     *
+     * Frames must be analyzed in display order when their picture types are
+     * given, so the blocks an encoder moved off non-reference frames are
+     * looked for on the reference frame that carries them, and when
+     * scene_cut_threshold is set, so the pattern is resynchronised at the
+     * same cuts as in the encoder.
      * @param frame Frame data
      * @param frame_index Frame index
+     * @param info Picture type of the frame, unknown if not given
      * @return Frame analysis data
      */
-    FrameAnalysis analyzeFrame(const cv::Mat& frame, uint32_t frame_index);
+    FrameAnalysis analyzeFrame(const cv::Mat& frame, uint32_t frame_index,
+                               const FrameInfo& info = FrameInfo());
+
+    /**
+     * @brief Analyze a single frame into an existing result
+     *
+     * Reuses the vectors of analysis and the extractor's pooled working
+     * images, so a stream analyzed into the same result allocates nothing
+     * once its resolution has been seen.
+     * @param frame Frame data
+     * @param frame_index Frame index
+     * @param info Picture type of the frame
+     * @param analysis Result to overwrite
+     */
+    void analyzeFrame(const cv::Mat& frame, uint32_t frame_index,
+                      const FrameInfo& info, FrameAnalysis& analysis);
+
+    /**
+     * @brief Analyze the luma plane of a planar YUV frame without conversion
+     * @param luma First byte of the Y plane
+     * @param stride Bytes between the starts of two rows
+     * @param width Frame width in pixels
+     * @param height Frame height in pixels
+     * @param frame_index Frame index
+     * @param info Picture type of the frame, unknown if not given
+     * @return Frame analysis data
+     */
+    FrameAnalysis analyzeLuma(const uint8_t* luma, size_t stride,
+                              uint32_t width, uint32_t height, uint32_t frame_index,
+                              const FrameInfo& info = FrameInfo());
+
+    /**
+     * @brief Analyze the luma plane of a planar YUV frame into an existing result
+     * @param luma First byte of the Y plane
+     * @param stride Bytes between the starts of two rows
+     * @param width Frame width in pixels
+     * @param height Frame height in pixels
+     * @param frame_index Frame index
+     * @param info Picture type of the frame
+     * @param analysis Result to overwrite
+     */
+    void analyzeLuma(const uint8_t* luma, size_t stride,
+                     uint32_t width, uint32_t height, uint32_t frame_index,
+                     const FrameInfo& info, FrameAnalysis& analysis);
 
     /**
      * @brief Extract watermark from analyzed frames
@@ -84,6 +162,15 @@ public:
      */
     void updateConfig(const ExtractionConfig& config);
 
+    /**
+     * @brief Attach a buffer pool for the working images
+     *
+     * Must be attached before the first frame; its counters are included in
+     * getStats(). The pool must outlive the extractor.
+     * @param pool Pool to use, owned by the caller, or null for none
+     */
+    void setBufferPool(BufferPool* pool) { buffer_pool_ = pool; }
+
     /**
      * @brief Get extraction statistics
      * @return Statistics string
@@ -91,6 +178,14 @@ public:
     std::string getStats() const;
 
 private:
+    /**
+     * @brief Working image kept across frames in recycled aligned storage
+     */
+    struct Workspace {
+        BufferPool::Buffer buffer;  // Backing storage, 64-byte aligned rows
+        cv::Mat mat;                // Header over buffer
+    };
+
     ExtractionConfig config_;
     bool initialized_;
     
@@ -98,10 +193,50 @@ private:
     uint32_t frames_analyzed_;
     uint32_t videos_processed_;
     uint32_t watermarks_detected_;
+    uint32_t pilot_locks_;
     
     // Model data (would be loaded from TensorFlow.js in practice)
     std::vector<double> model_weights_;
     
+    // Block activity scratch for adaptive schedules
+    std::vector<uint32_t> activity_;
+    
+    // Per-column sums for the block proxies of one block row
+    std::vector<double> block_sums_;
+    
+    // Encoder schedule and its mapping onto the current frame's grid
+    std::shared_ptr<const EmbeddingSchedule> schedule_;
+    std::vector<uint16_t> mapped_x_;
+    std::vector<uint16_t> mapped_y_;
+    std::vector<int8_t> mapped_qp_;
+    std::vector<uint16_t> mapped_channel_;
+    
+    // Non-reference frames seen since the last reference frame
+    PhaseCarry phase_carry_;
+    
+    // Same cut detection as the encoder; frames are sampled relative to
+    // the start of their scene
+    SceneCutDetector scene_detector_;
+    uint32_t scene_start_;
+    
+    // Working images reused frame to frame; OpenCV writes into them in
+    // place as long as the frame size does not change
+    BufferPool* buffer_pool_;
+    Workspace gray_;
+    Workspace resized_;
+    Workspace processed_;
+    Workspace dct_;
+    
+    /**
+     * @brief Size a workspace for an image, reusing its storage when it fits
+     * @param workspace Workspace to prepare
+     * @param rows Image rows
+     * @param cols Image columns
+     * @param type OpenCV element type
+     * @return Image header over the workspace storage
+     */
+    cv::Mat& prepareWorkspace(Workspace& workspace, int rows, int cols, int type);
+    
     /**
      * @brief Load the extraction model
      * @return true if successful
@@ -110,24 +245,57 @@ private:
     
     /**
      * @brief Preprocess frame for analysis
-     * @param frame Input frame
-     * @return Preprocessed frame
+     * @param frame Grayscale input frame
+     * @return Preprocessed frame, valid until the next call
      */
-    cv::Mat preprocessFrame(const cv::Mat& frame);
+    const cv::Mat& preprocessFrame(const cv::Mat& frame);
     
     /**
      * @brief Extract QP values from frame
      * @param frame Input frame
-     * @return Vector of QP values
+     * @param qp_values Receives the QP values
+     */
+    void extractQPValues(const cv::Mat& frame, std::vector<double>& qp_values);
+    
+    /**
+     * @brief Build the encoder's schedule unless the current one matches
+     * @param width Frame width in pixels, the reference if none is configured
+     * @param height Frame height in pixels
+     */
+    void prepareSchedule(uint32_t width, uint32_t height);
+    
+    /**
+     * @brief Record the QP proxy of every block of a frame
+     *
+     * Lets the extractor sample the frame again at another schedule
+     * position or geometry, see searchOffset() and searchPilot(). With
+     * adaptive embedding each entry
+     * holds the proxy of the block the encoder would have moved to.
+     * @param gray Grayscale frame at its native resolution
+     * @param analysis Receives block_proxy and its dimensions
      */
-    std::vector<double> extractQPValues(const cv::Mat& frame);
+    void recordBlockProxies(const cv::Mat& gray, FrameAnalysis& analysis);
+    
+    /**
+     * @brief Sample the QP proxy at the blocks scheduled for a frame
+     * @param gray Grayscale frame at its native resolution
+     * @param schedule_index Frames since the start of the frame's scene
+     * @param phases Phases the frame carries, see PhaseCarry
+     * @param samples Receives the QP proxy per scheduled block, in the
+     *        encoder's span order
+     * @param evidence Receives the frame's soft evidence per channel bit,
+     *        empty if the frame carries no blocks
+     */
+    void sampleScheduledBlocks(const cv::Mat& gray, uint32_t schedule_index,
+                               uint32_t phases, std::vector<double>& samples,
+                               std::vector<float>& evidence);
     
     /**
      * @brief Extract DCT coefficients from frame
      * @param frame Input frame
-     * @return Vector of DCT coefficients
+     * @param coefficients Receives the coefficients in row order
      */
-    std::vector<double> extractDCTCoefficients(const cv::Mat& frame);
+    void extractDCTCoefficients(const cv::Mat& frame, std::vector<double>& coefficients);
     
     /**
      * @brief Calculate frame entropy
@@ -158,11 +326,49 @@ private:
     DetectionResult mlAnalysis(const std::vector<FrameAnalysis>& frames);
     
     /**
-     * @brief Decode payload from detected pattern
-     * @param pattern Detected watermark pattern
-     * @return Decoded payload
+     * @brief Decode the payload from the channel evidence of all frames
+     * @param frames Frame analysis data
+     * @param payload Receives the payload, decrypted if a key is configured
+     * @param confidence Receives the weighted share of the evidence that
+     *        agrees with the decoded codeword (0.5 for noise, 1.0 for a
+     *        clean mark)
+     * @return true if the evidence decoded to a valid codeword
+     */
+    bool decodePayload(const std::vector<FrameAnalysis>& frames, Payload& payload, double& confidence);
+    
+    /**
+     * @brief Decode a clip that starts at an unknown position in the pattern
+     *
+     * Frames before the first scene cut were sampled as if the clip began
+     * the pattern. Each other position in the cycle is tried by sampling
+     * their recorded block proxies there, while later scenes keep their
+     * own evidence; the position whose evidence fits a codeword best wins.
+     * @param frames Frame analysis data
+     * @param decoded Receives the payload before decryption
+     * @param info Receives the decode details
+     * @return true if some position decoded to a valid codeword
+     */
+    bool searchOffset(const std::vector<FrameAnalysis>& frames, Payload& decoded,
+                      SoftDecodeInfo& info);
+    
+    /**
+     * @brief Decode a clip that was cropped, rescaled or cut from anywhere
+     *
+     * Locks onto the sync pilot in the recorded block proxies of the
+     * frames before the first scene cut (see PilotSync), which gives the
+     * scale, the crop offset modulo the pilot tile and the frame phase
+     * modulo the period. The schedule is then sampled through that
+     * geometry for each crop position that fits the reference picture and
+     * each repetition of the period within the cycle, and the candidate
+     * whose evidence fits a codeword best wins. Needs the reference size
+     * configured unless the clip shows the whole picture.
+     * @param frames Frame analysis data
+     * @param decoded Receives the payload before decryption
+     * @param info Receives the decode details
+     * @return true if the pilot locked and some candidate decoded
      */
-    uint64_t decodePayload(const std::vector<double>& pattern);
+    bool searchPilot(const std::vector<FrameAnalysis>& frames, Payload& decoded,
+                     SoftDecodeInfo& info);
 };
 
 } // namespace phantomframe
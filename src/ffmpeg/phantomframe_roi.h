@@ -0,0 +1,48 @@
+#ifndef PHANTOMFRAME_ROI_H
+#define PHANTOMFRAME_ROI_H
+
+/*
+ * C interface to phantomframe::RoiTagger, used by the libavfilter
+ * "phantomframe" filter (patches/ffmpeg_vf_phantomframe.patch).
+ */
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct AVFrame;
+typedef struct pf_roi_tagger pf_roi_tagger;
+
+/**
+ * @brief Create a tagger for frames of a fixed size
+ * @param payload_hex 128-bit payload, up to 32 hexadecimal digits
+ * @param seed Block selection seed
+ * @param block_density Fraction of blocks to modify
+ * @param temporal_period Frames between pattern repetition
+ * @param width Frame width
+ * @param height Frame height
+ * @param fps Frames per second
+ * @return Tagger, or NULL on invalid parameters
+ */
+pf_roi_tagger* pf_roi_tagger_create(const char* payload_hex, uint32_t seed,
+                                    float block_density, uint32_t temporal_period,
+                                    uint32_t width, uint32_t height, float fps);
+
+/**
+ * @brief Attach the watermark of one frame as ROI side data
+ * @return Number of regions attached, or a negative AVERROR code
+ */
+int pf_roi_tagger_tag(pf_roi_tagger* tagger, struct AVFrame* frame, uint32_t frame_index);
+
+/**
+ * @brief Destroy a tagger
+ */
+void pf_roi_tagger_destroy(pf_roi_tagger* tagger);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* PHANTOMFRAME_ROI_H */
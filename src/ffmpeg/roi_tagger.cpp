@@ -0,0 +1,165 @@
+#include "roi_tagger.h"
+#include "phantomframe_roi.h"
+#include "common/utils.h"
+#include <algorithm>
+#include <sstream>
+
+extern "C" {
+#include <libavutil/buffer.h>
+#include <libavutil/error.h>
+#include <libavutil/frame.h>
+}
+
+namespace phantomframe {
+
+namespace {
+
+// libx264 scales ROI qoffsets in [-1, 1] by its QP range (51 at 8 bits)
+constexpr int kQPRange = 51;
+
+} // namespace
+
+RoiTagger::RoiTagger(const WatermarkConfig& config)
+    : encoder_(config), width_(0), height_(0), mb_width_(0), mb_height_(0),
+      pool_(nullptr), pool_entry_size_(0), frames_tagged_(0), regions_attached_(0) {
+}
+
+RoiTagger::~RoiTagger() {
+    av_buffer_pool_uninit(&pool_);
+}
+
+bool RoiTagger::initialize(uint32_t width, uint32_t height, float fps) {
+    if (!encoder_.initialize(width, height, fps)) {
+        return false;
+    }
+    
+    width_ = width;
+    height_ = height;
+    mb_width_ = (width + 15) / 16;
+    mb_height_ = (height + 15) / 16;
+    offsets_.assign(static_cast<size_t>(mb_width_) * mb_height_, 0.0f);
+    touched_.resize(encoder_.getMaxBlocksPerFrame());
+    
+    // Worst case is one region per scheduled block
+    av_buffer_pool_uninit(&pool_);
+    pool_entry_size_ = std::max<size_t>(1, touched_.size()) * sizeof(AVRegionOfInterest);
+    pool_ = av_buffer_pool_init(pool_entry_size_, nullptr);
+    
+    return pool_ != nullptr;
+}
+
+int RoiTagger::tagFrame(AVFrame* frame, uint32_t frame_index) {
+    if (!frame || !pool_) {
+        return AVERROR(EINVAL);
+    }
+    
+    QuantOffsetPlane plane{offsets_.data(), mb_width_, mb_height_};
+    size_t written = encoder_.writeQuantOffsets(frame_index, plane, 
+                                                touched_.data(), touched_.size());
+    written = std::min(written, touched_.size());
+    
+    AVBufferRef* buffer = av_buffer_pool_get(pool_);
+    if (!buffer) {
+        return AVERROR(ENOMEM);
+    }
+    
+    // One region per distinct macroblock; clearing the entry as it is
+    // emitted both deduplicates and resets the scratch plane
+    auto* regions = reinterpret_cast<AVRegionOfInterest*>(buffer->data);
+    size_t count = 0;
+    for (size_t i = 0; i < written; ++i) {
+        uint32_t mb_index = touched_[i];
+        float offset = offsets_[mb_index];
+        offsets_[mb_index] = 0.0f;
+        if (offset == 0.0f) {
+            continue;
+        }
+        
+        int mb_x = static_cast<int>(mb_index % mb_width_) * 16;
+        int mb_y = static_cast<int>(mb_index / mb_width_) * 16;
+        
+        AVRegionOfInterest& roi = regions[count++];
+        roi.self_size = sizeof(AVRegionOfInterest);
+        roi.left = mb_x;
+        roi.top = mb_y;
+        roi.right = std::min<int>(mb_x + 16, width_);
+        roi.bottom = std::min<int>(mb_y + 16, height_);
+        roi.qoffset = av_make_q(static_cast<int>(offset), kQPRange);
+    }
+    
+    av_frame_remove_side_data(frame, AV_FRAME_DATA_REGIONS_OF_INTEREST);
+    if (count == 0) {
+        av_buffer_unref(&buffer);
+        frames_tagged_++;
+        return 0;
+    }
+    
+    buffer->size = count * sizeof(AVRegionOfInterest);
+    if (!av_frame_new_side_data_from_buf(frame, AV_FRAME_DATA_REGIONS_OF_INTEREST, buffer)) {
+        av_buffer_unref(&buffer);
+        return AVERROR(ENOMEM);
+    }
+    
+    frames_tagged_++;
+    regions_attached_ += count;
+    return static_cast<int>(count);
+}
+
+std::string RoiTagger::getStats() const {
+    std::ostringstream oss;
+    oss << "RoiTagger Stats:\n"
+        << "  Frames tagged: " << frames_tagged_ << "\n"
+        << "  Regions attached: " << regions_attached_ << "\n"
+        << encoder_.getStats();
+    
+    return oss.str();
+}
+
+} // namespace phantomframe
+
+struct pf_roi_tagger {
+    phantomframe::RoiTagger tagger;
+    
+    explicit pf_roi_tagger(const phantomframe::WatermarkConfig& config) : tagger(config) {}
+};
+
+extern "C" pf_roi_tagger* pf_roi_tagger_create(const char* payload_hex, uint32_t seed,
+                                               float block_density, uint32_t temporal_period,
+                                               uint32_t width, uint32_t height, float fps) {
+    phantomframe::WatermarkConfig config;
+    config.payload = payload_hex ? phantomframe::utils::hexToPayload(payload_hex) : phantomframe::Payload();
+    config.seed = seed;
+    config.block_density = block_density;
+    config.temporal_period = temporal_period;
+    config.adaptive_embedding = false;
+    config.quality_threshold = 0.0f;
+    config.frame_budget_us = 0;
+    config.scene_cut_threshold = 0.0f;
+    config.window_frames = 0;
+    config.window_repeats = 1;
+    config.pilot_density = 0.0f;
+    config.marked_period_interval = 1;
+    config.enable_encryption = false;
+    
+    try {
+        auto* handle = new pf_roi_tagger(config);
+        if (!handle->tagger.initialize(width, height, fps)) {
+            delete handle;
+            return nullptr;
+        }
+        return handle;
+    } catch (...) {
+        return nullptr;
+    }
+}
+
+extern "C" int pf_roi_tagger_tag(pf_roi_tagger* tagger, AVFrame* frame, uint32_t frame_index) {
+    if (!tagger) {
+        return AVERROR(EINVAL);
+    }
+    return tagger->tagger.tagFrame(frame, frame_index);
+}
+
+extern "C" void pf_roi_tagger_destroy(pf_roi_tagger* tagger) {
+    delete tagger;
+}
@@ -0,0 +1,71 @@
+#ifndef PHANTOMFRAME_ROI_TAGGER_H
+#define PHANTOMFRAME_ROI_TAGGER_H
+
+#include <cstdint>
+#include <vector>
+#include "encoder/watermark_encoder.h"
+
+extern "C" {
+struct AVFrame;
+struct AVBufferPool;
+}
+
+namespace phantomframe {
+
+/**
+ * @brief Attaches the watermark to AVFrames as region-of-interest side data
+ *
+ * Each macroblock touched by the frame's schedule becomes one 16x16
+ * AVRegionOfInterest whose qoffset FFmpeg's libx264 wrapper turns into
+ * the same quant_offsets entry the encoder would write directly. Pixels
+ * are never read or copied, and side-data buffers come from a pool.
+ */
+class RoiTagger {
+public:
+    explicit RoiTagger(const WatermarkConfig& config);
+    ~RoiTagger();
+
+    RoiTagger(const RoiTagger&) = delete;
+    RoiTagger& operator=(const RoiTagger&) = delete;
+
+    /**
+     * @brief Prepare for frames of the given size
+     * @param width Frame width
+     * @param height Frame height
+     * @param fps Frames per second
+     * @return true if successful
+     */
+    bool initialize(uint32_t width, uint32_t height, float fps);
+
+    /**
+     * @brief Attach this frame's watermark to an AVFrame
+     * @param frame Frame to tag; existing ROI side data is replaced
+     * @param frame_index Current frame index
+     * @return Number of regions attached, or a negative AVERROR code
+     */
+    int tagFrame(AVFrame* frame, uint32_t frame_index);
+
+    /**
+     * @brief Get tagger statistics
+     * @return Statistics string
+     */
+    std::string getStats() const;
+
+private:
+    WatermarkEncoder encoder_;
+    uint32_t width_, height_;
+    uint32_t mb_width_, mb_height_;
+
+    // Scratch macroblock plane; entries are reset as regions are emitted
+    std::vector<float> offsets_;
+    std::vector<uint32_t> touched_;
+    AVBufferPool* pool_;
+    size_t pool_entry_size_;
+
+    uint64_t frames_tagged_;
+    uint64_t regions_attached_;
+};
+
+} // namespace phantomframe
+
+#endif // PHANTOMFRAME_ROI_TAGGER_H
@@ -1,10 +1,21 @@
+#include <algorithm>
 #include <iostream>
 #include <string>
 #include <memory>
 #include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <vector>
+#include "bitstream/h264_rewriter.h"
 #include "encoder/watermark_encoder.h"
 #include "extractor/watermark_extractor.h"
 #include "common/utils.h"
+#include "packager/manifest_packager.h"
+#ifdef PHANTOMFRAME_HAVE_PIPELINE
+#include "pipeline/encode_pipeline.h"
+#include "pipeline/gop_splicer.h"
+#endif
 
 using namespace phantomframe;
 
@@ -12,16 +23,28 @@ void printUsage() {
     std::cout << "PhantomFrame - Imperceptible Video Watermarking System\n"
               << "Usage:\n"
               << "  phantomframe encode <input_video> <output_video> <payload>\n"
+              << "  phantomframe rewrite <input.h264> <output.h264> <payload>\n"
+              << "  phantomframe splice <input_video> <output_video> <payload> [period_interval]\n"
+              << "  phantomframe variants <input_video> <output_dir> <payload> [segment_seconds]\n"
+              << "  phantomframe package <variant_a> <variant_b> <output_playlist> <session_id> <secret>\n"
               << "  phantomframe detect <input_video>\n"
               << "  phantomframe demo\n"
               << "\n"
               << "Commands:\n"
-              << "  encode  - Embed watermark in video\n"
-              << "  detect  - Detect watermark in video\n"
-              << "  demo    - Run demonstration\n"
+              << "  encode   - Embed watermark in video\n"
+              << "  rewrite  - Embed watermark in an H.264 stream without re-encoding\n"
+              << "  splice   - Re-encode only the GOPs that carry marks, copy the rest\n"
+              << "  variants - Encode A and B variants of a stream as aligned HLS segments\n"
+              << "  package  - Assemble a session's playlist from the A and B variants\n"
+              << "  detect   - Detect watermark in video\n"
+              << "  demo     - Run demonstration\n"
               << "\n"
               << "Examples:\n"
               << "  phantomframe encode input.mp4 output.mp4 \"Creator123\"\n"
+              << "  phantomframe rewrite input.h264 output.h264 \"Creator123\"\n"
+              << "  phantomframe splice archive.mp4 marked.mp4 \"Creator123\" 10\n"
+              << "  phantomframe variants movie.mp4 out \"Movie42\" 4\n"
+              << "  phantomframe package out/A/stream.m3u8 out/B/stream.m3u8 s1.m3u8 \"session-1\" \"secret\"\n"
               << "  phantomframe detect video.mp4\n"
               << "  phantomframe demo\n";
 }
@@ -31,7 +54,7 @@ void runDemo() {
     
     // Generate demo payload
     std::string demo_creator = "DemoCreator2024";
-    uint64_t payload = utils::generatePayloadFromString(demo_creator);
+    Payload payload = utils::generatePayloadFromString(demo_creator);
     uint32_t seed = utils::generateRandomSeed();
     
     std::cout << "Demo Creator: " << demo_creator << "\n";
@@ -44,6 +67,14 @@ void runDemo() {
     encoder_config.seed = seed;
     encoder_config.block_density = 0.008f;  // 0.8% of blocks
     encoder_config.temporal_period = 30;    // Every 30 frames
+    encoder_config.adaptive_embedding = false;
+    encoder_config.quality_threshold = 0.0f;
+    encoder_config.frame_budget_us = 0;
+    encoder_config.scene_cut_threshold = 0.0f;
+    encoder_config.window_frames = 0;
+    encoder_config.window_repeats = 1;
+    encoder_config.pilot_density = 0.0f;
+    encoder_config.marked_period_interval = 1;
     encoder_config.enable_encryption = false;
     
     auto encoder = std::make_unique<WatermarkEncoder>(encoder_config);
@@ -56,14 +87,19 @@ void runDemo() {
     std::cout << "Encoder initialized successfully\n";
     std::cout << encoder->getStats() << "\n\n";
     
-    // Simulate processing some frames
+    // Simulate processing some frames in the encoder's native I420 layout;
+    // only the luma plane is read, chroma is never converted or copied
     std::cout << "Simulating frame processing...\n";
-    for (int i = 0; i < 5; ++i) {
-        // Create dummy frame data
-        std::vector<uint8_t> dummy_frame(1920 * 1080 * 3, 128); // Gray frame
-        
-        auto processed_frame = encoder->processFrame(dummy_frame.data(), dummy_frame.size(), i);
-        std::cout << "Processed frame " << i << " (" << processed_frame.size() << " bytes)\n";
+    std::vector<uint8_t> luma(1920 * 1080, 128);
+    std::vector<uint8_t> chroma_u(960 * 540, 128);
+    std::vector<uint8_t> chroma_v(960 * 540, 128);
+    PlanarFrame frame{PixelFormat::I420, {luma.data(), chroma_u.data(), chroma_v.data()},
+                      {1920, 960, 960}, 1920, 1080};
+    std::vector<BlockInfo> blocks(encoder->getMaxBlocksPerFrame());
+    
+    for (uint32_t i = 0; i < 5; ++i) {
+        size_t modified = encoder->processFrame(frame, i, blocks.data(), blocks.size());
+        std::cout << "Processed frame " << i << " (" << modified << " blocks)\n";
     }
     
     std::cout << "\nFinal encoder stats:\n";
@@ -75,6 +111,19 @@ void runDemo() {
     extractor_config.max_frames = 1000;
     extractor_config.confidence_threshold = 0.7;
     extractor_config.enable_debug = true;
+    extractor_config.seed = seed;
+    extractor_config.block_density = encoder_config.block_density;
+    extractor_config.temporal_period = encoder_config.temporal_period;
+    extractor_config.adaptive_embedding = encoder_config.adaptive_embedding;
+    extractor_config.quality_threshold = encoder_config.quality_threshold;
+    extractor_config.reference_width = 0;
+    extractor_config.reference_height = 0;
+    extractor_config.scene_cut_threshold = encoder_config.scene_cut_threshold;
+    extractor_config.window_frames = encoder_config.window_frames;
+    extractor_config.window_repeats = encoder_config.window_repeats;
+    extractor_config.pilot_density = encoder_config.pilot_density;
+    extractor_config.marked_period_interval = encoder_config.marked_period_interval;
+    extractor_config.encryption_key = encoder_config.encryption_key;
     
     auto extractor = std::make_unique<WatermarkExtractor>(extractor_config);
     
@@ -101,7 +150,7 @@ void encodeVideo(const std::string& input_path, const std::string& output_path,
     }
     
     // Generate payload and seed
-    uint64_t payload = utils::generatePayloadFromString(payload_str);
+    Payload payload = utils::generatePayloadFromString(payload_str);
     uint32_t seed = utils::generateRandomSeed();
     
     std::cout << "Input: " << input_path << "\n";
@@ -115,25 +164,246 @@ void encodeVideo(const std::string& input_path, const std::string& output_path,
     config.seed = seed;
     config.block_density = 0.008f;
     config.temporal_period = 30;
+    config.adaptive_embedding = false;
+    config.quality_threshold = 0.0f;
+    config.frame_budget_us = 0;
+    config.scene_cut_threshold = 0.0f;
+    config.window_frames = 0;
+    config.window_repeats = 1;
+    config.pilot_density = 0.0f;
+    config.marked_period_interval = 1;
     config.enable_encryption = false;
+
+#ifdef PHANTOMFRAME_HAVE_PIPELINE
+    PipelineConfig pipeline_config;
+    pipeline_config.input_path = input_path;
+    pipeline_config.output_path = output_path;
+    pipeline_config.watermark = config;
+    pipeline_config.queue_depth = 8;
+    pipeline_config.preset = "medium";
+    pipeline_config.crf = 23.0f;
+    pipeline_config.encoder_threads = 0;
+    pipeline_config.segment_duration = 0.0f;
+    pipeline_config.embed_threads = 1;
+    pipeline_config.huge_pages = false;
+    pipeline_config.verbose = true;
+    
+    EncodePipeline pipeline(pipeline_config);
+    auto result = pipeline.run();
+    
+    if (!result.success) {
+        std::cerr << "Error encoding watermark: " << result.error_message << "\n";
+        return;
+    }
     
+    std::cout << "Successfully encoded watermark!\n";
+    std::cout << pipeline.getStats() << "\n";
+#else
     auto encoder = std::make_unique<WatermarkEncoder>(config);
     
     // Get video info (simplified)
     std::cout << "Video info:\n";
     std::cout << utils::getVideoInfo(input_path) << "\n\n";
     
-    // In a real implementation, this would:
-    // 1. Open the video file
-    // 2. Process each frame through the encoder
-    // 3. Write the watermarked video
-    // 4. Integrate with VLC's x264 encoder
-    
-    std::cout << "Note: Full video encoding requires VLC integration.\n";
-    std::cout << "This demo shows the watermarking algorithm setup.\n\n";
+    std::cout << "Note: Full video encoding requires building with FFmpeg and x264.\n";
+    std::cout << "This build shows the watermarking algorithm setup.\n\n";
     
     std::cout << "Encoder configuration:\n";
     std::cout << encoder->getStats() << "\n";
+#endif
+}
+
+void rewriteVideo(const std::string& input_path, const std::string& output_path, const std::string& payload_str) {
+    std::cout << "Rewriting H.264 stream with watermark...\n";
+    
+    std::ifstream input(input_path, std::ios::binary);
+    if (!input) {
+        std::cerr << "Error: Cannot open input file: " << input_path << "\n";
+        return;
+    }
+    std::vector<uint8_t> stream((std::istreambuf_iterator<char>(input)), std::istreambuf_iterator<char>());
+    
+    Payload payload = utils::generatePayloadFromString(payload_str);
+    uint32_t seed = utils::generateRandomSeed();
+    
+    std::cout << "Input: " << input_path << "\n";
+    std::cout << "Output: " << output_path << "\n";
+    std::cout << "Payload: " << utils::payloadToHex(payload) << "\n";
+    std::cout << "Seed: " << seed << "\n\n";
+    
+    // Same schedule as encode; the compressed domain has no pixels to adapt to
+    RewriteConfig config;
+    config.watermark.payload = payload;
+    config.watermark.seed = seed;
+    config.watermark.block_density = 0.008f;
+    config.watermark.temporal_period = 30;
+    config.watermark.adaptive_embedding = false;
+    config.watermark.quality_threshold = 0.0f;
+    config.watermark.frame_budget_us = 0;
+    config.watermark.scene_cut_threshold = 0.0f;
+    config.watermark.window_frames = 0;
+    config.watermark.window_repeats = 1;
+    config.watermark.pilot_density = 0.0f;
+    config.watermark.marked_period_interval = 1;
+    config.watermark.enable_encryption = false;
+    config.fps = 30.0f;
+    config.reencode_unmarked = false;
+    
+    auto start = std::chrono::steady_clock::now();
+    H264Rewriter rewriter(config);
+    std::vector<uint8_t> output;
+    if (!rewriter.rewriteAnnexB(stream.data(), stream.size(), output)) {
+        std::cerr << "Warning: some NAL units could not be parsed and were copied unchanged\n";
+    }
+    auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now() - start).count();
+    
+    std::ofstream out(output_path, std::ios::binary);
+    if (!out.write(reinterpret_cast<const char*>(output.data()), output.size())) {
+        std::cerr << "Error: Cannot write output file: " << output_path << "\n";
+        return;
+    }
+    
+    std::cout << "Rewrote " << stream.size() << " bytes in " << elapsed << " ms\n";
+    std::cout << rewriter.getStats() << "\n";
+}
+
+void spliceVideo(const std::string& input_path, const std::string& output_path,
+                 const std::string& payload_str, uint32_t period_interval) {
+    std::cout << "Splicing watermarked GOPs into video...\n";
+    
+    Payload payload = utils::generatePayloadFromString(payload_str);
+    uint32_t seed = utils::generateRandomSeed();
+    
+    std::cout << "Input: " << input_path << "\n";
+    std::cout << "Output: " << output_path << "\n";
+    std::cout << "Payload: " << utils::payloadToHex(payload) << "\n";
+    std::cout << "Seed: " << seed << "\n";
+    std::cout << "Marked periods: 1 in " << std::max<uint32_t>(1, period_interval) << "\n\n";
+
+#ifdef PHANTOMFRAME_HAVE_PIPELINE
+    SpliceConfig config;
+    config.input_path = input_path;
+    config.output_path = output_path;
+    config.watermark.payload = payload;
+    config.watermark.seed = seed;
+    config.watermark.block_density = 0.008f;
+    config.watermark.temporal_period = 30;
+    config.watermark.adaptive_embedding = false;
+    config.watermark.quality_threshold = 0.0f;
+    config.watermark.frame_budget_us = 0;
+    config.watermark.scene_cut_threshold = 0.0f;
+    config.watermark.window_frames = 0;
+    config.watermark.window_repeats = 1;
+    config.watermark.pilot_density = 0.0f;
+    config.watermark.marked_period_interval = period_interval;
+    config.watermark.enable_encryption = false;
+    config.preset = "medium";
+    config.crf = 23.0f;
+    config.encoder_threads = 0;
+    config.verbose = true;
+    
+    GopSplicer splicer(config);
+    auto result = splicer.run();
+    
+    if (!result.success) {
+        std::cerr << "Error splicing watermark: " << result.error_message << "\n";
+        return;
+    }
+    
+    std::cout << "Re-encoded " << result.gops_reencoded << " of " << result.gops << " GOPs\n";
+    std::cout << splicer.getStats() << "\n";
+#else
+    std::cout << "Note: GOP splicing requires building with FFmpeg and x264.\n";
+#endif
+}
+
+void encodeVariants(const std::string& input_path, const std::string& output_dir,
+                    const std::string& payload_str, float segment_seconds) {
+    std::cout << "Encoding A/B segment variants...\n";
+    
+    // Both variants share the seed and schedule; only the payload differs
+    Payload content = utils::generatePayloadFromString(payload_str);
+    uint32_t seed = utils::generateRandomSeed();
+    
+    std::cout << "Input: " << input_path << "\n";
+    std::cout << "Output: " << output_dir << "/{A,B}/stream.m3u8\n";
+    std::cout << "Variant A payload: " << utils::payloadToHex(variantPayload(content, 0)) << "\n";
+    std::cout << "Variant B payload: " << utils::payloadToHex(variantPayload(content, 1)) << "\n";
+    std::cout << "Seed: " << seed << "\n";
+    std::cout << "Segment duration: " << segment_seconds << " s\n\n";
+
+#ifdef PHANTOMFRAME_HAVE_PIPELINE
+    for (uint32_t variant = 0; variant < 2; ++variant) {
+        std::string dir = output_dir + (variant ? "/B" : "/A");
+        std::filesystem::create_directories(dir);
+        
+        PipelineConfig config;
+        config.input_path = input_path;
+        config.output_path = dir + "/stream.m3u8";
+        config.watermark.payload = variantPayload(content, variant);
+        config.watermark.seed = seed;
+        config.watermark.block_density = 0.008f;
+        config.watermark.temporal_period = 30;
+        config.watermark.adaptive_embedding = false;
+        config.watermark.quality_threshold = 0.0f;
+        config.watermark.frame_budget_us = 0;
+        config.watermark.scene_cut_threshold = 0.0f;
+        config.watermark.window_frames = 0;
+        config.watermark.window_repeats = 1;
+        config.watermark.pilot_density = 0.0f;
+        config.watermark.marked_period_interval = 1;
+        config.watermark.enable_encryption = false;
+        config.queue_depth = 8;
+        config.preset = "medium";
+        config.crf = 23.0f;
+        config.encoder_threads = 0;
+        config.segment_duration = segment_seconds;
+        config.embed_threads = 1;
+        config.huge_pages = false;
+        config.verbose = true;
+        
+        EncodePipeline pipeline(config);
+        auto result = pipeline.run();
+        
+        if (!result.success) {
+            std::cerr << "Error encoding variant " << (variant ? "B" : "A") << ": "
+                      << result.error_message << "\n";
+            return;
+        }
+        std::cout << "Variant " << (variant ? "B" : "A") << ": " << config.output_path << "\n";
+    }
+#else
+    std::cout << "Note: Variant encoding requires building with FFmpeg and x264.\n";
+#endif
+}
+
+void packageSession(const std::string& variant_a, const std::string& variant_b,
+                    const std::string& output_path, const std::string& session_id,
+                    const std::string& secret) {
+    namespace fs = std::filesystem;
+    
+    // Segment references are resolved against the packaged playlist's directory
+    fs::path output_dir = fs::absolute(output_path).parent_path();
+    auto prefixFor = [&output_dir](const std::string& playlist) {
+        fs::path relative = fs::absolute(playlist).parent_path().lexically_relative(output_dir);
+        return relative.empty() || relative == "." ? std::string() : relative.generic_string() + "/";
+    };
+    
+    ManifestPackager packager;
+    if (!packager.load(variant_a, variant_b, prefixFor(variant_a), prefixFor(variant_b))) {
+        std::cerr << "Error: Cannot package " << variant_a << " and " << variant_b << "\n";
+        return;
+    }
+    
+    SessionSequence session(session_id, secret);
+    if (!packager.write(session, output_path)) {
+        return;
+    }
+    
+    std::cout << "Session: " << session_id << "\n";
+    std::cout << "Session payload: " << utils::payloadToHex(session.payload()) << "\n";
+    std::cout << "Packaged " << packager.segmentCount() << " segments into " << output_path << "\n";
 }
 
 void detectWatermark(const std::string& input_path) {
@@ -153,6 +423,19 @@ void detectWatermark(const std::string& input_path) {
     config.max_frames = 1000;
     config.confidence_threshold = 0.7;
     config.enable_debug = true;
+    config.seed = 0;
+    config.block_density = 0.008f;
+    config.temporal_period = 30;
+    config.adaptive_embedding = false;
+    config.quality_threshold = 0.0f;
+    config.reference_width = 0;
+    config.reference_height = 0;
+    config.scene_cut_threshold = 0.0f;
+    config.window_frames = 0;
+    config.window_repeats = 1;
+    config.pilot_density = 0.0f;
+    config.marked_period_interval = 1;
+    config.encryption_key = "";
     
     auto extractor = std::make_unique<WatermarkExtractor>(config);
     
@@ -191,6 +474,40 @@ int main(int argc, char* argv[]) {
             }
             encodeVideo(argv[2], argv[3], argv[4]);
         }
+        else if (command == "rewrite") {
+            if (argc != 5) {
+                std::cerr << "Error: rewrite command requires 3 arguments\n";
+                printUsage();
+                return 1;
+            }
+            rewriteVideo(argv[2], argv[3], argv[4]);
+        }
+        else if (command == "splice") {
+            if (argc != 5 && argc != 6) {
+                std::cerr << "Error: splice command requires 3 or 4 arguments\n";
+                printUsage();
+                return 1;
+            }
+            uint32_t period_interval = argc == 6 ? std::stoul(argv[5]) : 1;
+            spliceVideo(argv[2], argv[3], argv[4], period_interval);
+        }
+        else if (command == "variants") {
+            if (argc != 5 && argc != 6) {
+                std::cerr << "Error: variants command requires 3 or 4 arguments\n";
+                printUsage();
+                return 1;
+            }
+            float segment_seconds = argc == 6 ? std::stof(argv[5]) : 4.0f;
+            encodeVariants(argv[2], argv[3], argv[4], segment_seconds);
+        }
+        else if (command == "package") {
+            if (argc != 7) {
+                std::cerr << "Error: package command requires 5 arguments\n";
+                printUsage();
+                return 1;
+            }
+            packageSession(argv[2], argv[3], argv[4], argv[5], argv[6]);
+        }
         else if (command == "detect") {
             if (argc != 3) {
                 std::cerr << "Error: detect command requires 1 argument\n";
@@ -0,0 +1,332 @@
+#include "manifest_packager.h"
+#include "common/utils.h"
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+
+namespace phantomframe {
+
+namespace {
+
+// Whether a playlist reference is resolved against the playlist's location
+bool isRelative(const std::string& uri, size_t begin, size_t end) {
+    if (begin == end || uri[begin] == '/') {
+        return false;
+    }
+    size_t colon = uri.find(':', begin);
+    size_t slash = uri.find('/', begin);
+    bool has_scheme = colon < end && colon < slash;
+    return !has_scheme;
+}
+
+// Prefix the relative values of every attribute="..." in text
+std::string prefixAttribute(const std::string& text, const std::string& attribute,
+                            const std::string& prefix) {
+    if (prefix.empty()) {
+        return text;
+    }
+    
+    std::string pattern = attribute + "=\"";
+    std::string result;
+    size_t pos = 0;
+    size_t found;
+    while ((found = text.find(pattern, pos)) != std::string::npos) {
+        size_t value = found + pattern.size();
+        size_t close = text.find('"', value);
+        if (close == std::string::npos) {
+            break;
+        }
+        result.append(text, pos, value - pos);
+        if (isRelative(text, value, close)) {
+            result += prefix;
+        }
+        result.append(text, value, close - value);
+        pos = close;
+    }
+    result.append(text, pos, std::string::npos);
+    return result;
+}
+
+// Lines without their terminators; a final line without one is kept
+std::vector<std::string> splitLines(const std::string& text) {
+    std::vector<std::string> lines;
+    size_t pos = 0;
+    while (pos < text.size()) {
+        size_t end = text.find('\n', pos);
+        if (end == std::string::npos) {
+            end = text.size();
+        }
+        size_t stop = end > pos && text[end - 1] == '\r' ? end - 1 : end;
+        lines.emplace_back(text, pos, stop - pos);
+        pos = end + 1;
+    }
+    return lines;
+}
+
+bool startsWith(const std::string& text, const char* prefix) {
+    return text.compare(0, std::char_traits<char>::length(prefix), prefix) == 0;
+}
+
+bool readFile(const std::string& path, std::string& text) {
+    std::ifstream input(path, std::ios::binary);
+    if (!input) {
+        return false;
+    }
+    text.assign(std::istreambuf_iterator<char>(input), std::istreambuf_iterator<char>());
+    return true;
+}
+
+} // namespace
+
+Payload variantPayload(const Payload& content, uint32_t variant) {
+    Payload payload = content;
+    payload.bytes[Payload::kBytes - 1] &= 0xFE;
+    payload.bytes[Payload::kBytes - 1] |= variant & 1;
+    return payload;
+}
+
+SessionSequence::SessionSequence(const std::string& session_id, const std::string& secret)
+    : payload_(sessionPayload(session_id, secret)), length_(kPayloadCodedBits) {
+    CodedPayload coded;
+    encodePayload(payload_, coded);
+    bits_.assign(coded.words.begin(), coded.words.end());
+}
+
+SessionSequence::SessionSequence(const TardosCode& code, uint64_t viewer_id)
+    : length_(code.length()), bits_(code.words()) {
+    code.codeword(viewer_id, bits_.data());
+}
+
+Payload SessionSequence::sessionPayload(const std::string& session_id, const std::string& secret) {
+    return utils::keyedPayload(secret, session_id);
+}
+
+float segmentVariantEvidence(const float* soft, const CodedPayload& variant_a,
+                             const CodedPayload& variant_b) {
+    // Positive evidence favours a 0 bit, so A is favoured where A has the 0
+    float evidence = 0.0f;
+    for (uint32_t j = 0; j < kPayloadCodedBits; ++j) {
+        if (variant_a[j] != variant_b[j]) {
+            evidence += variant_a[j] ? -soft[j] : soft[j];
+        }
+    }
+    return evidence;
+}
+
+bool decodeSession(const float* segment_evidence, size_t segments, Payload& session,
+                   SoftDecodeInfo* info) {
+    // A is bit 0, which positive channel evidence stands for
+    std::vector<float> soft(kPayloadCodedBits, 0.0f);
+    for (size_t i = 0; i < segments; ++i) {
+        soft[i % kPayloadCodedBits] += segment_evidence[i];
+    }
+    return decodePayloadSoft(soft.data(), session, info);
+}
+
+ManifestPackager::ManifestPackager()
+    : format_(ManifestFormat::HLS)
+    , segment_count_(0)
+    , rendered_size_(0) {
+}
+
+bool ManifestPackager::load(const std::string& variant_a_path, const std::string& variant_b_path,
+                            const std::string& prefix_a, const std::string& prefix_b) {
+    std::string variant_a;
+    std::string variant_b;
+    if (!readFile(variant_a_path, variant_a)) {
+        std::cerr << "Cannot read playlist " << variant_a_path << std::endl;
+        return false;
+    }
+    if (!readFile(variant_b_path, variant_b)) {
+        std::cerr << "Cannot read playlist " << variant_b_path << std::endl;
+        return false;
+    }
+    return parse(variant_a, variant_b, prefix_a, prefix_b);
+}
+
+bool ManifestPackager::parse(const std::string& variant_a, const std::string& variant_b,
+                             const std::string& prefix_a, const std::string& prefix_b) {
+    clear();
+    
+    bool ok;
+    if (startsWith(variant_a, "#EXTM3U")) {
+        format_ = ManifestFormat::HLS;
+        ok = parseHls(variant_a, variant_b, prefix_a, prefix_b);
+    }
+    else if (variant_a.find("<MPD") != std::string::npos) {
+        format_ = ManifestFormat::DASH;
+        ok = parseDash(variant_a, variant_b, prefix_a, prefix_b);
+    }
+    else {
+        std::cerr << "Playlist is neither an HLS playlist nor a DASH MPD" << std::endl;
+        ok = false;
+    }
+    if (!ok) {
+        clear();
+        return false;
+    }
+    
+    rendered_size_ = 0;
+    for (const auto& text : shared_) {
+        rendered_size_ += text.size();
+    }
+    for (const auto& segment : segments_) {
+        rendered_size_ += std::max(segment.variant_a.size(), segment.variant_b.size());
+    }
+    return true;
+}
+
+bool ManifestPackager::parseHls(const std::string& variant_a, const std::string& variant_b,
+                                const std::string& prefix_a, const std::string& prefix_b) {
+    std::vector<std::string> lines_a = splitLines(variant_a);
+    std::vector<std::string> lines_b = splitLines(variant_b);
+    if (lines_a.size() != lines_b.size()) {
+        std::cerr << "Variant playlists are not segment-aligned: " << lines_a.size()
+                  << " and " << lines_b.size() << " lines" << std::endl;
+        return false;
+    }
+    
+    std::string shared;
+    Segment segment{"", "", 0};
+    for (size_t i = 0; i < lines_a.size(); ++i) {
+        const std::string& a = lines_a[i];
+        const std::string& b = lines_b[i];
+        
+        if (startsWith(a, "#EXT-X-STREAM-INF")) {
+            std::cerr << "Master playlists are not packaged; package each rendition's media playlist"
+                      << std::endl;
+            return false;
+        }
+        
+        bool uri_a = !a.empty() && a[0] != '#';
+        bool uri_b = !b.empty() && b[0] != '#';
+        if (uri_a && uri_b) {
+            segment.variant_a += (isRelative(a, 0, a.size()) ? prefix_a : std::string()) + a + "\n";
+            segment.variant_b += (isRelative(b, 0, b.size()) ? prefix_b : std::string()) + b + "\n";
+            segment.index = static_cast<uint32_t>(segments_.size());
+            shared_.push_back(std::move(shared));
+            segments_.push_back(std::move(segment));
+            shared.clear();
+            segment = Segment{"", "", 0};
+        }
+        else if (startsWith(a, "#EXT-X-BYTERANGE") && startsWith(b, "#EXT-X-BYTERANGE")) {
+            // Byte ranges belong to the segment that follows
+            segment.variant_a += a + "\n";
+            segment.variant_b += b + "\n";
+        }
+        else if (a == b && !uri_a) {
+            shared += prefixAttribute(a, "URI", prefix_a) + "\n";
+        }
+        else {
+            std::cerr << "Variant playlists are not segment-aligned at line " << i + 1
+                      << ": \"" << a << "\" and \"" << b << "\"" << std::endl;
+            return false;
+        }
+    }
+    shared_.push_back(std::move(shared));
+    
+    if (segments_.empty()) {
+        std::cerr << "Playlist has no segments" << std::endl;
+        return false;
+    }
+    segment_count_ = static_cast<uint32_t>(segments_.size());
+    return true;
+}
+
+bool ManifestPackager::parseDash(const std::string& variant_a, const std::string& variant_b,
+                                 const std::string& prefix_a, const std::string& prefix_b) {
+    if (variant_a.find("<SegmentTemplate") != std::string::npos) {
+        std::cerr << "MPD uses SegmentTemplate; per-session MPDs need SegmentList addressing"
+                  << std::endl;
+        return false;
+    }
+    
+    const std::string element = "<SegmentURL";
+    size_t pos_a = 0;
+    size_t pos_b = 0;
+    uint32_t index = 0;
+    while (true) {
+        size_t start_a = variant_a.find(element, pos_a);
+        size_t start_b = variant_b.find(element, pos_b);
+        size_t shared_end_a = start_a == std::string::npos ? variant_a.size() : start_a;
+        size_t shared_end_b = start_b == std::string::npos ? variant_b.size() : start_b;
+        
+        if (variant_a.compare(pos_a, shared_end_a - pos_a, variant_b,
+                              pos_b, shared_end_b - pos_b) != 0) {
+            std::cerr << "Variant MPDs are not segment-aligned after segment "
+                      << segments_.size() << std::endl;
+            return false;
+        }
+        std::string shared = variant_a.substr(pos_a, shared_end_a - pos_a);
+        if (shared.find("<SegmentList") != std::string::npos) {
+            index = 0;
+        }
+        shared_.push_back(prefixAttribute(shared, "sourceURL", prefix_a));
+        if (start_a == std::string::npos) {
+            break;
+        }
+        
+        size_t end_a = variant_a.find('>', start_a);
+        size_t end_b = variant_b.find('>', start_b);
+        if (end_a == std::string::npos || end_b == std::string::npos) {
+            std::cerr << "Unterminated SegmentURL element" << std::endl;
+            return false;
+        }
+        Segment segment;
+        segment.variant_a = prefixAttribute(variant_a.substr(start_a, end_a + 1 - start_a), "media", prefix_a);
+        segment.variant_b = prefixAttribute(variant_b.substr(start_b, end_b + 1 - start_b), "media", prefix_b);
+        segment.index = index++;
+        segments_.push_back(std::move(segment));
+        segment_count_ = std::max(segment_count_, index);
+        
+        pos_a = end_a + 1;
+        pos_b = end_b + 1;
+    }
+    
+    if (segments_.empty()) {
+        std::cerr << "MPD has no SegmentURL elements" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+void ManifestPackager::render(const SessionSequence& session, std::string& output) const {
+    output.clear();
+    output.reserve(rendered_size_);
+    for (size_t i = 0; i < segments_.size(); ++i) {
+        const Segment& segment = segments_[i];
+        output += shared_[i];
+        output += session.variant(segment.index) ? segment.variant_b : segment.variant_a;
+    }
+    if (!shared_.empty()) {
+        output += shared_.back();
+    }
+}
+
+std::string ManifestPackager::render(const SessionSequence& session) const {
+    std::string output;
+    render(session, output);
+    return output;
+}
+
+bool ManifestPackager::write(const SessionSequence& session, const std::string& output_path) const {
+    std::string output;
+    render(session, output);
+    
+    std::ofstream out(output_path, std::ios::binary);
+    if (!out.write(output.data(), output.size())) {
+        std::cerr << "Cannot write playlist " << output_path << std::endl;
+        return false;
+    }
+    return true;
+}
+
+void ManifestPackager::clear() {
+    shared_.clear();
+    segments_.clear();
+    segment_count_ = 0;
+    rendered_size_ = 0;
+}
+
+} // namespace phantomframe
@@ -0,0 +1,237 @@
+#ifndef PHANTOMFRAME_MANIFEST_PACKAGER_H
+#define PHANTOMFRAME_MANIFEST_PACKAGER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "common/payload.h"
+#include "common/payload_code.h"
+#include "common/tardos_code.h"
+
+namespace phantomframe {
+
+/**
+ * @brief Payload of one of the two variants of a stream
+ *
+ * Variant A (0) carries the content payload with its last bit cleared and
+ * variant B (1) with it set. The outer code spreads that one bit over the
+ * parity, so the two codewords differ in many channel bits and a segment
+ * is told apart with segmentVariantEvidence() long before either payload
+ * could be decoded from it.
+ * @param content Content payload
+ * @param variant 0 for A, 1 for B
+ * @return Payload to encode the variant with
+ */
+Payload variantPayload(const Payload& content, uint32_t variant);
+
+/**
+ * @brief Variant sequence a viewer session receives
+ *
+ * The session ID and a secret are hashed into a 128-bit session payload,
+ * which is encoded with the payload code (encodePayload()). Segment i of
+ * the session is served from variant A or B as channel bit
+ * i % kPayloadCodedBits of that codeword says, so the A/B sequence of a
+ * leaked copy is itself a codeword and decodeSession() recovers the
+ * session payload from it, with the code's error correction absorbing
+ * misjudged segments. Without the secret the sequence of a session cannot
+ * be predicted.
+ *
+ * A sequence can instead follow a viewer's TardosCode codeword, which
+ * survives colluders averaging their copies: segment i is served as bit
+ * i % length of the codeword, and leaks are traced by scoring registered
+ * viewers with AccusationScorer.
+ */
+class SessionSequence {
+public:
+    /**
+     * @brief Derive the sequence of a session
+     * @param session_id Session ID as issued by the CDN or player
+     * @param secret Operator secret, the same for every session
+     */
+    SessionSequence(const std::string& session_id, const std::string& secret);
+
+    /**
+     * @brief Follow a viewer's fingerprinting codeword
+     * @param code Fingerprinting code
+     * @param viewer_id Viewer ID the codeword is generated for
+     */
+    SessionSequence(const TardosCode& code, uint64_t viewer_id);
+
+    /**
+     * @brief Session payload, what decodeSession() returns for a leak
+     *
+     * HMAC-SHA-256 of the session ID keyed by the secret, so a viewer who
+     * decodes their own payload learns nothing about anyone else's.
+     */
+    static Payload sessionPayload(const std::string& session_id, const std::string& secret);
+
+    /**
+     * @brief Variant served for a segment
+     * @param segment Segment number from the start of the stream
+     * @return 0 for A, 1 for B
+     */
+    uint32_t variant(uint64_t segment) const {
+        uint64_t bit = segment % length_;
+        return (bits_[bit / 64] >> (bit % 64)) & 1;
+    }
+
+    /**
+     * @brief Session payload, empty for a sequence that follows a codeword
+     */
+    const Payload& payload() const { return payload_; }
+
+private:
+    Payload payload_;
+    uint32_t length_;               // Segments before the sequence repeats
+    std::vector<uint64_t> bits_;    // Variant of segment i in bit i % 64 of bits_[i / 64]
+};
+
+/**
+ * @brief Evidence that a segment was served from variant A rather than B
+ *
+ * Correlates the channel evidence summed over a segment's frames (see
+ * FrameAnalysis::channel_evidence) with the channel bits where the two
+ * variants' codewords differ. Bits they share say nothing about the
+ * variant and are skipped.
+ * @param soft Evidence per channel bit, kPayloadCodedBits entries
+ * @param variant_a Codeword of variant A's payload
+ * @param variant_b Codeword of variant B's payload
+ * @return Positive for A, negative for B, magnitude is reliability
+ */
+float segmentVariantEvidence(const float* soft, const CodedPayload& variant_a,
+                             const CodedPayload& variant_b);
+
+/**
+ * @brief Recover the session payload from the variants of a leaked copy
+ *
+ * Evidence of segment i is added to channel bit i % kPayloadCodedBits, so
+ * streams longer than one codeword add up and segments that were not
+ * recovered are passed as 0. At least kPayloadCodedBits segments are
+ * needed for every channel bit to be seen; fewer leave erasures that the
+ * code may or may not bridge.
+ * @param segment_evidence Evidence per segment from segmentVariantEvidence()
+ * @param segments Number of segments
+ * @param session Output session payload
+ * @param info Optional decode details
+ * @return true if a session payload was decoded
+ */
+bool decodeSession(const float* segment_evidence, size_t segments, Payload& session,
+                   SoftDecodeInfo* info = nullptr);
+
+/**
+ * @brief Playlist format of a packaged stream
+ */
+enum class ManifestFormat {
+    HLS,    // Media playlist (.m3u8)
+    DASH    // MPD with SegmentList addressing
+};
+
+/**
+ * @brief Builds per-session playlists from the playlists of two variants
+ *
+ * The variants are encoded once each (EncodePipeline with a
+ * segment_duration, two payloads from variantPayload()) and their
+ * playlists parsed once into a template: text both share, and for each
+ * segment the two alternatives. Packaging a session then only walks the
+ * template and appends A's or B's segment reference as its
+ * SessionSequence says, so the cost of a per-viewer mark is a string
+ * concatenation instead of an encode, and segments stay cacheable on the
+ * CDN because every viewer fetches the same two sets of files.
+ *
+ * HLS media playlists and DASH MPDs with SegmentList addressing are
+ * supported. The two playlists must be identical except for segment
+ * references, which holds when both variants were encoded with the same
+ * settings and fixed GOPs; anything else is rejected as misaligned. DASH
+ * segments are numbered per Representation, so every rendition serves the
+ * same variant at the same time. Relative references (segment URIs,
+ * EXT-X-MAP and EXT-X-KEY URIs, Initialization sourceURLs) are prefixed
+ * with the location of their variant; shared references are taken from
+ * variant A.
+ */
+class ManifestPackager {
+public:
+    ManifestPackager();
+
+    /**
+     * @brief Load the playlists of both variants
+     * @param variant_a_path Playlist of variant A
+     * @param variant_b_path Playlist of variant B
+     * @param prefix_a Prepended to A's relative references (e.g. "../A/"), may be empty
+     * @param prefix_b Prepended to B's relative references
+     * @return false if a playlist cannot be read or the two do not align
+     */
+    bool load(const std::string& variant_a_path, const std::string& variant_b_path,
+              const std::string& prefix_a, const std::string& prefix_b);
+
+    /**
+     * @brief Parse the playlists of both variants from memory
+     * @see load()
+     */
+    bool parse(const std::string& variant_a, const std::string& variant_b,
+               const std::string& prefix_a, const std::string& prefix_b);
+
+    /**
+     * @brief Assemble the playlist of a session
+     * @param session Variant sequence of the session
+     * @param output Output playlist text, replaced; reusing it across
+     *        sessions avoids reallocating
+     */
+    void render(const SessionSequence& session, std::string& output) const;
+
+    /**
+     * @brief Assemble the playlist of a session
+     * @param session Variant sequence of the session
+     * @return Playlist text
+     */
+    std::string render(const SessionSequence& session) const;
+
+    /**
+     * @brief Assemble the playlist of a session and write it to a file
+     * @param session Variant sequence of the session
+     * @param output_path Output playlist
+     * @return false if the file cannot be written
+     */
+    bool write(const SessionSequence& session, const std::string& output_path) const;
+
+    ManifestFormat format() const { return format_; }
+
+    /**
+     * @brief Segments per rendition, the length of the variant sequence used
+     */
+    uint32_t segmentCount() const { return segment_count_; }
+
+private:
+    struct Segment {
+        std::string variant_a;  // Reference to A's segment, prefixed
+        std::string variant_b;  // Reference to B's segment, prefixed
+        uint32_t index;         // Segment number within its rendition
+    };
+
+    ManifestFormat format_;
+    std::vector<std::string> shared_;   // Text before each segment, plus the tail
+    std::vector<Segment> segments_;
+    uint32_t segment_count_;
+    size_t rendered_size_;              // Largest playlist a session can get
+
+    /**
+     * @brief Split two HLS media playlists into the template
+     */
+    bool parseHls(const std::string& variant_a, const std::string& variant_b,
+                  const std::string& prefix_a, const std::string& prefix_b);
+
+    /**
+     * @brief Split two SegmentList MPDs into the template
+     */
+    bool parseDash(const std::string& variant_a, const std::string& variant_b,
+                   const std::string& prefix_a, const std::string& prefix_b);
+
+    /**
+     * @brief Reset the template
+     */
+    void clear();
+};
+
+} // namespace phantomframe
+
+#endif // PHANTOMFRAME_MANIFEST_PACKAGER_H
@@ -0,0 +1,570 @@
+#include "encode_pipeline.h"
+#include "common/spsc_queue.h"
+#include "encoder/quant_offset_buffer.h"
+#include "common/worker_pool.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+#include <libavformat/avformat.h>
+#include <libavutil/dict.h>
+#include <libavutil/imgutils.h>
+#include <libswscale/swscale.h>
+#include <x264.h>
+}
+
+namespace phantomframe {
+
+namespace {
+
+/**
+ * @brief One frame travelling through the pipeline
+ */
+struct FrameItem {
+    AVFrame* decoded;           // Reference to the decoder's picture
+    AVFrame* converted;         // I420 copy, used when the decoder output isn't I420
+    AVFrame* picture;           // Whichever of the two holds the picture
+    uint32_t frame_index;       // Index used for the watermark schedule
+    int64_t pts;                // Presentation timestamp in input time base
+    const float* quant_offsets; // Watermark plane for x264
+};
+
+bool isI420(int format) {
+    return format == AV_PIX_FMT_YUV420P || format == AV_PIX_FMT_YUVJ420P;
+}
+
+std::string avError(int errnum) {
+    char buffer[AV_ERROR_MAX_STRING_SIZE] = {0};
+    av_strerror(errnum, buffer, sizeof(buffer));
+    return buffer;
+}
+
+} // namespace
+
+struct EncodePipeline::Context {
+    explicit Context(size_t depth)
+        : abort(false), free_items(depth), decoded(depth), embedded(depth), items(depth),
+          input(nullptr), decoder(nullptr), stream_index(-1), scaler(nullptr),
+          x264(nullptr), output(nullptr), out_stream(nullptr), global_header(false),
+          frames_encoded(0) {
+        for (auto& item : items) {
+            item.decoded = av_frame_alloc();
+            item.converted = av_frame_alloc();
+            item.picture = nullptr;
+            item.quant_offsets = nullptr;
+        }
+    }
+    
+    ~Context() {
+        for (auto& item : items) {
+            av_frame_free(&item.decoded);
+            av_frame_free(&item.converted);
+        }
+        if (x264) {
+            x264_encoder_close(x264);
+        }
+        if (output) {
+            if (!(output->oformat->flags & AVFMT_NOFILE)) {
+                avio_closep(&output->pb);
+            }
+            avformat_free_context(output);
+        }
+        sws_freeContext(scaler);
+        avcodec_free_context(&decoder);
+        avformat_close_input(&input);
+    }
+    
+    std::atomic<bool> abort;
+    std::mutex error_mutex;
+    std::string error;
+    
+    // Items cycle free -> decoded -> embedded -> free
+    SpscQueue<FrameItem*> free_items;
+    SpscQueue<FrameItem*> decoded;
+    SpscQueue<FrameItem*> embedded;
+    std::vector<FrameItem> items;
+    
+    // Input side
+    AVFormatContext* input;
+    AVCodecContext* decoder;
+    int stream_index;
+    AVRational time_base;
+    SwsContext* scaler;
+    
+    // Watermark stage
+    std::unique_ptr<BufferPool> buffers;
+    std::unique_ptr<WorkerPool> slice_pool;
+    std::unique_ptr<WatermarkEncoder> watermark;
+    std::unique_ptr<QuantOffsetBuffer> planes;
+    
+    // Output side
+    x264_t* x264;
+    AVFormatContext* output;
+    AVStream* out_stream;
+    std::vector<int> stream_map;    // Output stream of each input stream, -1 if dropped
+    std::mutex output_mutex;        // Copied packets are muxed from the decode stage
+    bool global_header;
+    uint64_t frames_encoded;
+};
+
+EncodePipeline::EncodePipeline(const PipelineConfig& config)
+    : config_(config), frames_processed_(0), processing_time_(0.0) {
+}
+
+EncodePipeline::~EncodePipeline() = default;
+
+PipelineResult EncodePipeline::run() {
+    auto start_time = std::chrono::steady_clock::now();
+    
+    // One plane per in-flight frame keeps every plane alive until x264 read it
+    size_t depth = std::max<uint32_t>(2, config_.queue_depth);
+    Context ctx(depth);
+    
+    // Open input and decoder
+    int ret = avformat_open_input(&ctx.input, config_.input_path.c_str(), nullptr, nullptr);
+    if (ret < 0) {
+        return {false, 0, 0.0, 0.0, "Failed to open input: " + avError(ret)};
+    }
+    if ((ret = avformat_find_stream_info(ctx.input, nullptr)) < 0) {
+        return {false, 0, 0.0, 0.0, "Failed to read stream info: " + avError(ret)};
+    }
+    
+    const AVCodec* codec = nullptr;
+    ctx.stream_index = av_find_best_stream(ctx.input, AVMEDIA_TYPE_VIDEO, -1, -1, &codec, 0);
+    if (ctx.stream_index < 0 || !codec) {
+        return {false, 0, 0.0, 0.0, "No decodable video stream in " + config_.input_path};
+    }
+    
+    AVStream* in_stream = ctx.input->streams[ctx.stream_index];
+    ctx.time_base = in_stream->time_base;
+    
+    ctx.decoder = avcodec_alloc_context3(codec);
+    avcodec_parameters_to_context(ctx.decoder, in_stream->codecpar);
+    ctx.decoder->thread_count = 0;
+    ctx.decoder->thread_type = FF_THREAD_FRAME | FF_THREAD_SLICE;
+    if ((ret = avcodec_open2(ctx.decoder, codec, nullptr)) < 0) {
+        return {false, 0, 0.0, 0.0, "Failed to open decoder: " + avError(ret)};
+    }
+    
+    const int width = ctx.decoder->width;
+    const int height = ctx.decoder->height;
+    AVRational frame_rate = av_guess_frame_rate(ctx.input, in_stream, nullptr);
+    if (frame_rate.num <= 0 || frame_rate.den <= 0) {
+        frame_rate = {25, 1};
+    }
+    
+    // Watermark stage
+    ctx.buffers = std::make_unique<BufferPool>(config_.huge_pages);
+    ctx.watermark = std::make_unique<WatermarkEncoder>(config_.watermark);
+    ctx.watermark->setBufferPool(ctx.buffers.get());
+    if (config_.embed_threads > 1) {
+        ctx.slice_pool = std::make_unique<WorkerPool>(config_.embed_threads);
+        ctx.watermark->setWorkerPool(ctx.slice_pool.get());
+    }
+    if (!ctx.watermark->initialize(width, height, static_cast<float>(av_q2d(frame_rate)))) {
+        return {false, 0, 0.0, 0.0, "Failed to initialize watermark encoder"};
+    }
+    ctx.planes = std::make_unique<QuantOffsetBuffer>(width, height, depth, ctx.buffers.get());
+    
+    // Open output container
+    avformat_alloc_output_context2(&ctx.output, nullptr, nullptr, config_.output_path.c_str());
+    if (!ctx.output) {
+        return {false, 0, 0.0, 0.0, "Unsupported output format: " + config_.output_path};
+    }
+    ctx.global_header = (ctx.output->oformat->flags & AVFMT_GLOBALHEADER) != 0;
+    
+    // Open x264
+    x264_param_t param;
+    const char* preset = config_.preset.empty() ? "medium" : config_.preset.c_str();
+    if (x264_param_default_preset(&param, preset, nullptr) < 0) {
+        return {false, 0, 0.0, 0.0, "Unknown x264 preset: " + config_.preset};
+    }
+    param.i_width = width;
+    param.i_height = height;
+    param.i_csp = X264_CSP_I420;
+    param.i_threads = config_.encoder_threads > 0 ? config_.encoder_threads : X264_THREADS_AUTO;
+    param.b_vfr_input = 1;
+    param.i_timebase_num = ctx.time_base.num;
+    param.i_timebase_den = ctx.time_base.den;
+    param.i_fps_num = frame_rate.num;
+    param.i_fps_den = frame_rate.den;
+    param.rc.i_rc_method = X264_RC_CRF;
+    param.rc.f_rf_constant = config_.crf > 0.0f ? config_.crf : 23.0f;
+    // x264 only applies quant_offsets with AQ enabled; zero strength keeps
+    // the watermark as the only offset when the preset disables AQ
+    if (param.rc.i_aq_mode == X264_AQ_NONE) {
+        param.rc.i_aq_mode = X264_AQ_VARIANCE;
+        param.rc.f_aq_strength = 0.0f;
+    }
+    // Fixed closed GOPs, so segments cut at the same frames whatever the payload
+    int gop_frames = 0;
+    if (config_.segment_duration > 0.0f) {
+        gop_frames = std::max(1, static_cast<int>(std::lround(config_.segment_duration * av_q2d(frame_rate))));
+        param.i_keyint_max = gop_frames;
+        param.i_keyint_min = gop_frames;
+        param.i_scenecut_threshold = 0;
+        param.b_open_gop = 0;
+    }
+    param.b_annexb = 1;
+    param.b_repeat_headers = ctx.global_header ? 0 : 1;
+    x264_param_apply_profile(&param, "high");
+    
+    ctx.x264 = x264_encoder_open(&param);
+    if (!ctx.x264) {
+        return {false, 0, 0.0, 0.0, "Failed to open x264 encoder"};
+    }
+    
+    // Output streams in input order: the encoded video, copied audio and subtitles
+    ctx.stream_map.assign(ctx.input->nb_streams, -1);
+    for (unsigned i = 0; i < ctx.input->nb_streams; ++i) {
+        AVStream* stream = ctx.input->streams[i];
+        AVMediaType type = stream->codecpar->codec_type;
+        if (static_cast<int>(i) == ctx.stream_index) {
+            ctx.out_stream = avformat_new_stream(ctx.output, nullptr);
+            if (!ctx.out_stream) {
+                return {false, 0, 0.0, 0.0, "Failed to create output stream"};
+            }
+            ctx.stream_map[i] = ctx.out_stream->index;
+            continue;
+        }
+        if (type != AVMEDIA_TYPE_AUDIO && type != AVMEDIA_TYPE_SUBTITLE) {
+            continue;
+        }
+        
+        AVStream* out = avformat_new_stream(ctx.output, nullptr);
+        if (!out || avcodec_parameters_copy(out->codecpar, stream->codecpar) < 0) {
+            return {false, 0, 0.0, 0.0, "Failed to create output stream"};
+        }
+        out->codecpar->codec_tag = 0;
+        out->time_base = stream->time_base;
+        ctx.stream_map[i] = out->index;
+    }
+    
+    ctx.out_stream->time_base = ctx.time_base;
+    ctx.out_stream->avg_frame_rate = frame_rate;
+    AVCodecParameters* par = ctx.out_stream->codecpar;
+    par->codec_type = AVMEDIA_TYPE_VIDEO;
+    par->codec_id = AV_CODEC_ID_H264;
+    par->width = width;
+    par->height = height;
+    par->format = AV_PIX_FMT_YUV420P;
+    
+    if (ctx.global_header) {
+        x264_nal_t* nals;
+        int nal_count;
+        x264_encoder_headers(ctx.x264, &nals, &nal_count);
+        
+        // SPS and PPS only; the muxer converts them to avcC as needed
+        int size = 0;
+        for (int i = 0; i < nal_count; ++i) {
+            if (nals[i].i_type == NAL_SPS || nals[i].i_type == NAL_PPS) {
+                size += nals[i].i_payload;
+            }
+        }
+        par->extradata = static_cast<uint8_t*>(av_mallocz(size + AV_INPUT_BUFFER_PADDING_SIZE));
+        for (int i = 0; i < nal_count; ++i) {
+            if (nals[i].i_type == NAL_SPS || nals[i].i_type == NAL_PPS) {
+                memcpy(par->extradata + par->extradata_size, nals[i].p_payload, nals[i].i_payload);
+                par->extradata_size += nals[i].i_payload;
+            }
+        }
+    }
+    
+    if (!(ctx.output->oformat->flags & AVFMT_NOFILE)) {
+        if ((ret = avio_open(&ctx.output->pb, config_.output_path.c_str(), AVIO_FLAG_WRITE)) < 0) {
+            return {false, 0, 0.0, 0.0, "Failed to open output: " + avError(ret)};
+        }
+    }
+    
+    // Segmenting muxers: one segment per GOP, every segment kept in the list
+    AVDictionary* mux_options = nullptr;
+    std::string format_name = ctx.output->oformat->name ? ctx.output->oformat->name : "";
+    if (gop_frames > 0 && format_name == "hls") {
+        av_dict_set(&mux_options, "hls_time", std::to_string(config_.segment_duration).c_str(), 0);
+        av_dict_set(&mux_options, "hls_list_size", "0", 0);
+        av_dict_set(&mux_options, "hls_playlist_type", "vod", 0);
+    }
+    else if (gop_frames > 0 && format_name == "dash") {
+        av_dict_set(&mux_options, "seg_duration", std::to_string(config_.segment_duration).c_str(), 0);
+        av_dict_set(&mux_options, "use_template", "0", 0);
+        av_dict_set(&mux_options, "use_timeline", "0", 0);
+    }
+    ret = avformat_write_header(ctx.output, &mux_options);
+    av_dict_free(&mux_options);
+    if (ret < 0) {
+        return {false, 0, 0.0, 0.0, "Failed to write output header: " + avError(ret)};
+    }
+    
+    for (auto& item : ctx.items) {
+        ctx.free_items.tryPush(&item);
+    }
+    
+    if (config_.verbose) {
+        std::cout << "Pipeline: " << width << "x" << height << " @ " << av_q2d(frame_rate) 
+                  << "fps, " << depth << " frames in flight" << std::endl;
+    }
+    
+    // Run the three stages concurrently
+    std::thread decode_thread(&EncodePipeline::decodeStage, this, std::ref(ctx));
+    std::thread embed_thread(&EncodePipeline::embedStage, this, std::ref(ctx));
+    std::thread encode_thread(&EncodePipeline::encodeStage, this, std::ref(ctx));
+    
+    decode_thread.join();
+    embed_thread.join();
+    encode_thread.join();
+    
+    if (ctx.error.empty()) {
+        av_write_trailer(ctx.output);
+    }
+    
+    auto end_time = std::chrono::steady_clock::now();
+    frames_processed_ = ctx.frames_encoded;
+    processing_time_ = std::chrono::duration<double, std::milli>(end_time - start_time).count();
+    encoder_stats_ = ctx.watermark->getStats();
+    
+    double fps = processing_time_ > 0.0 ? frames_processed_ * 1000.0 / processing_time_ : 0.0;
+    return {ctx.error.empty(), frames_processed_, processing_time_, fps, ctx.error};
+}
+
+std::string EncodePipeline::getStats() const {
+    std::ostringstream oss;
+    oss << "EncodePipeline Stats:\n"
+        << "  Frames processed: " << frames_processed_ << "\n"
+        << "  Processing time: " << processing_time_ << " ms\n"
+        << "  Throughput: " 
+        << (processing_time_ > 0.0 ? frames_processed_ * 1000.0 / processing_time_ : 0.0) 
+        << " fps\n"
+        << encoder_stats_;
+    
+    return oss.str();
+}
+
+void EncodePipeline::decodeStage(Context& ctx) {
+    AVPacket* packet = av_packet_alloc();
+    AVFrame* frame = av_frame_alloc();
+    uint32_t frame_index = 0;
+    int64_t last_pts = AV_NOPTS_VALUE;
+    bool draining = false;
+    
+    while (!ctx.abort.load() && !draining) {
+        int ret = av_read_frame(ctx.input, packet);
+        if (ret < 0) {
+            // End of input: flush the decoder
+            draining = true;
+            ret = avcodec_send_packet(ctx.decoder, nullptr);
+        } else if (packet->stream_index != ctx.stream_index) {
+            // Audio and subtitles are copied straight to the muxer
+            int out_index = ctx.stream_map[packet->stream_index];
+            if (out_index >= 0) {
+                av_packet_rescale_ts(packet, ctx.input->streams[packet->stream_index]->time_base,
+                                     ctx.output->streams[out_index]->time_base);
+                packet->stream_index = out_index;
+                packet->pos = -1;
+                std::lock_guard<std::mutex> lock(ctx.output_mutex);
+                if ((ret = av_interleaved_write_frame(ctx.output, packet)) < 0) {
+                    fail(ctx, "Failed to write packet: " + avError(ret));
+                }
+            }
+            av_packet_unref(packet);
+            continue;
+        } else {
+            ret = avcodec_send_packet(ctx.decoder, packet);
+            av_packet_unref(packet);
+        }
+        
+        // Corrupt packets are skipped rather than aborting the whole file
+        if (ret < 0 && ret != AVERROR(EAGAIN) && ret != AVERROR_EOF && config_.verbose) {
+            std::cerr << "Decode error: " << avError(ret) << std::endl;
+        }
+        
+        while ((ret = avcodec_receive_frame(ctx.decoder, frame)) >= 0) {
+            // x264 needs strictly increasing timestamps
+            int64_t pts = frame->best_effort_timestamp;
+            if (pts == AV_NOPTS_VALUE || (last_pts != AV_NOPTS_VALUE && pts <= last_pts)) {
+                pts = last_pts == AV_NOPTS_VALUE ? 0 : last_pts + 1;
+            }
+            last_pts = pts;
+            
+            FrameItem* item = nullptr;
+            if (!ctx.free_items.pop(item, ctx.abort)) {
+                break;
+            }
+            
+            if (isI420(frame->format) && frame->width == ctx.decoder->width && 
+                frame->height == ctx.decoder->height) {
+                av_frame_move_ref(item->decoded, frame);
+                item->picture = item->decoded;
+            } else {
+                // Convert once into the item's own I420 buffer
+                AVFrame* converted = item->converted;
+                if (!converted->data[0]) {
+                    converted->format = AV_PIX_FMT_YUV420P;
+                    converted->width = ctx.decoder->width;
+                    converted->height = ctx.decoder->height;
+                    if (av_frame_get_buffer(converted, 0) < 0) {
+                        fail(ctx, "Failed to allocate conversion buffer");
+                        break;
+                    }
+                }
+                ctx.scaler = sws_getCachedContext(ctx.scaler, frame->width, frame->height,
+                                                  static_cast<AVPixelFormat>(frame->format),
+                                                  converted->width, converted->height,
+                                                  AV_PIX_FMT_YUV420P, SWS_BILINEAR,
+                                                  nullptr, nullptr, nullptr);
+                if (!ctx.scaler) {
+                    fail(ctx, "Unsupported input pixel format");
+                    break;
+                }
+                sws_scale(ctx.scaler, frame->data, frame->linesize, 0, frame->height,
+                          converted->data, converted->linesize);
+                item->picture = converted;
+            }
+            
+            av_frame_unref(frame);
+            
+            item->pts = pts;
+            item->frame_index = frame_index++;
+            if (!ctx.decoded.push(item, ctx.abort)) {
+                break;
+            }
+        }
+        
+        if (ret != AVERROR(EAGAIN) && ret != AVERROR_EOF && ret < 0) {
+            fail(ctx, "Decoding failed: " + avError(ret));
+        }
+    }
+    
+    ctx.decoded.push(nullptr, ctx.abort);
+    
+    av_frame_free(&frame);
+    av_packet_free(&packet);
+}
+
+void EncodePipeline::embedStage(Context& ctx) {
+    FrameItem* item = nullptr;
+    
+    while (ctx.decoded.pop(item, ctx.abort)) {
+        if (item) {
+            // Texture and cuts are measured on the picture x264 will encode
+            if (ctx.watermark->needsAnalysis()) {
+                const AVFrame* picture = item->picture;
+                PlanarFrame frame{PixelFormat::I420, 
+                                  {picture->data[0], picture->data[1], picture->data[2]},
+                                  {static_cast<size_t>(picture->linesize[0]),
+                                   static_cast<size_t>(picture->linesize[1]),
+                                   static_cast<size_t>(picture->linesize[2])},
+                                  static_cast<uint32_t>(picture->width),
+                                  static_cast<uint32_t>(picture->height)};
+                ctx.watermark->analyzeFrame(frame, item->frame_index);
+            }
+            
+            const QuantOffsetPlane& plane = ctx.planes->fill(*ctx.watermark, item->frame_index);
+            item->quant_offsets = plane.offsets;
+        }
+        
+        if (!ctx.embedded.push(item, ctx.abort) || !item) {
+            break;
+        }
+    }
+}
+
+void EncodePipeline::encodeStage(Context& ctx) {
+    x264_picture_t picture;
+    x264_picture_t picture_out;
+    x264_nal_t* nals = nullptr;
+    int nal_count = 0;
+    
+    // Packets point straight at x264's output; the interleaver copies
+    // what it has to hold back for the copied streams
+    AVPacket* packet = av_packet_alloc();
+    
+    auto writeOutput = [&](int frame_size) {
+        if (frame_size <= 0) {
+            return frame_size == 0;
+        }
+        packet->data = nals[0].p_payload;
+        packet->size = frame_size;
+        packet->stream_index = ctx.out_stream->index;
+        packet->pts = picture_out.i_pts;
+        packet->dts = picture_out.i_dts;
+        packet->flags = picture_out.b_keyframe ? AV_PKT_FLAG_KEY : 0;
+        av_packet_rescale_ts(packet, ctx.time_base, ctx.out_stream->time_base);
+        
+        std::lock_guard<std::mutex> lock(ctx.output_mutex);
+        int ret = av_interleaved_write_frame(ctx.output, packet);
+        if (ret < 0) {
+            fail(ctx, "Failed to write packet: " + avError(ret));
+            return false;
+        }
+        ctx.frames_encoded++;
+        return true;
+    };
+    
+    FrameItem* item = nullptr;
+    while (ctx.embedded.pop(item, ctx.abort) && item) {
+        x264_picture_init(&picture);
+        picture.img.i_csp = X264_CSP_I420;
+        picture.img.i_plane = 3;
+        for (int p = 0; p < 3; ++p) {
+            picture.img.plane[p] = item->picture->data[p];
+            picture.img.i_stride[p] = item->picture->linesize[p];
+        }
+        picture.i_pts = item->pts;
+        picture.prop.quant_offsets = const_cast<float*>(item->quant_offsets);
+        
+        int frame_size = x264_encoder_encode(ctx.x264, &nals, &nal_count, &picture, &picture_out);
+        
+        // x264 copied the picture and consumed the offsets: recycle now
+        av_frame_unref(item->decoded);
+        ctx.free_items.push(item, ctx.abort);
+        
+        if (frame_size < 0) {
+            fail(ctx, "x264 encoding failed");
+        }
+        if (!writeOutput(frame_size)) {
+            break;
+        }
+    }
+    
+    // Drain frames delayed by lookahead and B-frames
+    while (!ctx.abort.load() && x264_encoder_delayed_frames(ctx.x264) > 0) {
+        int frame_size = x264_encoder_encode(ctx.x264, &nals, &nal_count, nullptr, &picture_out);
+        if (frame_size < 0) {
+            fail(ctx, "x264 flush failed");
+        }
+        if (!writeOutput(frame_size)) {
+            break;
+        }
+    }
+    
+    packet->data = nullptr;
+    packet->size = 0;
+    av_packet_free(&packet);
+}
+
+void EncodePipeline::fail(Context& ctx, const std::string& message) {
+    {
+        std::lock_guard<std::mutex> lock(ctx.error_mutex);
+        if (ctx.error.empty()) {
+            ctx.error = message;
+        }
+    }
+    ctx.abort.store(true);
+    
+    // Stages asleep on a queue recheck the flag
+    ctx.free_items.wake();
+    ctx.decoded.wake();
+    ctx.embedded.wake();
+}
+
+} // namespace phantomframe
@@ -0,0 +1,108 @@
+#ifndef PHANTOMFRAME_ENCODE_PIPELINE_H
+#define PHANTOMFRAME_ENCODE_PIPELINE_H
+
+#include <cstdint>
+#include <string>
+#include "encoder/watermark_encoder.h"
+
+namespace phantomframe {
+
+/**
+ * @brief Configuration for file-to-file watermark encoding
+ */
+struct PipelineConfig {
+    std::string input_path;     // Any input libavformat can demux
+    std::string output_path;    // Output container, chosen from the extension
+    WatermarkConfig watermark;  // Watermark parameters
+    uint32_t queue_depth;       // Frames buffered between pipeline stages
+    std::string preset;         // x264 preset (e.g. "medium")
+    float crf;                  // x264 constant rate factor
+    int encoder_threads;        // x264 threads, 0 for automatic
+    float segment_duration;     // Fixed GOP and HLS/DASH segment length in seconds, 0 for x264's choice
+    uint32_t embed_threads;     // Slice workers for the watermark map, 0 or 1 for none
+    bool huge_pages;            // Back the pipeline's buffer pool with transparent huge pages
+    bool verbose;               // Print progress
+};
+
+/**
+ * @brief Outcome of a pipeline run
+ */
+struct PipelineResult {
+    bool success;               // Whether the output was written
+    uint64_t frames_processed;  // Frames encoded
+    double processing_time;     // Wall-clock time in milliseconds
+    double fps;                 // Encoded frames per second
+    std::string error_message;  // Error message if encoding failed
+};
+
+/**
+ * @brief Decode, watermark and re-encode a video file
+ *
+ * Decoding (libavformat/libavcodec), watermark map generation
+ * (WatermarkEncoder) and encoding (libx264) run on separate threads joined
+ * by bounded lock-free queues, on which a stage sleeps once it has briefly
+ * waited for a slower neighbour. The watermark is handed to x264 as
+ * quant_offsets, so pixels are never modified or copied by the watermark
+ * stage. The best video stream is encoded; audio and subtitle streams are
+ * copied unchanged and interleaved with it, other streams are dropped.
+ *
+ * With segment_duration set, every GOP is closed and exactly that long,
+ * with no scene-cut IDRs, so two runs over the same input with different
+ * payloads cut at identical frames. An output ending in .m3u8 or .mpd is
+ * then written as a VOD HLS playlist or a DASH SegmentList MPD with one
+ * segment per GOP, ready for ManifestPackager.
+ */
+class EncodePipeline {
+public:
+    explicit EncodePipeline(const PipelineConfig& config);
+    ~EncodePipeline();
+
+    /**
+     * @brief Run the pipeline to completion
+     * @return Pipeline result
+     */
+    PipelineResult run();
+
+    /**
+     * @brief Get statistics of the last run
+     * @return Statistics string
+     */
+    std::string getStats() const;
+
+private:
+    struct Context;
+
+    PipelineConfig config_;
+    std::string encoder_stats_;
+    uint64_t frames_processed_;
+    double processing_time_;
+
+    /**
+     * @brief Demux and decode the input, feeding the embed stage
+     * @param ctx Shared pipeline state
+     */
+    void decodeStage(Context& ctx);
+
+    /**
+     * @brief Compute the watermark QP map for every decoded frame
+     * @param ctx Shared pipeline state
+     */
+    void embedStage(Context& ctx);
+
+    /**
+     * @brief Encode watermarked frames with x264 and mux the output
+     * @param ctx Shared pipeline state
+     */
+    void encodeStage(Context& ctx);
+
+    /**
+     * @brief Record the first error and stop all stages
+     * @param ctx Shared pipeline state
+     * @param message Error message
+     */
+    void fail(Context& ctx, const std::string& message);
+};
+
+} // namespace phantomframe
+
+#endif // PHANTOMFRAME_ENCODE_PIPELINE_H
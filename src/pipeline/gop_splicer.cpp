@@ -0,0 +1,581 @@
+#include "gop_splicer.h"
+#include "bitstream/h264_splice.h"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <sstream>
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+#include <libavformat/avformat.h>
+#include <libswscale/swscale.h>
+#include <x264.h>
+}
+
+namespace phantomframe {
+
+namespace {
+
+bool isI420(int format) {
+    return format == AV_PIX_FMT_YUV420P || format == AV_PIX_FMT_YUVJ420P;
+}
+
+std::string avError(int errnum) {
+    char buffer[AV_ERROR_MAX_STRING_SIZE] = {0};
+    av_strerror(errnum, buffer, sizeof(buffer));
+    return buffer;
+}
+
+// x264 profile matching the source's profile_idc, so both SPSs agree
+const char* profileName(uint32_t profile_idc) {
+    switch (profile_idc) {
+        case 66: return "baseline";
+        case 77: return "main";
+        default: return "high";
+    }
+}
+
+} // namespace
+
+/**
+ * @brief One re-encoded frame, in the packet framing of the source
+ */
+struct GopSplicer::EncodedFrame {
+    std::vector<uint8_t> data;  // Access unit, Annex B or length-prefixed
+    int64_t pts;                // Presentation timestamp in input time base
+    bool keyframe;              // IDR picture
+};
+
+struct GopSplicer::Context {
+    Context()
+        : input(nullptr), decoder(nullptr), stream_index(-1), length_size(0),
+          scaler(nullptr), converted(av_frame_alloc()), decoded(av_frame_alloc()),
+          mb_width(0), mb_height(0), x264(nullptr), output(nullptr), gop_starts_idr(false),
+          gop_first_frame(0), gop_number(0), pictures(0) {
+    }
+    
+    ~Context() {
+        for (AVPacket*& packet : gop) {
+            av_packet_free(&packet);
+        }
+        if (x264) {
+            x264_encoder_close(x264);
+        }
+        if (output) {
+            if (!(output->oformat->flags & AVFMT_NOFILE)) {
+                avio_closep(&output->pb);
+            }
+            avformat_free_context(output);
+        }
+        av_frame_free(&decoded);
+        av_frame_free(&converted);
+        sws_freeContext(scaler);
+        avcodec_free_context(&decoder);
+        avformat_close_input(&input);
+    }
+
+    // Input side
+    AVFormatContext* input;
+    AVCodecContext* decoder;
+    int stream_index;
+    AVRational time_base;
+    uint32_t length_size;           // NAL length field size of packets, 0 for Annex B
+    SwsContext* scaler;
+    AVFrame* converted;
+    AVFrame* decoded;
+
+    // Watermark
+    std::unique_ptr<WatermarkEncoder> watermark;
+    std::vector<float> offsets;
+    uint32_t mb_width;
+    uint32_t mb_height;
+
+    // Re-encoding; x264 is opened per GOP so each one ends fully flushed
+    x264_param_t param;
+    x264_t* x264;
+
+    // Output side
+    AVFormatContext* output;
+    std::vector<int> stream_map;    // Output stream of each input stream, -1 if dropped
+
+    // GOP being collected, in decode order
+    std::vector<AVPacket*> gop;
+    bool gop_starts_idr;
+    uint32_t gop_first_frame;       // Display index of the GOP's first frame
+    uint64_t gop_number;
+    std::vector<int64_t> gop_pts;   // Source timestamps in display order
+    uint32_t pictures;              // Pictures of the GOP handed to x264
+};
+
+GopSplicer::GopSplicer(const SpliceConfig& config)
+    : config_(config), result_{false, 0, 0, 0, 0, 0.0, ""}, gops_failed_(0) {
+    // Unmarked GOPs are never decoded, so cuts in them would go unseen,
+    // and a deadline would change the marks of a re-encode
+    config_.watermark.scene_cut_threshold = 0.0f;
+    config_.watermark.frame_budget_us = 0;
+}
+
+GopSplicer::~GopSplicer() = default;
+
+SpliceResult GopSplicer::run() {
+    auto start_time = std::chrono::steady_clock::now();
+    result_ = {false, 0, 0, 0, 0, 0.0, ""};
+    gops_failed_ = 0;
+    Context ctx;
+    
+    auto failure = [this](const std::string& message) {
+        result_.error_message = message;
+        return result_;
+    };
+    
+    // Open input and decoder
+    int ret = avformat_open_input(&ctx.input, config_.input_path.c_str(), nullptr, nullptr);
+    if (ret < 0) {
+        return failure("Failed to open input: " + avError(ret));
+    }
+    if ((ret = avformat_find_stream_info(ctx.input, nullptr)) < 0) {
+        return failure("Failed to read stream info: " + avError(ret));
+    }
+    
+    const AVCodec* codec = nullptr;
+    ctx.stream_index = av_find_best_stream(ctx.input, AVMEDIA_TYPE_VIDEO, -1, -1, &codec, 0);
+    if (ctx.stream_index < 0 || !codec) {
+        return failure("No decodable video stream in " + config_.input_path);
+    }
+    
+    AVStream* in_stream = ctx.input->streams[ctx.stream_index];
+    if (in_stream->codecpar->codec_id != AV_CODEC_ID_H264) {
+        return failure("GOP splicing needs H.264 video, " + config_.input_path + " has " +
+                       avcodec_get_name(in_stream->codecpar->codec_id));
+    }
+    ctx.time_base = in_stream->time_base;
+    
+    const uint8_t* extradata = in_stream->codecpar->extradata;
+    size_t extradata_size = static_cast<size_t>(in_stream->codecpar->extradata_size);
+    ctx.length_size = nalLengthSize(extradata, extradata_size);
+    
+    ParameterSets source_sets;
+    if (!readParameterSets(extradata, extradata_size, source_sets)) {
+        return failure("Malformed H.264 extradata in " + config_.input_path);
+    }
+    int parameter_set_id = unusedParameterSetId(source_sets);
+    if (parameter_set_id < 0) {
+        return failure("The input uses every SPS id; none is left for re-encoded GOPs");
+    }
+    
+    ctx.decoder = avcodec_alloc_context3(codec);
+    avcodec_parameters_to_context(ctx.decoder, in_stream->codecpar);
+    ctx.decoder->thread_count = 0;
+    ctx.decoder->thread_type = FF_THREAD_FRAME | FF_THREAD_SLICE;
+    if ((ret = avcodec_open2(ctx.decoder, codec, nullptr)) < 0) {
+        return failure("Failed to open decoder: " + avError(ret));
+    }
+    
+    const int width = ctx.decoder->width;
+    const int height = ctx.decoder->height;
+    AVRational frame_rate = av_guess_frame_rate(ctx.input, in_stream, nullptr);
+    if (frame_rate.num <= 0 || frame_rate.den <= 0) {
+        frame_rate = {25, 1};
+    }
+    
+    // Watermark
+    ctx.watermark = std::make_unique<WatermarkEncoder>(config_.watermark);
+    if (!ctx.watermark->initialize(width, height, static_cast<float>(av_q2d(frame_rate)))) {
+        return failure("Failed to initialize watermark encoder");
+    }
+    ctx.mb_width = static_cast<uint32_t>(width + 15) / 16;
+    ctx.mb_height = static_cast<uint32_t>(height + 15) / 16;
+    ctx.offsets.resize(static_cast<size_t>(ctx.mb_width) * ctx.mb_height);
+    
+    // x264 settings shared by every re-encoded GOP
+    x264_param_t& param = ctx.param;
+    const char* preset = config_.preset.empty() ? "medium" : config_.preset.c_str();
+    if (x264_param_default_preset(&param, preset, nullptr) < 0) {
+        return failure("Unknown x264 preset: " + config_.preset);
+    }
+    param.i_width = width;
+    param.i_height = height;
+    param.i_csp = X264_CSP_I420;
+    param.i_threads = config_.encoder_threads > 0 ? config_.encoder_threads : X264_THREADS_AUTO;
+    param.i_log_level = X264_LOG_WARNING;
+    param.b_vfr_input = 1;
+    param.i_timebase_num = ctx.time_base.num;
+    param.i_timebase_den = ctx.time_base.den;
+    param.i_fps_num = frame_rate.num;
+    param.i_fps_den = frame_rate.den;
+    param.vui.i_sar_width = ctx.decoder->sample_aspect_ratio.num;
+    param.vui.i_sar_height = ctx.decoder->sample_aspect_ratio.den;
+    param.vui.b_fullrange = ctx.decoder->color_range == AVCOL_RANGE_JPEG;
+    param.rc.i_rc_method = X264_RC_CRF;
+    param.rc.f_rf_constant = config_.crf > 0.0f ? config_.crf : 23.0f;
+    if (param.rc.i_aq_mode == X264_AQ_NONE) {
+        param.rc.i_aq_mode = X264_AQ_VARIANCE;
+        param.rc.f_aq_strength = 0.0f;
+    }
+    // One IDR opening the GOP, then P pictures in display order: decode
+    // times can then be taken from the source GOP
+    param.i_bframe = 0;
+    param.i_keyint_max = X264_KEYINT_MAX_INFINITE;
+    param.i_scenecut_threshold = 0;
+    param.b_annexb = 1;
+    param.b_repeat_headers = 1;
+    param.i_sps_id = parameter_set_id;
+    
+    uint32_t profile_idc = 100;
+    if (!source_sets.sps.empty() && source_sets.sps[0].size() >= 4) {
+        profile_idc = source_sets.sps[0][1];
+        param.i_level_idc = source_sets.sps[0][3];
+    }
+    if (x264_param_apply_profile(&param, profileName(profile_idc)) < 0) {
+        return failure("x264 cannot encode the input's profile");
+    }
+    
+    // The re-encode's parameter sets join the source's in the extradata
+    ParameterSets x264_sets;
+    {
+        x264_t* probe = x264_encoder_open(&param);
+        if (!probe) {
+            return failure("Failed to open x264 encoder");
+        }
+        x264_nal_t* nals;
+        int nal_count;
+        int size = x264_encoder_headers(probe, &nals, &nal_count);
+        
+        // The header NALs are contiguous Annex B; the SEI is left out
+        if (size > 0) {
+            readParameterSets(nals[0].p_payload, static_cast<size_t>(size), x264_sets);
+        }
+        x264_encoder_close(probe);
+    }
+    
+    // Open output container; the video and any audio or subtitles are copied
+    avformat_alloc_output_context2(&ctx.output, nullptr, nullptr, config_.output_path.c_str());
+    if (!ctx.output) {
+        return failure("Unsupported output format: " + config_.output_path);
+    }
+    
+    ctx.stream_map.assign(ctx.input->nb_streams, -1);
+    for (unsigned i = 0; i < ctx.input->nb_streams; ++i) {
+        AVStream* stream = ctx.input->streams[i];
+        AVMediaType type = stream->codecpar->codec_type;
+        if (static_cast<int>(i) != ctx.stream_index && type != AVMEDIA_TYPE_AUDIO &&
+            type != AVMEDIA_TYPE_SUBTITLE) {
+            continue;
+        }
+        
+        AVStream* out = avformat_new_stream(ctx.output, nullptr);
+        if (!out || avcodec_parameters_copy(out->codecpar, stream->codecpar) < 0) {
+            return failure("Failed to create output stream");
+        }
+        out->codecpar->codec_tag = 0;
+        out->time_base = stream->time_base;
+        ctx.stream_map[i] = out->index;
+        
+        if (static_cast<int>(i) == ctx.stream_index) {
+            out->avg_frame_rate = frame_rate;
+            std::vector<uint8_t> merged;
+            if (!appendParameterSets(extradata, extradata_size, x264_sets, merged)) {
+                return failure("Cannot add parameter sets to the input's extradata");
+            }
+            av_freep(&out->codecpar->extradata);
+            out->codecpar->extradata = static_cast<uint8_t*>(
+                av_mallocz(merged.size() + AV_INPUT_BUFFER_PADDING_SIZE));
+            memcpy(out->codecpar->extradata, merged.data(), merged.size());
+            out->codecpar->extradata_size = static_cast<int>(merged.size());
+        }
+    }
+    
+    if (!(ctx.output->oformat->flags & AVFMT_NOFILE)) {
+        if ((ret = avio_open(&ctx.output->pb, config_.output_path.c_str(), AVIO_FLAG_WRITE)) < 0) {
+            return failure("Failed to open output: " + avError(ret));
+        }
+    }
+    if ((ret = avformat_write_header(ctx.output, nullptr)) < 0) {
+        return failure("Failed to write output header: " + avError(ret));
+    }
+    
+    if (config_.verbose) {
+        std::cout << "Splice: " << width << "x" << height << " @ " << av_q2d(frame_rate)
+                  << "fps, " << profileName(profile_idc) << " profile, re-encoded GOPs use SPS id "
+                  << parameter_set_id << std::endl;
+    }
+    
+    // Collect each GOP until the next IDR picture closes it
+    AVPacket* packet = av_packet_alloc();
+    bool ok = true;
+    while (ok && (ret = av_read_frame(ctx.input, packet)) >= 0) {
+        int out_index = ctx.stream_map[packet->stream_index];
+        if (out_index < 0) {
+            av_packet_unref(packet);
+            continue;
+        }
+        
+        if (packet->stream_index != ctx.stream_index) {
+            av_packet_rescale_ts(packet, ctx.input->streams[packet->stream_index]->time_base,
+                                 ctx.output->streams[out_index]->time_base);
+            packet->stream_index = out_index;
+            packet->pos = -1;
+            if ((ret = av_interleaved_write_frame(ctx.output, packet)) < 0) {
+                result_.error_message = "Failed to write packet: " + avError(ret);
+                ok = false;
+            }
+            continue;
+        }
+        
+        bool idr = isIdrAccessUnit(packet->data, packet->size, ctx.length_size);
+        if (idr && !ctx.gop.empty()) {
+            ok = finishGop(ctx);
+        }
+        if (ctx.gop.empty()) {
+            ctx.gop_starts_idr = idr;
+        }
+        AVPacket* held = av_packet_alloc();
+        av_packet_move_ref(held, packet);
+        ctx.gop.push_back(held);
+    }
+    av_packet_free(&packet);
+    
+    if (ok && !ctx.gop.empty()) {
+        ok = finishGop(ctx);
+    }
+    if (ok && (ret = av_write_trailer(ctx.output)) < 0) {
+        result_.error_message = "Failed to write output trailer: " + avError(ret);
+        ok = false;
+    }
+    
+    auto end_time = std::chrono::steady_clock::now();
+    result_.success = ok;
+    result_.processing_time = std::chrono::duration<double, std::milli>(end_time - start_time).count();
+    encoder_stats_ = ctx.watermark->getStats();
+    
+    return result_;
+}
+
+std::string GopSplicer::getStats() const {
+    std::ostringstream oss;
+    oss << "GopSplicer Stats:\n"
+        << "  GOPs: " << result_.gops << "\n"
+        << "  GOPs re-encoded: " << result_.gops_reencoded << "\n"
+        << "  GOPs copied after a failed re-encode: " << gops_failed_ << "\n"
+        << "  Frames re-encoded: " << result_.frames_reencoded << "\n"
+        << "  Frames copied: " << result_.frames_copied << "\n"
+        << "  Processing time: " << result_.processing_time << " ms\n"
+        << encoder_stats_;
+    
+    return oss.str();
+}
+
+bool GopSplicer::finishGop(Context& ctx) {
+    uint32_t frame_count = static_cast<uint32_t>(ctx.gop.size());
+    bool marked = ctx.gop_starts_idr && ctx.watermark->carriesMarks(ctx.gop_first_frame, frame_count);
+    
+    std::vector<EncodedFrame> frames;
+    if (marked && !reencodeGop(ctx, frames)) {
+        gops_failed_++;
+        frames.clear();
+        if (config_.verbose) {
+            std::cerr << "GOP " << ctx.gop_number << " could not be re-encoded, copying it" << std::endl;
+        }
+    }
+    
+    AVStream* in_stream = ctx.input->streams[ctx.stream_index];
+    AVStream* out_stream = ctx.output->streams[ctx.stream_map[ctx.stream_index]];
+    bool ok = true;
+    
+    if (!frames.empty()) {
+        // Decode times come from the source GOP; with no reordering in the
+        // re-encode, the i-th decoded frame has the i-th smallest timestamp
+        // and no valid source decodes its i-th frame later than that
+        for (size_t i = 0; i < frames.size() && ok; ++i) {
+            AVPacket* out = av_packet_alloc();
+            if (!out || av_new_packet(out, static_cast<int>(frames[i].data.size())) < 0) {
+                av_packet_free(&out);
+                result_.error_message = "Out of memory";
+                return false;
+            }
+            memcpy(out->data, frames[i].data.data(), frames[i].data.size());
+            int64_t dts = ctx.gop[i]->dts;
+            out->pts = frames[i].pts;
+            out->dts = dts == AV_NOPTS_VALUE ? frames[i].pts : std::min(dts, frames[i].pts);
+            out->duration = ctx.gop[i]->duration;
+            out->flags = frames[i].keyframe ? AV_PKT_FLAG_KEY : 0;
+            out->stream_index = out_stream->index;
+            av_packet_rescale_ts(out, in_stream->time_base, out_stream->time_base);
+            
+            int ret = av_interleaved_write_frame(ctx.output, out);
+            if (ret < 0) {
+                result_.error_message = "Failed to write packet: " + avError(ret);
+                ok = false;
+            }
+            av_packet_free(&out);
+        }
+        
+        result_.gops_reencoded++;
+        result_.frames_reencoded += frame_count;
+        if (config_.verbose) {
+            std::cout << "GOP " << ctx.gop_number << ": frames " << ctx.gop_first_frame << "-"
+                      << ctx.gop_first_frame + frame_count - 1 << " re-encoded" << std::endl;
+        }
+    } else {
+        for (AVPacket* packet : ctx.gop) {
+            if (!ok) {
+                break;
+            }
+            av_packet_rescale_ts(packet, in_stream->time_base, out_stream->time_base);
+            packet->stream_index = out_stream->index;
+            packet->pos = -1;
+            int ret = av_interleaved_write_frame(ctx.output, packet);
+            if (ret < 0) {
+                result_.error_message = "Failed to write packet: " + avError(ret);
+                ok = false;
+            }
+        }
+        result_.frames_copied += frame_count;
+    }
+    
+    for (AVPacket*& packet : ctx.gop) {
+        av_packet_free(&packet);
+    }
+    ctx.gop.clear();
+    
+    // Closed GOPs occupy consecutive display ranges
+    result_.gops++;
+    ctx.gop_number++;
+    ctx.gop_first_frame += frame_count;
+    return ok;
+}
+
+bool GopSplicer::reencodeGop(Context& ctx, std::vector<EncodedFrame>& frames) {
+    // Pictures take the source's timestamps, sorted into display order
+    ctx.gop_pts.clear();
+    for (const AVPacket* packet : ctx.gop) {
+        if (packet->pts == AV_NOPTS_VALUE) {
+            return false;
+        }
+        ctx.gop_pts.push_back(packet->pts);
+    }
+    std::sort(ctx.gop_pts.begin(), ctx.gop_pts.end());
+    ctx.pictures = 0;
+    
+    ctx.x264 = x264_encoder_open(&ctx.param);
+    if (!ctx.x264) {
+        return false;
+    }
+    
+    // The decoder was drained at the end of the previous marked GOP
+    avcodec_flush_buffers(ctx.decoder);
+    bool ok = true;
+    for (size_t i = 0; i <= ctx.gop.size() && ok; ++i) {
+        int ret = avcodec_send_packet(ctx.decoder, i < ctx.gop.size() ? ctx.gop[i] : nullptr);
+        if (ret < 0 && ret != AVERROR(EAGAIN) && ret != AVERROR_EOF) {
+            ok = false;
+            break;
+        }
+        while (ok && (ret = avcodec_receive_frame(ctx.decoder, ctx.decoded)) >= 0) {
+            ok = encodePicture(ctx, ctx.decoded, frames);
+            av_frame_unref(ctx.decoded);
+        }
+    }
+    ok = ok && encodePicture(ctx, nullptr, frames);
+    
+    x264_encoder_close(ctx.x264);
+    ctx.x264 = nullptr;
+    return ok && frames.size() == ctx.gop.size() && ctx.pictures == ctx.gop.size();
+}
+
+bool GopSplicer::encodePicture(Context& ctx, const AVFrame* picture,
+                               std::vector<EncodedFrame>& frames) {
+    x264_picture_t picture_in;
+    x264_picture_t picture_out;
+    x264_nal_t* nals = nullptr;
+    int nal_count = 0;
+    
+    auto store = [&](int frame_size) {
+        if (frame_size <= 0) {
+            return frame_size == 0;
+        }
+        EncodedFrame frame;
+        frame.pts = picture_out.i_pts;
+        frame.keyframe = picture_out.b_keyframe != 0;
+        if (ctx.length_size == 0) {
+            frame.data.assign(nals[0].p_payload, nals[0].p_payload + frame_size);
+        } else if (!annexBToLengthPrefixed(nals[0].p_payload, frame_size, ctx.length_size, frame.data)) {
+            return false;
+        }
+        frames.push_back(std::move(frame));
+        return true;
+    };
+    
+    if (!picture) {
+        while (x264_encoder_delayed_frames(ctx.x264) > 0) {
+            if (!store(x264_encoder_encode(ctx.x264, &nals, &nal_count, nullptr, &picture_out))) {
+                return false;
+            }
+        }
+        return true;
+    }
+    
+    // A GOP decoding to more pictures than it has packets is not spliced
+    if (ctx.pictures >= ctx.gop_pts.size()) {
+        return false;
+    }
+    
+    const AVFrame* source = picture;
+    if (!isI420(picture->format) || picture->width != ctx.decoder->width ||
+        picture->height != ctx.decoder->height) {
+        AVFrame* converted = ctx.converted;
+        if (!converted->data[0]) {
+            converted->format = AV_PIX_FMT_YUV420P;
+            converted->width = ctx.decoder->width;
+            converted->height = ctx.decoder->height;
+            if (av_frame_get_buffer(converted, 0) < 0) {
+                return false;
+            }
+        }
+        ctx.scaler = sws_getCachedContext(ctx.scaler, picture->width, picture->height,
+                                          static_cast<AVPixelFormat>(picture->format),
+                                          converted->width, converted->height,
+                                          AV_PIX_FMT_YUV420P, SWS_BILINEAR,
+                                          nullptr, nullptr, nullptr);
+        if (!ctx.scaler) {
+            return false;
+        }
+        sws_scale(ctx.scaler, picture->data, picture->linesize, 0, picture->height,
+                  converted->data, converted->linesize);
+        source = converted;
+    }
+    
+    uint32_t frame_index = ctx.gop_first_frame + ctx.pictures;
+    if (ctx.watermark->needsAnalysis()) {
+        PlanarFrame frame{PixelFormat::I420,
+                          {source->data[0], source->data[1], source->data[2]},
+                          {static_cast<size_t>(source->linesize[0]),
+                           static_cast<size_t>(source->linesize[1]),
+                           static_cast<size_t>(source->linesize[2])},
+                          static_cast<uint32_t>(source->width),
+                          static_cast<uint32_t>(source->height)};
+        ctx.watermark->analyzeFrame(frame, frame_index);
+    }
+    
+    // x264 applies the offsets before encode() returns, so one plane serves
+    // every picture
+    ctx.watermark->renderQuantOffsets(frame_index,
+                                      QuantOffsetPlane{ctx.offsets.data(), ctx.mb_width, ctx.mb_height});
+    
+    x264_picture_init(&picture_in);
+    picture_in.img.i_csp = X264_CSP_I420;
+    picture_in.img.i_plane = 3;
+    for (int p = 0; p < 3; ++p) {
+        picture_in.img.plane[p] = source->data[p];
+        picture_in.img.i_stride[p] = source->linesize[p];
+    }
+    picture_in.i_pts = ctx.gop_pts[ctx.pictures++];
+    picture_in.i_type = frame_index == ctx.gop_first_frame ? X264_TYPE_IDR : X264_TYPE_AUTO;
+    picture_in.prop.quant_offsets = ctx.offsets.data();
+    
+    return store(x264_encoder_encode(ctx.x264, &nals, &nal_count, &picture_in, &picture_out));
+}
+
+} // namespace phantomframe
@@ -0,0 +1,121 @@
+#ifndef PHANTOMFRAME_GOP_SPLICER_H
+#define PHANTOMFRAME_GOP_SPLICER_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "encoder/watermark_encoder.h"
+
+struct AVFrame;
+
+namespace phantomframe {
+
+/**
+ * @brief Configuration for watermarking by re-encoding selected GOPs
+ */
+struct SpliceConfig {
+    std::string input_path;         // H.264 input in any container libavformat can demux
+    std::string output_path;        // Output container, chosen from the extension
+    WatermarkConfig watermark;      // Watermark parameters
+    std::string preset;             // x264 preset for re-encoded GOPs (e.g. "medium")
+    float crf;                      // x264 constant rate factor for re-encoded GOPs
+    int encoder_threads;            // x264 threads, 0 for automatic
+    bool verbose;                   // Print one line per re-encoded GOP
+};
+
+/**
+ * @brief Outcome of a splice run
+ */
+struct SpliceResult {
+    bool success;                   // Whether the output was written
+    uint64_t gops;                  // Closed GOPs in the input
+    uint64_t gops_reencoded;        // GOPs re-encoded with the watermark
+    uint64_t frames_reencoded;      // Frames in those GOPs
+    uint64_t frames_copied;         // Frames stream-copied
+    double processing_time;         // Wall-clock time in milliseconds
+    std::string error_message;      // Error message if splicing failed
+};
+
+/**
+ * @brief Watermark a video by re-encoding only the GOPs that carry marks
+ *
+ * The input is read packet by packet and cut into closed GOPs at IDR
+ * pictures. Each GOP is looked up in the watermark schedule
+ * (WatermarkEncoder::carriesMarks()); a GOP that needs marks is decoded
+ * and encoded again with libx264, the watermark handed over as
+ * quant_offsets like EncodePipeline does, and every other GOP is copied
+ * packet for packet. Audio and subtitle streams are copied. Decoding and
+ * encoding cost is spent on marked GOPs only, so with a schedule that is
+ * sparse in time (watermark.marked_period_interval above 1) a long video
+ * is processed at little more than the cost of remuxing it. The sparsity
+ * lives in the schedule, so an extractor configured with the same
+ * interval knows which frames were left unmarked.
+ *
+ * Re-encoded GOPs keep the source's frame count, timestamps and
+ * decode-order timing. Their SPS and PPS use an id the source leaves free
+ * and are added to the output's codec extradata as well as sent in-band,
+ * so copied and re-encoded GOPs decode side by side without resetting the
+ * decoder. The re-encode uses the source's profile and level and no
+ * B-frames, which keeps every re-encoded frame's decode time at or before
+ * its presentation time.
+ *
+ * Packets before the first IDR picture, and GOPs that fail to decode to
+ * the same number of frames, are copied unmarked. Scene-cut restarts are
+ * disabled because unmarked GOPs are never decoded; frames are indexed in
+ * display order from the start of the file.
+ */
+class GopSplicer {
+public:
+    explicit GopSplicer(const SpliceConfig& config);
+    ~GopSplicer();
+
+    /**
+     * @brief Splice the input into the output
+     * @return Splice result
+     */
+    SpliceResult run();
+
+    /**
+     * @brief Get statistics of the last run
+     * @return Statistics string
+     */
+    std::string getStats() const;
+
+private:
+    struct Context;
+    struct EncodedFrame;
+
+    SpliceConfig config_;
+    SpliceResult result_;
+    uint64_t gops_failed_;
+    std::string encoder_stats_;
+
+    /**
+     * @brief Write a complete GOP, re-encoding it if it needs marks
+     * @param ctx Shared splice state
+     * @return false if writing the output failed
+     */
+    bool finishGop(Context& ctx);
+
+    /**
+     * @brief Decode a GOP and encode it with the watermark
+     * @param ctx Shared splice state
+     * @param frames Output packets in decode order
+     * @return false if the GOP must be copied instead
+     */
+    bool reencodeGop(Context& ctx, std::vector<EncodedFrame>& frames);
+
+    /**
+     * @brief Encode one decoded picture of the current GOP
+     * @param ctx Shared splice state
+     * @param picture Decoded picture, or nullptr to drain x264
+     * @param frames Output packets, appended to
+     * @return false on an encoder error
+     */
+    bool encodePicture(Context& ctx, const AVFrame* picture,
+                       std::vector<EncodedFrame>& frames);
+};
+
+} // namespace phantomframe
+
+#endif // PHANTOMFRAME_GOP_SPLICER_H
@@ -0,0 +1,57 @@
+#include <gtest/gtest.h>
+#include <vector>
+#include "common/block_activity.h"
+#include "test_helpers.h"
+
+using namespace phantomframe;
+using phantomframe::test::TestHelpers;
+
+TEST(BlockActivityTest, FlatBlocksHaveZeroActivity) {
+    std::vector<uint8_t> plane(64 * 32, 128);
+    std::vector<uint32_t> activity(8 * 4, 1);
+
+    computeBlockActivity(plane.data(), 64, 64, 32, activity.data());
+
+    for (uint32_t value : activity) {
+        EXPECT_EQ(value, 0u);
+    }
+}
+
+TEST(BlockActivityTest, MatchesDefinition) {
+    // Alternating 0/255 columns: variance 255^2 / 4
+    std::vector<uint8_t> plane(16 * 8);
+    for (size_t i = 0; i < plane.size(); ++i) {
+        plane[i] = (i % 2) ? 255 : 0;
+    }
+    std::vector<uint32_t> activity(2);
+
+    computeBlockActivity(plane.data(), 16, 16, 8, activity.data());
+
+    EXPECT_EQ(activity[0], 64u * 64u * 255u * 255u / 4u);
+    EXPECT_EQ(activity[1], activity[0]);
+}
+
+TEST(BlockActivityTest, SimdKernelsMatchScalar) {
+    // Odd sizes exercise the scalar tail and the partial edge blocks
+    const uint32_t width = 1917;
+    const uint32_t height = 1077;
+    const size_t stride = 1984;
+    auto plane = TestHelpers::generateNoise(stride * height, 7);
+
+    const size_t blocks = ((width + 7) / 8) * ((height + 7) / 8);
+    std::vector<uint32_t> expected(blocks);
+    computeBlockActivity(plane.data(), stride, width, height, expected.data(), SimdLevel::Scalar);
+
+    for (SimdLevel level : {SimdLevel::SSE2, SimdLevel::AVX2}) {
+        if (level > detectSimdLevel()) {
+            continue;
+        }
+        std::vector<uint32_t> actual(blocks, 0xFFFFFFFFu);
+        computeBlockActivity(plane.data(), stride, width, height, actual.data(), level);
+        EXPECT_EQ(actual, expected) << simdLevelName(level);
+    }
+
+    // Right and bottom partial blocks are not measured
+    EXPECT_EQ(expected[(width + 7) / 8 - 1], 0u);
+    EXPECT_EQ(expected.back(), 0u);
+}
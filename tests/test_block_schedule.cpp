@@ -0,0 +1,91 @@
+#include <gtest/gtest.h>
+#include <vector>
+#include "common/block_schedule.h"
+
+using namespace phantomframe;
+
+class BlockScheduleTest : public ::testing::Test {
+protected:
+    static constexpr uint32_t TEST_SEED = 12345;
+};
+
+TEST_F(BlockScheduleTest, PermutationIsBijective) {
+    // Include sizes that are not powers of two to exercise cycle walking
+    std::vector<uint32_t> sizes = {1, 2, 3, 64, 100, 1000, 32400};
+    
+    for (uint32_t total : sizes) {
+        BlockSchedule schedule(TEST_SEED, total, 1.0f, 1);
+        std::vector<bool> seen(total, false);
+        
+        for (uint32_t slot = 0; slot < total; ++slot) {
+            uint32_t block = schedule.permute(slot);
+            ASSERT_LT(block, total);
+            EXPECT_FALSE(seen[block]) << "Duplicate block for total " << total;
+            seen[block] = true;
+        }
+    }
+}
+
+TEST_F(BlockScheduleTest, DeterministicForSeed) {
+    BlockSchedule a(TEST_SEED, 32400, 0.01f, 30);
+    BlockSchedule b(TEST_SEED, 32400, 0.01f, 30);
+    
+    for (uint32_t frame = 0; frame < 60; ++frame) {
+        for (uint32_t i = 0; i < a.blocksPerFrame(); ++i) {
+            EXPECT_EQ(a.blockIndex(frame, i), b.blockIndex(frame, i));
+        }
+    }
+}
+
+TEST_F(BlockScheduleTest, DifferentSeedsGiveDifferentSchedules) {
+    BlockSchedule a(TEST_SEED, 32400, 1.0f, 1);
+    BlockSchedule b(TEST_SEED + 1, 32400, 1.0f, 1);
+    
+    uint32_t differences = 0;
+    for (uint32_t slot = 0; slot < 100; ++slot) {
+        differences += a.permute(slot) != b.permute(slot);
+    }
+    EXPECT_GT(differences, 90u);
+}
+
+TEST_F(BlockScheduleTest, FramesWithinPeriodUseDisjointBlocks) {
+    BlockSchedule schedule(TEST_SEED, 32400, 0.05f, 30);
+    ASSERT_GT(schedule.blocksPerFrame(), 0u);
+    
+    std::vector<bool> used(schedule.totalBlocks(), false);
+    for (uint32_t frame = 0; frame < 30; ++frame) {
+        for (uint32_t i = 0; i < schedule.blocksPerFrame(); ++i) {
+            uint32_t block = schedule.blockIndex(frame, i);
+            EXPECT_FALSE(used[block]);
+            used[block] = true;
+        }
+    }
+    
+    // The pattern repeats after one temporal period
+    EXPECT_EQ(schedule.blockIndex(3, 0), schedule.blockIndex(33, 0));
+}
+
+TEST_F(BlockScheduleTest, LowDensitySpreadsOverFrames) {
+    // 64 blocks at 0.3 over 30 frames is 19 blocks, fewer than one per frame
+    BlockSchedule schedule(TEST_SEED, 64, 0.3f, 30);
+    EXPECT_EQ(schedule.blocksPerPeriod(), 19u);
+    EXPECT_EQ(schedule.blocksPerFrame(), 1u);
+    
+    std::vector<bool> used(schedule.totalBlocks(), false);
+    uint32_t carried = 0;
+    for (uint32_t frame = 0; frame < 30; ++frame) {
+        EXPECT_EQ(schedule.blocksInFrame(frame), frame < 19 ? 1u : 0u);
+        for (uint32_t i = 0; i < schedule.blocksInFrame(frame); ++i) {
+            uint32_t block = schedule.blockIndex(frame, i);
+            EXPECT_FALSE(used[block]);
+            used[block] = true;
+            carried++;
+        }
+    }
+    EXPECT_EQ(carried, schedule.blocksPerPeriod());
+}
+
+TEST_F(BlockScheduleTest, EmptyScheduleTest) {
+    BlockSchedule schedule(TEST_SEED, 0, 0.5f, 30);
+    EXPECT_EQ(schedule.blocksPerFrame(), 0u);
+}
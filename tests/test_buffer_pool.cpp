@@ -0,0 +1,141 @@
+#include <gtest/gtest.h>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include "common/buffer_pool.h"
+#include "encoder/quant_offset_buffer.h"
+#include "encoder/watermark_encoder.h"
+
+using namespace phantomframe;
+
+namespace {
+
+constexpr uint32_t kWidth = 1280;
+constexpr uint32_t kHeight = 720;
+
+bool isAligned(const void* pointer, size_t alignment) {
+    return reinterpret_cast<uintptr_t>(pointer) % alignment == 0;
+}
+
+WatermarkConfig makeConfig() {
+    WatermarkConfig config{};
+    config.seed = 12345;
+    config.block_density = 0.05f;
+    config.temporal_period = 30;
+    config.adaptive_embedding = false;
+    config.quality_threshold = 0.0f;
+    config.frame_budget_us = 0;
+    config.scene_cut_threshold = 0.0f;
+    config.window_frames = 0;
+    config.window_repeats = 1;
+    config.pilot_density = 0.0f;
+    config.marked_period_interval = 1;
+    config.enable_encryption = false;
+    return config;
+}
+
+} // namespace
+
+TEST(BufferPoolTest, RecyclesBuffersOfTheSameSize) {
+    BufferPool pool;
+    uint8_t* first = nullptr;
+    {
+        BufferPool::Buffer buffer = pool.acquire(1000);
+        ASSERT_FALSE(buffer.empty());
+        EXPECT_EQ(buffer.size(), 1000u);
+        EXPECT_TRUE(isAligned(buffer.data(), BufferPool::kAlignment));
+        first = buffer.data();
+    }
+
+    // Sizes in the same 64-byte class share buffers, others do not
+    BufferPool::Buffer again = pool.acquire(990);
+    EXPECT_EQ(again.data(), first);
+    BufferPool::Buffer other = pool.acquire(4096);
+    EXPECT_NE(other.data(), first);
+
+    BufferPoolStats stats = pool.getStats();
+    EXPECT_EQ(stats.hits, 1u);
+    EXPECT_EQ(stats.misses, 2u);
+    EXPECT_EQ(stats.bytes_allocated, 1024u + 4096u);
+}
+
+TEST(BufferPoolTest, MovedBuffersReturnOnce) {
+    BufferPool pool;
+    BufferPool::Buffer a = pool.acquire(256);
+    BufferPool::Buffer b = std::move(a);
+    EXPECT_TRUE(a.empty());
+    b.release();
+    EXPECT_TRUE(b.empty());
+
+    // One idle buffer, so the second request misses
+    BufferPool::Buffer c = pool.acquire(256);
+    BufferPool::Buffer d = pool.acquire(256);
+    EXPECT_NE(c.data(), d.data());
+    EXPECT_EQ(pool.getStats().hits, 1u);
+    EXPECT_EQ(pool.getStats().misses, 2u);
+}
+
+TEST(BufferPoolTest, HugePageBuffersUseWholePages) {
+    BufferPool pool(true);
+    BufferPool::Buffer frame = pool.acquire(static_cast<size_t>(kWidth) * kHeight * 3);
+    ASSERT_FALSE(frame.empty());
+    EXPECT_TRUE(isAligned(frame.data(), BufferPool::kHugePageSize));
+    EXPECT_EQ(pool.getStats().bytes_allocated % BufferPool::kHugePageSize, 0u);
+
+    // Small buffers stay on normal pages
+    BufferPool::Buffer small = pool.acquire(100);
+    EXPECT_TRUE(isAligned(small.data(), BufferPool::kAlignment));
+    EXPECT_EQ(pool.getStats().bytes_allocated % BufferPool::kHugePageSize, 128u);
+}
+
+TEST(BufferPoolTest, StandaloneBuffersWithoutPool) {
+    BufferPool::Buffer buffer = BufferPool::acquire(nullptr, 100);
+    ASSERT_FALSE(buffer.empty());
+    EXPECT_TRUE(isAligned(buffer.data(), BufferPool::kAlignment));
+    std::memset(buffer.data(), 0, buffer.size());
+    EXPECT_TRUE(BufferPool::acquire(nullptr, 0).empty());
+}
+
+TEST(BufferPoolTest, SteadyEncodeStopsMissing) {
+    BufferPool pool;
+    WatermarkEncoder encoder(makeConfig());
+    ASSERT_TRUE(encoder.initialize(kWidth, kHeight, 30.0f));
+    encoder.setBufferPool(&pool);
+    QuantOffsetBuffer planes(kWidth, kHeight, 2, &pool);
+    EXPECT_TRUE(isAligned(planes.fill(encoder, 0).offsets, BufferPool::kAlignment));
+
+    std::vector<uint8_t> frame(static_cast<size_t>(kWidth) * kHeight, 128);
+    for (uint32_t i = 1; i < 4; ++i) {
+        BufferPool::Buffer output = encoder.processFrameBuffer(frame.data(), frame.size(), i);
+        ASSERT_EQ(output.size(), frame.size());
+    }
+    uint64_t misses = pool.getStats().misses;
+
+    for (uint32_t i = 4; i < 40; ++i) {
+        BufferPool::Buffer output = encoder.processFrameBuffer(frame.data(), frame.size(), i);
+        planes.fill(encoder, i);
+    }
+    EXPECT_EQ(pool.getStats().misses, misses);
+    EXPECT_GE(pool.getStats().hits, 36u);
+    EXPECT_NE(encoder.getStats().find("Buffer pool"), std::string::npos);
+}
+
+TEST(BufferPoolTest, PooledCopyMatchesVectorCopy) {
+    BufferPool pool;
+    WatermarkEncoder pooled(makeConfig());
+    WatermarkEncoder plain(makeConfig());
+    ASSERT_TRUE(pooled.initialize(kWidth, kHeight, 30.0f));
+    ASSERT_TRUE(plain.initialize(kWidth, kHeight, 30.0f));
+    pooled.setBufferPool(&pool);
+
+    std::vector<uint8_t> frame(static_cast<size_t>(kWidth) * kHeight);
+    for (size_t i = 0; i < frame.size(); ++i) {
+        frame[i] = static_cast<uint8_t>(i * 7);
+    }
+
+    BufferPool::Buffer a = pooled.processFrameBuffer(frame.data(), frame.size(), 5);
+    std::vector<uint8_t> b = plain.processFrame(frame.data(), frame.size(), 5);
+    ASSERT_EQ(a.size(), b.size());
+    EXPECT_EQ(std::memcmp(a.data(), b.data(), b.size()), 0);
+    EXPECT_TRUE(pooled.processFrameBuffer(nullptr, frame.size(), 6).empty());
+}
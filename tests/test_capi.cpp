@@ -0,0 +1,238 @@
+#include <gtest/gtest.h>
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdlib>
+#include <new>
+#include <thread>
+#include <vector>
+#include "capi/phantomframe.h"
+
+namespace {
+
+// Counts operator new calls while armed, to check the per-frame path
+std::atomic<bool> g_count_allocations(false);
+std::atomic<size_t> g_allocations(0);
+
+} // namespace
+
+// The replacements below pair malloc with free, which GCC cannot see through
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+
+void* operator new(size_t size) {
+    if (g_count_allocations.load(std::memory_order_relaxed)) {
+        g_allocations.fetch_add(1, std::memory_order_relaxed);
+    }
+    void* ptr = std::malloc(size ? size : 1);
+    if (!ptr) {
+        throw std::bad_alloc();
+    }
+    return ptr;
+}
+
+void* operator new[](size_t size) {
+    return operator new(size);
+}
+
+void operator delete(void* ptr) noexcept {
+    std::free(ptr);
+}
+
+void operator delete[](void* ptr) noexcept {
+    std::free(ptr);
+}
+
+void operator delete(void* ptr, size_t) noexcept {
+    std::free(ptr);
+}
+
+void operator delete[](void* ptr, size_t) noexcept {
+    std::free(ptr);
+}
+
+class CApiTest : public ::testing::Test {
+protected:
+    void SetUp() override {
+        phantomframe_config_init(&config);
+        config.payload_hex = "0123456789abcdef";
+        config.seed = 12345;
+        config.block_density = 0.05f;
+        config.width = 1920;
+        config.height = 1080;
+        config.fps = 30.0f;
+    }
+
+    phantomframe_config config;
+};
+
+TEST_F(CApiTest, CreateRejectsInvalidParameters) {
+    EXPECT_EQ(phantomframe_create(nullptr), nullptr);
+
+    config.width = 0;
+    EXPECT_EQ(phantomframe_create(&config), nullptr);
+}
+
+TEST_F(CApiTest, CreateWritesNothingToStdout) {
+    // The host may own stdout, e.g. a player or an encoder writing video to it
+    testing::internal::CaptureStdout();
+    phantomframe_handle* handle = phantomframe_create(&config);
+    EXPECT_EQ(testing::internal::GetCapturedStdout(), "");
+    ASSERT_NE(handle, nullptr);
+    phantomframe_destroy(handle);
+}
+
+TEST_F(CApiTest, OffsetCountMatchesMacroblockGrid) {
+    phantomframe_handle* handle = phantomframe_create(&config);
+    ASSERT_NE(handle, nullptr);
+
+    uint32_t mb_width = 0;
+    uint32_t mb_height = 0;
+    EXPECT_EQ(phantomframe_offset_count(handle, &mb_width, &mb_height), 120u * 68u);
+    EXPECT_EQ(mb_width, 120u);
+    EXPECT_EQ(mb_height, 68u);
+
+    phantomframe_destroy(handle);
+}
+
+TEST_F(CApiTest, ApplyWritesQuantOffsets) {
+    phantomframe_handle* handle = phantomframe_create(&config);
+    ASSERT_NE(handle, nullptr);
+
+    std::vector<float> offsets(phantomframe_offset_count(handle, nullptr, nullptr), 5.0f);
+    int written = phantomframe_apply_watermark(handle, 0, nullptr, 0, offsets.data(), offsets.size());
+    ASSERT_GT(written, 0);
+
+    // The whole plane is overwritten with deltas of -1, 0 or +1 per block
+    int nonzero = 0;
+    for (float value : offsets) {
+        ASSERT_LE(std::abs(value), 4.0f);
+        nonzero += value != 0.0f;
+    }
+    EXPECT_GT(nonzero, 0);
+    EXPECT_LE(nonzero, written);
+
+    phantomframe_stats stats;
+    ASSERT_EQ(phantomframe_get_stats(handle, &stats), PHANTOMFRAME_OK);
+    EXPECT_EQ(stats.frames_processed, 1u);
+    EXPECT_GT(stats.blocks_modified, 0u);
+
+    phantomframe_destroy(handle);
+}
+
+TEST_F(CApiTest, ApplyRejectsSmallBuffer) {
+    phantomframe_handle* handle = phantomframe_create(&config);
+    ASSERT_NE(handle, nullptr);
+
+    std::vector<float> offsets(16);
+    EXPECT_EQ(phantomframe_apply_watermark(handle, 0, nullptr, 0, offsets.data(), offsets.size()),
+              PHANTOMFRAME_ERROR_BUFFER);
+    EXPECT_EQ(phantomframe_apply_watermark(nullptr, 0, nullptr, 0, offsets.data(), offsets.size()),
+              PHANTOMFRAME_ERROR_INVALID);
+
+    phantomframe_destroy(handle);
+}
+
+TEST_F(CApiTest, NonReferenceFramesGetEmptyMaps) {
+    phantomframe_handle* handle = phantomframe_create(&config);
+    ASSERT_NE(handle, nullptr);
+    std::vector<float> offsets(phantomframe_offset_count(handle, nullptr, nullptr), 5.0f);
+
+    EXPECT_EQ(phantomframe_set_frame_type(handle, 0, 7, 0), PHANTOMFRAME_ERROR_INVALID);
+    EXPECT_EQ(phantomframe_set_frame_type(nullptr, 0, PHANTOMFRAME_FRAME_B, 0), 
+              PHANTOMFRAME_ERROR_INVALID);
+
+    ASSERT_EQ(phantomframe_set_frame_type(handle, 0, PHANTOMFRAME_FRAME_B, 0), PHANTOMFRAME_OK);
+    EXPECT_EQ(phantomframe_apply_watermark(handle, 0, nullptr, 0, offsets.data(), offsets.size()), 0);
+    EXPECT_TRUE(std::all_of(offsets.begin(), offsets.end(), [](float value) { return value == 0.0f; }));
+
+    // The next reference frame carries the skipped frame's blocks too
+    ASSERT_EQ(phantomframe_set_frame_type(handle, 1, PHANTOMFRAME_FRAME_P, 1), PHANTOMFRAME_OK);
+    EXPECT_GT(phantomframe_apply_watermark(handle, 1, nullptr, 0, offsets.data(), offsets.size()), 0);
+
+    phantomframe_stats stats;
+    ASSERT_EQ(phantomframe_get_stats(handle, &stats), PHANTOMFRAME_OK);
+    EXPECT_EQ(stats.frames_processed, 2u);
+
+    phantomframe_destroy(handle);
+}
+
+TEST_F(CApiTest, ApplyDoesNotAllocate) {
+    config.adaptive_embedding = 1;
+    config.quality_threshold = 1.0f;
+    config.frame_budget_us = 100000;
+    config.scene_cut_threshold = 20.0f;
+    phantomframe_handle* handle = phantomframe_create(&config);
+    ASSERT_NE(handle, nullptr);
+
+    std::vector<uint8_t> luma(1920 * 1080);
+    for (size_t i = 0; i < luma.size(); ++i) {
+        luma[i] = static_cast<uint8_t>(i * 2654435761u >> 24);
+    }
+    std::vector<float> offsets(phantomframe_offset_count(handle, nullptr, nullptr));
+    phantomframe_stats stats;
+
+    g_allocations.store(0);
+    g_count_allocations.store(true);
+    for (uint32_t frame = 0; frame < 90; ++frame) {
+        phantomframe_apply_watermark(handle, frame, luma.data(), 1920, offsets.data(), offsets.size());
+        phantomframe_get_stats(handle, &stats);
+    }
+    g_count_allocations.store(false);
+
+    EXPECT_EQ(g_allocations.load(), 0u);
+    EXPECT_EQ(stats.frames_processed, 90u);
+
+    phantomframe_destroy(handle);
+}
+
+TEST_F(CApiTest, ConcurrentHandlesAreIndependent) {
+    const uint32_t kStreams = 4;
+    const uint32_t kFrames = 30;
+    config.adaptive_embedding = 1;
+    config.quality_threshold = 1.0f;
+
+    std::vector<uint8_t> luma(1920 * 1080);
+    for (size_t i = 0; i < luma.size(); ++i) {
+        luma[i] = static_cast<uint8_t>(i * 2654435761u >> 24);
+    }
+
+    // Reference maps from a single handle on this thread
+    phantomframe_handle* reference = phantomframe_create(&config);
+    ASSERT_NE(reference, nullptr);
+    size_t count = phantomframe_offset_count(reference, nullptr, nullptr);
+    std::vector<float> expected(count * kFrames);
+    for (uint32_t frame = 0; frame < kFrames; ++frame) {
+        ASSERT_GE(phantomframe_apply_watermark(reference, frame, luma.data(), 1920,
+                                               expected.data() + frame * count, count), 0);
+    }
+    phantomframe_destroy(reference);
+
+    // Streams share nothing, so each must reproduce the reference exactly
+    std::vector<int> matches(kStreams, 0);
+    std::vector<std::thread> streams;
+    for (uint32_t s = 0; s < kStreams; ++s) {
+        streams.emplace_back([&, s]() {
+            phantomframe_handle* handle = phantomframe_create(&config);
+            if (!handle) {
+                return;
+            }
+            std::vector<float> offsets(count);
+            bool same = true;
+            for (uint32_t frame = 0; frame < kFrames; ++frame) {
+                phantomframe_apply_watermark(handle, frame, luma.data(), 1920, offsets.data(), count);
+                same = same && std::equal(offsets.begin(), offsets.end(), expected.begin() + frame * count);
+            }
+            phantomframe_destroy(handle);
+            matches[s] = same ? 1 : 0;
+        });
+    }
+    for (auto& stream : streams) {
+        stream.join();
+    }
+
+    for (uint32_t s = 0; s < kStreams; ++s) {
+        EXPECT_EQ(matches[s], 1) << "stream " << s;
+    }
+}
@@ -0,0 +1,335 @@
+#include <gtest/gtest.h>
+#include <algorithm>
+#include <tuple>
+#include <utility>
+#include <vector>
+#include "common/embedding_schedule.h"
+#include "common/block_schedule.h"
+#include "common/payload_code.h"
+#include "common/worker_pool.h"
+#include "encoder/watermark_encoder.h"
+
+using namespace phantomframe;
+
+class EmbeddingScheduleTest : public ::testing::Test {
+protected:
+    static constexpr uint32_t TEST_SEED = 12345;
+    static constexpr uint32_t REF_WIDTH = 1920;
+    static constexpr uint32_t REF_HEIGHT = 1080;
+    static constexpr uint32_t TEST_PERIOD = 30;
+    static constexpr float TEST_DENSITY = 0.05f;
+};
+
+TEST_F(EmbeddingScheduleTest, ReferenceGridMatchesBlockSchedule) {
+    auto schedule = EmbeddingSchedule::create(TEST_SEED, TEST_DENSITY, TEST_PERIOD,
+                                              REF_WIDTH, REF_HEIGHT);
+    uint32_t blocks_x = (REF_WIDTH + 7) / 8;
+    uint32_t blocks_y = (REF_HEIGHT + 7) / 8;
+    BlockSchedule selection(TEST_SEED, blocks_x * blocks_y, TEST_DENSITY, TEST_PERIOD);
+    ASSERT_EQ(schedule->blocksPerFrame(), selection.blocksPerFrame());
+
+    std::vector<uint16_t> x(schedule->blocksPerFrame());
+    std::vector<uint16_t> y(schedule->blocksPerFrame());
+    for (uint32_t frame = 0; frame < TEST_PERIOD; ++frame) {
+        uint32_t count = schedule->mapFrame(frame, REF_WIDTH, REF_HEIGHT, x.data(), y.data());
+        ASSERT_EQ(count, selection.blocksPerFrame());
+
+        std::vector<uint32_t> expected(count);
+        for (uint32_t i = 0; i < count; ++i) {
+            expected[i] = selection.blockIndex(frame, i);
+        }
+        std::sort(expected.begin(), expected.end());
+
+        for (uint32_t i = 0; i < count; ++i) {
+            EXPECT_EQ(x[i], (expected[i] % blocks_x) * 8);
+            EXPECT_EQ(y[i], (expected[i] / blocks_x) * 8);
+        }
+    }
+}
+
+TEST_F(EmbeddingScheduleTest, MapsOntoSmallerGridsInRowOrder) {
+    auto schedule = EmbeddingSchedule::create(TEST_SEED, TEST_DENSITY, TEST_PERIOD,
+                                              REF_WIDTH, REF_HEIGHT);
+    std::vector<std::pair<uint32_t, uint32_t>> renditions = {
+        {1280, 720}, {854, 480}, {640, 360}, {426, 240}};
+
+    std::vector<uint16_t> x(schedule->blocksPerFrame());
+    std::vector<uint16_t> y(schedule->blocksPerFrame());
+    for (const auto& size : renditions) {
+        uint32_t count = schedule->mapFrame(3, size.first, size.second, x.data(), y.data());
+        ASSERT_EQ(count, schedule->blocksPerFrame());
+
+        for (uint32_t i = 0; i < count; ++i) {
+            EXPECT_LT(x[i], size.first);
+            EXPECT_LT(y[i], size.second);
+            EXPECT_EQ(x[i] % 8, 0);
+            EXPECT_EQ(y[i] % 8, 0);
+            if (i > 0) {
+                EXPECT_LE(y[i - 1], y[i]);
+            }
+        }
+    }
+}
+
+TEST_F(EmbeddingScheduleTest, ParallelBuildMatchesSerial) {
+    WorkerPool pool(4);
+    auto serial = EmbeddingSchedule::create(TEST_SEED, TEST_DENSITY, TEST_PERIOD,
+                                            REF_WIDTH, REF_HEIGHT);
+    auto parallel = EmbeddingSchedule::create(TEST_SEED, TEST_DENSITY, TEST_PERIOD,
+                                              REF_WIDTH, REF_HEIGHT, &pool);
+    ASSERT_EQ(serial->blocksPerFrame(), parallel->blocksPerFrame());
+
+    for (uint32_t frame = 0; frame < TEST_PERIOD; ++frame) {
+        auto a = serial->phase(frame);
+        auto b = parallel->phase(frame);
+        ASSERT_EQ(a.count, b.count);
+        EXPECT_TRUE(std::equal(a.u, a.u + a.count, b.u));
+        EXPECT_TRUE(std::equal(a.v, a.v + a.count, b.v));
+        EXPECT_TRUE(std::equal(a.qp_delta, a.qp_delta + a.count, b.qp_delta));
+    }
+}
+
+TEST_F(EmbeddingScheduleTest, RenditionsShareOneSchedule) {
+    WatermarkConfig config{};
+    config.seed = TEST_SEED;
+    config.block_density = TEST_DENSITY;
+    config.temporal_period = TEST_PERIOD;
+
+    auto schedule = EmbeddingSchedule::create(TEST_SEED, TEST_DENSITY, TEST_PERIOD,
+                                              REF_WIDTH, REF_HEIGHT);
+    WatermarkEncoder top(config);
+    WatermarkEncoder low(config);
+    ASSERT_TRUE(top.initialize(REF_WIDTH, REF_HEIGHT, 30.0f, schedule));
+    ASSERT_TRUE(low.initialize(640, 360, 30.0f, schedule));
+    EXPECT_EQ(top.getMaxBlocksPerFrame(), low.getMaxBlocksPerFrame());
+
+    // Every rendition carries the same QP deltas in the same order
+    for (uint32_t frame = 0; frame < TEST_PERIOD; ++frame) {
+        BlockSpan a = top.getScheduleForFrame(frame);
+        BlockSpan b = low.getScheduleForFrame(frame);
+        ASSERT_EQ(a.count, b.count);
+        EXPECT_TRUE(std::equal(a.qp_delta, a.qp_delta + a.count, b.qp_delta));
+    }
+}
+
+TEST_F(EmbeddingScheduleTest, MapFramesMergesPhasesInRowOrder) {
+    auto schedule = EmbeddingSchedule::create(TEST_SEED, TEST_DENSITY, TEST_PERIOD,
+                                              REF_WIDTH, REF_HEIGHT);
+    uint32_t per_frame = schedule->blocksPerFrame();
+    std::vector<uint16_t> x(per_frame * 3), y(per_frame * 3);
+    std::vector<int8_t> qp(per_frame * 3);
+
+    // Frame 1 carries the phases of frames 29, 0 and 1 of the period
+    uint32_t count = schedule->mapFrames(1, 3, 1280, 720, x.data(), y.data(), qp.data());
+    ASSERT_EQ(count, per_frame * 3);
+    EXPECT_TRUE(std::is_sorted(y.begin(), y.end()));
+
+    std::vector<std::tuple<uint16_t, uint16_t, int8_t>> merged, expected;
+    for (uint32_t i = 0; i < count; ++i) {
+        merged.emplace_back(x[i], y[i], qp[i]);
+    }
+    std::vector<uint16_t> px(per_frame), py(per_frame);
+    for (uint32_t frame : {29u, 30u, 31u}) {
+        schedule->mapFrame(frame, 1280, 720, px.data(), py.data());
+        EmbeddingSchedule::Phase blocks = schedule->phase(frame);
+        for (uint32_t i = 0; i < per_frame; ++i) {
+            expected.emplace_back(px[i], py[i], blocks.qp_delta[i]);
+        }
+    }
+    std::sort(merged.begin(), merged.end());
+    std::sort(expected.begin(), expected.end());
+    EXPECT_EQ(merged, expected);
+}
+
+TEST_F(EmbeddingScheduleTest, CycleCarriesEveryChannelBit) {
+    // A sparse schedule needs several periods to carry the whole codeword
+    auto schedule = EmbeddingSchedule::create(TEST_SEED, 0.005f, TEST_PERIOD,
+                                              REF_WIDTH, REF_HEIGHT);
+    ASSERT_EQ(schedule->cycle() % schedule->period(), 0u);
+    ASSERT_GT(schedule->cycle(), schedule->period());
+
+    std::vector<uint32_t> carried(kPayloadCodedBits, 0);
+    for (uint32_t frame = 0; frame < schedule->cycle(); ++frame) {
+        EmbeddingSchedule::Phase blocks = schedule->phase(frame);
+        for (uint32_t i = 0; i < blocks.count; ++i) {
+            if (blocks.qp_delta[i] != 0) {
+                ASSERT_LT(blocks.channel[i], kPayloadCodedBits);
+                carried[blocks.channel[i]]++;
+            }
+        }
+    }
+    EXPECT_GT(*std::min_element(carried.begin(), carried.end()), 0u);
+}
+
+TEST_F(EmbeddingScheduleTest, CodewordFlipsDeltaSigns) {
+    CodedPayload codeword;
+    encodePayload(Payload(0x0123456789ABCDEFull, 0xFEDCBA9876543210ull), codeword);
+
+    auto plain = EmbeddingSchedule::create(TEST_SEED, TEST_DENSITY, TEST_PERIOD,
+                                           REF_WIDTH, REF_HEIGHT);
+    auto marked = EmbeddingSchedule::create(TEST_SEED, TEST_DENSITY, TEST_PERIOD,
+                                            REF_WIDTH, REF_HEIGHT, nullptr, &codeword);
+    ASSERT_EQ(plain->cycle(), marked->cycle());
+
+    for (uint32_t frame = 0; frame < marked->cycle(); ++frame) {
+        auto a = plain->phase(frame);
+        auto b = marked->phase(frame);
+        ASSERT_EQ(a.count, b.count);
+        EXPECT_TRUE(std::equal(a.u, a.u + a.count, b.u));
+        EXPECT_TRUE(std::equal(a.v, a.v + a.count, b.v));
+        for (uint32_t i = 0; i < b.count; ++i) {
+            ASSERT_EQ(a.channel[i], b.channel[i]);
+            int expected = codeword[b.channel[i]] ? -a.qp_delta[i] : a.qp_delta[i];
+            EXPECT_EQ(b.qp_delta[i], expected);
+        }
+    }
+}
+
+TEST_F(EmbeddingScheduleTest, WindowCarriesEveryBitRepeatedly) {
+    // Two seconds at 30 fps from anywhere in the stream, each bit twice
+    const uint32_t window = 60;
+    auto sparse = EmbeddingSchedule::create(TEST_SEED, 0.005f, TEST_PERIOD,
+                                            REF_WIDTH, REF_HEIGHT);
+    auto windowed = EmbeddingSchedule::create(TEST_SEED, 0.005f, TEST_PERIOD,
+                                              REF_WIDTH, REF_HEIGHT, nullptr, nullptr, window, 2);
+    EXPECT_LT(sparse->coverage(window), 2u);
+    EXPECT_GE(windowed->coverage(window), 2u);
+    EXPECT_GT(windowed->blocksPerFrame(), sparse->blocksPerFrame());
+    EXPECT_EQ(windowed->windowFrames(), window);
+
+    // A density that already covers the window is left alone
+    auto dense = EmbeddingSchedule::create(TEST_SEED, TEST_DENSITY, TEST_PERIOD,
+                                           REF_WIDTH, REF_HEIGHT, nullptr, nullptr, window, 2);
+    auto plain = EmbeddingSchedule::create(TEST_SEED, TEST_DENSITY, TEST_PERIOD,
+                                           REF_WIDTH, REF_HEIGHT);
+    EXPECT_EQ(dense->blocksPerFrame(), plain->blocksPerFrame());
+    EXPECT_GE(dense->coverage(window), 2u);
+}
+
+TEST_F(EmbeddingScheduleTest, PilotIsMergedIntoEveryFrame) {
+    auto plain = EmbeddingSchedule::create(TEST_SEED, TEST_DENSITY, TEST_PERIOD,
+                                           REF_WIDTH, REF_HEIGHT);
+    auto piloted = EmbeddingSchedule::create(TEST_SEED, TEST_DENSITY, TEST_PERIOD,
+                                             REF_WIDTH, REF_HEIGHT, nullptr, nullptr, 0, 1, 0.1f);
+    EXPECT_EQ(plain->pilotBlocks(), 0u);
+    ASSERT_GT(piloted->pilotBlocks(), 0u);
+    EXPECT_EQ(piloted->maxBlocksPerFrame(),
+              plain->maxBlocksPerFrame() + piloted->pilotBlocks());
+
+    // The payload is untouched; every frame adds the pilot, sorted in,
+    // with its sign following the frame's
+    const uint32_t phases = 3;
+    std::vector<uint16_t> x(piloted->maxBlocksPerFrame());
+    std::vector<uint16_t> y(x.size());
+    std::vector<int8_t> qp(x.size());
+    std::vector<uint16_t> channel(x.size());
+    for (uint32_t frame = 0; frame < 2 * TEST_PERIOD; frame += 7) {
+        uint32_t count = piloted->mapFrames(frame, phases, REF_WIDTH, REF_HEIGHT,
+                                            x.data(), y.data(), qp.data(), channel.data());
+        ASSERT_EQ(count, phases * plain->blocksPerFrame() + piloted->pilotBlocks());
+        EXPECT_TRUE(std::is_sorted(y.begin(), y.begin() + count));
+
+        uint32_t pilot = 0;
+        int8_t sign = piloted->pilot().sign(frame);
+        for (uint32_t i = 0; i < count; ++i) {
+            if (channel[i] != EmbeddingSchedule::kPilotChannel) {
+                continue;
+            }
+            uint32_t cell_x = x[i] / PilotPattern::kCellPixels;
+            uint32_t cell_y = y[i] / PilotPattern::kCellPixels;
+            EXPECT_EQ(x[i] % PilotPattern::kCellPixels, 0u);
+            EXPECT_EQ(qp[i], sign * piloted->pilot().cell(cell_x, cell_y));
+            pilot++;
+        }
+        EXPECT_EQ(pilot, piloted->pilotBlocks());
+    }
+}
+
+TEST_F(EmbeddingScheduleTest, SmallFramesStillCarryBlocks) {
+    // 64x64 at a density of 0.3 rounds to no blocks at all per frame
+    auto schedule = EmbeddingSchedule::create(TEST_SEED, 0.3f, TEST_PERIOD, 64, 64);
+    ASSERT_EQ(schedule->blocksPerFrame(), 1u);
+
+    uint32_t blocks = 0;
+    std::vector<uint32_t> carried(kPayloadCodedBits, 0);
+    for (uint32_t frame = 0; frame < schedule->cycle(); ++frame) {
+        EmbeddingSchedule::Phase phase = schedule->phase(frame);
+        ASSERT_LE(phase.count, 1u);
+        blocks += phase.count;
+        for (uint32_t i = 0; i < phase.count; ++i) {
+            if (phase.qp_delta[i] != 0) {
+                carried[phase.channel[i]]++;
+            }
+        }
+    }
+    EXPECT_EQ(blocks, 19u * schedule->cycle() / TEST_PERIOD);
+    EXPECT_GT(*std::min_element(carried.begin(), carried.end()), 0u);
+    EXPECT_GT(schedule->coverage(schedule->cycle()), 0u);
+}
+
+TEST_F(EmbeddingScheduleTest, MarkedPeriodIntervalSkipsPeriods) {
+    const uint32_t interval = 3;
+    CodedPayload codeword;
+    encodePayload(Payload(0x1234, 0x5678), codeword);
+    auto dense = EmbeddingSchedule::create(TEST_SEED, 0.005f, TEST_PERIOD, REF_WIDTH, REF_HEIGHT,
+                                           nullptr, &codeword, 0, 1, 0.1f);
+    auto sparse = EmbeddingSchedule::create(TEST_SEED, 0.005f, TEST_PERIOD, REF_WIDTH, REF_HEIGHT,
+                                            nullptr, &codeword, 0, 1, 0.1f, interval);
+    EXPECT_EQ(sparse->markedPeriodInterval(), interval);
+    EXPECT_EQ(sparse->cycle(), dense->cycle() * interval);
+
+    // Marked periods carry the dense schedule's frames in order, the
+    // periods in between nothing, not even the pilot
+    std::vector<uint16_t> x(sparse->maxBlocksPerFrame());
+    std::vector<uint16_t> y(x.size());
+    std::vector<int8_t> qp(x.size());
+    for (uint32_t frame = 0; frame < sparse->cycle(); ++frame) {
+        uint32_t period = frame / TEST_PERIOD;
+        EmbeddingSchedule::Phase blocks = sparse->phase(frame);
+        uint32_t count = sparse->mapFrames(frame, 1, REF_WIDTH, REF_HEIGHT,
+                                           x.data(), y.data(), qp.data());
+        EXPECT_EQ(sparse->marksFrame(frame), period % interval == 0);
+        if (period % interval != 0) {
+            EXPECT_EQ(blocks.count, 0u);
+            EXPECT_EQ(count, 0u);
+            continue;
+        }
+
+        uint32_t dense_frame = period / interval * TEST_PERIOD + frame % TEST_PERIOD;
+        EmbeddingSchedule::Phase expected = dense->phase(dense_frame);
+        ASSERT_EQ(blocks.count, expected.count);
+        EXPECT_TRUE(std::equal(blocks.qp_delta, blocks.qp_delta + blocks.count, expected.qp_delta));
+        EXPECT_TRUE(std::equal(blocks.channel, blocks.channel + blocks.count, expected.channel));
+        EXPECT_EQ(count, blocks.count + sparse->pilotBlocks());
+    }
+
+    // A window guarantee counts only the marked frames of a window
+    auto windowed = EmbeddingSchedule::create(TEST_SEED, 0.005f, TEST_PERIOD, REF_WIDTH, REF_HEIGHT,
+                                              nullptr, nullptr, 4 * TEST_PERIOD * interval, 1,
+                                              0.0f, interval);
+    EXPECT_GE(windowed->coverage(4 * TEST_PERIOD * interval), 1u);
+}
+
+TEST_F(EmbeddingScheduleTest, PhaseCarryMovesNonReferenceFramesForward) {
+    const FrameInfo i_frame{FrameType::I, true};
+    const FrameInfo p_frame{FrameType::P, true};
+    const FrameInfo b_frame{FrameType::B, false};
+    const FrameInfo b_ref{FrameType::B, true};
+
+    PhaseCarry carry;
+    EXPECT_EQ(carry.next(i_frame, TEST_PERIOD), 1u);
+    EXPECT_EQ(carry.next(b_frame, TEST_PERIOD), 0u);
+    EXPECT_EQ(carry.next(b_ref, TEST_PERIOD), 2u);
+    EXPECT_EQ(carry.next(b_frame, TEST_PERIOD), 0u);
+    EXPECT_EQ(carry.next(p_frame, TEST_PERIOD), 2u);
+    EXPECT_EQ(carry.next(FrameInfo{FrameType::Unknown, false}, TEST_PERIOD), 1u);
+
+    // Long runs are capped, and a short period never repeats a phase
+    for (int i = 0; i < 20; ++i) {
+        carry.next(b_frame, TEST_PERIOD);
+    }
+    EXPECT_EQ(carry.next(p_frame, TEST_PERIOD), EmbeddingSchedule::kMaxFramePhases);
+    carry.next(b_frame, 2);
+    carry.next(b_frame, 2);
+    EXPECT_EQ(carry.next(p_frame, 2), 2u);
+}
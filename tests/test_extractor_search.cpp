@@ -0,0 +1,236 @@
+#include <gtest/gtest.h>
+#include <cmath>
+#include <random>
+#include <string>
+#include <vector>
+#include "common/embedding_schedule.h"
+#include "common/payload_code.h"
+#include "encoder/watermark_encoder.h"
+#include "extractor/watermark_extractor.h"
+
+using namespace phantomframe;
+
+namespace {
+
+// Frames a clip is cut out of: the block activity of a static textured
+// picture, lowered where the encoder's rendered quant offsets raise the QP
+class RenderedStream {
+public:
+    RenderedStream(const WatermarkConfig& config, uint32_t width, uint32_t height)
+        : encoder_(config), columns_((width + 7) / 8), rows_((height + 7) / 8),
+          mb_width_((width + 15) / 16), mb_height_((height + 15) / 16),
+          offsets_(static_cast<size_t>(mb_width_) * mb_height_),
+          texture_(static_cast<size_t>(columns_) * rows_), rng_(3) {
+        encoder_.initialize(width, height, 30.0f);
+        std::uniform_real_distribution<float> content(12.0f, 18.0f);
+        for (auto& value : texture_) {
+            value = content(rng_);
+        }
+    }
+
+    /**
+     * @brief Activity of a clip frame showing the picture from (crop_x,
+     * crop_y) at the given scale, sampled at each clip block's centre
+     */
+    FrameAnalysis clipFrame(uint32_t frame_index, uint32_t clip_index, uint32_t clip_columns,
+                            uint32_t clip_rows, float scale, uint32_t crop_x, uint32_t crop_y) {
+        encoder_.renderQuantOffsets(frame_index, QuantOffsetPlane{offsets_.data(), mb_width_,
+                                                                   mb_height_});
+        std::normal_distribution<float> noise(0.0f, 2.0f);
+
+        FrameAnalysis frame{};
+        frame.frame_index = clip_index;
+        frame.weight = 1.0;
+        frame.scene_cut = false;
+        frame.schedule_index = clip_index;
+        frame.block_columns = clip_columns;
+        frame.block_rows = clip_rows;
+        frame.block_proxy.resize(static_cast<size_t>(clip_columns) * clip_rows);
+        for (uint32_t by = 0; by < clip_rows; ++by) {
+            uint32_t y = static_cast<uint32_t>((by * 8 + 4) / scale) + crop_y;
+            for (uint32_t bx = 0; bx < clip_columns; ++bx) {
+                uint32_t x = static_cast<uint32_t>((bx * 8 + 4) / scale) + crop_x;
+                float offset = offsets_[static_cast<size_t>(y / 16) * mb_width_ + x / 16];
+                frame.block_proxy[static_cast<size_t>(by) * clip_columns + bx] =
+                    texture_[static_cast<size_t>(y / 8) * columns_ + x / 8] - 4.0f * offset +
+                    noise(rng_);
+            }
+        }
+        return frame;
+    }
+
+private:
+    WatermarkEncoder encoder_;
+    uint32_t columns_;
+    uint32_t rows_;
+    uint32_t mb_width_;
+    uint32_t mb_height_;
+    std::vector<float> offsets_;
+    std::vector<float> texture_;
+    std::mt19937 rng_;
+};
+
+// What analyzeFrame() samples for a frame: the schedule at its index within
+// the clip, mapped onto the clip's own grid, as unit-variance deviations
+void addDirectEvidence(const EmbeddingSchedule& schedule, FrameAnalysis& frame) {
+    size_t capacity = schedule.maxBlocksPerFrame();
+    std::vector<uint16_t> x(capacity);
+    std::vector<uint16_t> y(capacity);
+    std::vector<int8_t> qp(capacity);
+    std::vector<uint16_t> channel(capacity);
+    uint32_t count = schedule.mapFrames(frame.schedule_index, 1, frame.block_columns * 8,
+                                        frame.block_rows * 8, x.data(), y.data(), qp.data(),
+                                        channel.data());
+
+    std::vector<double> samples;
+    double sum = 0.0;
+    double sum_sq = 0.0;
+    for (uint32_t i = 0; i < count; ++i) {
+        double sample = frame.block_proxy[static_cast<size_t>(y[i] / 8) * frame.block_columns +
+                                          x[i] / 8];
+        samples.push_back(sample);
+        if (qp[i] != 0 && channel[i] < kPayloadCodedBits) {
+            sum += sample;
+            sum_sq += sample * sample;
+        }
+    }
+
+    uint32_t carrying = 0;
+    for (uint32_t i = 0; i < count; ++i) {
+        carrying += qp[i] != 0 && channel[i] < kPayloadCodedBits;
+    }
+    frame.channel_evidence.assign(kPayloadCodedBits, 0.0f);
+    if (carrying < 2) {
+        return;
+    }
+    double mean = sum / carrying;
+    double scale = 1.0 / std::sqrt(std::max(1e-9, sum_sq / carrying - mean * mean));
+    for (uint32_t i = 0; i < count; ++i) {
+        if (qp[i] != 0 && channel[i] < kPayloadCodedBits) {
+            frame.channel_evidence[channel[i]] -=
+                static_cast<float>(qp[i] * (samples[i] - mean) * scale);
+        }
+    }
+}
+
+// Whether the frames' own evidence decodes to the payload without a search
+bool decodesDirectly(const std::vector<FrameAnalysis>& frames, const Payload& payload) {
+    std::vector<float> soft(kPayloadCodedBits, 0.0f);
+    for (const auto& frame : frames) {
+        for (uint32_t j = 0; j < kPayloadCodedBits; ++j) {
+            soft[j] += frame.channel_evidence[j];
+        }
+    }
+    Payload decoded;
+    SoftDecodeInfo info;
+    return decodePayloadSoft(soft.data(), decoded, &info) && info.agreement > 0.0f &&
+           decoded == payload;
+}
+
+WatermarkConfig makeWatermark() {
+    WatermarkConfig config;
+    config.payload = Payload(0x0123456789abcdefull, 0xfedcba9876543210ull);
+    config.seed = 4242;
+    config.block_density = 0.02f;
+    config.temporal_period = 30;
+    config.adaptive_embedding = false;
+    config.quality_threshold = 0.8f;
+    config.frame_budget_us = 0;
+    config.scene_cut_threshold = 0.0f;
+    config.window_frames = 0;
+    config.window_repeats = 1;
+    config.pilot_density = 0.0f;
+    config.marked_period_interval = 1;
+    config.enable_encryption = false;
+    return config;
+}
+
+ExtractionConfig matchingExtraction(const WatermarkConfig& watermark) {
+    ExtractionConfig config;
+    config.min_frames = 1;
+    config.max_frames = 0;
+    config.confidence_threshold = 0.5;
+    config.enable_debug = false;
+    config.model_path = "";
+    config.seed = watermark.seed;
+    config.block_density = watermark.block_density;
+    config.temporal_period = watermark.temporal_period;
+    config.adaptive_embedding = watermark.adaptive_embedding;
+    config.quality_threshold = watermark.quality_threshold;
+    config.reference_width = 0;
+    config.reference_height = 0;
+    config.scene_cut_threshold = watermark.scene_cut_threshold;
+    config.window_frames = watermark.window_frames;
+    config.window_repeats = watermark.window_repeats;
+    config.pilot_density = watermark.pilot_density;
+    config.marked_period_interval = watermark.marked_period_interval;
+    config.encryption_key = "";
+    return config;
+}
+
+} // namespace
+
+TEST(ExtractorSearchTest, ClipFromAnyOffsetDecodesThroughWindowSearch) {
+    const uint32_t width = 640;
+    const uint32_t height = 360;
+    WatermarkConfig watermark = makeWatermark();
+    watermark.window_frames = 90;
+    watermark.window_repeats = 2;
+    RenderedStream stream(watermark, width, height);
+    ExtractionConfig extraction = matchingExtraction(watermark);
+    auto schedule = EmbeddingSchedule::create(watermark.seed, watermark.block_density,
+                                              watermark.temporal_period, width, height, nullptr,
+                                              nullptr, watermark.window_frames,
+                                              watermark.window_repeats, 0.0f);
+
+    // A window's worth of frames cut from well into the stream, mid-cycle
+    const uint32_t start = 7 * schedule->cycle() + schedule->cycle() / 2 + 3;
+    std::vector<FrameAnalysis> frames;
+    for (uint32_t i = 0; i < watermark.window_frames; ++i) {
+        frames.push_back(stream.clipFrame(start + i, i, width / 8, height / 8, 1.0f, 0, 0));
+        addDirectEvidence(*schedule, frames.back());
+    }
+    EXPECT_FALSE(decodesDirectly(frames, watermark.payload));
+
+    WatermarkExtractor extractor(extraction);
+    ASSERT_TRUE(extractor.initialize());
+    DetectionResult result = extractor.extractWatermark(frames);
+    EXPECT_TRUE(result.detected);
+    EXPECT_EQ(result.payload, watermark.payload);
+}
+
+TEST(ExtractorSearchTest, CroppedRescaledClipDecodesOnlyThroughPilotLock) {
+    // The top rendition is 720p; the clip is a 2/3 rescale of the region
+    // starting at (48, 32), cut from mid-cycle
+    const uint32_t width = 1280;
+    const uint32_t height = 720;
+    const float scale = 2.0f / 3.0f;
+    WatermarkConfig watermark = makeWatermark();
+    watermark.temporal_period = 24;
+    watermark.block_density = 0.08f;
+    watermark.pilot_density = 0.1f;
+    RenderedStream stream(watermark, width, height);
+    ExtractionConfig extraction = matchingExtraction(watermark);
+    extraction.reference_width = width;
+    extraction.reference_height = height;
+    auto schedule = EmbeddingSchedule::create(watermark.seed, watermark.block_density,
+                                              watermark.temporal_period, width, height, nullptr,
+                                              nullptr, 0, 1, watermark.pilot_density);
+    ASSERT_TRUE(schedule->pilot().enabled());
+
+    const uint32_t start = 5 * schedule->cycle() + 13;
+    std::vector<FrameAnalysis> frames;
+    for (uint32_t i = 0; i < 4 * watermark.temporal_period; ++i) {
+        frames.push_back(stream.clipFrame(start + i, i, 102, 57, scale, 48, 32));
+        addDirectEvidence(*schedule, frames.back());
+    }
+    EXPECT_FALSE(decodesDirectly(frames, watermark.payload));
+
+    // Without a window there is no offset search, so only the lock can decode
+    WatermarkExtractor extractor(extraction);
+    ASSERT_TRUE(extractor.initialize());
+    DetectionResult result = extractor.extractWatermark(frames);
+    EXPECT_TRUE(result.detected);
+    EXPECT_EQ(result.payload, watermark.payload);
+    EXPECT_NE(extractor.getStats().find("Pilot locks: 1"), std::string::npos);
+}
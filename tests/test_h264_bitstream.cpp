@@ -0,0 +1,177 @@
+#include <gtest/gtest.h>
+#include <algorithm>
+#include <random>
+#include <vector>
+#include "bitstream/h264_bitstream.h"
+#include "bitstream/h264_cavlc.h"
+
+using namespace phantomframe;
+
+namespace {
+
+// Block with exactly total non-zero levels at random scan positions
+std::vector<int32_t> makeBlock(std::mt19937& rng, uint32_t max_coeff, uint32_t total, int32_t max_level) {
+    std::vector<int32_t> block(max_coeff, 0);
+    std::vector<uint32_t> positions(max_coeff);
+    for (uint32_t i = 0; i < max_coeff; ++i) {
+        positions[i] = i;
+    }
+    std::shuffle(positions.begin(), positions.end(), rng);
+    std::uniform_int_distribution<int32_t> magnitude(1, max_level);
+    for (uint32_t i = 0; i < total; ++i) {
+        // Mostly small levels, as trailing ones and suffix growth depend on them
+        int32_t level = (rng() % 3 == 0) ? magnitude(rng) : 1 + static_cast<int32_t>(rng() % 3);
+        block[positions[i]] = (rng() & 1) ? level : -level;
+    }
+    return block;
+}
+
+} // namespace
+
+TEST(H264BitstreamTest, ExpGolombRoundTrip) {
+    BitWriter writer;
+    std::vector<uint32_t> unsigned_values = {0, 1, 2, 3, 7, 8, 254, 255, 65535, 1u << 20, 0xFFFFFFFEu};
+    std::vector<int32_t> signed_values = {0, 1, -1, 2, -2, 100, -100, 32767, -32768};
+    for (uint32_t value : unsigned_values) {
+        writer.putUE(value);
+    }
+    for (int32_t value : signed_values) {
+        writer.putSE(value);
+    }
+    writer.putBits(5, 0x15);
+    writer.putTrailingBits();
+
+    const std::vector<uint8_t>& bytes = writer.bytes();
+    BitReader reader(bytes.data(), bytes.size());
+    for (uint32_t value : unsigned_values) {
+        EXPECT_EQ(reader.readUE(), value);
+    }
+    for (int32_t value : signed_values) {
+        EXPECT_EQ(reader.readSE(), value);
+    }
+    EXPECT_EQ(reader.readBits(5), 0x15u);
+    EXPECT_FALSE(reader.moreRbspData());
+    EXPECT_FALSE(reader.overrun());
+}
+
+TEST(H264BitstreamTest, ReadsPastEndSetOverrun) {
+    const uint8_t data[2] = {0xFF, 0x80};
+    BitReader reader(data, sizeof(data));
+    EXPECT_EQ(reader.readBits(12), 0xFF8u);
+    EXPECT_FALSE(reader.overrun());
+    reader.readBits(8);
+    EXPECT_TRUE(reader.overrun());
+}
+
+TEST(H264BitstreamTest, CopyBitsAtAnyAlignment) {
+    std::mt19937 rng(3);
+    std::vector<uint8_t> source(64);
+    for (auto& byte : source) {
+        byte = static_cast<uint8_t>(rng());
+    }
+    BitReader reader(source.data(), source.size());
+
+    for (size_t begin : {0u, 3u, 8u, 13u}) {
+        for (size_t end : {begin, begin + 1, begin + 29, static_cast<size_t>(500)}) {
+            BitWriter writer;
+            writer.putBits(3, 5);
+            writer.copyBits(reader, begin, end);
+            writer.alignZero();
+            const std::vector<uint8_t>& bytes = writer.bytes();
+
+            BitReader copy(bytes.data(), bytes.size());
+            ASSERT_EQ(copy.readBits(3), 5u);
+            BitReader original(source.data(), source.size());
+            original.seek(begin);
+            for (size_t bit = begin; bit < end; ++bit) {
+                ASSERT_EQ(copy.readBits(1), original.readBits(1)) << begin << "-" << end << " at " << bit;
+            }
+        }
+    }
+}
+
+TEST(H264BitstreamTest, EmulationPreventionRoundTrip) {
+    std::vector<uint8_t> rbsp = {0x00, 0x00, 0x00, 0x00, 0x00, 0x01, 0x00, 0x00, 0x02,
+                                 0x00, 0x00, 0x03, 0x00, 0x00, 0x04, 0x12, 0x00, 0x00};
+    std::vector<uint8_t> escaped;
+    appendEscaped(rbsp.data(), rbsp.size(), escaped);
+
+    // No start code prefix or zero run may remain in the payload
+    for (size_t i = 2; i < escaped.size(); ++i) {
+        EXPECT_FALSE(escaped[i - 2] == 0 && escaped[i - 1] == 0 && escaped[i] <= 2)
+            << "at " << i;
+    }
+    EXPECT_NE(escaped.back(), 0x00);
+
+    std::vector<uint8_t> unescaped;
+    unescapeRbsp(escaped.data(), escaped.size(), unescaped);
+    EXPECT_EQ(unescaped, rbsp);
+}
+
+TEST(H264BitstreamTest, FindsNalUnits) {
+    const std::vector<uint8_t> stream = {
+        0x00, 0x00, 0x00, 0x01, 0x67, 0x42, 0x00,       // 4-byte start code
+        0x00, 0x00, 0x01, 0x68, 0xCE,                   // 3-byte start code
+        0x00, 0x00, 0x00, 0x00, 0x01, 0x65, 0x88, 0x00, // trailing_zero_8bits before it
+        0x00
+    };
+    std::vector<NalRange> nals;
+    findNalUnits(stream.data(), stream.size(), nals);
+
+    ASSERT_EQ(nals.size(), 3u);
+    EXPECT_EQ(nals[0].begin, 4u);
+    EXPECT_EQ(nals[0].end, 6u);
+    EXPECT_EQ(nals[1].begin, 10u);
+    EXPECT_EQ(nals[1].end, 12u);
+    EXPECT_EQ(nals[2].begin, 17u);
+    EXPECT_EQ(nals[2].end, 19u);
+}
+
+TEST(H264CavlcTest, ResidualBlocksRoundTrip) {
+    std::mt19937 rng(7);
+    const int contexts[] = {kChromaDcNc, 0, 1, 2, 3, 4, 6, 8, 12, 16};
+    const uint32_t sizes[] = {4, 15, 16};
+
+    for (int nc : contexts) {
+        for (uint32_t max_coeff : sizes) {
+            if ((nc == kChromaDcNc) != (max_coeff == 4)) {
+                continue;
+            }
+            BitWriter writer;
+            std::vector<std::vector<int32_t>> blocks;
+            for (int i = 0; i < 200; ++i) {
+                uint32_t total = rng() % (max_coeff + 1);
+                blocks.push_back(makeBlock(rng, max_coeff, total, i % 10 == 0 ? 3000 : 40));
+                ASSERT_EQ(writeResidualBlock(writer, nc, max_coeff, blocks.back().data()), total);
+            }
+            writer.putTrailingBits();
+
+            const std::vector<uint8_t>& bytes = writer.bytes();
+            BitReader reader(bytes.data(), bytes.size());
+            std::vector<int32_t> decoded(max_coeff);
+            for (const auto& block : blocks) {
+                int total = readResidualBlock(reader, nc, max_coeff, decoded.data());
+                ASSERT_GE(total, 0) << "nC " << nc;
+                ASSERT_EQ(decoded, block) << "nC " << nc << " maxNumCoeff " << max_coeff;
+            }
+            EXPECT_FALSE(reader.moreRbspData());
+        }
+    }
+}
+
+TEST(H264CavlcTest, HighLevelsUseExtendedEscape) {
+    int32_t block[16] = {};
+    block[0] = 30000;
+    block[3] = -4100;
+
+    BitWriter writer;
+    writeResidualBlock(writer, 0, 16, block);
+    writer.putTrailingBits();
+    const std::vector<uint8_t>& bytes = writer.bytes();
+
+    BitReader reader(bytes.data(), bytes.size());
+    int32_t decoded[16];
+    ASSERT_EQ(readResidualBlock(reader, 0, 16, decoded), 2);
+    EXPECT_EQ(decoded[0], 30000);
+    EXPECT_EQ(decoded[3], -4100);
+}
@@ -0,0 +1,292 @@
+#include <gtest/gtest.h>
+#include <cstdlib>
+#include <random>
+#include <vector>
+#include "bitstream/h264_bitstream.h"
+#include "bitstream/h264_cavlc.h"
+#include "bitstream/h264_rewriter.h"
+
+using namespace phantomframe;
+
+namespace {
+
+constexpr uint32_t kWidthMbs = 20;
+constexpr uint32_t kHeightMbs = 12;
+constexpr uint32_t kCoeffs = 3;         // Non-zero levels of every 4x4 AC block
+constexpr uint32_t kSkippedTail = 3;    // Skipped macroblocks ending each P slice
+
+RewriteConfig makeConfig(float density, bool reencode_unmarked) {
+    RewriteConfig config{};
+    config.watermark.payload = 0x0123456789ABCDEFull;
+    config.watermark.seed = 12345;
+    config.watermark.block_density = density;
+    config.watermark.temporal_period = 4;
+    config.watermark.quality_threshold = 0.5f;
+    config.fps = 25.0f;
+    config.reencode_unmarked = reencode_unmarked;
+    return config;
+}
+
+void appendNal(uint8_t header, BitWriter& writer, std::vector<uint8_t>& stream) {
+    writer.putTrailingBits();
+    const std::vector<uint8_t>& rbsp = writer.bytes();
+    stream.insert(stream.end(), {0x00, 0x00, 0x00, 0x01, header});
+    appendEscaped(rbsp.data(), rbsp.size(), stream);
+    writer.clear();
+}
+
+void writeBlock(BitWriter& writer, std::mt19937& rng, int nc, uint32_t max_coeff, uint32_t total) {
+    int32_t levels[16] = {};
+    for (uint32_t i = 0; i < total; ++i) {
+        uint32_t pos;
+        do {
+            pos = rng() % max_coeff;
+        } while (levels[pos] != 0);
+        int32_t level = 1 + static_cast<int32_t>(rng() % 24);
+        levels[pos] = (rng() & 1) ? level : -level;
+    }
+    writeResidualBlock(writer, nc, max_coeff, levels);
+}
+
+/**
+ * Residual of one macroblock. Every AC block has kCoeffs levels, so every
+ * block's nC is kCoeffs except the top-left blocks of macroblock 0, whose
+ * neighbours are all unavailable.
+ */
+void writeResidual(BitWriter& writer, std::mt19937& rng, uint32_t mb, bool intra16x16) {
+    int origin_nc = mb == 0 ? 0 : static_cast<int>(kCoeffs);
+    if (intra16x16) {
+        writeBlock(writer, rng, origin_nc, 16, 1 + rng() % 16);
+    }
+    for (uint32_t blk = 0; blk < 16; ++blk) {
+        writeBlock(writer, rng, blk == 0 ? origin_nc : static_cast<int>(kCoeffs),
+                   intra16x16 ? 15 : 16, kCoeffs);
+    }
+    for (int c = 0; c < 2; ++c) {
+        writeBlock(writer, rng, kChromaDcNc, 4, rng() % 5);
+    }
+    for (int c = 0; c < 2; ++c) {
+        for (uint32_t blk = 0; blk < 4; ++blk) {
+            writeBlock(writer, rng, blk == 0 ? origin_nc : static_cast<int>(kCoeffs), 15, kCoeffs);
+        }
+    }
+}
+
+/**
+ * Baseline CAVLC stream: an IDR picture of Intra16x16 macroblocks followed
+ * by P pictures of P_L0_16x16 macroblocks, one access unit per entry.
+ */
+std::vector<std::vector<uint8_t>> makeStream(uint32_t pictures, bool cabac_pps) {
+    std::mt19937 rng(99);
+    std::vector<std::vector<uint8_t>> units(pictures);
+    BitWriter writer;
+
+    // SPS: Baseline, POC type 0 with 6-bit lsb
+    writer.putBits(8, 66);
+    writer.putBits(16, 30);
+    writer.putUE(0);
+    writer.putUE(0);
+    writer.putUE(0);
+    writer.putUE(2);
+    writer.putUE(1);
+    writer.putFlag(false);
+    writer.putUE(kWidthMbs - 1);
+    writer.putUE(kHeightMbs - 1);
+    writer.putFlag(true);
+    writer.putFlag(true);
+    writer.putFlag(false);
+    writer.putFlag(false);
+    appendNal(0x67, writer, units[0]);
+
+    // PPS
+    writer.putUE(0);
+    writer.putUE(0);
+    writer.putFlag(cabac_pps);
+    writer.putFlag(false);
+    writer.putUE(0);
+    writer.putUE(0);
+    writer.putUE(0);
+    writer.putFlag(false);
+    writer.putBits(2, 0);
+    writer.putSE(0);
+    writer.putSE(0);
+    writer.putSE(0);
+    writer.putFlag(true);
+    writer.putFlag(false);
+    writer.putFlag(false);
+    appendNal(0x68, writer, units[0]);
+
+    for (uint32_t picture = 0; picture < pictures; ++picture) {
+        bool idr = picture == 0;
+        writer.putUE(0);
+        writer.putUE(idr ? 7 : 5);
+        writer.putUE(0);
+        writer.putBits(4, picture & 15);
+        if (idr) {
+            writer.putUE(0);
+        }
+        writer.putBits(6, (picture * 2) & 63);
+        if (!idr) {
+            writer.putFlag(false);  // num_ref_idx_active_override_flag
+            writer.putFlag(false);  // ref_pic_list_modification_flag_l0
+        }
+        writer.putBits(idr ? 2 : 1, 0);
+        if (cabac_pps && !idr) {
+            writer.putUE(0);        // cabac_init_idc
+        }
+        writer.putSE(2);            // SliceQP 28
+        writer.putUE(1);            // Deblocking disabled
+
+        const uint32_t coded = kWidthMbs * kHeightMbs - (idr ? 0 : kSkippedTail);
+        for (uint32_t mb = 0; mb < coded; ++mb) {
+            if (idr) {
+                writer.putUE(21);   // I_16x16_0_2_1: AC luma and chroma coded
+                writer.putUE(0);
+            } else {
+                writer.putUE(0);    // mb_skip_run
+                writer.putUE(0);    // P_L0_16x16
+                writer.putSE(static_cast<int32_t>(rng() % 9) - 4);
+                writer.putSE(static_cast<int32_t>(rng() % 9) - 4);
+                writer.putUE(12);   // coded_block_pattern 47
+            }
+            writer.putSE(static_cast<int32_t>(rng() % 5) - 2);
+            writeResidual(writer, rng, mb, idr);
+        }
+        if (!idr) {
+            writer.putUE(kSkippedTail);
+        }
+        appendNal(idr ? 0x65 : 0x41, writer, units[picture]);
+    }
+    return units;
+}
+
+} // namespace
+
+TEST(H264RewriterTest, ReencodeIsBitExact) {
+    auto units = makeStream(6, false);
+    H264Rewriter rewriter(makeConfig(0.0f, true));
+
+    std::vector<uint8_t> out;
+    for (const auto& unit : units) {
+        ASSERT_TRUE(rewriter.rewriteAnnexB(unit.data(), unit.size(), out));
+        EXPECT_EQ(out, unit);
+    }
+
+    RewriteStats stats = rewriter.getRewriteStats();
+    EXPECT_EQ(stats.pictures, 6u);
+    EXPECT_EQ(stats.slices_rewritten, 6u);
+    EXPECT_EQ(stats.slices_failed, 0u);
+    EXPECT_EQ(stats.macroblocks_marked, 0u);
+}
+
+TEST(H264RewriterTest, UnmarkedPicturesPassThrough) {
+    auto units = makeStream(4, false);
+    H264Rewriter rewriter(makeConfig(0.0f, false));
+
+    std::vector<uint8_t> out;
+    for (const auto& unit : units) {
+        ASSERT_TRUE(rewriter.rewriteAnnexB(unit.data(), unit.size(), out));
+        EXPECT_EQ(out, unit);
+    }
+    EXPECT_EQ(rewriter.getRewriteStats().slices_copied, 4u);
+    EXPECT_EQ(rewriter.getRewriteStats().slices_rewritten, 0u);
+}
+
+TEST(H264RewriterTest, MarksChangeOnlyMacroblockQp) {
+    const uint32_t pictures = 8;
+    auto units = makeStream(pictures, false);
+    H264Rewriter original(makeConfig(0.0f, true));
+    H264Rewriter marker(makeConfig(0.05f, false));
+    H264Rewriter checker(makeConfig(0.0f, true));
+
+    uint64_t differing = 0;
+    std::vector<uint8_t> unchanged, marked, reparsed;
+    for (const auto& unit : units) {
+        ASSERT_TRUE(original.rewriteAnnexB(unit.data(), unit.size(), unchanged));
+        ASSERT_TRUE(marker.rewriteAnnexB(unit.data(), unit.size(), marked));
+
+        // The marked stream parses, and re-encodes to itself
+        ASSERT_TRUE(checker.rewriteAnnexB(marked.data(), marked.size(), reparsed));
+        EXPECT_EQ(reparsed, marked);
+        if (marker.macroblockQp()[0] != 0xFF) {
+            EXPECT_EQ(checker.macroblockQp(), marker.macroblockQp());
+        }
+
+        const auto& before = original.macroblockQp();
+        const auto& after = checker.macroblockQp();
+        ASSERT_EQ(before.size(), after.size());
+        for (size_t mb = 0; mb < before.size(); ++mb) {
+            if (before[mb] != after[mb]) {
+                differing++;
+                EXPECT_LE(std::abs(before[mb] - after[mb]), 2) << "macroblock " << mb;
+            }
+        }
+    }
+
+    RewriteStats stats = marker.getRewriteStats();
+    EXPECT_GT(stats.macroblocks_marked, 0u);
+    EXPECT_EQ(differing, stats.macroblocks_marked);
+    EXPECT_EQ(stats.slices_failed, 0u);
+    EXPECT_EQ(checker.getRewriteStats().slices_failed, 0u);
+    EXPECT_EQ(marker.lastFrameIndex(), pictures - 1);
+}
+
+TEST(H264RewriterTest, CabacSlicesAreCounted) {
+    auto units = makeStream(4, true);
+    H264Rewriter rewriter(makeConfig(0.05f, false));
+
+    std::vector<uint8_t> out;
+    for (const auto& unit : units) {
+        ASSERT_TRUE(rewriter.rewriteAnnexB(unit.data(), unit.size(), out));
+        EXPECT_EQ(out, unit);
+    }
+    RewriteStats stats = rewriter.getRewriteStats();
+    EXPECT_EQ(stats.slices_rewritten, 0u);
+    EXPECT_GT(stats.slices_unsupported, 0u);
+}
+
+TEST(H264RewriterTest, LengthPrefixedSamples) {
+    auto units = makeStream(3, false);
+    H264Rewriter annexb(makeConfig(0.05f, false));
+    H264Rewriter mp4(makeConfig(0.05f, false));
+
+    // Parameter sets go to the avcC record, slices to 4-byte prefixed samples
+    std::vector<NalRange> nals;
+    findNalUnits(units[0].data(), units[0].size(), nals);
+    ASSERT_EQ(nals.size(), 3u);
+    std::vector<uint8_t> avcc = {1, 66, 0, 30, 0xFF, 0xE1};
+    for (int i = 0; i < 2; ++i) {
+        size_t length = nals[i].end - nals[i].begin;
+        avcc.push_back(static_cast<uint8_t>(length >> 8));
+        avcc.push_back(static_cast<uint8_t>(length));
+        avcc.insert(avcc.end(), units[0].begin() + nals[i].begin, units[0].begin() + nals[i].end);
+        if (i == 0) {
+            avcc.push_back(1);
+        }
+    }
+    ASSERT_TRUE(mp4.loadParameterSets(avcc.data(), avcc.size()));
+
+    std::vector<uint8_t> expected, sample, out;
+    for (size_t picture = 0; picture < units.size(); ++picture) {
+        ASSERT_TRUE(annexb.rewriteAnnexB(units[picture].data(), units[picture].size(), expected));
+
+        // The slice is the last NAL unit of each access unit
+        findNalUnits(units[picture].data(), units[picture].size(), nals);
+        const NalRange& slice = nals.back();
+        size_t length = slice.end - slice.begin;
+        sample = {static_cast<uint8_t>(length >> 24), static_cast<uint8_t>(length >> 16),
+                  static_cast<uint8_t>(length >> 8), static_cast<uint8_t>(length)};
+        sample.insert(sample.end(), units[picture].begin() + slice.begin,
+                      units[picture].begin() + slice.end);
+        ASSERT_TRUE(mp4.rewriteLengthPrefixed(sample.data(), sample.size(), 4, out));
+
+        findNalUnits(expected.data(), expected.size(), nals);
+        std::vector<uint8_t> expected_slice(expected.begin() + nals.back().begin,
+                                            expected.begin() + nals.back().end);
+        ASSERT_GE(out.size(), 4u);
+        size_t out_length = (static_cast<size_t>(out[0]) << 24) | (out[1] << 16) | (out[2] << 8) | out[3];
+        EXPECT_EQ(out_length, out.size() - 4);
+        EXPECT_EQ(std::vector<uint8_t>(out.begin() + 4, out.end()), expected_slice);
+    }
+    EXPECT_EQ(mp4.getRewriteStats().macroblocks_marked, annexb.getRewriteStats().macroblocks_marked);
+}
@@ -0,0 +1,177 @@
+#include <gtest/gtest.h>
+#include <vector>
+#include "bitstream/h264_bitstream.h"
+#include "bitstream/h264_splice.h"
+
+using namespace phantomframe;
+
+namespace {
+
+// Just enough of an SPS or PPS to carry its id
+std::vector<uint8_t> makeParameterSet(bool sps, uint32_t id) {
+    BitWriter writer;
+    writer.putBits(8, sps ? 0x67 : 0x68);
+    if (sps) {
+        writer.putBits(8, 77);
+        writer.putBits(8, 0);
+        writer.putBits(8, 30);
+        writer.putUE(id);
+        writer.putUE(0);
+    } else {
+        writer.putUE(id);
+        writer.putUE(0);
+        writer.putBits(1, 0);
+    }
+    writer.putTrailingBits();
+    return writer.bytes();
+}
+
+std::vector<uint8_t> makeAvcC(const ParameterSets& sets, const std::vector<uint8_t>& trailer) {
+    std::vector<uint8_t> avcc = {1, 77, 0, 30, 0xFF, static_cast<uint8_t>(0xE0 | sets.sps.size())};
+    for (const auto* list : {&sets.sps, &sets.pps}) {
+        if (list == &sets.pps) {
+            avcc.push_back(static_cast<uint8_t>(sets.pps.size()));
+        }
+        for (const auto& nal : *list) {
+            avcc.push_back(static_cast<uint8_t>(nal.size() >> 8));
+            avcc.push_back(static_cast<uint8_t>(nal.size()));
+            avcc.insert(avcc.end(), nal.begin(), nal.end());
+        }
+    }
+    avcc.insert(avcc.end(), trailer.begin(), trailer.end());
+    return avcc;
+}
+
+} // namespace
+
+TEST(H264SpliceTest, DetectsPacketFraming) {
+    ParameterSets sets;
+    sets.sps.push_back(makeParameterSet(true, 0));
+    sets.pps.push_back(makeParameterSet(false, 0));
+    std::vector<uint8_t> avcc = makeAvcC(sets, {});
+    EXPECT_EQ(nalLengthSize(avcc.data(), avcc.size()), 4u);
+
+    avcc[4] = 0xFD;
+    EXPECT_EQ(nalLengthSize(avcc.data(), avcc.size()), 2u);
+
+    const uint8_t annexb[] = {0, 0, 0, 1, 0x67, 0x4D, 0x00, 0x1E};
+    EXPECT_EQ(nalLengthSize(annexb, sizeof(annexb)), 0u);
+    EXPECT_EQ(nalLengthSize(nullptr, 0), 0u);
+}
+
+TEST(H264SpliceTest, FindsIdrInEitherFraming) {
+    // SEI then an IDR slice; then an SEI and a non-IDR slice
+    const std::vector<uint8_t> idr_annexb = {0, 0, 0, 1, 0x06, 0x05, 0x80, 0, 0, 1, 0x65, 0x88, 0x84};
+    const std::vector<uint8_t> p_annexb = {0, 0, 0, 1, 0x06, 0x05, 0x80, 0, 0, 1, 0x41, 0x9A, 0x02};
+    EXPECT_TRUE(isIdrAccessUnit(idr_annexb.data(), idr_annexb.size(), 0));
+    EXPECT_FALSE(isIdrAccessUnit(p_annexb.data(), p_annexb.size(), 0));
+
+    std::vector<uint8_t> idr_prefixed;
+    std::vector<uint8_t> p_prefixed;
+    ASSERT_TRUE(annexBToLengthPrefixed(idr_annexb.data(), idr_annexb.size(), 4, idr_prefixed));
+    ASSERT_TRUE(annexBToLengthPrefixed(p_annexb.data(), p_annexb.size(), 4, p_prefixed));
+    EXPECT_EQ(idr_prefixed.size(), 2u * 4 + 3 + 3);
+    EXPECT_TRUE(isIdrAccessUnit(idr_prefixed.data(), idr_prefixed.size(), 4));
+    EXPECT_FALSE(isIdrAccessUnit(p_prefixed.data(), p_prefixed.size(), 4));
+}
+
+TEST(H264SpliceTest, LengthPrefixedRoundTrip) {
+    const std::vector<uint8_t> annexb = {0, 0, 0, 1, 0x09, 0xF0, 0, 0, 1, 0x65, 0x88, 0x00, 0x03, 0x01,
+                                         0, 0, 1, 0x41, 0x9A};
+    for (uint32_t length_size : {1u, 2u, 4u}) {
+        std::vector<uint8_t> prefixed;
+        ASSERT_TRUE(annexBToLengthPrefixed(annexb.data(), annexb.size(), length_size, prefixed));
+
+        std::vector<NalRange> expected;
+        std::vector<NalRange> nals;
+        findNalUnits(annexb.data(), annexb.size(), expected);
+        ASSERT_TRUE(splitNalUnits(prefixed.data(), prefixed.size(), length_size, nals));
+        ASSERT_EQ(nals.size(), expected.size());
+        for (size_t i = 0; i < nals.size(); ++i) {
+            EXPECT_EQ(std::vector<uint8_t>(prefixed.begin() + nals[i].begin, prefixed.begin() + nals[i].end),
+                      std::vector<uint8_t>(annexb.begin() + expected[i].begin, annexb.begin() + expected[i].end));
+        }
+
+        // A length running past the packet is reported
+        prefixed.pop_back();
+        EXPECT_FALSE(splitNalUnits(prefixed.data(), prefixed.size(), length_size, nals));
+    }
+
+    // 300 bytes do not fit a one-byte length
+    std::vector<uint8_t> long_nal = {0, 0, 1, 0x65};
+    long_nal.resize(304, 0x11);
+    std::vector<uint8_t> prefixed;
+    EXPECT_FALSE(annexBToLengthPrefixed(long_nal.data(), long_nal.size(), 1, prefixed));
+}
+
+TEST(H264SpliceTest, ReadsParameterSetIds) {
+    std::vector<uint8_t> sps = makeParameterSet(true, 3);
+    std::vector<uint8_t> pps = makeParameterSet(false, 17);
+    EXPECT_EQ(parameterSetId(sps.data(), sps.size()), 3);
+    EXPECT_EQ(parameterSetId(pps.data(), pps.size()), 17);
+
+    const uint8_t slice[] = {0x65, 0x88};
+    EXPECT_EQ(parameterSetId(slice, sizeof(slice)), -1);
+
+    ParameterSets sets;
+    EXPECT_EQ(unusedParameterSetId(sets), 31);
+    sets.sps.push_back(makeParameterSet(true, 31));
+    sets.pps.push_back(makeParameterSet(false, 30));
+    sets.pps.push_back(makeParameterSet(false, 0));
+    EXPECT_EQ(unusedParameterSetId(sets), 29);
+}
+
+TEST(H264SpliceTest, AppendsParameterSetsToAvcC) {
+    ParameterSets source;
+    source.sps.push_back(makeParameterSet(true, 0));
+    source.pps.push_back(makeParameterSet(false, 0));
+    source.pps.push_back(makeParameterSet(false, 1));
+    // High profile trailer: chroma format, bit depths, no SPS extensions
+    const std::vector<uint8_t> trailer = {0xFD, 0xF8, 0xF8, 0x00};
+    std::vector<uint8_t> avcc = makeAvcC(source, trailer);
+
+    ParameterSets extra;
+    extra.sps.push_back(makeParameterSet(true, 31));
+    extra.pps.push_back(makeParameterSet(false, 31));
+
+    std::vector<uint8_t> merged;
+    ASSERT_TRUE(appendParameterSets(avcc.data(), avcc.size(), extra, merged));
+    EXPECT_EQ(merged.size(), avcc.size() + 4 + extra.sps[0].size() + extra.pps[0].size());
+    EXPECT_EQ(std::vector<uint8_t>(merged.begin(), merged.begin() + 5),
+              std::vector<uint8_t>(avcc.begin(), avcc.begin() + 5));
+    EXPECT_EQ(std::vector<uint8_t>(merged.end() - 4, merged.end()), trailer);
+    EXPECT_EQ(nalLengthSize(merged.data(), merged.size()), 4u);
+
+    ParameterSets read;
+    ASSERT_TRUE(readParameterSets(merged.data(), merged.size(), read));
+    ASSERT_EQ(read.sps.size(), 2u);
+    ASSERT_EQ(read.pps.size(), 3u);
+    EXPECT_EQ(read.sps[0], source.sps[0]);
+    EXPECT_EQ(read.sps[1], extra.sps[0]);
+    EXPECT_EQ(read.pps[1], source.pps[1]);
+    EXPECT_EQ(read.pps[2], extra.pps[0]);
+
+    // Truncated extradata is rejected
+    EXPECT_FALSE(appendParameterSets(avcc.data(), 12, extra, merged));
+}
+
+TEST(H264SpliceTest, AppendsParameterSetsToAnnexB) {
+    std::vector<uint8_t> sps = makeParameterSet(true, 0);
+    std::vector<uint8_t> extradata = {0, 0, 0, 1};
+    extradata.insert(extradata.end(), sps.begin(), sps.end());
+
+    ParameterSets extra;
+    extra.sps.push_back(makeParameterSet(true, 31));
+    extra.pps.push_back(makeParameterSet(false, 31));
+
+    std::vector<uint8_t> merged;
+    ASSERT_TRUE(appendParameterSets(extradata.data(), extradata.size(), extra, merged));
+    EXPECT_EQ(nalLengthSize(merged.data(), merged.size()), 0u);
+
+    ParameterSets read;
+    ASSERT_TRUE(readParameterSets(merged.data(), merged.size(), read));
+    ASSERT_EQ(read.sps.size(), 2u);
+    ASSERT_EQ(read.pps.size(), 1u);
+    EXPECT_EQ(read.sps[1], extra.sps[0]);
+    EXPECT_EQ(read.pps[0], extra.pps[0]);
+}
@@ -92,6 +92,17 @@ std::vector<uint8_t> TestHelpers::generateRandomData(size_t size) {
     return data;
 }
 
+std::vector<uint8_t> TestHelpers::generateNoise(size_t size, uint32_t seed) {
+    std::mt19937 generator(seed);
+    
+    std::vector<uint8_t> data(size);
+    for (auto& value : data) {
+        value = static_cast<uint8_t>(generator());
+    }
+    
+    return data;
+}
+
 std::string TestHelpers::createTempTestFile(const std::string& prefix, 
                                            const std::string& extension,
                                            const std::string& content) {
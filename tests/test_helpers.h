@@ -41,6 +41,14 @@ public:
      */
     static std::vector<uint8_t> generateRandomData(size_t size);
     
+    /**
+     * @brief Generate reproducible random bytes, e.g. noise for a luma plane
+     * @param size Size of data to generate
+     * @param seed Seed; the same seed always gives the same bytes
+     * @return Vector of random bytes
+     */
+    static std::vector<uint8_t> generateNoise(size_t size, uint32_t seed);
+    
     /**
      * @brief Create a temporary test file
      * @param prefix File prefix
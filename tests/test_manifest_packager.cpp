@@ -0,0 +1,242 @@
+#include <gtest/gtest.h>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "common/utils.h"
+#include "packager/manifest_packager.h"
+
+using namespace phantomframe;
+
+namespace {
+
+// Media playlist of one variant as the HLS muxer writes it for fixed GOPs
+std::string makeHlsPlaylist(uint32_t segments) {
+    std::ostringstream out;
+    out << "#EXTM3U\n#EXT-X-VERSION:7\n#EXT-X-TARGETDURATION:4\n"
+        << "#EXT-X-MEDIA-SEQUENCE:0\n#EXT-X-PLAYLIST-TYPE:VOD\n"
+        << "#EXT-X-MAP:URI=\"init.mp4\"\n";
+    for (uint32_t i = 0; i < segments; ++i) {
+        out << "#EXTINF:4.000000,\nstream" << i << ".m4s\n";
+    }
+    out << "#EXT-X-ENDLIST\n";
+    return out.str();
+}
+
+// SegmentList MPD with two renditions
+std::string makeDashMpd(uint32_t segments) {
+    std::ostringstream out;
+    out << "<?xml version=\"1.0\"?>\n<MPD type=\"static\">\n<Period>\n<AdaptationSet>\n";
+    for (uint32_t r = 0; r < 2; ++r) {
+        out << "<Representation id=\"" << r << "\">\n<SegmentList duration=\"4\">\n"
+            << "<Initialization sourceURL=\"init-" << r << ".m4s\"/>\n";
+        for (uint32_t i = 0; i < segments; ++i) {
+            out << "<SegmentURL media=\"chunk-" << r << "-" << i << ".m4s\"/>\n";
+        }
+        out << "</SegmentList>\n</Representation>\n";
+    }
+    out << "</AdaptationSet>\n</Period>\n</MPD>\n";
+    return out.str();
+}
+
+// Variant of each segment reference in a packaged playlist, in order
+std::vector<uint32_t> servedVariants(const std::string& playlist, const std::string& marker_a,
+                                     const std::string& marker_b) {
+    std::vector<uint32_t> variants;
+    std::istringstream in(playlist);
+    std::string line;
+    while (std::getline(in, line)) {
+        if (line.find(marker_a) != std::string::npos) {
+            variants.push_back(0);
+        }
+        else if (line.find(marker_b) != std::string::npos) {
+            variants.push_back(1);
+        }
+    }
+    return variants;
+}
+
+void writeFile(const std::filesystem::path& path, const std::string& text) {
+    std::ofstream out(path, std::ios::binary);
+    out << text;
+}
+
+} // namespace
+
+TEST(ManifestPackagerTest, VariantPayloadsDifferInManyChannelBits) {
+    Payload content(0x0123456789ABCDEFull, 0xFEDCBA9876543210ull);
+    Payload a = variantPayload(content, 0);
+    Payload b = variantPayload(content, 1);
+    EXPECT_EQ(a.high(), b.high());
+    EXPECT_EQ(a.low() ^ b.low(), 1u);
+
+    CodedPayload coded_a;
+    CodedPayload coded_b;
+    encodePayload(a, coded_a);
+    encodePayload(b, coded_b);
+
+    uint32_t differing = 0;
+    std::vector<float> soft(kPayloadCodedBits);
+    for (uint32_t j = 0; j < kPayloadCodedBits; ++j) {
+        differing += coded_a[j] != coded_b[j];
+        soft[j] = coded_b[j] ? -0.1f : 0.1f;
+    }
+    EXPECT_GT(differing, kPayloadCodedBits / 8);
+
+    EXPECT_LT(segmentVariantEvidence(soft.data(), coded_a, coded_b), 0.0f);
+    EXPECT_GT(segmentVariantEvidence(soft.data(), coded_b, coded_a), 0.0f);
+}
+
+TEST(ManifestPackagerTest, PackagesHlsSessionsFromFiles) {
+    std::filesystem::path dir = std::filesystem::temp_directory_path() / "phantomframe_packager_test";
+    std::filesystem::create_directories(dir / "A");
+    std::filesystem::create_directories(dir / "B");
+    const uint32_t segments = kPayloadCodedBits + 4;
+    writeFile(dir / "A" / "stream.m3u8", makeHlsPlaylist(segments));
+    writeFile(dir / "B" / "stream.m3u8", makeHlsPlaylist(segments));
+
+    ManifestPackager packager;
+    ASSERT_TRUE(packager.load((dir / "A" / "stream.m3u8").string(),
+                              (dir / "B" / "stream.m3u8").string(), "A/", "B/"));
+    EXPECT_EQ(packager.format(), ManifestFormat::HLS);
+    EXPECT_EQ(packager.segmentCount(), segments);
+
+    SessionSequence session("session-42", "secret");
+    ASSERT_TRUE(packager.write(session, (dir / "session.m3u8").string()));
+
+    std::ifstream in(dir / "session.m3u8");
+    std::string playlist((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    std::filesystem::remove_all(dir);
+
+    // Shared tags kept once, shared references resolved against variant A
+    EXPECT_EQ(playlist.find("#EXTM3U\n"), 0u);
+    EXPECT_NE(playlist.find("#EXT-X-MAP:URI=\"A/init.mp4\""), std::string::npos);
+    EXPECT_NE(playlist.find("#EXT-X-ENDLIST"), std::string::npos);
+
+    std::vector<uint32_t> served = servedVariants(playlist, "A/stream", "B/stream");
+    ASSERT_EQ(served.size(), segments);
+    uint32_t served_b = 0;
+    for (uint32_t i = 0; i < segments; ++i) {
+        EXPECT_EQ(served[i], session.variant(i)) << "segment " << i;
+        served_b += served[i];
+    }
+    EXPECT_GT(served_b, segments / 4);
+    EXPECT_LT(served_b, segments * 3 / 4);
+
+    // Another session gets another sequence from the same template
+    SessionSequence other("session-43", "secret");
+    EXPECT_NE(packager.render(other), playlist);
+}
+
+TEST(ManifestPackagerTest, PackagesDashRenditionsInStep) {
+    const uint32_t segments = 40;
+    ManifestPackager packager;
+    ASSERT_TRUE(packager.parse(makeDashMpd(segments), makeDashMpd(segments),
+                               "https://cdn.example/a/", "https://cdn.example/b/"));
+    EXPECT_EQ(packager.format(), ManifestFormat::DASH);
+    EXPECT_EQ(packager.segmentCount(), segments);
+
+    SessionSequence session("viewer-7", "secret");
+    std::string mpd = packager.render(session);
+    EXPECT_NE(mpd.find("sourceURL=\"https://cdn.example/a/init-1.m4s\""), std::string::npos);
+
+    std::vector<uint32_t> served = servedVariants(mpd, "/a/chunk", "/b/chunk");
+    ASSERT_EQ(served.size(), 2 * segments);
+    for (uint32_t i = 0; i < segments; ++i) {
+        EXPECT_EQ(served[i], session.variant(i));
+        EXPECT_EQ(served[segments + i], session.variant(i));
+    }
+}
+
+TEST(ManifestPackagerTest, RejectsMisalignedVariants) {
+    ManifestPackager packager;
+    std::string longer = makeHlsPlaylist(10);
+    std::string shorter = makeHlsPlaylist(9);
+    EXPECT_FALSE(packager.parse(longer, shorter, "", ""));
+
+    std::string retimed = longer;
+    retimed.replace(retimed.find("#EXTINF:4.000000"), 16, "#EXTINF:3.960000");
+    EXPECT_FALSE(packager.parse(longer, retimed, "", ""));
+
+    std::string master = "#EXTM3U\n#EXT-X-STREAM-INF:BANDWIDTH=1\nlow.m3u8\n";
+    EXPECT_FALSE(packager.parse(master, master, "", ""));
+    EXPECT_EQ(packager.segmentCount(), 0u);
+}
+
+TEST(ManifestPackagerTest, TracesLeakToSession) {
+    Payload content(0x1111, 0x2222);
+    CodedPayload variant_a;
+    CodedPayload variant_b;
+    encodePayload(variantPayload(content, 0), variant_a);
+    encodePayload(variantPayload(content, 1), variant_b);
+
+    // A leak of 420 segments, each seen as noisy channel evidence of the
+    // variant it was served from, with a stretch of segments lost
+    SessionSequence session("session-1001", "secret");
+    std::mt19937 rng(5);
+    std::normal_distribution<float> noise(0.0f, 1.5f);
+    std::vector<float> evidence(420, 0.0f);
+    std::vector<float> soft(kPayloadCodedBits);
+    for (size_t i = 0; i < evidence.size(); ++i) {
+        if (i >= 100 && i < 120) {
+            continue;
+        }
+        const CodedPayload& served = session.variant(i) ? variant_b : variant_a;
+        for (uint32_t j = 0; j < kPayloadCodedBits; ++j) {
+            soft[j] = (served[j] ? -0.2f : 0.2f) + noise(rng);
+        }
+        evidence[i] = segmentVariantEvidence(soft.data(), variant_a, variant_b);
+    }
+
+    Payload traced;
+    ASSERT_TRUE(decodeSession(evidence.data(), evidence.size(), traced));
+    EXPECT_EQ(traced, session.payload());
+    EXPECT_EQ(traced, SessionSequence::sessionPayload("session-1001", "secret"));
+    EXPECT_NE(traced, SessionSequence::sessionPayload("session-1001", "other secret"));
+}
+
+TEST(ManifestPackagerTest, SessionPayloadsAreKeyed) {
+    // RFC 4231 test case 2, truncated to 128 bits
+    EXPECT_EQ(utils::keyedPayload("Jefe", "what do ya want for nothing?"),
+              utils::hexToPayload("5bdcc146bf60754e6a042426089575c7"));
+    // Test case 6, a key longer than the block
+    EXPECT_EQ(utils::keyedPayload(std::string(131, '\xaa'),
+                                  "Test Using Larger Than Block-Size Key - Hash Key First"),
+              utils::hexToPayload("60e431591ee0b67f0d8a26aacbf5b77f"));
+
+    // A viewer decoding their own payload must not be able to derive
+    // another's: there is no secret-independent relation between the two
+    Payload own = SessionSequence::sessionPayload("session-1001", "secret");
+    Payload other = SessionSequence::sessionPayload("session-1002", "secret");
+    Payload own_rekeyed = SessionSequence::sessionPayload("session-1001", "other secret");
+    Payload other_rekeyed = SessionSequence::sessionPayload("session-1002", "other secret");
+    EXPECT_NE(own ^ other, own_rekeyed ^ other_rekeyed);
+    EXPECT_NE(own ^ utils::generatePayloadFromString("session-1001") ^
+                  utils::generatePayloadFromString("session-1002"),
+              other);
+
+    // Nearby session IDs give unrelated payloads, about half the bits apart
+    Payload diff = own ^ other;
+    size_t differing = 0;
+    for (size_t i = 0; i < Payload::kBits; ++i) {
+        differing += diff.bit(i);
+    }
+    EXPECT_GT(differing, 40u);
+    EXPECT_LT(differing, 88u);
+}
+
+TEST(ManifestPackagerTest, SessionsCanFollowTardosCodewords) {
+    TardosCode code(99, 300, 4);
+    SessionSequence session(code, 123456);
+    EXPECT_TRUE(session.payload().empty());
+
+    std::vector<uint64_t> words(code.words());
+    code.codeword(123456, words.data());
+    for (uint32_t i = 0; i < 2 * code.length(); ++i) {
+        uint32_t bit = i % code.length();
+        EXPECT_EQ(session.variant(i), (words[bit / 64] >> (bit % 64)) & 1) << "segment " << i;
+    }
+}
@@ -0,0 +1,123 @@
+#include <gtest/gtest.h>
+#include <random>
+#include <vector>
+#include "common/payload_code.h"
+#include "common/utils.h"
+
+using namespace phantomframe;
+
+namespace {
+
+// Evidence a clean mark would give, plus Gaussian noise of the given deviation
+std::vector<float> makeEvidence(const CodedPayload& coded, float noise, std::mt19937& rng) {
+    std::normal_distribution<float> gauss(0.0f, noise);
+    std::vector<float> soft(kPayloadCodedBits);
+    for (uint32_t j = 0; j < kPayloadCodedBits; ++j) {
+        soft[j] = (coded[j] ? -1.0f : 1.0f) + (noise > 0.0f ? gauss(rng) : 0.0f);
+    }
+    return soft;
+}
+
+} // namespace
+
+TEST(PayloadTest, HexRoundTripKeepsAll128Bits) {
+    Payload payload(0x0123456789ABCDEFull, 0xFEDCBA9876543210ull);
+    EXPECT_EQ(utils::payloadToHex(payload), "0x0123456789abcdeffedcba9876543210");
+    EXPECT_EQ(utils::hexToPayload(utils::payloadToHex(payload)), payload);
+    EXPECT_EQ(payload.high(), 0x0123456789ABCDEFull);
+    EXPECT_EQ(payload.low(), 0xFEDCBA9876543210ull);
+
+    // Short strings and 64-bit values fill the low half
+    EXPECT_EQ(utils::hexToPayload("0123456789abcdef"), Payload(0x0123456789ABCDEFull));
+    EXPECT_EQ(utils::hexToPayload("0xFF"), Payload(0xFF));
+    EXPECT_TRUE(utils::hexToPayload("").empty());
+
+    // Both halves of a generated payload depend on the input
+    Payload a = utils::generatePayloadFromString("viewer-1");
+    Payload b = utils::generatePayloadFromString("viewer-2");
+    EXPECT_NE(a.high(), b.high());
+    EXPECT_NE(a.low(), b.low());
+    EXPECT_EQ(utils::xorEncrypt(utils::xorEncrypt(a, b), b), a);
+}
+
+TEST(PayloadCodeTest, BatchEncoderMatchesScalarAtEveryLevel) {
+    // Not a multiple of any batch width, so partial batches are covered
+    std::mt19937_64 rng(7);
+    std::vector<Payload> payloads(300);
+    for (auto& payload : payloads) {
+        payload = Payload(rng(), rng());
+    }
+    payloads[0] = Payload();
+
+    std::vector<CodedPayload> expected(payloads.size());
+    for (size_t i = 0; i < payloads.size(); ++i) {
+        encodePayload(payloads[i], expected[i]);
+    }
+
+    for (SimdLevel level : {SimdLevel::Scalar, SimdLevel::SSE2, SimdLevel::AVX2}) {
+        std::vector<CodedPayload> coded(payloads.size());
+        encodePayloads(payloads.data(), payloads.size(), coded.data(), level);
+        for (size_t i = 0; i < payloads.size(); ++i) {
+            EXPECT_EQ(coded[i], expected[i]) << simdLevelName(level) << " payload " << i;
+        }
+    }
+}
+
+TEST(PayloadCodeTest, DecodesCleanAndNoisyEvidence) {
+    std::mt19937 rng(11);
+    Payload payload(0x0123456789ABCDEFull, 0xFEDCBA9876543210ull);
+    CodedPayload coded;
+    encodePayload(payload, coded);
+
+    Payload decoded;
+    SoftDecodeInfo info;
+    std::vector<float> clean = makeEvidence(coded, 0.0f, rng);
+    ASSERT_TRUE(decodePayloadSoft(clean.data(), decoded, &info));
+    EXPECT_EQ(decoded, payload);
+    EXPECT_EQ(info.corrected_bytes, 0u);
+    EXPECT_FLOAT_EQ(info.agreement, 1.0f);
+
+    // Noise at 0.6 flips about one channel bit in twenty
+    for (int trial = 0; trial < 20; ++trial) {
+        std::vector<float> noisy = makeEvidence(coded, 0.6f, rng);
+        ASSERT_TRUE(decodePayloadSoft(noisy.data(), decoded, &info)) << "trial " << trial;
+        EXPECT_EQ(decoded, payload);
+        EXPECT_GT(info.agreement, 0.0f);
+    }
+}
+
+TEST(PayloadCodeTest, OuterCodeCorrectsBursts) {
+    std::mt19937 rng(13);
+    Payload payload(0xA5A5A5A5A5A5A5A5ull, 0x5A5A5A5A5A5A5A5Aull);
+    CodedPayload coded;
+    encodePayload(payload, coded);
+
+    // A confidently wrong stretch, e.g. a logo over part of the picture,
+    // defeats the Viterbi decoder locally; the outer code repairs the bytes
+    std::vector<float> soft = makeEvidence(coded, 0.0f, rng);
+    for (uint32_t j = 100; j < 124; ++j) {
+        soft[j] = -4.0f * soft[j];
+    }
+
+    Payload decoded;
+    SoftDecodeInfo info;
+    ASSERT_TRUE(decodePayloadSoft(soft.data(), decoded, &info));
+    EXPECT_EQ(decoded, payload);
+    EXPECT_GT(info.corrected_bytes, 0u);
+    EXPECT_LT(info.agreement, 1.0f);
+}
+
+TEST(PayloadCodeTest, RejectsNoise) {
+    std::mt19937 rng(17);
+    std::normal_distribution<float> gauss(0.0f, 1.0f);
+    std::vector<float> soft(kPayloadCodedBits);
+
+    Payload decoded(42);
+    for (int trial = 0; trial < 200; ++trial) {
+        for (auto& value : soft) {
+            value = gauss(rng);
+        }
+        EXPECT_FALSE(decodePayloadSoft(soft.data(), decoded));
+    }
+    EXPECT_EQ(decoded, Payload(42));
+}
@@ -0,0 +1,126 @@
+#include <gtest/gtest.h>
+#include <cmath>
+#include <random>
+#include <vector>
+#include "common/pilot_sync.h"
+
+using namespace phantomframe;
+
+namespace {
+
+// Block activities of a clip showing the reference picture from
+// (offset_x, offset_y) at the given scale, where a pilot cell lowers the
+// activity of its blocks by amplitude times the frame's sign
+struct SyntheticClip {
+    uint32_t blocks_x;
+    uint32_t blocks_y;
+    float scale;
+    uint32_t offset_x;
+    uint32_t offset_y;
+    uint32_t phase;
+};
+
+void feedClip(const PilotPattern& pattern, const SyntheticClip& clip, uint32_t frames,
+              float amplitude, float noise, PilotSync& sync) {
+    std::mt19937 rng(11);
+    std::uniform_real_distribution<float> content(5.0f, 40.0f);
+    std::normal_distribution<float> gauss(0.0f, noise);
+
+    size_t count = static_cast<size_t>(clip.blocks_x) * clip.blocks_y;
+    std::vector<float> picture(count);
+    for (auto& value : picture) {
+        value = content(rng);
+    }
+
+    std::vector<float> activity(count);
+    for (uint32_t t = 0; t < frames; ++t) {
+        float sign = amplitude > 0.0f ? pattern.sign(t + clip.phase) : 0.0f;
+        for (uint32_t by = 0; by < clip.blocks_y; ++by) {
+            uint32_t ref_y = static_cast<uint32_t>((by * 8 + 4) / clip.scale) + clip.offset_y;
+            for (uint32_t bx = 0; bx < clip.blocks_x; ++bx) {
+                uint32_t ref_x = static_cast<uint32_t>((bx * 8 + 4) / clip.scale) + clip.offset_x;
+                size_t i = static_cast<size_t>(by) * clip.blocks_x + bx;
+                int8_t cell = pattern.cell(ref_x / PilotPattern::kCellPixels,
+                                           ref_y / PilotPattern::kCellPixels);
+                activity[i] = picture[i] - amplitude * sign * cell + gauss(rng);
+            }
+        }
+        sync.addFrame(activity.data(), t);
+    }
+}
+
+// Distance of two offsets on the tile, which wraps
+uint32_t tileDistance(uint32_t a, uint32_t b) {
+    uint32_t d = (a + PilotPattern::kTilePixels - b % PilotPattern::kTilePixels) %
+                 PilotPattern::kTilePixels;
+    return std::min(d, PilotPattern::kTilePixels - d);
+}
+
+} // namespace
+
+TEST(PilotSyncTest, PatternIsKeyedSparseAndBalanced) {
+    PilotPattern pattern(12345, 0.1f, 30);
+    PilotPattern same(12345, 0.1f, 30);
+    PilotPattern other(54321, 0.1f, 30);
+
+    int sign_sum = 0;
+    for (uint32_t i = 0; i < 30; ++i) {
+        sign_sum += pattern.sign(i);
+        EXPECT_EQ(pattern.sign(i), pattern.sign(i + 30));
+    }
+    EXPECT_EQ(sign_sum, 0);
+
+    uint32_t active = 0;
+    uint32_t differs = 0;
+    for (uint32_t y = 0; y < PilotPattern::kTileCells; ++y) {
+        for (uint32_t x = 0; x < PilotPattern::kTileCells; ++x) {
+            active += pattern.cell(x, y) != 0;
+            differs += pattern.cell(x, y) != other.cell(x, y);
+            EXPECT_EQ(pattern.cell(x, y), same.cell(x, y));
+            EXPECT_EQ(pattern.cell(x, y), pattern.cell(x + PilotPattern::kTileCells, y));
+        }
+    }
+    uint32_t cells = PilotPattern::kTileCells * PilotPattern::kTileCells;
+    EXPECT_NEAR(static_cast<float>(active) / cells, 0.1f, 0.03f);
+    EXPECT_GT(differs, active / 2);
+
+    EXPECT_FALSE(PilotPattern(12345, 0.0f, 30).enabled());
+}
+
+TEST(PilotSyncTest, LocksPhaseAndCropOffsetAtFullScale) {
+    PilotPattern pattern(12345, 0.1f, 30);
+    SyntheticClip clip = {240, 135, 1.0f, 96, 40, 7};
+    PilotSync sync(pattern, clip.blocks_x, clip.blocks_y);
+    feedClip(pattern, clip, 60, 0.5f, 2.0f, sync);
+
+    PilotLock lock = sync.lock();
+    ASSERT_TRUE(lock.locked) << "strength " << lock.strength;
+    EXPECT_EQ(lock.phase, clip.phase);
+    EXPECT_NEAR(lock.scale, clip.scale, 0.01f);
+    EXPECT_LE(tileDistance(lock.offset_x, clip.offset_x), 8u);
+    EXPECT_LE(tileDistance(lock.offset_y, clip.offset_y), 8u);
+}
+
+TEST(PilotSyncTest, LocksRescaledCrop) {
+    // A 720p rendition of a crop that starts 200 pixels into the picture
+    PilotPattern pattern(777, 0.1f, 24);
+    SyntheticClip clip = {160, 90, 2.0f / 3.0f, 200, 120, 19};
+    PilotSync sync(pattern, clip.blocks_x, clip.blocks_y);
+    feedClip(pattern, clip, 72, 0.5f, 2.0f, sync);
+
+    PilotLock lock = sync.lock();
+    ASSERT_TRUE(lock.locked) << "strength " << lock.strength;
+    EXPECT_EQ(lock.phase, clip.phase);
+    EXPECT_NEAR(lock.scale, clip.scale, 0.01f);
+    EXPECT_LE(tileDistance(lock.offset_x, clip.offset_x), 12u);
+    EXPECT_LE(tileDistance(lock.offset_y, clip.offset_y), 12u);
+}
+
+TEST(PilotSyncTest, DoesNotLockWithoutPilot) {
+    PilotPattern pattern(12345, 0.1f, 30);
+    SyntheticClip clip = {240, 135, 1.0f, 0, 0, 0};
+    PilotSync sync(pattern, clip.blocks_x, clip.blocks_y);
+    feedClip(pattern, clip, 60, 0.0f, 2.0f, sync);
+
+    EXPECT_FALSE(sync.lock().locked);
+}
@@ -0,0 +1,84 @@
+#include <gtest/gtest.h>
+#include <vector>
+#include "common/scene_cut.h"
+#include "test_helpers.h"
+
+using namespace phantomframe;
+using phantomframe::test::TestHelpers;
+
+namespace {
+
+constexpr uint32_t kWidth = 640;
+constexpr uint32_t kHeight = 360;
+
+// Diagonal gradient panning right by shift pixels, with a scene-specific slope
+std::vector<uint8_t> makeScene(uint32_t slope, uint32_t shift) {
+    std::vector<uint8_t> plane(kWidth * kHeight);
+    for (uint32_t y = 0; y < kHeight; ++y) {
+        for (uint32_t x = 0; x < kWidth; ++x) {
+            plane[y * kWidth + x] = static_cast<uint8_t>(((x + shift) * slope / 8 + y) & 0xFF);
+        }
+    }
+    return plane;
+}
+
+} // namespace
+
+TEST(SceneCutTest, SimdKernelsMatchScalar) {
+    // Odd sizes exercise the scalar tail and the dropped edge macroblocks
+    const uint32_t width = 1917;
+    const uint32_t height = 1077;
+    const size_t stride = 1984;
+    auto plane = TestHelpers::generateNoise(stride * height, 11);
+    auto other = TestHelpers::generateNoise(stride * height, 12);
+
+    const size_t cells = (width / 16) * (height / 16);
+    std::vector<uint8_t> expected(cells);
+    computeLumaThumbnail(plane.data(), stride, width, height, expected.data(), SimdLevel::Scalar);
+    uint64_t expected_sad = sumAbsDiff(plane.data(), other.data(), 100003, SimdLevel::Scalar);
+
+    for (SimdLevel level : {SimdLevel::SSE2, SimdLevel::AVX2}) {
+        if (level > detectSimdLevel()) {
+            continue;
+        }
+        std::vector<uint8_t> actual(cells, 0xFF);
+        computeLumaThumbnail(plane.data(), stride, width, height, actual.data(), level);
+        EXPECT_EQ(actual, expected) << simdLevelName(level);
+        EXPECT_EQ(sumAbsDiff(plane.data(), other.data(), 100003, level), expected_sad) 
+            << simdLevelName(level);
+    }
+}
+
+TEST(SceneCutTest, DetectsCutsButNotMotion) {
+    SceneCutDetector detector(20.0f);
+
+    // A steady pan is not a cut, however long it runs
+    for (uint32_t f = 0; f < 10; ++f) {
+        auto frame = makeScene(3, f * 4);
+        EXPECT_FALSE(detector.process(frame.data(), kWidth, kWidth, kHeight)) << "frame " << f;
+    }
+
+    auto cut = TestHelpers::generateNoise(kWidth * kHeight, 5);
+    EXPECT_TRUE(detector.process(cut.data(), kWidth, kWidth, kHeight));
+    EXPECT_GE(detector.lastScore(), 20.0f);
+
+    // The new scene holds still
+    EXPECT_FALSE(detector.process(cut.data(), kWidth, kWidth, kHeight));
+    EXPECT_EQ(detector.lastScore(), 0.0f);
+}
+
+TEST(SceneCutTest, DisabledOrResetNeverCuts) {
+    auto first = makeScene(3, 0);
+    auto second = TestHelpers::generateNoise(kWidth * kHeight, 5);
+
+    SceneCutDetector disabled;
+    EXPECT_FALSE(disabled.enabled());
+    EXPECT_FALSE(disabled.process(first.data(), kWidth, kWidth, kHeight));
+    EXPECT_FALSE(disabled.process(second.data(), kWidth, kWidth, kHeight));
+
+    // The first frame after a reset has nothing to compare against
+    SceneCutDetector detector(20.0f);
+    EXPECT_FALSE(detector.process(first.data(), kWidth, kWidth, kHeight));
+    detector.reset();
+    EXPECT_FALSE(detector.process(second.data(), kWidth, kWidth, kHeight));
+}
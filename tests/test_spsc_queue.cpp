@@ -0,0 +1,92 @@
+#include <gtest/gtest.h>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include "common/spsc_queue.h"
+
+using namespace phantomframe;
+
+TEST(SpscQueueTest, RespectsCapacity) {
+    SpscQueue<int> queue(4);
+    
+    int pushed = 0;
+    while (queue.tryPush(pushed)) {
+        pushed++;
+    }
+    EXPECT_GE(pushed, 4);
+    
+    int value = -1;
+    ASSERT_TRUE(queue.tryPop(value));
+    EXPECT_EQ(value, 0);
+    EXPECT_TRUE(queue.tryPush(pushed));
+}
+
+TEST(SpscQueueTest, EmptyQueuePopFails) {
+    SpscQueue<int> queue(2);
+    int value = 0;
+    EXPECT_FALSE(queue.tryPop(value));
+}
+
+TEST(SpscQueueTest, PreservesOrderAcrossThreads) {
+    SpscQueue<uint32_t> queue(8);
+    std::atomic<bool> abort(false);
+    const uint32_t count = 100000;
+    
+    std::thread producer([&]() {
+        for (uint32_t i = 0; i < count; ++i) {
+            queue.push(i, abort);
+        }
+    });
+    
+    uint32_t expected = 0;
+    bool in_order = true;
+    for (uint32_t i = 0; i < count; ++i) {
+        uint32_t value = 0;
+        ASSERT_TRUE(queue.pop(value, abort));
+        in_order = in_order && value == expected++;
+    }
+    producer.join();
+    
+    EXPECT_TRUE(in_order);
+}
+
+TEST(SpscQueueTest, AbortUnblocksPop) {
+    SpscQueue<int> queue(2);
+    std::atomic<bool> abort(true);
+    int value = 0;
+    EXPECT_FALSE(queue.pop(value, abort));
+}
+
+TEST(SpscQueueTest, SleepingPopWakesOnPush) {
+    SpscQueue<int> queue(2);
+    std::atomic<bool> abort(false);
+    int value = 0;
+    
+    // Long enough that the consumer is asleep, not spinning, by the push
+    std::thread consumer([&]() {
+        EXPECT_TRUE(queue.pop(value, abort));
+    });
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    EXPECT_TRUE(queue.push(7, abort));
+    consumer.join();
+    
+    EXPECT_EQ(value, 7);
+}
+
+TEST(SpscQueueTest, WakeUnblocksSleepingPush) {
+    SpscQueue<int> queue(1);
+    std::atomic<bool> abort(false);
+    while (queue.tryPush(0)) {
+    }
+    
+    std::atomic<bool> pushed(true);
+    std::thread producer([&]() {
+        pushed = queue.push(1, abort);
+    });
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    abort = true;
+    queue.wake();
+    producer.join();
+    
+    EXPECT_FALSE(pushed);
+}
@@ -0,0 +1,187 @@
+#include <gtest/gtest.h>
+#include <algorithm>
+#include <cmath>
+#include <random>
+#include <vector>
+#include "common/tardos_code.h"
+#include "common/worker_pool.h"
+
+using namespace phantomframe;
+
+namespace {
+
+bool codewordBit(const std::vector<uint64_t>& words, uint32_t i) {
+    return (words[i / 64] >> (i % 64)) & 1;
+}
+
+std::vector<uint64_t> makeViewerIds(size_t count) {
+    std::vector<uint64_t> ids(count);
+    for (size_t j = 0; j < count; ++j) {
+        ids[j] = 1000000 + j * 7;
+    }
+    return ids;
+}
+
+// Evidence of a copy averaged from the colluders' copies, plus noise;
+// positive favours 0 as in the extractor
+std::vector<float> averagedEvidence(const TardosCode& code, const std::vector<uint64_t>& colluders,
+                                    float noise, std::mt19937& rng) {
+    std::normal_distribution<float> gauss(0.0f, noise);
+    std::vector<float> soft(code.length(), 0.0f);
+    std::vector<uint64_t> words(code.words());
+    for (uint64_t id : colluders) {
+        code.codeword(id, words.data());
+        for (uint32_t i = 0; i < code.length(); ++i) {
+            soft[i] += codewordBit(words, i) ? -1.0f : 1.0f;
+        }
+    }
+    for (auto& value : soft) {
+        value = value / colluders.size() + gauss(rng);
+    }
+    return soft;
+}
+
+} // namespace
+
+TEST(TardosCodeTest, CodewordsAreKeyedAndFollowBiases) {
+    TardosCode code(42, 500, 4);
+    TardosCode same(42, 500, 4);
+    TardosCode other(43, 500, 4);
+    ASSERT_EQ(code.words(), 8u);
+
+    std::vector<uint64_t> a(code.words());
+    std::vector<uint64_t> b(code.words());
+    code.codeword(7, a.data());
+    same.codeword(7, b.data());
+    EXPECT_EQ(a, b);
+    other.codeword(7, b.data());
+    EXPECT_NE(a, b);
+    code.codeword(8, b.data());
+    EXPECT_NE(a, b);
+
+    // Biases stay inside the cutoff, and codewords follow them
+    double cutoff = 1.0 / 1200.0;
+    std::vector<uint32_t> ones(code.length(), 0);
+    const uint32_t viewers = 4000;
+    for (uint32_t j = 0; j < viewers; ++j) {
+        code.codeword(j, a.data());
+        for (uint32_t i = 0; i < code.length(); ++i) {
+            ones[i] += codewordBit(a, i);
+        }
+    }
+    for (uint32_t i = 0; i < code.length(); ++i) {
+        double p = code.bias(i);
+        EXPECT_GE(p, cutoff * 0.99);
+        EXPECT_LE(p, 1.0 - cutoff * 0.99);
+        double sigma = std::sqrt(p * (1.0 - p) / viewers);
+        EXPECT_NEAR(static_cast<double>(ones[i]) / viewers, p, 5.0 * sigma + 1e-3) << "position " << i;
+    }
+
+    // Unused bits of the last word stay clear
+    EXPECT_EQ(a.back() >> (code.length() % 64), 0u);
+
+    EXPECT_GT(TardosCode::recommendedLength(4, 1e-10), TardosCode::recommendedLength(2, 1e-10));
+    EXPECT_EQ(TardosCode::recommendedLength(1, std::exp(-1.0)), 10u);
+}
+
+TEST(TardosCodeTest, KernelsGiveIdenticalScores) {
+    TardosCode code(9, 1000, 3);
+    AccusationScorer scorer(code);
+    std::vector<uint64_t> ids = makeViewerIds(100);
+    scorer.setViewers(ids.data(), ids.size());
+    EXPECT_EQ(scorer.viewerCount(), 100u);
+    EXPECT_EQ(scorer.memoryBytes(), 4u * AccusationScorer::kBlockViewers * 125);
+
+    std::mt19937 rng(3);
+    std::normal_distribution<float> gauss(0.0f, 1.0f);
+    std::vector<float> soft(code.length());
+    for (auto& value : soft) {
+        value = gauss(rng);
+    }
+    soft[17] = 0.0f;
+
+    std::vector<float> scalar(ids.size());
+    scorer.score(soft.data(), scalar.data(), nullptr, SimdLevel::Scalar);
+
+    for (SimdLevel level : {SimdLevel::SSE2, SimdLevel::AVX2}) {
+        if (level > detectSimdLevel()) {
+            continue;
+        }
+        std::vector<float> scores(ids.size());
+        scorer.score(soft.data(), scores.data(), nullptr, level);
+        EXPECT_EQ(scores, scalar) << simdLevelName(level);
+    }
+
+    // Quantised weights stay close to the exact symmetric score
+    double norm = 0.0;
+    for (float value : soft) {
+        norm += value * value;
+    }
+    norm = std::sqrt(norm);
+    std::vector<uint64_t> words(code.words());
+    for (size_t j = 0; j < ids.size(); ++j) {
+        code.codeword(ids[j], words.data());
+        double exact = 0.0;
+        for (uint32_t i = 0; i < code.length(); ++i) {
+            double p = code.bias(i);
+            double b = -soft[i];
+            exact += codewordBit(words, i) ? b * std::sqrt((1.0 - p) / p) : -b * std::sqrt(p / (1.0 - p));
+        }
+        EXPECT_NEAR(scalar[j], exact / norm, 0.05) << "viewer " << j;
+    }
+}
+
+TEST(TardosCodeTest, InnocentScoresAreStandardised) {
+    TardosCode code(5, 1024, 4);
+    AccusationScorer scorer(code);
+    std::vector<uint64_t> ids = makeViewerIds(5000);
+    WorkerPool pool(4);
+    scorer.setViewers(ids.data(), ids.size(), &pool);
+
+    // Evidence from a copy of someone not registered
+    std::mt19937 rng(8);
+    std::vector<float> soft = averagedEvidence(code, {42}, 0.5f, rng);
+    std::vector<float> scores(ids.size());
+    scorer.score(soft.data(), scores.data(), &pool);
+
+    double mean = 0.0;
+    double square = 0.0;
+    for (float value : scores) {
+        mean += value;
+        square += value * value;
+    }
+    mean /= scores.size();
+    double deviation = std::sqrt(square / scores.size() - mean * mean);
+    EXPECT_NEAR(mean, 0.0, 0.1);
+    EXPECT_NEAR(deviation, 1.0, 0.1);
+    EXPECT_LT(*std::max_element(scores.begin(), scores.end()),
+              AccusationScorer::threshold(1e-3, ids.size()));
+}
+
+TEST(TardosCodeTest, AccusesAveragingColluders) {
+    const uint32_t colluders = 3;
+    TardosCode code(77, TardosCode::recommendedLength(colluders, 1e-6), colluders);
+    AccusationScorer scorer(code);
+    std::vector<uint64_t> ids = makeViewerIds(20000);
+    WorkerPool pool(4);
+    scorer.setViewers(ids.data(), ids.size(), &pool);
+
+    std::vector<uint64_t> coalition = {ids[123], ids[4567], ids[19999]};
+    std::mt19937 rng(21);
+    std::vector<float> soft = averagedEvidence(code, coalition, 1.0f, rng);
+
+    float threshold = AccusationScorer::threshold(1e-3, ids.size());
+    std::vector<Accusation> accused = scorer.accuse(soft.data(), threshold, 0, &pool);
+
+    ASSERT_FALSE(accused.empty());
+    for (size_t i = 1; i < accused.size(); ++i) {
+        EXPECT_GE(accused[i - 1].score, accused[i].score);
+    }
+    for (const auto& accusation : accused) {
+        EXPECT_NE(std::find(coalition.begin(), coalition.end(), accusation.viewer_id), coalition.end())
+            << "innocent viewer " << accusation.viewer_id << " scored " << accusation.score;
+    }
+    EXPECT_GE(accused.size(), 2u);
+
+    EXPECT_EQ(scorer.accuse(soft.data(), threshold, 1, &pool).size(), 1u);
+}
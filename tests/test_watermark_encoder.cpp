@@ -1,7 +1,13 @@
 #include <gtest/gtest.h>
 #include <vector>
 #include <cstring>
+#include <algorithm>
+#include <cmath>
+#include <atomic>
+#include <thread>
 #include "encoder/watermark_encoder.h"
+#include "encoder/quant_offset_buffer.h"
+#include "common/worker_pool.h"
 
 using namespace phantomframe;
 
@@ -30,6 +36,12 @@ protected:
         config.temporal_period = 30;
         config.adaptive_embedding = false;
         config.quality_threshold = 0.8f;
+        config.frame_budget_us = 0;
+        config.scene_cut_threshold = 0.0f;
+        config.window_frames = 0;
+        config.window_repeats = 1;
+        config.pilot_density = 0.0f;
+        config.marked_period_interval = 1;
     }
 
     WatermarkConfig config;
@@ -49,6 +61,15 @@ TEST_F(WatermarkEncoderTest, InitializationTest) {
     EXPECT_TRUE(result);
 }
 
+TEST_F(WatermarkEncoderTest, InitializationWritesNothingToStdout) {
+    // Hosts such as the ffmpeg filter may be writing the video to stdout
+    WatermarkEncoder encoder(config);
+    testing::internal::CaptureStdout();
+    bool result = encoder.initialize(TEST_WIDTH, TEST_HEIGHT, TEST_FPS);
+    EXPECT_EQ(testing::internal::GetCapturedStdout(), "");
+    EXPECT_TRUE(result);
+}
+
 TEST_F(WatermarkEncoderTest, InitializationWithZeroDimensions) {
     WatermarkEncoder encoder(config);
     bool result = encoder.initialize(0, 0, TEST_FPS);
@@ -280,3 +301,485 @@ TEST_F(WatermarkEncoderTest, MemoryLeakTest) {
     // If we get here without crashes, memory management is working
     EXPECT_TRUE(true);
 }
+
+TEST_F(WatermarkEncoderTest, InPlaceProcessFrameTest) {
+    WatermarkEncoder encoder(config);
+    ASSERT_TRUE(encoder.initialize(TEST_WIDTH, TEST_HEIGHT, TEST_FPS));
+
+    // Luma plane with padded rows, as handed out by real decoders
+    const size_t stride = TEST_WIDTH + 32;
+    std::vector<uint8_t> plane(stride * TEST_HEIGHT, 128);
+    FrameView view{plane.data(), stride, TEST_WIDTH, TEST_HEIGHT, PlaneLayout::Planar, 1};
+
+    std::vector<BlockInfo> blocks(encoder.getMaxBlocksPerFrame());
+    size_t count = encoder.processFrame(view, 0, blocks.data(), blocks.size());
+
+    // Same blocks as the copying API reports for this frame
+    auto expected = encoder.getBlocksForFrame(0);
+    ASSERT_EQ(count, expected.size());
+    for (size_t i = 0; i < count; ++i) {
+        EXPECT_EQ(blocks[i].x, expected[i].x);
+        EXPECT_EQ(blocks[i].y, expected[i].y);
+        EXPECT_EQ(blocks[i].qp_delta, expected[i].qp_delta);
+    }
+}
+
+TEST_F(WatermarkEncoderTest, InPlaceProcessFrameWithNullData) {
+    WatermarkEncoder encoder(config);
+    ASSERT_TRUE(encoder.initialize(TEST_WIDTH, TEST_HEIGHT, TEST_FPS));
+
+    FrameView view{nullptr, TEST_WIDTH, TEST_WIDTH, TEST_HEIGHT, PlaneLayout::Planar, 1};
+    EXPECT_EQ(encoder.processFrame(view, 0, nullptr, 0), 0u);
+}
+
+TEST_F(WatermarkEncoderTest, ScheduleSpanMatchesBlocks) {
+    WatermarkEncoder encoder(config);
+    ASSERT_TRUE(encoder.initialize(1920, 1080, TEST_FPS));
+
+    for (uint32_t frame = 0; frame < config.temporal_period; ++frame) {
+        BlockSpan span = encoder.getScheduleForFrame(frame);
+        auto blocks = encoder.getBlocksForFrame(frame);
+        ASSERT_EQ(span.count, blocks.size());
+        
+        for (uint32_t i = 0; i < span.count; ++i) {
+            EXPECT_EQ(span.x[i], blocks[i].x);
+            EXPECT_EQ(span.y[i], blocks[i].y);
+            EXPECT_EQ(span.qp_delta[i], blocks[i].qp_delta);
+        }
+    }
+}
+
+TEST_F(WatermarkEncoderTest, ScheduleSpanRepeatsEveryPeriod) {
+    WatermarkEncoder encoder(config);
+    ASSERT_TRUE(encoder.initialize(1920, 1080, TEST_FPS));
+
+    // The table is shared by all frames with the same phase
+    BlockSpan first = encoder.getScheduleForFrame(7);
+    BlockSpan later = encoder.getScheduleForFrame(7 + 10 * config.temporal_period);
+    EXPECT_EQ(first.x, later.x);
+    EXPECT_EQ(first.count, later.count);
+    EXPECT_GT(first.count, 0u);
+}
+
+TEST_F(WatermarkEncoderTest, WriteQuantOffsetsTouchesScheduledMacroblocks) {
+    WatermarkEncoder encoder(config);
+    ASSERT_TRUE(encoder.initialize(1920, 1080, TEST_FPS));
+
+    const uint32_t mb_width = (1920 + 15) / 16;
+    const uint32_t mb_height = (1080 + 15) / 16;
+    std::vector<float> offsets(mb_width * mb_height, 0.0f);
+    QuantOffsetPlane plane{offsets.data(), mb_width, mb_height};
+
+    std::vector<uint32_t> touched(encoder.getMaxBlocksPerFrame());
+    size_t written = encoder.writeQuantOffsets(0, plane, touched.data(), touched.size());
+    ASSERT_GT(written, 0u);
+
+    // Every entry outside the touched macroblocks stays zero
+    std::vector<bool> is_touched(offsets.size(), false);
+    for (size_t i = 0; i < written; ++i) {
+        is_touched[touched[i]] = true;
+    }
+    for (size_t mb = 0; mb < offsets.size(); ++mb) {
+        if (!is_touched[mb]) {
+            EXPECT_EQ(offsets[mb], 0.0f);
+        }
+        EXPECT_LE(std::abs(offsets[mb]), 4.0f);
+    }
+}
+
+TEST_F(WatermarkEncoderTest, QuantOffsetBufferReusesPlanes) {
+    WatermarkEncoder encoder(config);
+    ASSERT_TRUE(encoder.initialize(1920, 1080, TEST_FPS));
+
+    QuantOffsetBuffer buffer(1920, 1080, 2);
+    const QuantOffsetPlane& first = buffer.fill(encoder, 0);
+    const float* first_data = first.offsets;
+    buffer.fill(encoder, 1);
+
+    // Third fill reuses the first plane and only holds frame 2's deltas
+    const QuantOffsetPlane& third = buffer.fill(encoder, 2);
+    EXPECT_EQ(third.offsets, first_data);
+
+    std::vector<float> expected(buffer.mbWidth() * buffer.mbHeight(), 0.0f);
+    QuantOffsetPlane expected_plane{expected.data(), buffer.mbWidth(), buffer.mbHeight()};
+    encoder.writeQuantOffsets(2, expected_plane);
+
+    for (size_t mb = 0; mb < expected.size(); ++mb) {
+        EXPECT_EQ(third.offsets[mb], expected[mb]);
+    }
+}
+
+TEST_F(WatermarkEncoderTest, SliceParallelRenderMatchesSerial) {
+    WatermarkEncoder serial(config);
+    ASSERT_TRUE(serial.initialize(3840, 2160, TEST_FPS));
+
+    WorkerPool pool(4);
+    WatermarkEncoder sliced(config);
+    sliced.setWorkerPool(&pool);
+    ASSERT_TRUE(sliced.initialize(3840, 2160, TEST_FPS));
+
+    const uint32_t mb_width = (3840 + 15) / 16;
+    const uint32_t mb_height = (2160 + 15) / 16;
+    std::vector<float> expected(mb_width * mb_height, 0.0f);
+    std::vector<float> actual(mb_width * mb_height, 7.0f);
+    QuantOffsetPlane expected_plane{expected.data(), mb_width, mb_height};
+    QuantOffsetPlane actual_plane{actual.data(), mb_width, mb_height};
+
+    for (uint32_t frame = 0; frame < config.temporal_period; ++frame) {
+        std::fill(expected.begin(), expected.end(), 0.0f);
+        size_t expected_count = serial.writeQuantOffsets(frame, expected_plane);
+
+        // Rendering overwrites stale entries from the previous frame
+        EXPECT_EQ(sliced.renderQuantOffsets(frame, actual_plane), expected_count);
+        EXPECT_EQ(actual, expected);
+    }
+}
+
+TEST_F(WatermarkEncoderTest, UpdateConfigSwitchesOnNextFrame) {
+    WatermarkEncoder encoder(config);
+    ASSERT_TRUE(encoder.initialize(1920, 1080, TEST_FPS));
+
+    WatermarkConfig rotated = config;
+    rotated.seed = config.seed + 1;
+    WatermarkEncoder reference(rotated);
+    ASSERT_TRUE(reference.initialize(1920, 1080, TEST_FPS));
+
+    encoder.updateConfig(rotated);
+    EXPECT_TRUE(encoder.applyPendingConfig(5));
+    EXPECT_FALSE(encoder.applyPendingConfig(6));
+
+    BlockSpan span = encoder.getScheduleForFrame(5);
+    BlockSpan expected = reference.getScheduleForFrame(5);
+    ASSERT_EQ(span.count, expected.count);
+    for (uint32_t i = 0; i < span.count; ++i) {
+        EXPECT_EQ(span.x[i], expected.x[i]);
+        EXPECT_EQ(span.y[i], expected.y[i]);
+        EXPECT_EQ(span.qp_delta[i], expected.qp_delta[i]);
+    }
+}
+
+TEST_F(WatermarkEncoderTest, UpdateConfigWaitsForGopBoundary) {
+    WatermarkEncoder encoder(config);
+    ASSERT_TRUE(encoder.initialize(1920, 1080, TEST_FPS));
+
+    WatermarkConfig denser = config;
+    denser.block_density = config.block_density * 2;
+    encoder.updateConfig(denser, 60);
+
+    uint32_t before = encoder.getMaxBlocksPerFrame();
+    EXPECT_FALSE(encoder.applyPendingConfig(59));
+    EXPECT_EQ(encoder.getMaxBlocksPerFrame(), before);
+    EXPECT_TRUE(encoder.applyPendingConfig(120));
+    EXPECT_GT(encoder.getMaxBlocksPerFrame(), before);
+}
+
+TEST_F(WatermarkEncoderTest, UpdateConfigWhileRendering) {
+    WatermarkEncoder encoder(config);
+    ASSERT_TRUE(encoder.initialize(1920, 1080, TEST_FPS));
+
+    const uint32_t mb_width = (1920 + 15) / 16;
+    const uint32_t mb_height = (1080 + 15) / 16;
+    std::vector<float> offsets(mb_width * mb_height, 0.0f);
+    QuantOffsetPlane plane{offsets.data(), mb_width, mb_height};
+
+    std::atomic<bool> done(false);
+    std::thread updater([&]() {
+        WatermarkConfig next = config;
+        while (!done.load()) {
+            next.seed++;
+            encoder.updateConfig(next);
+        }
+    });
+
+    for (uint32_t frame = 0; frame < 2000; ++frame) {
+        encoder.renderQuantOffsets(frame, plane);
+    }
+    done = true;
+    updater.join();
+
+    EXPECT_NE(encoder.getStats().find("Frames processed: 2000"), std::string::npos);
+}
+
+TEST_F(WatermarkEncoderTest, AdaptiveEmbeddingMovesToTexturedBlocks) {
+    WatermarkConfig adaptive_config = config;
+    adaptive_config.adaptive_embedding = true;
+    adaptive_config.quality_threshold = 1.0f;
+
+    WatermarkEncoder encoder(adaptive_config);
+    ASSERT_TRUE(encoder.initialize(1920, 1080, TEST_FPS));
+
+    // Noise in even macroblock columns, flat elsewhere
+    std::vector<uint8_t> luma(1920 * 1080, 128);
+    for (uint32_t y = 0; y < 1080; ++y) {
+        for (uint32_t x = 0; x < 1920; ++x) {
+            if ((x / 16) % 2 == 0) {
+                luma[y * 1920 + x] = static_cast<uint8_t>((x * 37 + y * 91) ^ (x * y));
+            }
+        }
+    }
+    FrameView frame{luma.data(), 1920, 1920, 1080, PlaneLayout::Planar, 1};
+
+    std::vector<BlockInfo> blocks(encoder.getMaxBlocksPerFrame());
+    size_t count = encoder.processFrame(frame, 0, blocks.data(), blocks.size());
+    ASSERT_GT(count, 0u);
+
+    BlockSpan scheduled = encoder.getScheduleForFrame(0);
+    size_t moved = 0;
+    for (size_t i = 0; i < count; ++i) {
+        EXPECT_EQ((blocks[i].x / 16) % 2, 0u);
+        EXPECT_EQ(blocks[i].y, scheduled.y[i]);
+        moved += blocks[i].x != scheduled.x[i];
+    }
+    EXPECT_GT(moved, 0u);
+}
+
+TEST_F(WatermarkEncoderTest, PlanarFrameTouchesOnlyLuma) {
+    WatermarkEncoder planar_encoder(config);
+    WatermarkEncoder view_encoder(config);
+    ASSERT_TRUE(planar_encoder.initialize(1920, 1080, TEST_FPS));
+    ASSERT_TRUE(view_encoder.initialize(1920, 1080, TEST_FPS));
+
+    // NV12 with padded strides
+    const size_t stride = 2048;
+    std::vector<uint8_t> luma(stride * 1080, 16);
+    std::vector<uint8_t> chroma(stride * 540, 128);
+    PlanarFrame frame{PixelFormat::NV12, {luma.data(), chroma.data(), nullptr},
+                      {stride, stride, 0}, 1920, 1080};
+    FrameView view{luma.data(), stride, 1920, 1080, PlaneLayout::Planar, 1};
+
+    std::vector<BlockInfo> planar_blocks(planar_encoder.getMaxBlocksPerFrame());
+    std::vector<BlockInfo> view_blocks(view_encoder.getMaxBlocksPerFrame());
+    size_t count = planar_encoder.processFrame(frame, 3, planar_blocks.data(), planar_blocks.size());
+    ASSERT_EQ(count, view_encoder.processFrame(view, 3, view_blocks.data(), view_blocks.size()));
+    ASSERT_GT(count, 0u);
+
+    for (size_t i = 0; i < count; ++i) {
+        EXPECT_EQ(planar_blocks[i].x, view_blocks[i].x);
+        EXPECT_EQ(planar_blocks[i].y, view_blocks[i].y);
+    }
+    for (uint8_t value : chroma) {
+        ASSERT_EQ(value, 128);
+    }
+}
+
+TEST_F(WatermarkEncoderTest, PlanarFrameWithoutLuma) {
+    WatermarkEncoder encoder(config);
+    ASSERT_TRUE(encoder.initialize(1920, 1080, TEST_FPS));
+
+    PlanarFrame frame{PixelFormat::I420, {nullptr, nullptr, nullptr}, {0, 0, 0}, 1920, 1080};
+    EXPECT_EQ(encoder.processFrame(frame, 0, nullptr, 0), 0u);
+}
+
+TEST_F(WatermarkEncoderTest, FrameBudgetDisabledNeverDegrades) {
+    WatermarkConfig adaptive_config = config;
+    adaptive_config.adaptive_embedding = true;
+
+    WatermarkEncoder encoder(adaptive_config);
+    ASSERT_TRUE(encoder.initialize(1920, 1080, TEST_FPS));
+
+    std::vector<uint8_t> luma(1920 * 1080, 16);
+    PlanarFrame frame{PixelFormat::I420, {luma.data(), nullptr, nullptr}, {1920, 0, 0}, 1920, 1080};
+    size_t full = encoder.getBlocksForFrame(0).size();
+    for (uint32_t i = 0; i < 5; ++i) {
+        EXPECT_EQ(encoder.processFrame(frame, i, nullptr, 0), full);
+        EXPECT_EQ(encoder.beginFrame(i), EmbedStep::Full);
+    }
+
+    DeadlineStats stats = encoder.getDeadlineStats();
+    EXPECT_EQ(stats.analysis_skipped, 0u);
+    EXPECT_EQ(stats.maps_reused, 0u);
+    EXPECT_EQ(stats.density_reduced, 0u);
+    EXPECT_EQ(stats.deadline_misses, 0u);
+}
+
+TEST_F(WatermarkEncoderTest, FrameBudgetDegradesInSteps) {
+    // No 4K frame can be embedded in a microsecond
+    WatermarkConfig budget_config = config;
+    budget_config.adaptive_embedding = true;
+    budget_config.quality_threshold = 1.0f;
+    budget_config.frame_budget_us = 1;
+
+    WatermarkEncoder encoder(budget_config);
+    ASSERT_TRUE(encoder.initialize(3840, 2160, TEST_FPS));
+
+    std::vector<uint8_t> luma(3840 * 2160);
+    for (size_t i = 0; i < luma.size(); ++i) {
+        luma[i] = static_cast<uint8_t>(i * 2654435761u >> 24);
+    }
+    PlanarFrame frame{PixelFormat::I420, {luma.data(), nullptr, nullptr}, {3840, 0, 0}, 3840, 2160};
+    size_t full = encoder.getBlocksForFrame(0).size();
+
+    // The first frame has nothing to go by and is embedded in full
+    EXPECT_EQ(encoder.processFrame(frame, 0, nullptr, 0), full);
+    EXPECT_EQ(encoder.beginFrame(0), EmbedStep::Full);
+
+    // Then the previous map is reused for a couple of frames...
+    EXPECT_EQ(encoder.processFrame(frame, 1, nullptr, 0), 0u);
+    EXPECT_EQ(encoder.beginFrame(1), EmbedStep::ReuseMap);
+    EXPECT_EQ(encoder.processFrame(frame, 2, nullptr, 0), 0u);
+    EXPECT_EQ(encoder.beginFrame(2), EmbedStep::ReuseMap);
+
+    // ...before density is dropped
+    size_t reduced = encoder.processFrame(frame, 3, nullptr, 0);
+    EXPECT_EQ(encoder.beginFrame(3), EmbedStep::ReduceDensity);
+    DeadlineStats stats = encoder.getDeadlineStats();
+    ASSERT_GT(stats.density_shift, 0u);
+    EXPECT_EQ(reduced, (full + (1u << stats.density_shift) - 1) >> stats.density_shift);
+
+    EXPECT_EQ(stats.maps_reused, 2u);
+    EXPECT_EQ(stats.density_reduced, 1u);
+    EXPECT_GT(stats.deadline_misses, 0u);
+
+    // Lifting the deadline restores full embedding on the next frame
+    budget_config.frame_budget_us = 0;
+    encoder.updateConfig(budget_config);
+    EXPECT_EQ(encoder.processFrame(frame, 4, nullptr, 0), full);
+    EXPECT_EQ(encoder.getDeadlineStats().density_shift, 0u);
+}
+
+TEST_F(WatermarkEncoderTest, QuantOffsetBufferReusesPreviousMapOverBudget) {
+    WatermarkConfig budget_config = config;
+    budget_config.frame_budget_us = 1;
+
+    WatermarkEncoder encoder(budget_config);
+    ASSERT_TRUE(encoder.initialize(3840, 2160, TEST_FPS));
+    QuantOffsetBuffer buffer(3840, 2160, 3);
+
+    const QuantOffsetPlane& first = buffer.fill(encoder, 0);
+    float* first_offsets = first.offsets;
+    std::vector<float> expected(first.offsets, first.offsets + 240 * 135);
+
+    const QuantOffsetPlane& second = buffer.fill(encoder, 1);
+    ASSERT_EQ(encoder.beginFrame(1), EmbedStep::ReuseMap);
+    EXPECT_EQ(second.offsets, first_offsets);
+    EXPECT_TRUE(std::equal(expected.begin(), expected.end(), second.offsets));
+}
+
+TEST_F(WatermarkEncoderTest, NonReferenceFramesMoveBlocksToReferenceFrames) {
+    WatermarkEncoder typed(config);
+    WatermarkEncoder untyped(config);
+    ASSERT_TRUE(typed.initialize(1920, 1080, TEST_FPS));
+    ASSERT_TRUE(untyped.initialize(1920, 1080, TEST_FPS));
+
+    const uint32_t mb_width = 120;
+    const uint32_t mb_height = 68;
+    std::vector<float> typed_offsets(mb_width * mb_height, 7.0f);
+    std::vector<float> untyped_offsets(mb_width * mb_height, 0.0f);
+    QuantOffsetPlane typed_plane{typed_offsets.data(), mb_width, mb_height};
+    QuantOffsetPlane untyped_plane{untyped_offsets.data(), mb_width, mb_height};
+
+    // IBBPBBP in display order: each P carries the two B frames before it
+    const FrameInfo types[] = {{FrameType::I, true}, {FrameType::B, false}, {FrameType::B, false},
+                               {FrameType::P, true}, {FrameType::B, false}, {FrameType::B, false},
+                               {FrameType::P, true}};
+    size_t typed_blocks = 0;
+    size_t untyped_blocks = 0;
+    for (uint32_t f = 0; f < 7; ++f) {
+        bool reference = types[f].is_reference;
+        EXPECT_EQ(typed.beginFrame(f, types[f]), 
+                  reference ? EmbedStep::Full : EmbedStep::NonReference);
+        typed_blocks += typed.getScheduleForFrame(f).count;
+        typed.renderQuantOffsets(f, typed_plane);
+        
+        untyped_blocks += untyped.getBlocksForFrame(f).size();
+        untyped.writeQuantOffsets(f, untyped_plane);
+
+        if (!reference) {
+            EXPECT_TRUE(std::all_of(typed_offsets.begin(), typed_offsets.end(),
+                                    [](float value) { return value == 0.0f; }));
+            continue;
+        }
+
+        // A reference frame's map holds the deltas of every frame it carries
+        EXPECT_EQ(typed_offsets, untyped_offsets);
+        std::fill(untyped_offsets.begin(), untyped_offsets.end(), 0.0f);
+    }
+
+    // The GOP keeps its block budget
+    EXPECT_EQ(typed_blocks, untyped_blocks);
+    EXPECT_EQ(typed.getMaxBlocksPerFrame(), 
+              untyped.getBlocksForFrame(0).size() * EmbeddingSchedule::kMaxFramePhases);
+}
+
+TEST_F(WatermarkEncoderTest, NonReferenceFramesSkipAnalysis) {
+    WatermarkConfig adaptive_config = config;
+    adaptive_config.adaptive_embedding = true;
+
+    WatermarkEncoder encoder(adaptive_config);
+    ASSERT_TRUE(encoder.initialize(640, 480, TEST_FPS));
+
+    std::vector<uint8_t> luma(640 * 480, 16);
+    PlanarFrame frame{PixelFormat::I420, {luma.data(), nullptr, nullptr}, {640, 0, 0}, 640, 480};
+
+    ASSERT_EQ(encoder.beginFrame(0, FrameInfo{FrameType::B, false}), EmbedStep::NonReference);
+    EXPECT_FALSE(encoder.analyzeFrame(frame, 0));
+    EXPECT_EQ(encoder.processFrame(frame, 0, nullptr, 0), 0u);
+
+    ASSERT_EQ(encoder.beginFrame(1, FrameInfo{FrameType::P, true}), EmbedStep::Full);
+    EXPECT_TRUE(encoder.analyzeFrame(frame, 1));
+    EXPECT_EQ(encoder.processFrame(frame, 1, nullptr, 0), 
+              encoder.getScheduleForFrame(1).count);
+    EXPECT_GT(encoder.getScheduleForFrame(1).count, 0u);
+}
+
+TEST_F(WatermarkEncoderTest, SceneCutRestartsPattern) {
+    WatermarkConfig scene_config = config;
+    scene_config.scene_cut_threshold = 20.0f;
+
+    WatermarkEncoder encoder(scene_config);
+    WatermarkEncoder reference(config);
+    ASSERT_TRUE(encoder.initialize(640, 360, TEST_FPS));
+    ASSERT_TRUE(reference.initialize(640, 360, TEST_FPS));
+
+    std::vector<uint8_t> first(640 * 360, 40);
+    std::vector<uint8_t> second(640 * 360, 200);
+    FrameView view{first.data(), 640, 640, 360, PlaneLayout::Planar, 1};
+
+    for (uint32_t f = 0; f < 13; ++f) {
+        view.data = f < 10 ? first.data() : second.data();
+        encoder.processFrame(view, f, nullptr, 0);
+    }
+    EXPECT_EQ(encoder.getSceneCuts(), 1u);
+
+    // Frame 12 is the third frame of the scene that started at frame 10
+    std::vector<BlockInfo> blocks = encoder.getBlocksForFrame(12);
+    std::vector<BlockInfo> expected = reference.getBlocksForFrame(2);
+    ASSERT_EQ(blocks.size(), expected.size());
+    for (size_t i = 0; i < blocks.size(); ++i) {
+        EXPECT_EQ(blocks[i].x, expected[i].x);
+        EXPECT_EQ(blocks[i].y, expected[i].y);
+        EXPECT_EQ(blocks[i].qp_delta, expected[i].qp_delta);
+    }
+}
+
+TEST_F(WatermarkEncoderTest, CarriesMarksFollowsSchedule) {
+    WatermarkEncoder encoder(config);
+    ASSERT_TRUE(encoder.initialize(640, 360, TEST_FPS));
+
+    // Every phase of a dense schedule has a non-zero delta
+    EXPECT_TRUE(encoder.carriesMarks(0, 1));
+    EXPECT_TRUE(encoder.carriesMarks(1000, 60));
+    EXPECT_FALSE(encoder.carriesMarks(0, 0));
+
+    // A ranged query answers without touching the encoder's frame counters
+    EXPECT_EQ(encoder.getFramesProcessed(), 0u);
+
+    // A schedule with no blocks marks nothing
+    WatermarkConfig empty_config = config;
+    empty_config.block_density = 0.0f;
+    WatermarkEncoder empty(empty_config);
+    ASSERT_TRUE(empty.initialize(640, 360, TEST_FPS));
+    EXPECT_FALSE(empty.carriesMarks(0, 300));
+
+    // With one period in four marked, GOPs between marked periods are not
+    WatermarkConfig sparse_config = config;
+    sparse_config.marked_period_interval = 4;
+    WatermarkEncoder sparse(sparse_config);
+    ASSERT_TRUE(sparse.initialize(640, 360, TEST_FPS));
+    const uint32_t period = config.temporal_period;
+    EXPECT_TRUE(sparse.carriesMarks(0, period));
+    EXPECT_FALSE(sparse.carriesMarks(period, 3 * period));
+    EXPECT_TRUE(sparse.carriesMarks(period, 3 * period + 1));
+    EXPECT_TRUE(sparse.carriesMarks(4 * period + 5, 10));
+    EXPECT_FALSE(sparse.carriesMarks(9 * period, 2 * period));
+}
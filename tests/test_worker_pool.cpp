@@ -0,0 +1,52 @@
+#include <gtest/gtest.h>
+#include <atomic>
+#include <vector>
+#include "common/worker_pool.h"
+
+using namespace phantomframe;
+
+TEST(WorkerPoolTest, RunsEveryTaskOnce) {
+    WorkerPool pool(4);
+    EXPECT_EQ(pool.size(), 4u);
+    
+    std::vector<std::atomic<int>> hits(1000);
+    pool.run(static_cast<uint32_t>(hits.size()), [&hits](uint32_t i) {
+        hits[i].fetch_add(1);
+    });
+    
+    for (const auto& hit : hits) {
+        EXPECT_EQ(hit.load(), 1);
+    }
+}
+
+TEST(WorkerPoolTest, RunsRepeatedJobs) {
+    WorkerPool pool(3);
+    std::atomic<uint64_t> sum(0);
+    
+    for (int job = 0; job < 200; ++job) {
+        pool.run(7, [&sum](uint32_t i) {
+            sum.fetch_add(i + 1);
+        });
+    }
+    
+    EXPECT_EQ(sum.load(), 200u * 28u);
+}
+
+TEST(WorkerPoolTest, SingleThreadRunsOnCaller) {
+    WorkerPool pool(1);
+    EXPECT_EQ(pool.size(), 1u);
+    
+    std::vector<int> order;
+    pool.run(5, [&order](uint32_t i) {
+        order.push_back(static_cast<int>(i));
+    });
+    
+    EXPECT_EQ(order, (std::vector<int>{0, 1, 2, 3, 4}));
+}
+
+TEST(WorkerPoolTest, EmptyJobReturnsImmediately) {
+    WorkerPool pool(2);
+    bool called = false;
+    pool.run(0, [&called](uint32_t) { called = true; });
+    EXPECT_FALSE(called);
+}